@@ -0,0 +1,129 @@
+﻿using System;
+using System.Linq;
+using System.Threading;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+using Xunit;
+
+namespace SerialKeyboardMouse.Tests
+{
+    /// <summary>
+    /// Retry and timeout behavior of the sender against a <see cref="SimulatedSerialAdaptor"/> in virtual time.
+    /// Every scenario is seeded, so a failure reproduces exactly.
+    /// </summary>
+    public class SimulatedScenarioTests
+    {
+        private const int Frames = 20;
+
+        private static SimulatedSerialAdaptor CreateDevice(VirtualSenderClock clock, int seed,
+            double loss, double echoLoss, double corrupt)
+        {
+            return new SimulatedSerialAdaptor(clock, seed)
+            {
+                LossProbability = loss,
+                EchoLossProbability = echoLoss,
+                CorruptionProbability = corrupt,
+                Latency = TimeSpan.FromMilliseconds(0.4),
+                LatencyJitter = TimeSpan.FromMilliseconds(0.2)
+            };
+        }
+
+        /// <summary>
+        /// Press and release a key alternately, and wait for all of them.
+        /// </summary>
+        /// <returns>Number of frames that failed</returns>
+        private static int SendKeys(KeyboardMouse keyboardMouse)
+        {
+            Task[] frames = Enumerable.Range(0, Frames)
+                .Select(f => f % 2 == 0 ? keyboardMouse.KeyboardPress(0x04) : keyboardMouse.KeyboardRelease(0x04))
+                .ToArray();
+            int failed = 0;
+            foreach (Task frame in frames)
+            {
+                try
+                {
+                    frame.GetAwaiter().GetResult();
+                }
+                catch (SerialDeviceException)
+                {
+                    ++failed;
+                }
+            }
+            return failed;
+        }
+
+        [Theory]
+        [InlineData(1)]
+        [InlineData(2)]
+        [InlineData(3)]
+        [InlineData(4)]
+        [InlineData(5)]
+        public void LosslessLinkNeverRetries(int seed)
+        {
+            VirtualSenderClock clock = new VirtualSenderClock();
+            SimulatedSerialAdaptor device = CreateDevice(clock, seed, 0, 0, 0);
+            using KeyboardMouse keyboardMouse = new KeyboardMouse(device, clock);
+
+            Assert.Equal(0, SendKeys(keyboardMouse));
+            Assert.Equal(0, keyboardMouse.Metrics.Retries);
+            Assert.Equal(Frames, device.FramesExecuted);
+        }
+
+        [Theory]
+        [InlineData(1)]
+        [InlineData(2)]
+        [InlineData(3)]
+        [InlineData(4)]
+        [InlineData(5)]
+        public void TaggedFramesExecuteOnce(int seed)
+        {
+            VirtualSenderClock clock = new VirtualSenderClock();
+            SimulatedSerialAdaptor device = CreateDevice(clock, seed, 0.05, 0.2, 0.01);
+            using KeyboardMouse keyboardMouse = new KeyboardMouse(device, clock) { FrameTags = true };
+
+            Assert.Equal(0, SendKeys(keyboardMouse));
+            Assert.True(keyboardMouse.Metrics.Retries > 0);
+            Assert.Equal(Frames, device.FramesExecuted);
+        }
+
+        [Fact]
+        public void UntaggedRetransmissionsExecuteAgain()
+        {
+            // Same links as TaggedFramesExecuteOnce, so lost loop-backs are retransmitted and run twice.
+            // With fewer retries a frame may also fail, which does not matter here.
+            int executions = 0;
+            for (int seed = 1; seed <= 5; ++seed)
+            {
+                VirtualSenderClock clock = new VirtualSenderClock();
+                SimulatedSerialAdaptor device = CreateDevice(clock, seed, 0.05, 0.2, 0.01);
+                using KeyboardMouse keyboardMouse = new KeyboardMouse(device, clock);
+
+                SendKeys(keyboardMouse);
+                executions += device.FramesExecuted;
+            }
+
+            Assert.True(executions > 5 * Frames);
+        }
+
+        [Fact]
+        public void DeadlineExpiresBehindRetries()
+        {
+            VirtualSenderClock clock = new VirtualSenderClock();
+            SimulatedSerialAdaptor device = CreateDevice(clock, 1, 1, 0, 0);
+            using KeyboardMouse keyboardMouse = new KeyboardMouse(device, clock);
+            // Deadline is taken relative to simulated time, so hold it until both frames are queued
+            bool queued = false;
+            clock.AddQuiescenceCheck(() => Volatile.Read(ref queued));
+
+            // First frame is lost every time, so its retries outlast the second frame's deadline
+            Task lost = keyboardMouse.KeyboardPress(0x04);
+            Task expired = keyboardMouse.KeyboardRelease(0x04, deadline: DateTime.UtcNow.AddMilliseconds(50));
+            Volatile.Write(ref queued, true);
+
+            Assert.Throws<SerialDeviceException>(() => lost.GetAwaiter().GetResult());
+            Assert.Throws<TimeoutException>(() => expired.GetAwaiter().GetResult());
+            Assert.Equal(0, device.FramesExecuted);
+            Assert.True(clock.Elapsed >= TimeSpan.FromMilliseconds(50));
+        }
+    }
+}
@@ -0,0 +1,242 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.IO.Ports;
+using System.Linq;
+using System.Text.Json;
+using System.Threading;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Port found by <see cref="DeviceDiscovery"/>
+    /// </summary>
+    public class DiscoveredDevice
+    {
+        public string Port { get; }
+
+        public DeviceIdentity Identity { get; }
+
+        internal DiscoveredDevice(string port, DeviceIdentity identity)
+        {
+            Port = port;
+            Identity = identity;
+        }
+
+        public override string ToString()
+        {
+            return $"{Port}: {Identity}";
+        }
+    }
+
+    /// <summary>
+    /// Find which serial port belongs to which device. All candidate ports are probed in parallel with an
+    /// identify frame, so discovery takes one <see cref="ProbeTimeout"/> however many ports there are.
+    /// Port-to-id mapping is cached, optionally in a file, so a known device is found by probing one port.
+    /// </summary>
+    public class DeviceDiscovery
+    {
+        /// <summary>
+        /// Identify frame is sent again this often, in case device was busy or asleep
+        /// </summary>
+        private static readonly TimeSpan ResendInterval = TimeSpan.FromMilliseconds(60);
+
+        private const int ReadTimeout = 10;
+
+        private readonly string _cachePath;
+        private readonly Dictionary<string, uint> _cache;
+
+        /// <summary>
+        /// How long a port may take to answer. Ports not answering in time are not devices.
+        /// </summary>
+        public TimeSpan ProbeTimeout { get; set; } = TimeSpan.FromMilliseconds(250);
+
+        /// <summary>
+        /// Device id of each port, from the last discovery that probed it.
+        /// </summary>
+        public IReadOnlyDictionary<string, uint> CachedPorts
+        {
+            get
+            {
+                lock (_cache)
+                {
+                    return new Dictionary<string, uint>(_cache);
+                }
+            }
+        }
+
+        /// <param name="cachePath">File keeping port-to-id mapping between runs, or null to keep it in memory only</param>
+        public DeviceDiscovery(string cachePath = null)
+        {
+            _cachePath = cachePath;
+            _cache = new Dictionary<string, uint>();
+            if (cachePath != null && File.Exists(cachePath))
+            {
+                try
+                {
+                    _cache = JsonSerializer.Deserialize<Dictionary<string, uint>>(File.ReadAllText(cachePath))
+                             ?? _cache;
+                }
+                catch (JsonException)
+                {
+                    // Corrupted cache only costs a full discovery
+                }
+            }
+        }
+
+        /// <summary>
+        /// Probe ports in parallel and replace cached mapping of these ports.
+        /// </summary>
+        /// <param name="ports">Candidate ports, or null for all serial ports of this machine</param>
+        /// <returns>Ports answering, in the order given.</returns>
+        public async Task<IReadOnlyList<DiscoveredDevice>> DiscoverAsync(IEnumerable<string> ports = null)
+        {
+            string[] candidates = (ports ?? SerialPort.GetPortNames()).Distinct().ToArray();
+            DeviceIdentity[] identities = await Task.WhenAll(candidates.Select(p => Probe(p, ProbeTimeout)))
+                .ConfigureAwait(false);
+            List<DiscoveredDevice> found = new List<DiscoveredDevice>();
+            lock (_cache)
+            {
+                for (int i = 0; i < candidates.Length; ++i)
+                {
+                    _cache.Remove(candidates[i]);
+                    if (identities[i] != null)
+                    {
+                        _cache[candidates[i]] = identities[i].DeviceId;
+                        found.Add(new DiscoveredDevice(candidates[i], identities[i]));
+                    }
+                }
+            }
+            SaveCache();
+            return found;
+        }
+
+        /// <summary>
+        /// Find port of a device. Cached port is probed first, all ports only if device moved.
+        /// </summary>
+        /// <returns>Port name, or null if no port answers with this id.</returns>
+        public async Task<string> FindPortAsync(uint deviceId)
+        {
+            string cached;
+            lock (_cache)
+            {
+                cached = _cache.FirstOrDefault(p => p.Value == deviceId).Key;
+            }
+            if (cached != null)
+            {
+                DeviceIdentity identity = await Probe(cached, ProbeTimeout).ConfigureAwait(false);
+                if (identity != null && identity.DeviceId == deviceId)
+                {
+                    return cached;
+                }
+            }
+            IReadOnlyList<DiscoveredDevice> found = await DiscoverAsync().ConfigureAwait(false);
+            return found.FirstOrDefault(d => d.Identity.DeviceId == deviceId)?.Port;
+        }
+
+        /// <summary>
+        /// Ask one port for device identity. Port is opened only for the probe.
+        /// </summary>
+        /// <returns>Identity, or null if port is busy, missing or not answering.</returns>
+        public static Task<DeviceIdentity> Probe(string port, TimeSpan timeout)
+        {
+            // Serial I/O blocks, and thread pool would add threads too slowly for a rack of ports
+            return Task.Factory.StartNew(() => ProbeBlocking(port, timeout), CancellationToken.None,
+                TaskCreationOptions.LongRunning, TaskScheduler.Default);
+        }
+
+        private static DeviceIdentity ProbeBlocking(string port, TimeSpan timeout)
+        {
+            SerialPort serial = new SerialPort(port, SerialSymbols.BaudRate, Parity.None)
+            {
+                ReadTimeout = ReadTimeout,
+                WriteTimeout = ReadTimeout
+            };
+            try
+            {
+                serial.Open();
+            }
+            catch (Exception e) when (e is IOException || e is UnauthorizedAccessException
+                                                       || e is ArgumentException || e is InvalidOperationException)
+            {
+                serial.Dispose();
+                return null; // Missing, or opened by another process
+            }
+
+            using (serial)
+            {
+                byte[] identify = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.Identify, 0).Bytes.ToArray();
+                byte[] buffer = new byte[256];
+                int count = 0;
+                Stopwatch stopwatch = Stopwatch.StartNew();
+                TimeSpan nextSend = TimeSpan.Zero;
+                while (stopwatch.Elapsed < timeout)
+                {
+                    try
+                    {
+                        if (stopwatch.Elapsed >= nextSend)
+                        {
+                            serial.Write(identify, 0, identify.Length);
+                            nextSend += ResendInterval;
+                        }
+                        count += serial.Read(buffer, count, buffer.Length - count);
+                    }
+                    catch (TimeoutException)
+                    {
+                        continue;
+                    }
+                    catch (IOException)
+                    {
+                        return null;
+                    }
+                    DeviceIdentity identity = FindIdentity(buffer, ref count);
+                    if (identity != null)
+                    {
+                        return identity;
+                    }
+                }
+                return null;
+            }
+        }
+
+        /// <summary>
+        /// Scan received bytes for an identify reply, skipping boot messages and other frames.
+        /// Keeps only the tail that may start an incomplete reply.
+        /// </summary>
+        private static DeviceIdentity FindIdentity(byte[] buffer, ref int count)
+        {
+            int replyLength = SerialSymbols.ReplyLengthLookup[SerialSymbols.FrameType.Identify];
+            for (int i = 0; i + replyLength <= count; ++i)
+            {
+                ReadOnlySpan<byte> reply = new ReadOnlySpan<byte>(buffer, i, replyLength);
+                if (reply[0] == SerialSymbols.FrameStart && reply[1] == replyLength - 2
+                    && reply[2] == (byte)SerialSymbols.FrameType.Identify
+                    && SerialSymbols.XorChecker(reply.Slice(2, replyLength - 3), reply[^1]))
+                {
+                    return new DeviceIdentity(reply);
+                }
+            }
+            int keep = Math.Min(count, replyLength - 1);
+            Buffer.BlockCopy(buffer, count - keep, buffer, 0, keep);
+            count = keep;
+            return null;
+        }
+
+        private void SaveCache()
+        {
+            if (_cachePath == null)
+            {
+                return;
+            }
+            string json;
+            lock (_cache)
+            {
+                json = JsonSerializer.Serialize(_cache);
+            }
+            File.WriteAllText(_cachePath, json);
+        }
+    }
+}
@@ -0,0 +1,40 @@
+﻿using System;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Identity reported by the device, see <see cref="KeyboardMouse.QueryIdentity"/> and <see cref="DeviceDiscovery"/>.
+    /// </summary>
+    public class DeviceIdentity
+    {
+        /// <summary>
+        /// Persistent id, survives power cycles and firmware uploads. 0 if board has no persistent storage.
+        /// </summary>
+        public uint DeviceId { get; }
+
+        /// <summary>
+        /// Protocol version of firmware, see <see cref="SerialSymbols.ProtocolVersion"/>
+        /// </summary>
+        public byte ProtocolVersion { get; }
+
+        public SerialSymbols.DeviceCapabilities Capabilities { get; }
+
+        /// <summary>
+        /// True if firmware speaks the protocol of this library.
+        /// </summary>
+        public bool IsCompatible => ProtocolVersion == SerialSymbols.ProtocolVersion;
+
+        internal DeviceIdentity(ReadOnlySpan<byte> reply)
+        {
+            DeviceId = BitConverter.ToUInt32(reply.Slice(3, 4));
+            ProtocolVersion = reply[7];
+            Capabilities = (SerialSymbols.DeviceCapabilities)reply[8];
+        }
+
+        public override string ToString()
+        {
+            return $"Device {DeviceId:X8}, protocol {ProtocolVersion}, capabilities {Capabilities}";
+        }
+    }
+}
@@ -0,0 +1,43 @@
+﻿using System;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Idle sleep counters kept by the device, see <see cref="KeyboardMouse.QueryIdleStatistics"/>.
+    /// Device sleeps after a quiet period and wakes on serial input. Device cannot timestamp the wake itself,
+    /// so it reports how long the first frame took to handle after the wake instead. The whole delay seen by
+    /// host, wake included, shows in <see cref="LinkMetrics.AckLatencyMicroseconds"/>.
+    /// </summary>
+    public class DeviceIdleStatistics
+    {
+        /// <summary>
+        /// Times device woke from idle sleep and found serial input. Periodic timer and USB wakes are not counted.
+        /// 16 bits, wraps around.
+        /// </summary>
+        public ushort Wakes { get; }
+
+        /// <summary>
+        /// Time from finding the first byte after waking to loop-back of its frame, for the last wake:
+        /// receiving the rest of the frame, executing it and writing the loop-back. Saturates at 65535 us.
+        /// </summary>
+        public TimeSpan LastWakeFrameTime { get; }
+
+        /// <summary>
+        /// Highest <see cref="LastWakeFrameTime"/> seen since power-on.
+        /// </summary>
+        public TimeSpan MaxWakeFrameTime { get; }
+
+        internal DeviceIdleStatistics(ReadOnlySpan<byte> reply)
+        {
+            Wakes = BitConverter.ToUInt16(reply.Slice(3, 2));
+            LastWakeFrameTime = TimeSpan.FromTicks(BitConverter.ToUInt16(reply.Slice(5, 2)) * 10L);
+            MaxWakeFrameTime = TimeSpan.FromTicks(BitConverter.ToUInt16(reply.Slice(7, 2)) * 10L);
+        }
+
+        public override string ToString()
+        {
+            return $"Device woke {Wakes} times, first frame handled in {LastWakeFrameTime.TotalMilliseconds * 1000:F0} us, " +
+                   $"max {MaxWakeFrameTime.TotalMilliseconds * 1000:F0} us";
+        }
+    }
+}
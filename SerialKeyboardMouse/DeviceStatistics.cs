@@ -0,0 +1,39 @@
+﻿using System;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Link counters kept by the device, see <see cref="KeyboardMouse.QueryDeviceStatistics"/>.
+    /// Counters are 16 bits and wrap around.
+    /// </summary>
+    public class DeviceStatistics
+    {
+        /// <summary>
+        /// Unreliable mouse moves received intact.
+        /// </summary>
+        public ushort MovesReceived { get; }
+
+        /// <summary>
+        /// Unreliable mouse moves lost, detected by gaps in sequence number.
+        /// </summary>
+        public ushort MovesDropped { get; }
+
+        /// <summary>
+        /// Frames of any type discarded for timeout or bad checksum.
+        /// </summary>
+        public ushort FramesCorrupted { get; }
+
+        internal DeviceStatistics(ReadOnlySpan<byte> reply)
+        {
+            MovesReceived = BitConverter.ToUInt16(reply.Slice(3, 2));
+            MovesDropped = BitConverter.ToUInt16(reply.Slice(5, 2));
+            FramesCorrupted = BitConverter.ToUInt16(reply.Slice(7, 2));
+        }
+
+        public override string ToString()
+        {
+            return $"Device received {MovesReceived} unreliable moves, dropped {MovesDropped}, " +
+                   $"corrupted frames {FramesCorrupted}";
+        }
+    }
+}
@@ -0,0 +1,574 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Why <see cref="FailoverKeyboardMouse"/> switched to its standby.
+    /// </summary>
+    public enum FailoverReason
+    {
+        /// <summary>
+        /// A command failed after all retries
+        /// </summary>
+        CommandFailed,
+
+        /// <summary>
+        /// Smoothed ACK latency exceeded <see cref="FailoverOptions.MaxAckLatencyMicroseconds"/>
+        /// </summary>
+        AckLatency,
+
+        /// <summary>
+        /// Retries and failures exceeded <see cref="FailoverOptions.MaxErrorRate"/> of transmissions
+        /// </summary>
+        ErrorRate
+    }
+
+    /// <summary>
+    /// Health thresholds of <see cref="FailoverKeyboardMouse"/>.
+    /// </summary>
+    public class FailoverOptions
+    {
+        /// <summary>
+        /// How often link metrics of the active device are sampled.
+        /// </summary>
+        public TimeSpan HealthCheckInterval { get; set; } = TimeSpan.FromMilliseconds(10);
+
+        /// <summary>
+        /// Smoothed ACK latency above which the active device is unhealthy, 0 to ignore latency.
+        /// </summary>
+        public double MaxAckLatencyMicroseconds { get; set; } = 5000;
+
+        /// <summary>
+        /// Fraction of transmissions that were retries or failures above which the active device is unhealthy.
+        /// </summary>
+        public double MaxErrorRate { get; set; } = 0.25;
+
+        /// <summary>
+        /// Transmissions needed before error rate is judged, so one retry on an idle link is not a failover.
+        /// </summary>
+        public int MinErrorSamples { get; set; } = 4;
+
+        /// <summary>
+        /// A device that failed is not switched back to for health reasons until this passed,
+        /// so two degraded links do not flap. A failed command still switches back.
+        /// </summary>
+        public TimeSpan FailbackHoldoff { get; set; } = TimeSpan.FromSeconds(5);
+
+        /// <summary>
+        /// How often the standby is queried to confirm it is alive, <see cref="TimeSpan.Zero"/> to never.
+        /// </summary>
+        public TimeSpan StandbyProbeInterval { get; set; } = TimeSpan.FromSeconds(1);
+    }
+
+    /// <summary>
+    /// Two controllers attached to one target, one active and one hot standby. Commands go to the active device;
+    /// when one fails after all retries, or health sampling finds the link slow or lossy, the standby takes over
+    /// and the failed command is sent again on it. Key, button, pointer and resolution state is tracked as
+    /// commanded here, not as acknowledged, and replayed onto the standby before any later command, so nothing
+    /// stays stuck or is lost. Keys held by the old device are released on it, best effort.
+    /// Commands are delivered in call order: on a switch, commands still in flight on the old device are
+    /// cancelled there if not sent yet, and issued again on the standby in call order, after the replay and
+    /// before any later command. A scroll already written to the old device may be repeated on the standby,
+    /// enable <see cref="KeyboardMouse.FrameTags"/> on the old device to rule out the case of a lost loop-back.
+    /// </summary>
+    public class FailoverKeyboardMouse : IDisposable
+    {
+        private readonly KeyboardMouse[] _devices;
+        private readonly FailoverOptions _options;
+        private readonly Timer _healthTimer;
+        private readonly object _lock = new object();
+        private int _active;
+        private bool _disposedValue;
+
+        // Commanded state, replayed onto standby. Guarded by _lock.
+        private readonly HashSet<byte> _keys = new HashSet<byte>();
+        private SerialSymbols.MouseButton _buttons;
+        private (int X, int Y)? _position;
+        private (int Width, int Height) _resolution;
+
+        // Commands not completed yet, in call order, and the source cancelling sends still queued on the active
+        // device once it is switched away from. Guarded by _lock.
+        private readonly LinkedList<PendingCommand> _pending = new LinkedList<PendingCommand>();
+        private CancellationTokenSource _activeCancellation = new CancellationTokenSource();
+
+        // Health sampling of active device, only on timer callback
+        private long _baselineTransmissions;
+        private long _baselineErrors;
+        private long _baselineFramesSent;
+        private long _lastStandbyProbe;
+        private int _checking;
+
+        // Stopwatch timestamps of last failure per device, 0 if never. Guarded by _lock.
+        private readonly long[] _failedAt = new long[2];
+        private readonly long[] _commandFailedAt = new long[2];
+
+        private int _failovers;
+
+        /// <summary>
+        /// Device commands currently go to
+        /// </summary>
+        public KeyboardMouse Active => _devices[Volatile.Read(ref _active)];
+
+        /// <summary>
+        /// Device taking over when <see cref="Active"/> fails
+        /// </summary>
+        public KeyboardMouse Standby => _devices[1 - Volatile.Read(ref _active)];
+
+        /// <summary>
+        /// Number of switches so far
+        /// </summary>
+        public int Failovers => Volatile.Read(ref _failovers);
+
+        /// <summary>
+        /// Raised after switching, with the device now active. Raised on failing or timer thread, handlers must not block.
+        /// </summary>
+        public event Action<FailoverReason, KeyboardMouse> FailedOver;
+
+        /// <summary>
+        /// Raised when a standby probe fails. A failed command does not switch to it until a probe succeeds.
+        /// Raised on timer thread, handlers must not block.
+        /// </summary>
+        public event Action<KeyboardMouse, SerialDeviceException> StandbyFailed;
+
+        public int MouseResolutionWidth => Active.MouseResolutionWidth;
+
+        public int MouseResolutionHeight => Active.MouseResolutionHeight;
+
+        /// <summary>
+        /// Create over two devices, which are owned from now on.
+        /// </summary>
+        /// <param name="primary">Device active first</param>
+        /// <param name="standby">Device taking over</param>
+        /// <param name="options">Health thresholds, or null for defaults</param>
+        public FailoverKeyboardMouse(KeyboardMouse primary, KeyboardMouse standby, FailoverOptions options = null)
+        {
+            _devices = new[]
+            {
+                primary ?? throw new ArgumentNullException(nameof(primary)),
+                standby ?? throw new ArgumentNullException(nameof(standby))
+            };
+            if (primary == standby)
+            {
+                throw new ArgumentException("Standby must be another device!", nameof(standby));
+            }
+            _options = options ?? new FailoverOptions();
+            _resolution = (primary.MouseResolutionWidth, primary.MouseResolutionHeight);
+            _lastStandbyProbe = Stopwatch.GetTimestamp();
+            ResetBaseline(primary.Metrics);
+            _healthTimer = new Timer(CheckHealth, null, _options.HealthCheckInterval, _options.HealthCheckInterval);
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.SetMouseResolution"/>
+        public Task SetMouseResolution(int width, int height)
+        {
+            return Run((d, t) => d.SetMouseResolution(width, height, t), () => _resolution = (width, height));
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.MoveMouseToCoordinate"/>
+        public Task MoveMouseToCoordinate(int x, int y)
+        {
+            return Run((d, t) => d.MoveMouseToCoordinate(x, y, t), () => _position = (x, y));
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.MouseScroll"/>
+        public Task MouseScroll(sbyte value)
+        {
+            return Run((d, t) => d.MouseScroll(value, t), null);
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.MousePressButton"/>
+        public Task MousePressButton(SerialSymbols.MouseButton button)
+        {
+            return Run((d, t) => d.MousePressButton(button, t), () => _buttons |= button);
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.MouseReleaseButton"/>
+        public Task MouseReleaseButton(SerialSymbols.MouseButton button)
+        {
+            return Run((d, t) => d.MouseReleaseButton(button, t), () => _buttons &= ~button);
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.MouseReleaseAllButtons"/>
+        public Task MouseReleaseAllButtons()
+        {
+            return Run((d, t) => d.MouseReleaseAllButtons(t), () => _buttons = 0);
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.KeyboardPress"/>
+        public Task KeyboardPress(byte key)
+        {
+            return Run((d, t) => d.KeyboardPress(key, t), () => _keys.Add(key));
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.KeyboardRelease"/>
+        public Task KeyboardRelease(byte key)
+        {
+            return Run((d, t) => d.KeyboardRelease(key, t), () => _keys.Remove(key));
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.KeyboardReleaseAll"/>
+        public Task KeyboardReleaseAll()
+        {
+            return Run((d, t) => d.KeyboardReleaseAll(t), () => _keys.Clear());
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.KeyboardMousePress"/>
+        public Task KeyboardMousePress(byte key, SerialSymbols.MouseButton buttons)
+        {
+            return Run((d, t) => d.KeyboardMousePress(key, buttons, t), () =>
+            {
+                if (key != 0)
+                {
+                    _keys.Add(key);
+                }
+                _buttons |= buttons;
+            });
+        }
+
+        /// <inheritdoc cref="KeyboardMouse.KeyboardMouseRelease"/>
+        public Task KeyboardMouseRelease(byte key, SerialSymbols.MouseButton buttons)
+        {
+            return Run((d, t) => d.KeyboardMouseRelease(key, buttons, t), () =>
+            {
+                if (key != 0)
+                {
+                    _keys.Remove(key);
+                }
+                _buttons &= ~buttons;
+            });
+        }
+
+        /// <summary>
+        /// A command issued and not completed yet. It is issued again whenever its device is switched away from.
+        /// </summary>
+        private sealed class PendingCommand
+        {
+            public PendingCommand(Func<KeyboardMouse, CancellationToken, Task> command)
+            {
+                Command = command;
+            }
+
+            public Func<KeyboardMouse, CancellationToken, Task> Command { get; }
+
+            public TaskCompletionSource Completion { get; } = new TaskCompletionSource();
+
+            public LinkedListNode<PendingCommand> Node { get; set; }
+
+            /// <summary>
+            /// Incremented on each issue, outcomes of earlier issues are stale
+            /// </summary>
+            public int Issue { get; set; }
+
+            /// <summary>
+            /// True once its own failure switched devices, it does not switch again
+            /// </summary>
+            public bool FailedOver { get; set; }
+        }
+
+        /// <summary>
+        /// Issue a command on the active device and record its effect, under the lock so state and call order
+        /// agree. If the command fails, switching issues it again on the new active device, after the replay.
+        /// </summary>
+        /// <param name="command">Command, queued by device before it returns, given the token of active device</param>
+        /// <param name="record">Records commanded state, once command was accepted</param>
+        /// <exception cref="ArgumentException">If device rejects the arguments.</exception>
+        private Task Run(Func<KeyboardMouse, CancellationToken, Task> command, Action record)
+        {
+            PendingCommand pending = new PendingCommand(command);
+            lock (_lock)
+            {
+                Task sent = command(_devices[_active], _activeCancellation.Token);
+                record?.Invoke();
+                pending.Node = _pending.AddLast(pending);
+                Watch(pending, _active, sent);
+            }
+            return pending.Completion.Task;
+        }
+
+        /// <summary>
+        /// Must hold _lock. Complete a pending command with the outcome of this issue, unless it is issued again.
+        /// </summary>
+        private void Watch(PendingCommand pending, int index, Task sent)
+        {
+            int issue = ++pending.Issue;
+            sent.ContinueWith(t => OnSent(pending, index, issue, t));
+        }
+
+        private void OnSent(PendingCommand pending, int index, int issue, Task sent)
+        {
+            lock (_lock)
+            {
+                if (pending.Issue != issue)
+                {
+                    return;
+                }
+            }
+            if (!sent.IsCompletedSuccessfully && sent.Exception?.InnerException is SerialDeviceException
+                && !pending.FailedOver)
+            {
+                pending.FailedOver = true;
+                if (TryFailover(index, FailoverReason.CommandFailed))
+                {
+                    // Issued again by the switch, after replay
+                    return;
+                }
+            }
+            lock (_lock)
+            {
+                if (pending.Issue != issue)
+                {
+                    return;
+                }
+                _pending.Remove(pending.Node);
+            }
+            if (sent.IsCompletedSuccessfully)
+            {
+                pending.Completion.TrySetResult();
+            }
+            else if (sent.Exception != null)
+            {
+                pending.Completion.TrySetException(sent.Exception.InnerExceptions);
+            }
+            else
+            {
+                pending.Completion.TrySetCanceled();
+            }
+        }
+
+        /// <summary>
+        /// Switch away from a device, unless it is no longer active or the standby is known to be down.
+        /// </summary>
+        /// <returns>True if a device other than the failed one is active now.</returns>
+        private bool TryFailover(int failed, FailoverReason reason)
+        {
+            KeyboardMouse next;
+            lock (_lock)
+            {
+                if (_disposedValue)
+                {
+                    return false;
+                }
+                if (_active != failed)
+                {
+                    return true;
+                }
+                long now = Stopwatch.GetTimestamp();
+                long holdoff = (long)(_options.FailbackHoldoff.TotalSeconds * Stopwatch.Frequency);
+                long[] failures = reason == FailoverReason.CommandFailed ? _commandFailedAt : _failedAt;
+                _failedAt[failed] = now;
+                if (reason == FailoverReason.CommandFailed)
+                {
+                    _commandFailedAt[failed] = now;
+                }
+                if (failures[1 - failed] != 0 && now - failures[1 - failed] < holdoff)
+                {
+                    return false;
+                }
+                Switch(failed);
+                next = _devices[_active];
+                ++_failovers;
+            }
+            FailedOver?.Invoke(reason, next);
+            return true;
+        }
+
+        /// <summary>
+        /// Make standby active. Replay and commands in flight are only queued, not awaited, so they precede any
+        /// later command without holding the lock for a round trip. A replay failure fails those commands in turn.
+        /// </summary>
+        private void Switch(int failed)
+        {
+            KeyboardMouse old = _devices[failed];
+            KeyboardMouse next = _devices[1 - failed];
+
+            // Commands still queued on old device are issued again below, it must not send them as well.
+            // Not disposed, a pending move of old device may still register on its token.
+            CancellationTokenSource oldCancellation = _activeCancellation;
+            _activeCancellation = new CancellationTokenSource();
+            oldCancellation.Cancel();
+
+            // Target merges both keyboards, so a key left held by old device would stay stuck
+            Observe(() => old.KeyboardReleaseAll());
+            Observe(() => old.MouseReleaseAllButtons());
+
+            if ((next.MouseResolutionWidth, next.MouseResolutionHeight) != _resolution)
+            {
+                Observe(() => next.SetMouseResolution(_resolution.Width, _resolution.Height));
+            }
+            Observe(() => next.KeyboardReleaseAll());
+            Observe(() => next.MouseReleaseAllButtons());
+            if (_position.HasValue)
+            {
+                (int x, int y) = _position.Value;
+                Observe(() => next.MoveMouseToCoordinate(x, y));
+            }
+            foreach (byte key in _keys)
+            {
+                Observe(() => next.KeyboardPress(key));
+            }
+            foreach (SerialSymbols.MouseButton button in new[]
+                     {
+                         SerialSymbols.MouseButton.Left, SerialSymbols.MouseButton.Right,
+                         SerialSymbols.MouseButton.Middle
+                     })
+            {
+                if ((_buttons & button) != 0)
+                {
+                    Observe(() => next.MousePressButton(button));
+                }
+            }
+
+            // State replayed already includes their effect, issuing them again keeps call order on the target
+            foreach (PendingCommand pending in _pending)
+            {
+                Task sent;
+                try
+                {
+                    sent = pending.Command(next, _activeCancellation.Token);
+                }
+                catch (Exception e)
+                {
+                    sent = Task.FromException(e);
+                }
+                Watch(pending, 1 - failed, sent);
+            }
+
+            Volatile.Write(ref _active, 1 - failed);
+            ResetBaseline(next.Metrics);
+        }
+
+        /// <summary>
+        /// Issue a command whose failure is only observed, so it never goes unobserved.
+        /// </summary>
+        private static void Observe(Func<Task> command)
+        {
+            Task task;
+            try
+            {
+                task = command();
+            }
+            catch (ObjectDisposedException)
+            {
+                return;
+            }
+            task.ContinueWith(t => _ = t.Exception, TaskContinuationOptions.OnlyOnFaulted);
+        }
+
+        private void ResetBaseline(LinkMetrics metrics)
+        {
+            Interlocked.Exchange(ref _baselineErrors, metrics.Retries + metrics.FramesFailed);
+            Interlocked.Exchange(ref _baselineTransmissions,
+                metrics.FramesSent + metrics.Retries + metrics.FramesFailed);
+            Interlocked.Exchange(ref _baselineFramesSent, metrics.FramesSent);
+        }
+
+        /// <summary>
+        /// Sample link metrics of active device since the last judgement, and probe standby now and then.
+        /// </summary>
+        private void CheckHealth(object state)
+        {
+            // Timer callbacks may overlap when one is slow
+            if (Interlocked.Exchange(ref _checking, 1) != 0)
+            {
+                return;
+            }
+            try
+            {
+                int index = Volatile.Read(ref _active);
+                LinkMetrics metrics = _devices[index].Metrics;
+                long framesSent = metrics.FramesSent;
+                long errors = metrics.Retries + metrics.FramesFailed;
+                long transmissions = framesSent + errors;
+
+                // Smoothed latency is stale until frames were acknowledged since the switch
+                if (_options.MaxAckLatencyMicroseconds > 0 && framesSent > Interlocked.Read(ref _baselineFramesSent)
+                    && metrics.AckLatencyMicroseconds > _options.MaxAckLatencyMicroseconds)
+                {
+                    TryFailover(index, FailoverReason.AckLatency);
+                    return;
+                }
+                long samples = transmissions - Interlocked.Read(ref _baselineTransmissions);
+                if (samples >= _options.MinErrorSamples)
+                {
+                    double rate = (double)(errors - Interlocked.Read(ref _baselineErrors)) / samples;
+                    if (rate > _options.MaxErrorRate && TryFailover(index, FailoverReason.ErrorRate))
+                    {
+                        return;
+                    }
+                    ResetBaseline(metrics);
+                }
+
+                ProbeStandby(index);
+            }
+            finally
+            {
+                Volatile.Write(ref _checking, 0);
+            }
+        }
+
+        private void ProbeStandby(int active)
+        {
+            if (_options.StandbyProbeInterval <= TimeSpan.Zero)
+            {
+                return;
+            }
+            long now = Stopwatch.GetTimestamp();
+            if (now - _lastStandbyProbe < (long)(_options.StandbyProbeInterval.TotalSeconds * Stopwatch.Frequency))
+            {
+                return;
+            }
+            _lastStandbyProbe = now;
+            int standby = 1 - active;
+            KeyboardMouse device = _devices[standby];
+            device.QueryUsbStatus().ContinueWith(t =>
+            {
+                if (t.IsCompletedSuccessfully)
+                {
+                    // Recovered, a failed command may switch back to it again
+                    lock (_lock)
+                    {
+                        _commandFailedAt[standby] = 0;
+                    }
+                }
+                else if (t.Exception?.InnerException is SerialDeviceException e)
+                {
+                    lock (_lock)
+                    {
+                        _failedAt[standby] = Stopwatch.GetTimestamp();
+                        _commandFailedAt[standby] = _failedAt[standby];
+                    }
+                    StandbyFailed?.Invoke(device, e);
+                }
+            }, TaskContinuationOptions.ExecuteSynchronously);
+        }
+
+        protected virtual void Dispose(bool disposing)
+        {
+            lock (_lock)
+            {
+                if (_disposedValue)
+                {
+                    return;
+                }
+                _disposedValue = true;
+            }
+            if (disposing)
+            {
+                _healthTimer.Dispose();
+                _devices[0].Dispose();
+                _devices[1].Dispose();
+            }
+        }
+
+        public void Dispose()
+        {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
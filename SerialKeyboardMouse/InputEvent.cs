@@ -0,0 +1,74 @@
+﻿using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    public enum InputEventKind : byte
+    {
+        MoveTo,
+        Scroll,
+        MousePress,
+        MouseRelease,
+        MouseReleaseAll,
+        KeyPress,
+        KeyRelease,
+        KeyReleaseAll
+    }
+
+    /// <summary>
+    /// One input event of a stream consumed by <see cref="KeyboardMouse.SendStream(System.Threading.Channels.ChannelReader{InputEvent}, InputStreamOptions, System.Threading.CancellationToken)"/>.
+    /// Each event maps to the <see cref="KeyboardMouse"/> method of the same name.
+    /// </summary>
+    public readonly struct InputEvent
+    {
+        public InputEventKind Kind { get; }
+
+        /// <summary>
+        /// Coordinate X of <see cref="InputEventKind.MoveTo"/>, wheel delta of <see cref="InputEventKind.Scroll"/>,
+        /// button or key otherwise.
+        /// </summary>
+        public int Value { get; }
+
+        /// <summary>
+        /// Coordinate Y of <see cref="InputEventKind.MoveTo"/>
+        /// </summary>
+        public int Y { get; }
+
+        private InputEvent(InputEventKind kind, int value, int y = 0)
+        {
+            Kind = kind;
+            Value = value;
+            Y = y;
+        }
+
+        public static InputEvent MoveTo(int x, int y) => new InputEvent(InputEventKind.MoveTo, x, y);
+
+        public static InputEvent Scroll(sbyte delta) => new InputEvent(InputEventKind.Scroll, delta);
+
+        public static InputEvent MousePress(SerialSymbols.MouseButton button)
+            => new InputEvent(InputEventKind.MousePress, (int)button);
+
+        public static InputEvent MouseRelease(SerialSymbols.MouseButton button)
+            => new InputEvent(InputEventKind.MouseRelease, (int)button);
+
+        public static InputEvent MouseReleaseAll() => new InputEvent(InputEventKind.MouseReleaseAll, 0);
+
+        /// <param name="key">The HID usage id combined with modifiers.</param>
+        public static InputEvent KeyPress(byte key) => new InputEvent(InputEventKind.KeyPress, key);
+
+        /// <param name="key">The HID usage id combined with modifiers.</param>
+        public static InputEvent KeyRelease(byte key) => new InputEvent(InputEventKind.KeyRelease, key);
+
+        public static InputEvent KeyReleaseAll() => new InputEvent(InputEventKind.KeyReleaseAll, 0);
+
+        public override string ToString()
+        {
+            return Kind switch
+            {
+                InputEventKind.MoveTo => $"MoveTo({Value},{Y})",
+                InputEventKind.MouseReleaseAll or InputEventKind.KeyReleaseAll => Kind.ToString(),
+                InputEventKind.KeyPress or InputEventKind.KeyRelease => $"{Kind}(0x{Value:X2})",
+                _ => $"{Kind}({Value})"
+            };
+        }
+    }
+}
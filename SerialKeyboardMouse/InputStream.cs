@@ -0,0 +1,276 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Threading;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Options of <see cref="KeyboardMouse.SendStream(System.Threading.Channels.ChannelReader{InputEvent}, InputStreamOptions, CancellationToken)"/>.
+    /// </summary>
+    public class InputStreamOptions
+    {
+        /// <summary>
+        /// Largest <see cref="MaxInFlight"/>: frames the sender queues before rejecting more
+        /// </summary>
+        public const int MaxInFlightLimit = ReliableFrameSender.MaxNumQueuedTask;
+
+        /// <summary>
+        /// Frames submitted but not yet acknowledged before consuming more events. Bounds memory and
+        /// lets a slow device push back on the source. At most <see cref="MaxInFlightLimit"/>; the default
+        /// leaves room in the sender's queue for other callers.
+        /// </summary>
+        public int MaxInFlight { get; set; } = 32;
+
+        /// <summary>
+        /// Merge consecutive moves into the latest, and consecutive scrolls into their sum.
+        /// </summary>
+        public bool Coalesce { get; set; } = true;
+
+        /// <summary>
+        /// Stop consuming after the first failed event. Otherwise failures are only reported.
+        /// </summary>
+        public bool StopOnError { get; set; }
+
+        /// <summary>
+        /// Receives counters after each batch of events readily available from the source, and at the end.
+        /// </summary>
+        public IProgress<InputStreamProgress> Progress { get; set; }
+
+        /// <summary>
+        /// Called with each failed event: <see cref="SerialDeviceException"/> if device failed or sender's queue
+        /// was full, or
+        /// <see cref="ArgumentException"/> if event was invalid. Called on completing thread, must not block.
+        /// </summary>
+        public Action<InputEvent, Exception> EventFailed { get; set; }
+    }
+
+    /// <summary>
+    /// Counters of an input stream
+    /// </summary>
+    public class InputStreamProgress
+    {
+        /// <summary>
+        /// Events read from source
+        /// </summary>
+        public long EventsConsumed { get; }
+
+        /// <summary>
+        /// Events merged into a later move or scroll instead of sent
+        /// </summary>
+        public long EventsCoalesced { get; }
+
+        /// <summary>
+        /// Frames handed to device, including ones still in flight
+        /// </summary>
+        public long FramesSubmitted { get; }
+
+        public long FramesCompleted { get; }
+
+        public long EventsFailed { get; }
+
+        /// <summary>
+        /// True once stream ended and every frame completed
+        /// </summary>
+        public bool IsCompleted { get; }
+
+        internal InputStreamProgress(long consumed, long coalesced, long submitted, long completed, long failed,
+            bool isCompleted)
+        {
+            EventsConsumed = consumed;
+            EventsCoalesced = coalesced;
+            FramesSubmitted = submitted;
+            FramesCompleted = completed;
+            EventsFailed = failed;
+            IsCompleted = isCompleted;
+        }
+
+        public override string ToString()
+        {
+            return $"Consumed {EventsConsumed} events ({EventsCoalesced} coalesced), submitted {FramesSubmitted} frames, " +
+                   $"completed {FramesCompleted}, failed {EventsFailed}";
+        }
+    }
+
+    /// <summary>
+    /// Turns a stream of events into frames. Events are submitted without waiting for each other, since the
+    /// sender keeps call order; a move or scroll is held only until the next event differs or the source has
+    /// nothing ready, so coalescing never delays input the source already produced.
+    /// </summary>
+    internal class InputStreamPump
+    {
+        private const int MaxScrollStep = sbyte.MaxValue;
+
+        private readonly KeyboardMouse _keyboardMouse;
+        private readonly InputStreamOptions _options;
+        private readonly Queue<Task> _inFlight = new Queue<Task>();
+
+        private bool _hasPending;
+        private InputEvent _pending;
+        private int _pendingScroll;
+
+        private long _consumed;
+        private long _coalesced;
+        private long _submitted;
+        private long _completed;
+        private long _failed;
+        private volatile bool _stopped;
+
+        /// <summary>
+        /// True once <see cref="InputStreamOptions.StopOnError"/> stopped the stream
+        /// </summary>
+        public bool Stopped => _stopped;
+
+        public InputStreamPump(KeyboardMouse keyboardMouse, InputStreamOptions options)
+        {
+            _keyboardMouse = keyboardMouse;
+            _options = options ?? new InputStreamOptions();
+            if (_options.MaxInFlight <= 0 || _options.MaxInFlight > InputStreamOptions.MaxInFlightLimit)
+            {
+                throw new ArgumentOutOfRangeException(nameof(options),
+                    $"MaxInFlight must be between 1 and {InputStreamOptions.MaxInFlightLimit}.");
+            }
+        }
+
+        public async ValueTask Add(InputEvent e)
+        {
+            ++_consumed;
+            if (_options.Coalesce && _hasPending && _pending.Kind == e.Kind)
+            {
+                ++_coalesced;
+                if (e.Kind == InputEventKind.Scroll)
+                {
+                    _pendingScroll += e.Value;
+                    while (Math.Abs(_pendingScroll) > MaxScrollStep)
+                    {
+                        int step = Math.Sign(_pendingScroll) * MaxScrollStep;
+                        await Submit(InputEvent.Scroll((sbyte)step)).ConfigureAwait(false);
+                        _pendingScroll -= step;
+                    }
+                }
+                else
+                {
+                    _pending = e;
+                }
+                return;
+            }
+            await FlushPending().ConfigureAwait(false);
+            if (_options.Coalesce && (e.Kind == InputEventKind.MoveTo || e.Kind == InputEventKind.Scroll))
+            {
+                _hasPending = true;
+                _pending = e;
+                _pendingScroll = e.Kind == InputEventKind.Scroll ? e.Value : 0;
+                return;
+            }
+            await Submit(e).ConfigureAwait(false);
+        }
+
+        /// <summary>
+        /// Source has nothing ready: send held move or scroll and report progress.
+        /// </summary>
+        public async ValueTask Flush()
+        {
+            await FlushPending().ConfigureAwait(false);
+            _options.Progress?.Report(Snapshot(false));
+        }
+
+        /// <summary>
+        /// Source ended: send held event and wait for every frame.
+        /// </summary>
+        public async Task<InputStreamProgress> Complete()
+        {
+            await FlushPending().ConfigureAwait(false);
+            while (_inFlight.Count > 0)
+            {
+                await _inFlight.Dequeue().ConfigureAwait(false);
+            }
+            InputStreamProgress progress = Snapshot(true);
+            _options.Progress?.Report(progress);
+            return progress;
+        }
+
+        private async ValueTask FlushPending()
+        {
+            if (!_hasPending)
+            {
+                return;
+            }
+            _hasPending = false;
+            if (_pending.Kind == InputEventKind.Scroll)
+            {
+                if (_pendingScroll == 0)
+                {
+                    return; // Scrolls cancelled out
+                }
+                _pending = InputEvent.Scroll((sbyte)_pendingScroll);
+            }
+            await Submit(_pending).ConfigureAwait(false);
+        }
+
+        private async ValueTask Submit(InputEvent e)
+        {
+            while (_inFlight.Count >= _options.MaxInFlight)
+            {
+                // Frames complete in order, so oldest is the next to finish
+                await _inFlight.Dequeue().ConfigureAwait(false);
+            }
+            if (_stopped)
+            {
+                return;
+            }
+            Task frame;
+            try
+            {
+                frame = Dispatch(e);
+            }
+            catch (Exception ex) when (ex is ArgumentException || ex is SerialDeviceException)
+            {
+                // Invalid event, or sender queue full: reported like a frame that failed
+                OnFailed(e, ex);
+                return;
+            }
+            ++_submitted;
+            _inFlight.Enqueue(frame.ContinueWith(t =>
+            {
+                Interlocked.Increment(ref _completed);
+                if (t.IsFaulted)
+                {
+                    OnFailed(e, t.Exception?.InnerException);
+                }
+            }, CancellationToken.None, TaskContinuationOptions.ExecuteSynchronously, TaskScheduler.Default));
+        }
+
+        private Task Dispatch(InputEvent e)
+        {
+            return e.Kind switch
+            {
+                InputEventKind.MoveTo => _keyboardMouse.MoveMouseToCoordinate(e.Value, e.Y),
+                InputEventKind.Scroll => _keyboardMouse.MouseScroll((sbyte)e.Value),
+                InputEventKind.MousePress => _keyboardMouse.MousePressButton((SerialSymbols.MouseButton)e.Value),
+                InputEventKind.MouseRelease => _keyboardMouse.MouseReleaseButton((SerialSymbols.MouseButton)e.Value),
+                InputEventKind.MouseReleaseAll => _keyboardMouse.MouseReleaseAllButtons(),
+                InputEventKind.KeyPress => _keyboardMouse.KeyboardPress((byte)e.Value),
+                InputEventKind.KeyRelease => _keyboardMouse.KeyboardRelease((byte)e.Value),
+                InputEventKind.KeyReleaseAll => _keyboardMouse.KeyboardReleaseAll(),
+                _ => throw new ArgumentException($"Unknown input event kind {e.Kind}.")
+            };
+        }
+
+        private void OnFailed(InputEvent e, Exception ex)
+        {
+            Interlocked.Increment(ref _failed);
+            if (_options.StopOnError)
+            {
+                _stopped = true;
+            }
+            _options.EventFailed?.Invoke(e, ex);
+        }
+
+        private InputStreamProgress Snapshot(bool isCompleted)
+        {
+            return new InputStreamProgress(_consumed, _coalesced, _submitted, Interlocked.Read(ref _completed),
+                Interlocked.Read(ref _failed), isCompleted);
+        }
+    }
+}
@@ -0,0 +1,180 @@
+﻿using System.Threading;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Immutable copy of pressed keys and mouse buttons, as acknowledged by device.
+    /// </summary>
+    public readonly struct KeyStateSnapshot
+    {
+        private readonly ulong _keys0;
+        private readonly ulong _keys1;
+        private readonly ulong _keys2;
+        private readonly ulong _keys3;
+
+        /// <summary>
+        /// Mouse buttons currently pressed
+        /// </summary>
+        public SerialSymbols.MouseButton MouseButtons { get; }
+
+        internal KeyStateSnapshot(ulong keys0, ulong keys1, ulong keys2, ulong keys3,
+            SerialSymbols.MouseButton buttons)
+        {
+            _keys0 = keys0;
+            _keys1 = keys1;
+            _keys2 = keys2;
+            _keys3 = keys3;
+            MouseButtons = buttons;
+        }
+
+        /// <summary>
+        /// Return true if a key was pressed when snapshot was taken.
+        /// </summary>
+        public bool IsPressed(byte key)
+        {
+            ulong word = (key >> 6) switch
+            {
+                0 => _keys0,
+                1 => _keys1,
+                2 => _keys2,
+                _ => _keys3
+            };
+            return (word & (1UL << (key & 63))) != 0;
+        }
+
+        /// <summary>
+        /// True if any key is pressed, mouse buttons not counted.
+        /// </summary>
+        public bool AnyKeyPressed => (_keys0 | _keys1 | _keys2 | _keys3) != 0;
+
+        /// <summary>
+        /// True if no key and no mouse button is pressed.
+        /// </summary>
+        public bool IsIdle => (_keys0 | _keys1 | _keys2 | _keys3) == 0 && MouseButtons == 0;
+    }
+
+    /// <summary>
+    /// Key and button state as a 256-bit bitset, updated by the sender when device acknowledges
+    /// a press or release frame, so state never runs ahead of or lags behind the device.
+    /// Single writer (sender), lock-free readers: single key reads are one word, snapshots are
+    /// made consistent with a sequence counter bumped around each frame's key and button changes together.
+    /// </summary>
+    internal class KeyStateTracker
+    {
+        private readonly long[] _keys = new long[4];
+        private int _buttons;
+
+        /// <summary>
+        /// Odd while an update is in progress
+        /// </summary>
+        private int _version;
+
+        /// <summary>
+        /// Called by sender on acknowledgement of any frame.
+        /// </summary>
+        public void OnAcknowledged(SerialCommandFrame frame)
+        {
+            switch (frame.Type)
+            {
+                case SerialSymbols.FrameType.KeyboardPress:
+                case SerialSymbols.FrameType.KeyboardRelease:
+                case SerialSymbols.FrameType.MousePress:
+                case SerialSymbols.FrameType.MouseRelease:
+                case SerialSymbols.FrameType.KeyMousePress:
+                case SerialSymbols.FrameType.KeyMouseRelease:
+                    break;
+                default:
+                    return;
+            }
+
+            // One update per frame, so a snapshot never pairs keys of one acknowledgement with buttons of another
+            Interlocked.Increment(ref _version);
+            switch (frame.Type)
+            {
+                case SerialSymbols.FrameType.KeyboardPress:
+                    UpdateKey(frame.Key.Value, true);
+                    break;
+                case SerialSymbols.FrameType.KeyboardRelease:
+                    UpdateKey(frame.Key.Value, false);
+                    break;
+                case SerialSymbols.FrameType.MousePress:
+                    Interlocked.Or(ref _buttons, frame.Key.Value);
+                    break;
+                case SerialSymbols.FrameType.MouseRelease:
+                    if (frame.Key.Value == SerialSymbols.ReleaseAllKeys)
+                    {
+                        Volatile.Write(ref _buttons, 0);
+                    }
+                    else
+                    {
+                        Interlocked.And(ref _buttons, ~frame.Key.Value);
+                    }
+                    break;
+                case SerialSymbols.FrameType.KeyMousePress:
+                    if (frame.Key.Value != 0)
+                    {
+                        UpdateKey(frame.Key.Value, true);
+                    }
+                    Interlocked.Or(ref _buttons, frame.Buttons.Value);
+                    break;
+                case SerialSymbols.FrameType.KeyMouseRelease:
+                    if (frame.Key.Value != 0)
+                    {
+                        UpdateKey(frame.Key.Value, false);
+                    }
+                    Interlocked.And(ref _buttons, ~frame.Buttons.Value);
+                    break;
+            }
+            Interlocked.Increment(ref _version);
+        }
+
+        /// <summary>
+        /// Must be called between the two increments of version.
+        /// </summary>
+        private void UpdateKey(byte key, bool pressed)
+        {
+            if (!pressed && key == SerialSymbols.ReleaseAllKeys)
+            {
+                for (int i = 0; i < _keys.Length; ++i)
+                {
+                    Volatile.Write(ref _keys[i], 0);
+                }
+            }
+            else if (pressed)
+            {
+                Interlocked.Or(ref _keys[key >> 6], 1L << (key & 63));
+            }
+            else
+            {
+                Interlocked.And(ref _keys[key >> 6], ~(1L << (key & 63)));
+            }
+        }
+
+        public bool IsPressed(byte key)
+        {
+            return (Volatile.Read(ref _keys[key >> 6]) & (1L << (key & 63))) != 0;
+        }
+
+        public KeyStateSnapshot Snapshot()
+        {
+            SpinWait spinner = new SpinWait();
+            while (true)
+            {
+                int version = Volatile.Read(ref _version);
+                if ((version & 1) == 0)
+                {
+                    KeyStateSnapshot snapshot = new KeyStateSnapshot(
+                        (ulong)Volatile.Read(ref _keys[0]), (ulong)Volatile.Read(ref _keys[1]),
+                        (ulong)Volatile.Read(ref _keys[2]), (ulong)Volatile.Read(ref _keys[3]),
+                        (SerialSymbols.MouseButton)Volatile.Read(ref _buttons));
+                    if (Volatile.Read(ref _version) == version)
+                    {
+                        return snapshot;
+                    }
+                }
+                spinner.SpinOnce();
+            }
+        }
+    }
+}
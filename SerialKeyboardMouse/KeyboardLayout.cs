@@ -0,0 +1,102 @@
+﻿using System;
+using System.Collections.Generic;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Maps characters to HID usage ids for a given keyboard layout.
+    /// </summary>
+    public class KeyboardLayout
+    {
+        /// <summary>
+        /// Flag in layout table indicating character needs Shift. Same convention as _asciimap in Keyboard.cpp.
+        /// </summary>
+        private const byte Shift = 0x80;
+
+        /// <summary>
+        /// HID usage id of left shift
+        /// </summary>
+        public const byte LeftShiftUsage = 0xE1;
+
+        private readonly Dictionary<char, byte> _table;
+
+        /// <summary>
+        /// Name of this layout
+        /// </summary>
+        public string Name { get; }
+
+        /// <summary>
+        /// US ANSI layout, identical to the table used by Arduino's Keyboard library.
+        /// </summary>
+        public static KeyboardLayout UnitedStates { get; } = CreateUnitedStates();
+
+        public KeyboardLayout(string name, IDictionary<char, (byte Usage, bool Shift)> table)
+        {
+            Name = name ?? throw new ArgumentNullException(nameof(name));
+            _table = new Dictionary<char, byte>();
+            foreach (var pair in table)
+            {
+                if (pair.Value.Usage == 0 || pair.Value.Usage >= Shift)
+                {
+                    throw new ArgumentException($"Invalid HID usage 0x{pair.Value.Usage:X2} for '{pair.Key}'.");
+                }
+                _table[pair.Key] = (byte)(pair.Value.Usage | (pair.Value.Shift ? Shift : 0));
+            }
+        }
+
+        /// <summary>
+        /// Map a character to its HID usage id.
+        /// </summary>
+        /// <param name="c">Character to type</param>
+        /// <param name="usage">HID usage id of the key</param>
+        /// <param name="shift">True if Shift must be held for this character</param>
+        /// <returns>False if character cannot be typed with this layout</returns>
+        public bool TryMap(char c, out byte usage, out bool shift)
+        {
+            if (!_table.TryGetValue(c, out byte value))
+            {
+                usage = 0;
+                shift = false;
+                return false;
+            }
+            usage = (byte)(value & ~Shift);
+            shift = (value & Shift) != 0;
+            return true;
+        }
+
+        private static KeyboardLayout CreateUnitedStates()
+        {
+            var table = new Dictionary<char, (byte, bool)>
+            {
+                {'\b', (0x2A, false)},
+                {'\t', (0x2B, false)},
+                {'\n', (0x28, false)},
+                {' ', (0x2C, false)},
+                {'-', (0x2D, false)}, {'_', (0x2D, true)},
+                {'=', (0x2E, false)}, {'+', (0x2E, true)},
+                {'[', (0x2F, false)}, {'{', (0x2F, true)},
+                {']', (0x30, false)}, {'}', (0x30, true)},
+                {'\\', (0x31, false)}, {'|', (0x31, true)},
+                {';', (0x33, false)}, {':', (0x33, true)},
+                {'\'', (0x34, false)}, {'"', (0x34, true)},
+                {'`', (0x35, false)}, {'~', (0x35, true)},
+                {',', (0x36, false)}, {'<', (0x36, true)},
+                {'.', (0x37, false)}, {'>', (0x37, true)},
+                {'/', (0x38, false)}, {'?', (0x38, true)},
+                {'0', (0x27, false)}, {')', (0x27, true)},
+            };
+            const string shiftedDigits = "!@#$%^&*(";
+            for (int i = 0; i < 9; ++i)
+            {
+                table[(char)('1' + i)] = ((byte)(0x1E + i), false);
+                table[shiftedDigits[i]] = ((byte)(0x1E + i), true);
+            }
+            for (int i = 0; i < 26; ++i)
+            {
+                table[(char)('a' + i)] = ((byte)(0x04 + i), false);
+                table[(char)('A' + i)] = ((byte)(0x04 + i), true);
+            }
+            return new KeyboardLayout("en-US", table);
+        }
+    }
+}
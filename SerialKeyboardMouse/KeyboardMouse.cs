@@ -1,200 +1,756 @@
-﻿using System;
-using System.Collections.Generic;
-using System.Linq;
-using System.Numerics;
-using System.Text;
-using System.Threading.Tasks;
-using SerialKeyboardMouse.Serial;
-
-namespace SerialKeyboardMouse
-{
-    public class KeyboardMouse : IDisposable
-    {
-        private readonly ReliableFrameSender _sender;
-        private bool _disposedValue;
-        private readonly bool[] _keyboardKeyStates;
-
-        public int MouseResolutionWidth { get; private set; }
-
-        public int MouseResolutionHeight { get; private set; }
-
-        public KeyboardMouse(ISerialAdaptor serial)
-        {
-            _sender = new ReliableFrameSender(serial);
-            _keyboardKeyStates = new bool[255];
-        }
-
-        /// <summary>
-        /// Set the absolute mouse's resolution.
-        /// Note that in firmware, it has a limitation of 8K resolution.
-        /// </summary>
-        /// <param name="width">Width of resolution.</param>
-        /// <param name="height">Height of resolution. </param>
-        /// <exception cref="ArgumentException">If supplied with non-positive values</exception>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task SetMouseResolution(int width, int height)
-        {
-            if (width <= 0 || height <= 0)
-            {
-                throw new ArgumentException("Resolution values cannot be negative!");
-            }
-            MouseResolutionWidth = width;
-            MouseResolutionHeight = height;
-            SerialCommandFrame frame
-                = SerialCommandFrame.OfCoordinateType(SerialSymbols.FrameType.MouseResolution,
-                    new Tuple<ushort, ushort>((ushort)width, (ushort)height));
-            return _sender.SendFrame(frame);
-        }
-
-        /// <summary>
-        /// Move the absolute mouse to desired coordinate.
-        /// </summary>
-        /// <param name="x">Coordinate X</param>
-        /// <param name="y">Coordinate Y </param>
-        /// <exception cref="ArgumentException">If supplied with non-positive values or out of resolution range.</exception>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task MoveMouseToCoordinate(int x, int y)
-        {
-            if (x <= 0 || y <= 0 || x > MouseResolutionWidth || y > MouseResolutionHeight)
-            {
-                throw new ArgumentOutOfRangeException($"Mouse Coordinate {x},{y} is out of range {MouseResolutionWidth},{MouseResolutionHeight}!\n");
-            }
-            SerialCommandFrame frame
-                = SerialCommandFrame.OfCoordinateType(SerialSymbols.FrameType.MouseMove,
-                    new Tuple<ushort, ushort>((ushort)x, (ushort)y));
-            return _sender.SendFrame(frame);
-        }
-
-        /// <summary>
-        /// Scroll the wheel
-        /// </summary>
-        /// <param name="value">Wheel delta</param>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task MouseScroll(sbyte value)
-        {
-            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseScroll, (byte)value);
-            return _sender.SendFrame(frame);
-        }
-
-        /// <summary>
-        /// Press mouse's button.
-        /// </summary>
-        /// <param name="button"> Button to press.</param>
-        /// <see cref="SerialSymbols.MouseButton"/>
-        /// <seealso cref="MouseReleaseButton"/>
-        /// <seealso cref="MouseReleaseAllButtons"/>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task MousePressButton(SerialSymbols.MouseButton button)
-        {
-            CheckMouseButton(button);
-            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MousePress, (byte)button);
-            return _sender.SendFrame(frame);
-        }
-
-        /// <summary>
-        /// Release mouse's button.
-        /// </summary>
-        /// <param name="button"> Button to release.</param>
-        /// <see cref="SerialSymbols.MouseButton"/>
-        /// <seealso cref="MousePressButton"/>
-        /// <seealso cref="MouseReleaseAllButtons"/>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task MouseReleaseButton(SerialSymbols.MouseButton button)
-        {
-            CheckMouseButton(button);
-            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseRelease, (byte)button);
-            return _sender.SendFrame(frame);
-        }
-
-        /// <summary>
-        /// Release all mouse's buttons.
-        /// </summary>
-        /// <see cref="SerialSymbols.MouseButton"/>
-        /// <seealso cref="MousePressButton"/>
-        /// <seealso cref="MouseReleaseButton"/>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task MouseReleaseAllButtons()
-        {
-            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseRelease, SerialSymbols.ReleaseAllKeys);
-            return _sender.SendFrame(frame);
-        }
-
-        /// <summary>
-        /// Press the specific key. 
-        /// </summary>
-        /// <param name="key">The HID usage id combined with modifiers.</param>
-        /// <seealso cref="KeyboardRelease"/>
-        /// <seealso cref="KeyboardReleaseAll"/>
-        /// <seealso cref="HidHelper.GetHidUsageFromPs2Set1"/>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task KeyboardPress(byte key)
-        {
-            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardPress, key);
-            return _sender.SendFrame(frame).ContinueWith(task => _keyboardKeyStates[key] = true);
-        }
-
-        /// <summary>
-        /// Release the specific key. 
-        /// </summary>
-        /// <param name="key">The HID usage id combined with modifiers.</param>
-        /// <seealso cref="KeyboardPress"/>
-        /// <seealso cref="KeyboardReleaseAll"/>
-        /// <seealso cref="HidHelper.GetHidUsageFromPs2Set1"/>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task KeyboardRelease(byte key)
-        {
-            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardRelease, key);
-            return _sender.SendFrame(frame).ContinueWith(task => _keyboardKeyStates[key] = false);
-        }
-
-        /// <summary>
-        /// Release all keys.
-        /// </summary>
-        /// <seealso cref="KeyboardPress"/>
-        /// <seealso cref="KeyboardRelease"/>
-        /// <seealso cref="HidHelper.GetHidUsageFromPs2Set1"/>
-        /// <exception cref="SerialDeviceException">If command failed.</exception>
-        public Task KeyboardReleaseAll()
-        {
-            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardRelease, SerialSymbols.ReleaseAllKeys);
-            return _sender.SendFrame(frame).ContinueWith(task => Array.Fill(_keyboardKeyStates, false));
-        }
-
-        /// <summary>
-        /// Return true if a key is currently pressed.
-        /// </summary>
-        public bool KeyboardIsPressed(byte key)
-        {
-            return _keyboardKeyStates[key];
-        }
-
-        /// <summary>
-        /// Helper function to check mouse button and throw exception.
-        /// </summary>
-        private static void CheckMouseButton(SerialSymbols.MouseButton button)
-        {
-            if (!Enum.IsDefined(button))
-            {
-                throw new ArgumentException($"Unknown type of mouse button {button}.");
-            }
-        }
-
-        protected virtual void Dispose(bool disposing)
-        {
-            if (!_disposedValue)
-            {
-                if (disposing)
-                {
-                    _sender.Dispose();
-                }
-                _disposedValue = true;
-            }
-        }
-
-        public void Dispose()
-        {
-            Dispose(disposing: true);
-            GC.SuppressFinalize(this);
-        }
-    }
-}
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Numerics;
+using System.Text;
+using System.Threading;
+using System.Threading.Channels;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Macro;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Delivery class of absolute mouse moves.
+    /// </summary>
+    public enum MouseMoveDelivery
+    {
+        /// <summary>
+        /// Every move is looped back by device and retried on failure.
+        /// </summary>
+        Reliable,
+
+        /// <summary>
+        /// Moves are never acknowledged nor retried, only the latest position matters.
+        /// Device counts lost and corrupted moves, see <see cref="KeyboardMouse.QueryDeviceStatistics"/>.
+        /// </summary>
+        Unreliable
+    }
+
+    /// <summary>
+    /// Engine delivering frames to device. Both are reliable and in-order.
+    /// </summary>
+    public enum SenderEngine
+    {
+        /// <summary>
+        /// Blocking I/O on a dedicated high-priority thread per device. Lowest latency.
+        /// </summary>
+        DedicatedThread,
+
+        /// <summary>
+        /// Async I/O and timers on thread pool, no thread parked per device. Suited to many devices.
+        /// </summary>
+        Asynchronous
+    }
+
+    public class KeyboardMouse : IDisposable
+    {
+        private readonly IFrameSender _sender;
+        private readonly MouseMoveRateController _moveController;
+        private bool _disposedValue;
+        private readonly KeyStateTracker _keyStates;
+
+        /// <summary>
+        /// Last LED bits reported by device, -1 if not reported yet
+        /// </summary>
+        private int _keyboardLeds = -1;
+
+        public int MouseResolutionWidth { get; private set; }
+
+        public int MouseResolutionHeight { get; private set; }
+
+        /// <summary>
+        /// Counters of the serial link, including pacing error.
+        /// </summary>
+        public LinkMetrics Metrics => _sender.Metrics;
+
+        /// <summary>
+        /// Lock keys state last set by target, pushed by device whenever it changes.
+        /// Null until device reported it, see <see cref="QueryKeyboardLeds"/>.
+        /// </summary>
+        public SerialSymbols.KeyboardLeds? KeyboardLeds
+        {
+            get
+            {
+                int leds = Volatile.Read(ref _keyboardLeds);
+                return leds < 0 ? null : (SerialSymbols.KeyboardLeds)leds;
+            }
+        }
+
+        /// <summary>
+        /// USB state of device as seen from target, with boot-to-ready timing. Null until device reported it.
+        /// Frames sent while target is not ready are held and delivered once it is.
+        /// </summary>
+        public TargetUsbStatus UsbStatus => _sender.Readiness.Status;
+
+        /// <summary>
+        /// Raised when target enumerates, suspends or resumes device. Raised on receiving thread, handlers must not block.
+        /// </summary>
+        public event Action<TargetUsbStatus> UsbStatusChanged
+        {
+            add => _sender.Readiness.StatusChanged += value;
+            remove => _sender.Readiness.StatusChanged -= value;
+        }
+
+        /// <summary>
+        /// Raised when target changes lock keys state. Raised on receiving thread, handlers must not block.
+        /// </summary>
+        public event Action<SerialSymbols.KeyboardLeds> KeyboardLedsChanged;
+
+        /// <summary>
+        /// How mouse moves are delivered. Keys and buttons are always reliable.
+        /// </summary>
+        public MouseMoveDelivery MoveDelivery
+        {
+            get => _moveController.Unreliable ? MouseMoveDelivery.Unreliable : MouseMoveDelivery.Reliable;
+            set => _moveController.Unreliable = value == MouseMoveDelivery.Unreliable;
+        }
+
+        /// <summary>
+        /// Tag commands, so device re-acknowledges a retransmission without executing it again
+        /// (a scroll whose loop-back was lost no longer scrolls twice), and retry them on a shorter timeout.
+        /// Default is false. Only enable if <see cref="QueryIdentity"/> reports
+        /// <see cref="SerialSymbols.DeviceCapabilities.FrameTags"/>.
+        /// </summary>
+        public bool FrameTags
+        {
+            get => _sender.EnableFrameTags;
+            set => _sender.EnableFrameTags = value;
+        }
+
+        public KeyboardMouse(ISerialAdaptor serial) : this(serial, (WireCapture)null)
+        {
+        }
+
+        /// <summary>
+        /// Create with optional wire capture.
+        /// </summary>
+        /// <param name="serial">Serial adaptor of device</param>
+        /// <param name="capture">Capture receiving all serial traffic, or null. Owned by caller.</param>
+        /// <param name="engine">Engine delivering frames, see <see cref="SenderEngine"/></param>
+        public KeyboardMouse(ISerialAdaptor serial, WireCapture capture,
+            SenderEngine engine = SenderEngine.DedicatedThread)
+            : this(engine == SenderEngine.Asynchronous
+                ? new AsyncFrameSender(serial, capture)
+                : new ReliableFrameSender(serial, capture))
+        {
+        }
+
+        /// <summary>
+        /// Create on an injected clock, e.g. <see cref="VirtualSenderClock"/> with <see cref="SimulatedSerialAdaptor"/>
+        /// to run retry and timeout scenarios in simulated time. Uses <see cref="SenderEngine.DedicatedThread"/>.
+        /// </summary>
+        /// <param name="serial">Serial adaptor of device</param>
+        /// <param name="clock">Clock of all sender timeouts and delays</param>
+        public KeyboardMouse(ISerialAdaptor serial, ISenderClock clock)
+            : this(new ReliableFrameSender(serial, null, clock ?? throw new ArgumentNullException(nameof(clock))))
+        {
+        }
+
+        /// <summary>
+        /// Set up everything above the sender, whichever engine and clock it was created with.
+        /// </summary>
+        private KeyboardMouse(IFrameSender sender)
+        {
+            _sender = sender;
+            _moveController = new MouseMoveRateController(_sender);
+            _keyStates = new KeyStateTracker();
+            _sender.FrameAcknowledged = _keyStates.OnAcknowledged;
+            _sender.Receiver.Register(SerialSymbols.FrameType.EventKeyboardLeds, OnKeyboardLedsEvent);
+        }
+
+        /// <summary>
+        /// Set the absolute mouse's resolution.
+        /// Note that in firmware, it has a limitation of 8K resolution.
+        /// </summary>
+        /// <param name="width">Width of resolution.</param>
+        /// <param name="height">Height of resolution. </param>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="ArgumentException">If supplied with non-positive values</exception>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task SetMouseResolution(int width, int height,
+            CancellationToken token = default, DateTime? deadline = null)
+        {
+            if (width <= 0 || height <= 0)
+            {
+                throw new ArgumentException("Resolution values cannot be negative!");
+            }
+            MouseResolutionWidth = width;
+            MouseResolutionHeight = height;
+            SerialCommandFrame frame
+                = SerialCommandFrame.OfCoordinateType(SerialSymbols.FrameType.MouseResolution,
+                    new Tuple<ushort, ushort>((ushort)width, (ushort)height));
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Move the absolute mouse to desired coordinate. Can be called at any rate:
+        /// only the latest position is sent, at a rate adapted to link latency and queue depth.
+        /// Pending position is always sent before any later non-move command.
+        /// A position superseded before it was sent shares the outcome of the newest one, which is sent
+        /// with the newest caller's token and deadline.
+        /// </summary>
+        /// <returns>Task completed when this position, or a newer one, reached the device.</returns>
+        /// <param name="x">Coordinate X</param>
+        /// <param name="y">Coordinate Y </param>
+        /// <param name="token">Cancels move while it is pending or queued</param>
+        /// <param name="deadline">Time (UTC) after which move is no longer sent, null if none</param>
+        /// <exception cref="ArgumentException">If supplied with non-positive values or out of resolution range.</exception>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before move was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before move was sent.</exception>
+        public Task MoveMouseToCoordinate(int x, int y, CancellationToken token = default, DateTime? deadline = null)
+        {
+            if (x <= 0 || y <= 0 || x > MouseResolutionWidth || y > MouseResolutionHeight)
+            {
+                throw new ArgumentOutOfRangeException($"Mouse Coordinate {x},{y} is out of range {MouseResolutionWidth},{MouseResolutionHeight}!\n");
+            }
+            return _moveController.Submit((ushort)x, (ushort)y, token, deadline);
+        }
+
+        /// <summary>
+        /// Move the absolute mouse along a recorded or generated path. The path is simplified first, see
+        /// <see cref="TrajectorySimplifier"/>, and each point kept is sent as a reliable move at its own time
+        /// relative to the first, so acknowledgement latency does not accumulate into the timing.
+        /// </summary>
+        /// <param name="path">Samples in time order, in pixels of current resolution</param>
+        /// <param name="tolerance">Largest distance in pixels a dropped point may have from the path kept</param>
+        /// <param name="token">Cancellation Token, checked between moves</param>
+        /// <returns>Number of moves sent</returns>
+        /// <exception cref="ArgumentException">If tolerance is invalid, or points are out of time order.</exception>
+        /// <exception cref="SerialDeviceException">If any move failed.</exception>
+        public async Task<int> MoveAlong(IReadOnlyList<TrajectoryPoint> path,
+            double tolerance = TrajectorySimplifier.DefaultTolerance, CancellationToken token = default)
+        {
+            IReadOnlyList<TrajectoryPoint> kept
+                = TrajectorySimplifier.Simplify(path, MouseResolutionWidth, MouseResolutionHeight, tolerance);
+            if (kept.Count == 0)
+            {
+                return 0;
+            }
+            _moveController.Flush();
+            // Bounded like macro pipelining, so a path denser than the link cannot overrun the sender queue
+            const int pipelineDepth = 16;
+            Queue<Task> inflight = new Queue<Task>(pipelineDepth);
+            try
+            {
+                Stopwatch clock = Stopwatch.StartNew();
+                TimeSpan start = kept[0].Time;
+                foreach (TrajectoryPoint point in kept)
+                {
+                    token.ThrowIfCancellationRequested();
+                    TimeSpan wait = point.Time - start - clock.Elapsed;
+                    if (wait > TimeSpan.Zero)
+                    {
+                        await _sender.Pacer.DelayAsync(wait, token).ConfigureAwait(false);
+                    }
+                    if (inflight.Count >= pipelineDepth)
+                    {
+                        await inflight.Dequeue().ConfigureAwait(false);
+                    }
+                    inflight.Enqueue(_sender.SendFrame(SerialCommandFrame.OfCoordinateType(
+                        SerialSymbols.FrameType.MouseMove,
+                        new Tuple<ushort, ushort>((ushort)point.X, (ushort)point.Y)), token));
+                }
+                while (inflight.Count > 0)
+                {
+                    await inflight.Dequeue().ConfigureAwait(false);
+                }
+            }
+            finally
+            {
+                while (inflight.Count > 0)
+                {
+                    _ = inflight.Dequeue().ContinueWith(t => t.Exception, TaskContinuationOptions.OnlyOnFaulted);
+                }
+            }
+            return kept.Count;
+        }
+
+        /// <summary>
+        /// Scroll the wheel
+        /// </summary>
+        /// <param name="value">Wheel delta</param>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task MouseScroll(sbyte value, CancellationToken token = default, DateTime? deadline = null)
+        {
+            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseScroll, (byte)value);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Press mouse's button.
+        /// </summary>
+        /// <param name="button"> Button to press.</param>
+        /// <see cref="SerialSymbols.MouseButton"/>
+        /// <seealso cref="MouseReleaseButton"/>
+        /// <seealso cref="MouseReleaseAllButtons"/>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task MousePressButton(SerialSymbols.MouseButton button,
+            CancellationToken token = default, DateTime? deadline = null)
+        {
+            CheckMouseButton(button);
+            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MousePress, (byte)button);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Release mouse's button.
+        /// </summary>
+        /// <param name="button"> Button to release.</param>
+        /// <see cref="SerialSymbols.MouseButton"/>
+        /// <seealso cref="MousePressButton"/>
+        /// <seealso cref="MouseReleaseAllButtons"/>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task MouseReleaseButton(SerialSymbols.MouseButton button,
+            CancellationToken token = default, DateTime? deadline = null)
+        {
+            CheckMouseButton(button);
+            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseRelease, (byte)button);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Release all mouse's buttons.
+        /// </summary>
+        /// <see cref="SerialSymbols.MouseButton"/>
+        /// <seealso cref="MousePressButton"/>
+        /// <seealso cref="MouseReleaseButton"/>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task MouseReleaseAllButtons(CancellationToken token = default, DateTime? deadline = null)
+        {
+            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseRelease, SerialSymbols.ReleaseAllKeys);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Press the specific key. 
+        /// </summary>
+        /// <param name="key">The HID usage id combined with modifiers.</param>
+        /// <seealso cref="KeyboardRelease"/>
+        /// <seealso cref="KeyboardReleaseAll"/>
+        /// <seealso cref="HidHelper.GetHidUsageFromPs2Set1"/>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task KeyboardPress(byte key, CancellationToken token = default, DateTime? deadline = null)
+        {
+            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardPress, key);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Release the specific key. 
+        /// </summary>
+        /// <param name="key">The HID usage id combined with modifiers.</param>
+        /// <seealso cref="KeyboardPress"/>
+        /// <seealso cref="KeyboardReleaseAll"/>
+        /// <seealso cref="HidHelper.GetHidUsageFromPs2Set1"/>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task KeyboardRelease(byte key, CancellationToken token = default, DateTime? deadline = null)
+        {
+            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardRelease, key);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Release all keys.
+        /// </summary>
+        /// <seealso cref="KeyboardPress"/>
+        /// <seealso cref="KeyboardRelease"/>
+        /// <seealso cref="HidHelper.GetHidUsageFromPs2Set1"/>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task KeyboardReleaseAll(CancellationToken token = default, DateTime? deadline = null)
+        {
+            SerialCommandFrame frame = SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardRelease, SerialSymbols.ReleaseAllKeys);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Press a key and mouse buttons in one frame, e.g. Ctrl+Click. Device applies both before
+        /// target polls again, in a single report when it has <see cref="SerialSymbols.DeviceCapabilities.CompositeReport"/>.
+        /// Requires <see cref="SerialSymbols.DeviceCapabilities.KeyMouseFrames"/>.
+        /// </summary>
+        /// <param name="key">The HID usage id combined with modifiers, 0 for none.</param>
+        /// <param name="buttons">Buttons to press, 0 for none.</param>
+        /// <seealso cref="KeyboardMouseRelease"/>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="ArgumentException">If buttons contain unknown bits.</exception>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task KeyboardMousePress(byte key, SerialSymbols.MouseButton buttons,
+            CancellationToken token = default, DateTime? deadline = null)
+        {
+            CheckMouseButtons(buttons);
+            SerialCommandFrame frame
+                = SerialCommandFrame.OfKeyMouseType(SerialSymbols.FrameType.KeyMousePress, key, (byte)buttons);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Release a key and mouse buttons in one frame. Buttons are released before the key.
+        /// </summary>
+        /// <param name="key">The HID usage id combined with modifiers, 0 for none.</param>
+        /// <param name="buttons">Buttons to release, 0 for none.</param>
+        /// <seealso cref="KeyboardMousePress"/>
+        /// <param name="token">Cancels command while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which command is no longer sent, null if none</param>
+        /// <exception cref="ArgumentException">If buttons contain unknown bits.</exception>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        /// <exception cref="TimeoutException">If deadline passed before command was delivered.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled before command was sent.</exception>
+        public Task KeyboardMouseRelease(byte key, SerialSymbols.MouseButton buttons,
+            CancellationToken token = default, DateTime? deadline = null)
+        {
+            CheckMouseButtons(buttons);
+            SerialCommandFrame frame
+                = SerialCommandFrame.OfKeyMouseType(SerialSymbols.FrameType.KeyMouseRelease, key, (byte)buttons);
+            return Send(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Type a text with the fewest reports: Shift is held across runs of shifted characters, and frames are
+        /// queued back-to-back. See <see cref="TypingPlanner"/>.
+        /// </summary>
+        /// <param name="text">Text to type</param>
+        /// <param name="layout">Layout mapping characters to keys, default US</param>
+        /// <param name="token">Cancellation Token, checked between frames</param>
+        /// <returns>Plan that was typed, with its report count</returns>
+        /// <exception cref="ArgumentException">If a character cannot be typed with layout.</exception>
+        /// <exception cref="SerialDeviceException">If any command failed.</exception>
+        public async Task<TypingPlan> TypeText(string text, KeyboardLayout layout = null,
+            CancellationToken token = default)
+        {
+            // Release-all would also release keys the caller holds
+            TypingPlan plan = TypingPlanner.Plan(text, layout, !_keyStates.Snapshot().AnyKeyPressed);
+            _moveController.Flush();
+            await MacroExecutor.Execute(_sender, plan.ToMacro((MouseResolutionWidth, MouseResolutionHeight)), token)
+                .ConfigureAwait(false);
+            return plan;
+        }
+
+        /// <summary>
+        /// Type a text with the device's typing engine, which presses the next key in the report releasing the
+        /// previous one, about one report per character. Returns once the device queued every character; any
+        /// later command producing a report runs after typing finished. Requires
+        /// <see cref="SerialSymbols.DeviceCapabilities.Typing"/>.
+        /// </summary>
+        /// <param name="text">Text to type</param>
+        /// <param name="layout">Layout mapping characters to keys, default US</param>
+        /// <param name="token">Cancellation Token, checked between frames</param>
+        /// <exception cref="ArgumentException">If a character cannot be typed with layout.</exception>
+        /// <exception cref="SerialDeviceException">If any command failed.</exception>
+        public async Task TypeTextOnDevice(string text, KeyboardLayout layout = null,
+            CancellationToken token = default)
+        {
+            CompiledMacro macro = TypingPlanner.PlanOnDevice(text, layout,
+                (MouseResolutionWidth, MouseResolutionHeight));
+            _moveController.Flush();
+            await MacroExecutor.Execute(_sender, macro, token).ConfigureAwait(false);
+        }
+
+        /// <summary>
+        /// Execute a compiled macro. All frames are already encoded and validated,
+        /// so execution only streams them to the device.
+        /// </summary>
+        /// <param name="macro">Macro from <see cref="MacroCompiler"/> or <see cref="CompiledMacro.Load"/></param>
+        /// <param name="token">Cancellation Token, checked between frames</param>
+        /// <exception cref="ArgumentException">If macro assumes a different mouse resolution.</exception>
+        /// <exception cref="SerialDeviceException">If any command failed.</exception>
+        public async Task ExecuteMacro(CompiledMacro macro, CancellationToken token = default)
+        {
+            if (macro == null)
+            {
+                throw new ArgumentNullException(nameof(macro));
+            }
+            if (macro.RequiresAssumedResolution
+                && macro.AssumedResolution != (MouseResolutionWidth, MouseResolutionHeight))
+            {
+                throw new ArgumentException($"Macro was compiled for resolution {macro.AssumedResolution.Width}x" +
+                                            $"{macro.AssumedResolution.Height}, but current resolution is " +
+                                            $"{MouseResolutionWidth}x{MouseResolutionHeight}.");
+            }
+            _moveController.Flush();
+            await MacroExecutor.Execute(_sender, macro, token).ConfigureAwait(false);
+            if (macro.SetsResolution)
+            {
+                (MouseResolutionWidth, MouseResolutionHeight) = macro.FinalResolution;
+            }
+        }
+
+        /// <summary>
+        /// Send every event written to a channel until it completes. Events are submitted without waiting for
+        /// each other and delivered in order; consecutive moves and scrolls readily available in the channel
+        /// are coalesced. Failures are reported through <paramref name="options"/>, not thrown.
+        /// </summary>
+        /// <param name="events">Source of events, e.g. from a forwarding or replay pipeline</param>
+        /// <param name="options">Batching, progress and error reporting, or null for defaults</param>
+        /// <param name="token">Cancellation Token, stops consuming events</param>
+        /// <returns>Final counters, once every submitted frame completed.</returns>
+        /// <exception cref="ArgumentOutOfRangeException">If <see cref="InputStreamOptions.MaxInFlight"/> is out of range.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled.</exception>
+        public async Task<InputStreamProgress> SendStream(ChannelReader<InputEvent> events,
+            InputStreamOptions options = null, CancellationToken token = default)
+        {
+            if (events == null)
+            {
+                throw new ArgumentNullException(nameof(events));
+            }
+            InputStreamPump pump = new InputStreamPump(this, options);
+            while (!pump.Stopped && await events.WaitToReadAsync(token).ConfigureAwait(false))
+            {
+                while (!pump.Stopped && events.TryRead(out InputEvent e))
+                {
+                    await pump.Add(e).ConfigureAwait(false);
+                }
+                await pump.Flush().ConfigureAwait(false);
+            }
+            return await pump.Complete().ConfigureAwait(false);
+        }
+
+        /// <summary>
+        /// Send every event of an async sequence. Same as the channel overload; events the sequence yields
+        /// synchronously are treated as readily available and coalesced.
+        /// </summary>
+        /// <param name="events">Source of events</param>
+        /// <param name="options">Batching, progress and error reporting, or null for defaults</param>
+        /// <param name="token">Cancellation Token, passed to the sequence</param>
+        /// <returns>Final counters, once every submitted frame completed.</returns>
+        /// <exception cref="ArgumentOutOfRangeException">If <see cref="InputStreamOptions.MaxInFlight"/> is out of range.</exception>
+        /// <exception cref="OperationCanceledException">If cancelled.</exception>
+        public async Task<InputStreamProgress> SendStream(IAsyncEnumerable<InputEvent> events,
+            InputStreamOptions options = null, CancellationToken token = default)
+        {
+            if (events == null)
+            {
+                throw new ArgumentNullException(nameof(events));
+            }
+            InputStreamPump pump = new InputStreamPump(this, options);
+            await using IAsyncEnumerator<InputEvent> enumerator = events.GetAsyncEnumerator(token);
+            while (!pump.Stopped)
+            {
+                ValueTask<bool> next = enumerator.MoveNextAsync();
+                if (!next.IsCompleted)
+                {
+                    // Source is waiting for input, don't hold a coalesced move meanwhile
+                    await pump.Flush().ConfigureAwait(false);
+                }
+                if (!await next.ConfigureAwait(false))
+                {
+                    break;
+                }
+                await pump.Add(enumerator.Current).ConfigureAwait(false);
+            }
+            return await pump.Complete().ConfigureAwait(false);
+        }
+
+        /// <summary>
+        /// Read link counters kept by the device, e.g. unreliable moves dropped.
+        /// </summary>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public async Task<DeviceStatistics> QueryDeviceStatistics()
+        {
+            _moveController.Flush();
+            byte[] reply = await _sender.SendQuery(
+                SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.QueryStats, 0)).ConfigureAwait(false);
+            return new DeviceStatistics(reply);
+        }
+
+        /// <summary>
+        /// Read idle sleep counters of the device: how often it woke on serial input, and how long
+        /// the first frame after waking took to handle. Compare with <see cref="LinkMetrics.AckLatencyMicroseconds"/>.
+        /// </summary>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public async Task<DeviceIdleStatistics> QueryIdleStatistics()
+        {
+            _moveController.Flush();
+            byte[] reply = await _sender.SendQuery(
+                SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.QueryIdleStats, 0)).ConfigureAwait(false);
+            return new DeviceIdleStatistics(reply);
+        }
+
+        /// <summary>
+        /// Read persistent id, protocol version and capabilities of the device.
+        /// </summary>
+        /// <seealso cref="DeviceDiscovery"/>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public async Task<DeviceIdentity> QueryIdentity()
+        {
+            _moveController.Flush();
+            byte[] reply = await _sender.SendQuery(
+                SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.Identify, 0)).ConfigureAwait(false);
+            return new DeviceIdentity(reply);
+        }
+
+        /// <summary>
+        /// Ask device for current lock keys state, and update <see cref="KeyboardLeds"/>.
+        /// Only needed once after connecting, later changes are pushed by device.
+        /// </summary>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public async Task<SerialSymbols.KeyboardLeds> QueryKeyboardLeds()
+        {
+            _moveController.Flush();
+            byte[] reply = await _sender.SendQuery(
+                SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.EventKeyboardLeds, 0)).ConfigureAwait(false);
+            // Reply also went through OnKeyboardLedsEvent
+            return (SerialSymbols.KeyboardLeds)reply[3];
+        }
+
+        /// <summary>
+        /// Ask device for current USB state, and update <see cref="UsbStatus"/>.
+        /// Only needed once after connecting, later changes are pushed by device.
+        /// </summary>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public async Task<TargetUsbStatus> QueryUsbStatus()
+        {
+            _moveController.Flush();
+            byte[] reply = await _sender.SendQuery(
+                SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.EventUsbStatus, 0)).ConfigureAwait(false);
+            return new TargetUsbStatus(reply);
+        }
+
+        private void OnKeyboardLedsEvent(ReadOnlySpan<byte> frame)
+        {
+            int leds = frame[3];
+            if (Interlocked.Exchange(ref _keyboardLeds, leds) != leds)
+            {
+                KeyboardLedsChanged?.Invoke((SerialSymbols.KeyboardLeds)leds);
+            }
+        }
+
+        /// <summary>
+        /// Return true if a key is currently pressed. State changes when device acknowledges
+        /// the press or release, before its task completes.
+        /// </summary>
+        public bool KeyboardIsPressed(byte key)
+        {
+            return _keyStates.IsPressed(key);
+        }
+
+        /// <summary>
+        /// Consistent copy of all pressed keys and mouse buttons.
+        /// </summary>
+        public KeyStateSnapshot KeyStates => _keyStates.Snapshot();
+
+        /// <summary>
+        /// Send a frame encoded elsewhere, e.g. by a client of <see cref="Remote.KeyboardMouseServer"/>.
+        /// Frame is queued before this returns, so calls are delivered in call order.
+        /// </summary>
+        /// <returns>Reply of query types, null otherwise.</returns>
+        /// <exception cref="ArgumentException">If frame is not a command looped back by device or a query,
+        /// or moves out of resolution range.</exception>
+        internal async Task<byte[]> SendEncoded(SerialCommandFrame frame)
+        {
+            if (SerialSymbols.ReplyLengthLookup.ContainsKey(frame.Type))
+            {
+                _moveController.Flush();
+                return await _sender.SendQuery(frame).ConfigureAwait(false);
+            }
+            // Unreliable moves would share the device's sequence counter with our move controller
+            if (!SerialSymbols.TaggableFrameTypes.Contains(frame.Type))
+            {
+                throw new ArgumentException($"Frame type {frame.Type} cannot be forwarded!");
+            }
+            if (frame.Type == SerialSymbols.FrameType.MouseMove)
+            {
+                (ushort x, ushort y) = (frame.Coordinate.Item1, frame.Coordinate.Item2);
+                if (x == 0 || y == 0 || x > MouseResolutionWidth || y > MouseResolutionHeight)
+                {
+                    throw new ArgumentOutOfRangeException($"Mouse Coordinate {x},{y} is out of range {MouseResolutionWidth},{MouseResolutionHeight}!\n");
+                }
+            }
+            if (frame.Type == SerialSymbols.FrameType.MouseResolution)
+            {
+                MouseResolutionWidth = frame.Coordinate.Item1;
+                MouseResolutionHeight = frame.Coordinate.Item2;
+            }
+            await Send(frame).ConfigureAwait(false);
+            return null;
+        }
+
+        /// <summary>
+        /// Send a non-move frame, after any pending move so order is kept.
+        /// </summary>
+        private Task Send(SerialCommandFrame frame, CancellationToken token = default, DateTime? deadline = null)
+        {
+            _moveController.Flush();
+            return _sender.SendFrame(frame, token, deadline);
+        }
+
+        /// <summary>
+        /// Helper function to check mouse button and throw exception.
+        /// </summary>
+        private static void CheckMouseButton(SerialSymbols.MouseButton button)
+        {
+            if (!Enum.IsDefined(button))
+            {
+                throw new ArgumentException($"Unknown type of mouse button {button}.");
+            }
+        }
+
+        /// <summary>
+        /// Helper function to check a set of mouse buttons, which may be empty.
+        /// </summary>
+        private static void CheckMouseButtons(SerialSymbols.MouseButton buttons)
+        {
+            const SerialSymbols.MouseButton all = SerialSymbols.MouseButton.Left | SerialSymbols.MouseButton.Right
+                | SerialSymbols.MouseButton.Middle;
+            if ((buttons & ~all) != 0)
+            {
+                throw new ArgumentException($"Unknown type of mouse button {buttons}.");
+            }
+        }
+
+        protected virtual void Dispose(bool disposing)
+        {
+            if (!_disposedValue)
+            {
+                if (disposing)
+                {
+                    _moveController.Dispose();
+                    _sender.Dispose();
+                }
+                _disposedValue = true;
+            }
+        }
+
+        public void Dispose()
+        {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
@@ -0,0 +1,137 @@
+﻿using System.Threading;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Counters of the serial link to a device. All members are thread-safe and cheap to read.
+    /// </summary>
+    public class LinkMetrics
+    {
+        private long _framesSent;
+        private long _framesFailed;
+        private long _retries;
+        private long _unacknowledgedSent;
+        private long _inboundCorrupted;
+        private long _inboundUnrouted;
+        private long _notReadyRejections;
+        private long _mouseMovesCoalesced;
+        private long _framesCancelled;
+        private long _framesExpired;
+        private double _ackLatencyMicroseconds;
+        private double _mouseMoveRateHz;
+
+        /// <summary>
+        /// Weight of newest sample in <see cref="AckLatencyMicroseconds"/>
+        /// </summary>
+        private const double LatencySmoothing = 0.125;
+
+        /// <summary>
+        /// Frames acknowledged by device
+        /// </summary>
+        public long FramesSent => Interlocked.Read(ref _framesSent);
+
+        /// <summary>
+        /// Frames given up after all retries
+        /// </summary>
+        public long FramesFailed => Interlocked.Read(ref _framesFailed);
+
+        /// <summary>
+        /// Re-transmissions
+        /// </summary>
+        public long Retries => Interlocked.Read(ref _retries);
+
+        /// <summary>
+        /// Frames sent without acknowledgement, e.g. unreliable mouse moves
+        /// </summary>
+        public long UnacknowledgedFramesSent => Interlocked.Read(ref _unacknowledgedSent);
+
+        /// <summary>
+        /// Inbound bytes skipped while resynchronizing, for bad length or checksum
+        /// </summary>
+        public long InboundCorrupted => Interlocked.Read(ref _inboundCorrupted);
+
+        /// <summary>
+        /// Valid inbound frames of a type nobody consumes
+        /// </summary>
+        public long InboundUnrouted => Interlocked.Read(ref _inboundUnrouted);
+
+        /// <summary>
+        /// Frames rejected by device because target had not enumerated it or was suspended.
+        /// Those are held and sent again once target is ready.
+        /// </summary>
+        public long NotReadyRejections => Interlocked.Read(ref _notReadyRejections);
+
+        /// <summary>
+        /// Mouse moves replaced by a newer position before being sent
+        /// </summary>
+        public long MouseMovesCoalesced => Interlocked.Read(ref _mouseMovesCoalesced);
+
+        /// <summary>
+        /// Frames skipped because their caller cancelled before they were sent
+        /// </summary>
+        public long FramesCancelled => Interlocked.Read(ref _framesCancelled);
+
+        /// <summary>
+        /// Frames not sent because their deadline passed while queued or held for target
+        /// </summary>
+        public long FramesExpired => Interlocked.Read(ref _framesExpired);
+
+        /// <summary>
+        /// Smoothed time from last write of a frame to its acknowledgement, in microseconds
+        /// </summary>
+        public double AckLatencyMicroseconds => Volatile.Read(ref _ackLatencyMicroseconds);
+
+        /// <summary>
+        /// Current adaptive mouse move emit rate
+        /// </summary>
+        public double MouseMoveRateHz
+        {
+            get => Volatile.Read(ref _mouseMoveRateHz);
+            internal set => Volatile.Write(ref _mouseMoveRateHz, value);
+        }
+
+        /// <summary>
+        /// Error of all paced waits: retry back-off and macro replay delays.
+        /// </summary>
+        public PacingStatistics Pacing { get; } = new PacingStatistics();
+
+        internal void OnFrameSent() => Interlocked.Increment(ref _framesSent);
+
+        internal void OnFrameFailed() => Interlocked.Increment(ref _framesFailed);
+
+        internal void OnRetry() => Interlocked.Increment(ref _retries);
+
+        internal void OnUnacknowledgedSent() => Interlocked.Increment(ref _unacknowledgedSent);
+
+        internal void OnInboundCorrupted() => Interlocked.Increment(ref _inboundCorrupted);
+
+        internal void OnInboundUnrouted() => Interlocked.Increment(ref _inboundUnrouted);
+
+        internal void OnNotReadyRejection() => Interlocked.Increment(ref _notReadyRejections);
+
+        internal void OnMouseMoveCoalesced() => Interlocked.Increment(ref _mouseMovesCoalesced);
+
+        internal void OnFrameCancelled() => Interlocked.Increment(ref _framesCancelled);
+
+        internal void OnFrameExpired() => Interlocked.Increment(ref _framesExpired);
+
+        /// <summary>
+        /// Only called by sender thread, so no read-modify-write race.
+        /// </summary>
+        internal void OnAck(double latencyMicroseconds)
+        {
+            double old = _ackLatencyMicroseconds;
+            Volatile.Write(ref _ackLatencyMicroseconds,
+                old == 0 ? latencyMicroseconds : old + LatencySmoothing * (latencyMicroseconds - old));
+        }
+
+        public override string ToString()
+        {
+            return $"Sent {FramesSent} (+{UnacknowledgedFramesSent} unacknowledged), failed {FramesFailed}, retries {Retries}, " +
+                   $"cancelled {FramesCancelled}, expired {FramesExpired}, " +
+                   $"ACK latency {AckLatencyMicroseconds:F0} us, move rate {MouseMoveRateHz:F0} Hz " +
+                   $"({MouseMovesCoalesced} coalesced), inbound corrupted {InboundCorrupted}, " +
+                   $"unrouted {InboundUnrouted}, not-ready rejections {NotReadyRejections}. Pacing: {Pacing}";
+        }
+    }
+}
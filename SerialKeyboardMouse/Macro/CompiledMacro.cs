@@ -0,0 +1,236 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse.Macro
+{
+    /// <summary>
+    /// One precomputed frame of a compiled macro.
+    /// </summary>
+    public readonly struct MacroStep
+    {
+        internal SerialCommandFrame Frame { get; }
+
+        /// <summary>
+        /// Time to wait before sending this frame, in microseconds.
+        /// The wait starts after all previous frames are acknowledged.
+        /// </summary>
+        public uint DelayMicroseconds { get; }
+
+        /// <summary>
+        /// Line in source script that produced this step, 0 if unknown.
+        /// </summary>
+        public int SourceLine { get; }
+
+        /// <summary>
+        /// Encoded frame bytes, ready to write to serial.
+        /// </summary>
+        public ReadOnlyMemory<byte> FrameBytes => Frame.Bytes;
+
+        /// <summary>
+        /// Type of the frame
+        /// </summary>
+        public SerialSymbols.FrameType Type => Frame.Type;
+
+        internal MacroStep(SerialCommandFrame frame, uint delayMicroseconds, int sourceLine)
+        {
+            Frame = frame;
+            DelayMicroseconds = delayMicroseconds;
+            SourceLine = sourceLine;
+        }
+    }
+
+    /// <summary>
+    /// A validated and fully encoded sequence of frames with timing annotations,
+    /// produced by <see cref="MacroCompiler"/> and executed by <see cref="KeyboardMouse.ExecuteMacro"/>.
+    /// </summary>
+    public class CompiledMacro
+    {
+        private static readonly byte[] Magic = Encoding.ASCII.GetBytes("SKMM");
+        private const ushort FormatVersion = 1;
+
+        /// <summary>
+        /// Bytes of a step with its delay, source line and frame length, before the frame itself
+        /// </summary>
+        private const int MinStepLength = 4 + 4 + 1;
+
+        /// <summary>
+        /// All frames in order
+        /// </summary>
+        public IReadOnlyList<MacroStep> Steps { get; }
+
+        /// <summary>
+        /// Time to wait after the last frame, in microseconds.
+        /// </summary>
+        public uint TrailingDelayMicroseconds { get; }
+
+        /// <summary>
+        /// Mouse resolution that coordinates were validated against before the first resolution step.
+        /// </summary>
+        public (int Width, int Height) AssumedResolution { get; }
+
+        /// <summary>
+        /// True if macro contains any resolution step.
+        /// </summary>
+        public bool SetsResolution { get; }
+
+        /// <summary>
+        /// Mouse resolution after this macro finished.
+        /// </summary>
+        public (int Width, int Height) FinalResolution { get; }
+
+        /// <summary>
+        /// True if macro moves the mouse before setting its own resolution,
+        /// so device must already be at <see cref="AssumedResolution"/>.
+        /// </summary>
+        public bool RequiresAssumedResolution { get; }
+
+        /// <summary>
+        /// Sum of all delays, i.e. lower bound of execution time.
+        /// </summary>
+        public TimeSpan TotalDelay => TimeSpan.FromTicks(
+            (Steps.Sum(s => (long)s.DelayMicroseconds) + TrailingDelayMicroseconds) * 10);
+
+        internal CompiledMacro(IReadOnlyList<MacroStep> steps, uint trailingDelay,
+            (int, int) assumedResolution)
+        {
+            Steps = steps;
+            TrailingDelayMicroseconds = trailingDelay;
+            AssumedResolution = assumedResolution;
+            FinalResolution = assumedResolution;
+            RequiresAssumedResolution = false;
+            foreach (MacroStep step in steps)
+            {
+                if (step.Type == SerialSymbols.FrameType.MouseMove)
+                {
+                    RequiresAssumedResolution |= !SetsResolution;
+                }
+                else if (step.Type == SerialSymbols.FrameType.MouseResolution)
+                {
+                    SetsResolution = true;
+                    FinalResolution = (step.Frame.Coordinate.Item1, step.Frame.Coordinate.Item2);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Serialize to compact binary form.
+        /// </summary>
+        public void Save(Stream stream)
+        {
+            using BinaryWriter writer = new BinaryWriter(stream, Encoding.ASCII, true);
+            writer.Write(Magic);
+            writer.Write(FormatVersion);
+            writer.Write((ushort)AssumedResolution.Width);
+            writer.Write((ushort)AssumedResolution.Height);
+            writer.Write(Steps.Count);
+            writer.Write(TrailingDelayMicroseconds);
+            foreach (MacroStep step in Steps)
+            {
+                writer.Write(step.DelayMicroseconds);
+                writer.Write(step.SourceLine);
+                writer.Write((byte)step.FrameBytes.Length);
+                writer.Write(step.FrameBytes.Span);
+            }
+        }
+
+        /// <summary>
+        /// Deserialize from binary form written by <see cref="Save"/>. Every frame is validated again,
+        /// and moves are range-checked against the resolution in effect, as <see cref="MacroCompiler"/> does.
+        /// </summary>
+        /// <exception cref="InvalidDataException">If stream is not a valid compiled macro.</exception>
+        public static CompiledMacro Load(Stream stream)
+        {
+            using BinaryReader reader = new BinaryReader(stream, Encoding.ASCII, true);
+            if (!reader.ReadBytes(Magic.Length).AsSpan().SequenceEqual(Magic))
+            {
+                throw new InvalidDataException("Not a compiled macro.");
+            }
+            ushort version = reader.ReadUInt16();
+            if (version != FormatVersion)
+            {
+                throw new InvalidDataException($"Unsupported compiled macro version {version}.");
+            }
+            int width = reader.ReadUInt16();
+            int height = reader.ReadUInt16();
+            int count = reader.ReadInt32();
+            uint trailing = reader.ReadUInt32();
+            if (!IsValidResolution(width, height))
+            {
+                throw new InvalidDataException($"Invalid assumed resolution {width}x{height}.");
+            }
+            if (count < 0)
+            {
+                throw new InvalidDataException("Corrupted step count.");
+            }
+            // Count is untrusted: pre-size only as far as the rest of the stream could hold steps
+            int capacity = 0;
+            if (stream.CanSeek)
+            {
+                capacity = (int)Math.Min(count, Math.Max(0, stream.Length - stream.Position) / MinStepLength);
+            }
+            List<MacroStep> steps = new List<MacroStep>(capacity);
+            Span<byte> buffer = stackalloc byte[SerialSymbols.MaxFrameLength];
+            (int Width, int Height) resolution = (width, height);
+            for (int i = 0; i < count; ++i)
+            {
+                uint delay;
+                int line;
+                int length;
+                try
+                {
+                    delay = reader.ReadUInt32();
+                    line = reader.ReadInt32();
+                    length = reader.ReadByte();
+                }
+                catch (EndOfStreamException e)
+                {
+                    throw new InvalidDataException($"Truncated at step {i} of {count}.", e);
+                }
+                if (length > buffer.Length || reader.Read(buffer.Slice(0, length)) != length)
+                {
+                    throw new InvalidDataException($"Corrupted frame in step {i}.");
+                }
+                SerialCommandFrame frame;
+                try
+                {
+                    frame = SerialCommandFrame.Parse(buffer.Slice(0, length));
+                }
+                catch (ArgumentException e)
+                {
+                    throw new InvalidDataException($"Invalid frame in step {i}: {e.Message}", e);
+                }
+                // Device wraps coordinates beyond its resolution, so a move must stay inside it
+                if (frame.Type == SerialSymbols.FrameType.MouseMove)
+                {
+                    (int x, int y) = (frame.Coordinate.Item1, frame.Coordinate.Item2);
+                    if (x < 1 || y < 1 || x > resolution.Width || y > resolution.Height)
+                    {
+                        throw new InvalidDataException(
+                            $"Move to {x},{y} in step {i} is out of resolution {resolution.Width}x{resolution.Height}.");
+                    }
+                }
+                else if (frame.Type == SerialSymbols.FrameType.MouseResolution)
+                {
+                    resolution = (frame.Coordinate.Item1, frame.Coordinate.Item2);
+                    if (!IsValidResolution(resolution.Width, resolution.Height))
+                    {
+                        throw new InvalidDataException(
+                            $"Invalid resolution {resolution.Width}x{resolution.Height} in step {i}.");
+                    }
+                }
+                steps.Add(new MacroStep(frame, delay, line));
+            }
+            return new CompiledMacro(steps, trailing, (width, height));
+        }
+
+        private static bool IsValidResolution(int width, int height)
+        {
+            return width >= 1 && height >= 1
+                   && width <= MacroCompiler.MaxResolutionWidth && height <= MacroCompiler.MaxResolutionHeight;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+﻿using System;
+using System.Runtime.Serialization;
+
+namespace SerialKeyboardMouse.Macro
+{
+    /// <summary>
+    /// Thrown when an input script cannot be compiled.
+    /// </summary>
+    public class MacroCompileException : Exception
+    {
+        /// <summary>
+        /// 1-based line number in script where the error happened, 0 if unknown.
+        /// </summary>
+        public int LineNumber { get; }
+
+        public MacroCompileException()
+        {
+        }
+
+        protected MacroCompileException(SerializationInfo info, StreamingContext context) : base(info, context)
+        {
+        }
+
+        public MacroCompileException(string message) : base(message)
+        {
+        }
+
+        public MacroCompileException(int lineNumber, string message) : base($"Line {lineNumber}: {message}")
+        {
+            LineNumber = lineNumber;
+        }
+
+        public MacroCompileException(string message, Exception innerException) : base(message, innerException)
+        {
+        }
+    }
+}
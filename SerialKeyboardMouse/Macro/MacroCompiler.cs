@@ -0,0 +1,326 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Text;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse.Macro
+{
+    /// <summary>
+    /// Compiles text input scripts into <see cref="CompiledMacro"/>, so all parsing, validation
+    /// and encoding is done before execution starts.
+    /// </summary>
+    /// <remarks>
+    /// One command per line, '#' starts a comment:
+    /// <code>
+    /// resolution &lt;width&gt; &lt;height&gt;
+    /// wait &lt;ms&gt;
+    /// type &lt;text&gt;              (rest of line, supports \n \t \\ escapes)
+    /// press &lt;key&gt;
+    /// release &lt;key|all&gt;
+    /// tap &lt;key&gt;
+    /// chord &lt;key+key+...&gt;      (e.g. ctrl+shift+t)
+    /// move &lt;x&gt; &lt;y&gt;
+    /// click [left|right|middle] [&lt;x&gt; &lt;y&gt;]
+    /// mousedown [left|right|middle]
+    /// mouseup [left|right|middle|all]
+    /// scroll &lt;steps&gt;
+    /// </code>
+    /// Key names are resolved by <see cref="HidHelper.TryGetHidUsageFromName"/>.
+    /// </remarks>
+    public class MacroCompiler
+    {
+        internal const int MaxResolutionWidth = 7680;
+        internal const int MaxResolutionHeight = 4320;
+
+        private readonly KeyboardLayout _layout;
+        private readonly List<MacroStep> _steps = new List<MacroStep>();
+        private readonly (int, int) _assumedResolution;
+        private int _width;
+        private int _height;
+        private ulong _pendingDelay;
+        private int _line;
+
+        private MacroCompiler(int width, int height, KeyboardLayout layout)
+        {
+            _layout = layout ?? KeyboardLayout.UnitedStates;
+            _width = width;
+            _height = height;
+            _assumedResolution = (width, height);
+        }
+
+        /// <summary>
+        /// Compile a script.
+        /// </summary>
+        /// <param name="script">Script text</param>
+        /// <param name="width">Mouse resolution width assumed until script sets its own</param>
+        /// <param name="height">Mouse resolution height assumed until script sets its own</param>
+        /// <param name="layout">Layout for "type" command, default US</param>
+        /// <exception cref="MacroCompileException">If script is invalid.</exception>
+        public static CompiledMacro Compile(string script, int width = 1920, int height = 1080,
+            KeyboardLayout layout = null)
+        {
+            if (script == null)
+            {
+                throw new ArgumentNullException(nameof(script));
+            }
+            if (width <= 0 || height <= 0 || width > MaxResolutionWidth || height > MaxResolutionHeight)
+            {
+                throw new ArgumentException($"Invalid resolution {width}x{height}.");
+            }
+            MacroCompiler compiler = new MacroCompiler(width, height, layout);
+            using StringReader reader = new StringReader(script);
+            string line;
+            while ((line = reader.ReadLine()) != null)
+            {
+                ++compiler._line;
+                compiler.CompileLine(line);
+            }
+            return new CompiledMacro(compiler._steps.ToArray(), compiler.TakeDelay(), compiler._assumedResolution);
+        }
+
+        /// <summary>
+        /// Compile a script file.
+        /// </summary>
+        /// <seealso cref="Compile"/>
+        public static CompiledMacro CompileFile(string path, int width = 1920, int height = 1080,
+            KeyboardLayout layout = null)
+        {
+            return Compile(File.ReadAllText(path), width, height, layout);
+        }
+
+        private void CompileLine(string line)
+        {
+            string trimmed = line.TrimStart();
+            if (trimmed.Length == 0 || trimmed[0] == '#')
+            {
+                return;
+            }
+            int split = trimmed.IndexOfAny(new[] { ' ', '\t' });
+            string command = (split < 0 ? trimmed : trimmed.Substring(0, split)).ToLowerInvariant();
+            string rest = split < 0 ? string.Empty : trimmed.Substring(split + 1);
+            if (command == "type")
+            {
+                CompileType(Unescape(rest));
+                return;
+            }
+            int hash = rest.IndexOf('#');
+            string[] args = (hash < 0 ? rest : rest.Substring(0, hash))
+                .Split(new[] { ' ', '\t' }, StringSplitOptions.RemoveEmptyEntries);
+            switch (command)
+            {
+                case "resolution":
+                    ExpectArgs(args, 2, 2);
+                    CompileResolution(ParseInt(args[0], 1, MaxResolutionWidth), ParseInt(args[1], 1, MaxResolutionHeight));
+                    break;
+                case "wait":
+                    ExpectArgs(args, 1, 1);
+                    if (!double.TryParse(args[0], NumberStyles.Float, CultureInfo.InvariantCulture, out double ms)
+                        || ms < 0 || ms > uint.MaxValue / 1000.0)
+                    {
+                        throw Error($"Invalid wait time '{args[0]}'.");
+                    }
+                    _pendingDelay += (ulong)Math.Round(ms * 1000.0);
+                    if (_pendingDelay > uint.MaxValue)
+                    {
+                        throw Error("Accumulated wait time is too long.");
+                    }
+                    break;
+                case "press":
+                    ExpectArgs(args, 1, 1);
+                    AddKey(SerialSymbols.FrameType.KeyboardPress, ParseKey(args[0]));
+                    break;
+                case "release":
+                    ExpectArgs(args, 1, 1);
+                    AddKey(SerialSymbols.FrameType.KeyboardRelease,
+                        args[0].Equals("all", StringComparison.OrdinalIgnoreCase)
+                            ? (byte)SerialSymbols.ReleaseAllKeys
+                            : ParseKey(args[0]));
+                    break;
+                case "tap":
+                {
+                    ExpectArgs(args, 1, 1);
+                    byte key = ParseKey(args[0]);
+                    AddKey(SerialSymbols.FrameType.KeyboardPress, key);
+                    AddKey(SerialSymbols.FrameType.KeyboardRelease, key);
+                    break;
+                }
+                case "chord":
+                {
+                    ExpectArgs(args, 1, 1);
+                    string[] names = args[0].Split('+', StringSplitOptions.RemoveEmptyEntries);
+                    if (names.Length == 0 || names.Length > 6 + 8)
+                    {
+                        throw Error($"Invalid chord '{args[0]}'.");
+                    }
+                    byte[] keys = Array.ConvertAll(names, ParseKey);
+                    foreach (byte key in keys)
+                    {
+                        AddKey(SerialSymbols.FrameType.KeyboardPress, key);
+                    }
+                    for (int i = keys.Length - 1; i >= 0; --i)
+                    {
+                        AddKey(SerialSymbols.FrameType.KeyboardRelease, keys[i]);
+                    }
+                    break;
+                }
+                case "move":
+                    ExpectArgs(args, 2, 2);
+                    AddMove(args[0], args[1]);
+                    break;
+                case "click":
+                {
+                    ExpectArgs(args, 0, 3);
+                    int coordinateIndex = args.Length % 2 == 1 ? 1 : 0;
+                    byte button = args.Length % 2 == 1 ? ParseButton(args[0]) : (byte)SerialSymbols.MouseButton.Left;
+                    if (args.Length - coordinateIndex == 2)
+                    {
+                        AddMove(args[coordinateIndex], args[coordinateIndex + 1]);
+                    }
+                    AddKey(SerialSymbols.FrameType.MousePress, button);
+                    AddKey(SerialSymbols.FrameType.MouseRelease, button);
+                    break;
+                }
+                case "mousedown":
+                    ExpectArgs(args, 0, 1);
+                    AddKey(SerialSymbols.FrameType.MousePress,
+                        args.Length == 0 ? (byte)SerialSymbols.MouseButton.Left : ParseButton(args[0]));
+                    break;
+                case "mouseup":
+                    ExpectArgs(args, 0, 1);
+                    AddKey(SerialSymbols.FrameType.MouseRelease,
+                        args.Length == 0 ? (byte)SerialSymbols.MouseButton.Left
+                        : args[0].Equals("all", StringComparison.OrdinalIgnoreCase) ? (byte)SerialSymbols.ReleaseAllKeys
+                        : ParseButton(args[0]));
+                    break;
+                case "scroll":
+                    ExpectArgs(args, 1, 1);
+                    AddKey(SerialSymbols.FrameType.MouseScroll, (byte)(sbyte)ParseInt(args[0], sbyte.MinValue + 1, sbyte.MaxValue));
+                    break;
+                default:
+                    throw Error($"Unknown command '{command}'.");
+            }
+        }
+
+        private void CompileType(string text)
+        {
+            // Keys pressed by earlier commands may still be held, so no release-all
+            TypingPlan plan;
+            try
+            {
+                plan = TypingPlanner.Plan(text, _layout);
+            }
+            catch (ArgumentException e)
+            {
+                throw Error(e.Message);
+            }
+            foreach ((SerialSymbols.FrameType type, byte key) in plan.Steps)
+            {
+                AddKey(type, key);
+            }
+        }
+
+        private void CompileResolution(int width, int height)
+        {
+            _width = width;
+            _height = height;
+            Add(SerialCommandFrame.OfCoordinateType(SerialSymbols.FrameType.MouseResolution,
+                new Tuple<ushort, ushort>((ushort)width, (ushort)height)));
+        }
+
+        private void AddMove(string xText, string yText)
+        {
+            int x = ParseInt(xText, 1, _width);
+            int y = ParseInt(yText, 1, _height);
+            Add(SerialCommandFrame.OfCoordinateType(SerialSymbols.FrameType.MouseMove,
+                new Tuple<ushort, ushort>((ushort)x, (ushort)y)));
+        }
+
+        private void AddKey(SerialSymbols.FrameType type, byte key)
+        {
+            Add(SerialCommandFrame.OfKeyType(type, key));
+        }
+
+        private void Add(SerialCommandFrame frame)
+        {
+            _steps.Add(new MacroStep(frame, TakeDelay(), _line));
+        }
+
+        private uint TakeDelay()
+        {
+            uint delay = (uint)_pendingDelay;
+            _pendingDelay = 0;
+            return delay;
+        }
+
+        private byte ParseKey(string name)
+        {
+            if (!HidHelper.TryGetHidUsageFromName(name, out byte usage) || usage == 0)
+            {
+                throw Error($"Unknown key '{name}'.");
+            }
+            return usage;
+        }
+
+        private byte ParseButton(string name)
+        {
+            if (!Enum.TryParse(name, true, out SerialSymbols.MouseButton button) || !Enum.IsDefined(button))
+            {
+                throw Error($"Unknown mouse button '{name}'.");
+            }
+            return (byte)button;
+        }
+
+        private int ParseInt(string text, int min, int max)
+        {
+            if (!int.TryParse(text, NumberStyles.Integer, CultureInfo.InvariantCulture, out int value)
+                || value < min || value > max)
+            {
+                throw Error($"Value '{text}' is not an integer in range [{min}, {max}].");
+            }
+            return value;
+        }
+
+        private void ExpectArgs(string[] args, int min, int max)
+        {
+            if (args.Length < min || args.Length > max)
+            {
+                throw Error(min == max
+                    ? $"Expected {min} argument(s), got {args.Length}."
+                    : $"Expected {min} to {max} arguments, got {args.Length}.");
+            }
+        }
+
+        private string Unescape(string text)
+        {
+            StringBuilder builder = new StringBuilder(text.Length);
+            for (int i = 0; i < text.Length; ++i)
+            {
+                if (text[i] != '\\')
+                {
+                    builder.Append(text[i]);
+                    continue;
+                }
+                if (++i == text.Length)
+                {
+                    throw Error("Dangling escape at end of line.");
+                }
+                switch (text[i])
+                {
+                    case 'n': builder.Append('\n'); break;
+                    case 't': builder.Append('\t'); break;
+                    case 'b': builder.Append('\b'); break;
+                    case '\\': builder.Append('\\'); break;
+                    default: throw Error($"Unknown escape '\\{text[i]}'.");
+                }
+            }
+            return builder.ToString();
+        }
+
+        private MacroCompileException Error(string message)
+        {
+            return new MacroCompileException(_line, message);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Threading;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse.Macro
+{
+    /// <summary>
+    /// Streams a <see cref="CompiledMacro"/> into the sender. Frames between two waits are
+    /// queued back-to-back, so the serial link never idles waiting for the caller.
+    /// </summary>
+    internal static class MacroExecutor
+    {
+        /// <summary>
+        /// Maximum number of frames queued ahead of the one being sent.
+        /// Must stay well below the sender's queue limit.
+        /// </summary>
+        private const int PipelineDepth = 16;
+
+        public static async Task Execute(IFrameSender sender, CompiledMacro macro, CancellationToken token)
+        {
+            Queue<Task> inflight = new Queue<Task>(PipelineDepth);
+            try
+            {
+                foreach (MacroStep step in macro.Steps)
+                {
+                    token.ThrowIfCancellationRequested();
+                    if (step.DelayMicroseconds > 0)
+                    {
+                        // Delays are relative to completion of everything before them
+                        await Drain(inflight).ConfigureAwait(false);
+                        await sender.Pacer.DelayAsync(TimeSpan.FromTicks(step.DelayMicroseconds * 10L), token)
+                            .ConfigureAwait(false);
+                    }
+                    if (inflight.Count >= PipelineDepth)
+                    {
+                        await inflight.Dequeue().ConfigureAwait(false);
+                    }
+                    // Frames still queued when cancelled are dropped, not sent
+                    inflight.Enqueue(sender.SendFrame(step.Frame, token));
+                }
+                await Drain(inflight).ConfigureAwait(false);
+            }
+            finally
+            {
+                // Never leave unobserved failures behind if we stopped early
+                while (inflight.Count > 0)
+                {
+                    _ = inflight.Dequeue().ContinueWith(t => t.Exception, TaskContinuationOptions.OnlyOnFaulted);
+                }
+            }
+            if (macro.TrailingDelayMicroseconds > 0)
+            {
+                await sender.Pacer.DelayAsync(TimeSpan.FromTicks(macro.TrailingDelayMicroseconds * 10L), token)
+                    .ConfigureAwait(false);
+            }
+        }
+
+        private static async Task Drain(Queue<Task> inflight)
+        {
+            while (inflight.Count > 0)
+            {
+                await inflight.Dequeue().ConfigureAwait(false);
+            }
+        }
+    }
+}
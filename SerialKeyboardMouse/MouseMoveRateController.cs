@@ -0,0 +1,330 @@
+﻿using System;
+using System.Diagnostics;
+using System.Threading;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Accepts absolute mouse moves at any rate and emits only the latest position, at a rate adapted
+    /// to what the link sustains. Rate is raised toward USB polling limit while moves are acknowledged
+    /// quickly and nothing else is queued, and backed off multiplicatively as soon as acknowledgement
+    /// latency exceeds the emit interval or frames start queueing.
+    /// With an asynchronous sender, moves are emitted by an async loop started per burst of moves
+    /// instead of a dedicated thread.
+    /// </summary>
+    internal class MouseMoveRateController : IDisposable
+    {
+        /// <summary>
+        /// Highest rate. Arduino HID endpoint is polled every 1ms (bInterval = 1).
+        /// </summary>
+        public const double MaxRateHz = 1000.0;
+
+        /// <summary>
+        /// Lowest rate when backing off.
+        /// </summary>
+        public const double MinRateHz = 30.0;
+
+        /// <summary>
+        /// Rate to start with, same as the old fixed throttle.
+        /// </summary>
+        private const double InitialRateHz = 125.0;
+
+        /// <summary>
+        /// Sender queue depth considered congested.
+        /// </summary>
+        private const int QueueHighWater = 2;
+
+        /// <summary>
+        /// Interval multiplier on congestion, and on headroom.
+        /// </summary>
+        private const double BackOffFactor = 2.0;
+        private const double SpeedUpFactor = 0.9;
+
+        private static readonly long MinIntervalTicks = (long)(Stopwatch.Frequency / MaxRateHz);
+        private static readonly long MaxIntervalTicks = (long)(Stopwatch.Frequency / MinRateHz);
+
+        private readonly IFrameSender _sender;
+        private readonly LinkMetrics _metrics;
+        private readonly Thread _thread;
+        private readonly AutoResetEvent _trigger;
+        private readonly object _lock = new object();
+
+        private bool _hasPending;
+        private bool _emitLoopRunning;
+        private ushort _pendingX;
+        private ushort _pendingY;
+        private CancellationToken _pendingToken;
+        private DateTime? _pendingDeadline;
+        private TaskCompletionSource _pendingCompletion;
+
+        /// <summary>
+        /// Completion of the move the emit loop is waiting on, so dispose can release its callers
+        /// </summary>
+        private TaskCompletionSource _emittingCompletion;
+
+        private byte _sequence;
+        private volatile bool _unreliable;
+
+        private long _intervalTicks = (long)(Stopwatch.Frequency / InitialRateHz);
+        private long _lastEmit;
+        private volatile bool _shouldExit;
+        private bool _disposedValue;
+
+        public MouseMoveRateController(IFrameSender sender)
+        {
+            _sender = sender ?? throw new ArgumentNullException(nameof(sender));
+            _metrics = sender.Metrics;
+            _metrics.MouseMoveRateHz = InitialRateHz;
+            if (!sender.IsAsynchronous)
+            {
+                _trigger = new AutoResetEvent(false);
+                _thread = new Thread(ThreadLoop) { IsBackground = true, Priority = ThreadPriority.AboveNormal };
+                _thread.Start();
+            }
+        }
+
+        /// <summary>
+        /// Send moves as unacknowledged frames. Those complete once written and are never retried,
+        /// so rate is then bounded by UART bandwidth and USB polling, not by round trips.
+        /// </summary>
+        public bool Unreliable
+        {
+            get => _unreliable;
+            set => _unreliable = value;
+        }
+
+        /// <summary>
+        /// Set the latest target position. Token and deadline of the latest position apply when it is sent,
+        /// and positions it superseded share its outcome.
+        /// </summary>
+        /// <param name="x">Coordinate X</param>
+        /// <param name="y">Coordinate Y</param>
+        /// <param name="token">Cancels move while it is pending or queued in sender</param>
+        /// <param name="deadline">Time (UTC) after which move is no longer sent, null if none</param>
+        /// <returns>Task completed when this position, or a newer one superseding it, is acknowledged.</returns>
+        public Task Submit(ushort x, ushort y, CancellationToken token = default, DateTime? deadline = null)
+        {
+            if (token.IsCancellationRequested)
+            {
+                // Leave pending position of other callers alone
+                return Task.FromCanceled(token);
+            }
+            lock (_lock)
+            {
+                if (_disposedValue)
+                {
+                    throw new ObjectDisposedException(nameof(MouseMoveRateController));
+                }
+                if (_hasPending)
+                {
+                    _metrics.OnMouseMoveCoalesced();
+                }
+                _hasPending = true;
+                _pendingX = x;
+                _pendingY = y;
+                _pendingToken = token;
+                _pendingDeadline = deadline;
+                _pendingCompletion ??= new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+                if (_thread != null)
+                {
+                    _trigger.Set();
+                }
+                else if (!_emitLoopRunning)
+                {
+                    _emitLoopRunning = true;
+                    _ = EmitLoopAsync();
+                }
+                return _pendingCompletion.Task;
+            }
+        }
+
+        /// <summary>
+        /// Queue pending position into sender right now, regardless of pacing.
+        /// Called before any other frame, so moves and clicks keep their order.
+        /// </summary>
+        public void Flush()
+        {
+            lock (_lock)
+            {
+                if (!_hasPending)
+                {
+                    return;
+                }
+                Task sent = EnqueuePending(out TaskCompletionSource completion);
+                sent.ContinueWith(t => Complete(t, completion), TaskContinuationOptions.ExecuteSynchronously);
+            }
+        }
+
+        private void ThreadLoop()
+        {
+            while (!_shouldExit)
+            {
+                _trigger.WaitOne();
+                while (!_shouldExit)
+                {
+                    _sender.Pacer.WaitUntil(_lastEmit + Interlocked.Read(ref _intervalTicks));
+                    Task sent;
+                    TaskCompletionSource completion;
+                    lock (_lock)
+                    {
+                        if (!_hasPending)
+                        {
+                            break;
+                        }
+                        sent = EnqueuePending(out completion);
+                        _emittingCompletion = completion;
+                    }
+                    _lastEmit = Stopwatch.GetTimestamp();
+                    try
+                    {
+                        sent.Wait();
+                    }
+                    catch (AggregateException)
+                    {
+                        // Reported to caller through completion
+                    }
+                    Adapt(Stopwatch.GetTimestamp() - _lastEmit, sent.IsCompletedSuccessfully);
+                    Complete(sent, completion);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Async counterpart of <see cref="ThreadLoop"/>, running until no move is pending.
+        /// </summary>
+        private async Task EmitLoopAsync()
+        {
+            while (!_shouldExit)
+            {
+                long wait = _lastEmit + Interlocked.Read(ref _intervalTicks) - Stopwatch.GetTimestamp();
+                if (wait > 0)
+                {
+                    await _sender.Pacer.DelayAsync(TimeSpan.FromSeconds((double)wait / Stopwatch.Frequency))
+                        .ConfigureAwait(false);
+                }
+                Task sent;
+                TaskCompletionSource completion;
+                lock (_lock)
+                {
+                    if (!_hasPending)
+                    {
+                        _emitLoopRunning = false;
+                        return;
+                    }
+                    sent = EnqueuePending(out completion);
+                    _emittingCompletion = completion;
+                }
+                _lastEmit = Stopwatch.GetTimestamp();
+                try
+                {
+                    await sent.ConfigureAwait(false);
+                }
+                catch (Exception)
+                {
+                    // Reported to caller through completion
+                }
+                Adapt(Stopwatch.GetTimestamp() - _lastEmit, sent.IsCompletedSuccessfully);
+                Complete(sent, completion);
+            }
+            lock (_lock)
+            {
+                _emitLoopRunning = false;
+            }
+        }
+
+        /// <summary>
+        /// Must hold _lock. Enqueue pending move into sender, so its position in sender queue is fixed.
+        /// </summary>
+        private Task EnqueuePending(out TaskCompletionSource completion)
+        {
+            completion = _pendingCompletion;
+            _pendingCompletion = null;
+            _hasPending = false;
+            CancellationToken token = _pendingToken;
+            _pendingToken = default;
+            try
+            {
+                Tuple<ushort, ushort> cord = new Tuple<ushort, ushort>(_pendingX, _pendingY);
+                // Sender skips the move if token was cancelled while it was pending
+                return _sender.SendFrame(_unreliable
+                    ? SerialCommandFrame.OfUnreliableMove(cord, _sequence++)
+                    : SerialCommandFrame.OfCoordinateType(SerialSymbols.FrameType.MouseMove, cord),
+                    token, _pendingDeadline);
+            }
+            catch (Exception e)
+            {
+                return Task.FromException(e);
+            }
+        }
+
+        private void Adapt(long ackTicks, bool successful)
+        {
+            long interval = _intervalTicks;
+            if (!successful || ackTicks > interval || _sender.QueueDepth >= QueueHighWater)
+            {
+                // Link cannot keep up, back off before queue builds
+                interval = Math.Min(MaxIntervalTicks, (long)(interval * BackOffFactor));
+            }
+            else if (ackTicks * 2 < interval && _sender.QueueDepth == 0)
+            {
+                // Headroom, approach USB polling limit but never faster than a round trip
+                interval = Math.Max(Math.Max(MinIntervalTicks, ackTicks), (long)(interval * SpeedUpFactor));
+            }
+            Interlocked.Exchange(ref _intervalTicks, interval);
+            _metrics.MouseMoveRateHz = Stopwatch.Frequency / (double)interval;
+        }
+
+        private static void Complete(Task sent, TaskCompletionSource completion)
+        {
+            if (sent.IsCompletedSuccessfully)
+            {
+                completion.TrySetResult();
+            }
+            else if (sent.Exception != null)
+            {
+                completion.TrySetException(sent.Exception.InnerExceptions);
+            }
+            else
+            {
+                completion.TrySetCanceled();
+            }
+        }
+
+        /// <summary>
+        /// Stop emitting. Callers of a move not sent yet, or still awaited by the emit loop, get
+        /// <see cref="ObjectDisposedException"/> instead of waiting forever.
+        /// </summary>
+        public void Dispose()
+        {
+            TaskCompletionSource pending;
+            TaskCompletionSource emitting;
+            lock (_lock)
+            {
+                if (_disposedValue)
+                {
+                    return;
+                }
+                _disposedValue = true;
+                _shouldExit = true;
+                pending = _pendingCompletion;
+                emitting = _emittingCompletion;
+                _pendingCompletion = null;
+                _hasPending = false;
+            }
+            if (_thread != null)
+            {
+                _trigger.Set();
+                // Thread blocked on a move may not have exited yet, dispose trigger only once it has
+                if (_thread.Join(1000))
+                {
+                    _trigger.Dispose();
+                }
+            }
+            ObjectDisposedException disposed = new ObjectDisposedException(nameof(MouseMoveRateController));
+            pending?.TrySetException(disposed);
+            emitting?.TrySetException(disposed);
+        }
+    }
+}
@@ -0,0 +1,229 @@
+﻿using System;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Accumulated error of <see cref="PrecisionPacer"/> waits, i.e. how late each wait returned.
+    /// All members are thread-safe.
+    /// </summary>
+    public class PacingStatistics
+    {
+        private long _count;
+        private long _totalErrorTicks;
+        private long _maxErrorTicks;
+
+        /// <summary>
+        /// Number of waits
+        /// </summary>
+        public long Count => Interlocked.Read(ref _count);
+
+        /// <summary>
+        /// Mean lateness of waits in microseconds
+        /// </summary>
+        public double MeanErrorMicroseconds
+        {
+            get
+            {
+                long count = Count;
+                return count == 0 ? 0 : ToMicroseconds(Interlocked.Read(ref _totalErrorTicks)) / count;
+            }
+        }
+
+        /// <summary>
+        /// Worst lateness of waits in microseconds
+        /// </summary>
+        public double MaxErrorMicroseconds => ToMicroseconds(Interlocked.Read(ref _maxErrorTicks));
+
+        internal void Record(long errorTicks)
+        {
+            Interlocked.Increment(ref _count);
+            Interlocked.Add(ref _totalErrorTicks, errorTicks);
+            long max = Interlocked.Read(ref _maxErrorTicks);
+            while (errorTicks > max)
+            {
+                long original = Interlocked.CompareExchange(ref _maxErrorTicks, errorTicks, max);
+                if (original == max)
+                {
+                    break;
+                }
+                max = original;
+            }
+        }
+
+        private static double ToMicroseconds(long stopwatchTicks)
+        {
+            return stopwatchTicks * 1000000.0 / Stopwatch.Frequency;
+        }
+
+        public override string ToString()
+        {
+            return $"{Count} waits, mean error {MeanErrorMicroseconds:F1} us, max error {MaxErrorMicroseconds:F1} us";
+        }
+    }
+
+    /// <summary>
+    /// Waits until a deadline with microsecond-level precision. Most of the wait is done by an OS
+    /// high-resolution sleep (clock_nanosleep on Linux, high-resolution waitable timer on Windows),
+    /// and the last part is spun on <see cref="Stopwatch"/>, so the thread wakes neither early nor
+    /// at scheduler tick granularity like <see cref="Thread.Sleep(int)"/>.
+    /// </summary>
+    public class PrecisionPacer
+    {
+        /// <summary>
+        /// Remaining time that is spun instead of slept. OS sleeps may overshoot by about this much.
+        /// </summary>
+        private static readonly long SpinTicks = Stopwatch.Frequency / (OperatingSystem.IsLinux() ? 5000 : 1000);
+
+        /// <summary>
+        /// Margin left by <see cref="DelayAsync"/> for a precise synchronous finish,
+        /// since timer-queue based Task.Delay only has scheduler tick granularity.
+        /// </summary>
+        private static readonly TimeSpan AsyncMargin = TimeSpan.FromMilliseconds(OperatingSystem.IsWindows() ? 16 : 2);
+
+        [ThreadStatic]
+        private static IntPtr _windowsTimer;
+
+        /// <summary>
+        /// Error of all waits by this pacer
+        /// </summary>
+        public PacingStatistics Statistics { get; }
+
+        public PrecisionPacer() : this(new PacingStatistics())
+        {
+        }
+
+        public PrecisionPacer(PacingStatistics statistics)
+        {
+            Statistics = statistics ?? throw new ArgumentNullException(nameof(statistics));
+        }
+
+        /// <summary>
+        /// Block until <see cref="Stopwatch.GetTimestamp"/> reaches deadline.
+        /// </summary>
+        /// <param name="deadline">Deadline in <see cref="Stopwatch"/> timestamp</param>
+        public void WaitUntil(long deadline)
+        {
+            long remaining = deadline - Stopwatch.GetTimestamp();
+            if (remaining > SpinTicks)
+            {
+                Sleep(remaining - SpinTicks);
+            }
+            SpinWait spinner = new SpinWait();
+            long now;
+            while ((now = Stopwatch.GetTimestamp()) < deadline)
+            {
+                spinner.SpinOnce(-1); // Never fall back to Sleep(1)
+            }
+            Statistics.Record(now - deadline);
+        }
+
+        /// <summary>
+        /// Block for a duration.
+        /// </summary>
+        public void Delay(TimeSpan duration)
+        {
+            WaitUntil(Stopwatch.GetTimestamp() + ToStopwatchTicks(duration));
+        }
+
+        /// <summary>
+        /// Asynchronously wait for a duration. Most of it is awaited without a thread,
+        /// only the last couple of milliseconds are waited precisely on a pool thread.
+        /// </summary>
+        public async Task DelayAsync(TimeSpan duration, CancellationToken token = default)
+        {
+            long deadline = Stopwatch.GetTimestamp() + ToStopwatchTicks(duration);
+            if (duration > AsyncMargin)
+            {
+                await Task.Delay(duration - AsyncMargin, token).ConfigureAwait(false);
+            }
+            token.ThrowIfCancellationRequested();
+            WaitUntil(deadline);
+        }
+
+        public static long ToStopwatchTicks(TimeSpan duration)
+        {
+            return (long)(duration.Ticks * (Stopwatch.Frequency / (double)TimeSpan.TicksPerSecond));
+        }
+
+        private static void Sleep(long stopwatchTicks)
+        {
+            long nanoseconds = (long)(stopwatchTicks * (1e9 / Stopwatch.Frequency));
+            if (OperatingSystem.IsLinux())
+            {
+                SleepLinux(nanoseconds);
+                return;
+            }
+            if (OperatingSystem.IsWindows() && SleepWindows(nanoseconds))
+            {
+                return;
+            }
+            Thread.Sleep((int)(nanoseconds / 1000000));
+        }
+
+        private static void SleepLinux(long nanoseconds)
+        {
+            // Absolute deadline, so EINTR restarts don't accumulate drift
+            clock_gettime(ClockMonotonic, out Timespec deadline);
+            deadline.Seconds += nanoseconds / 1000000000;
+            deadline.Nanoseconds += nanoseconds % 1000000000;
+            if (deadline.Nanoseconds >= 1000000000)
+            {
+                deadline.Seconds += 1;
+                deadline.Nanoseconds -= 1000000000;
+            }
+            while (clock_nanosleep(ClockMonotonic, TimerAbsoluteTime, ref deadline, IntPtr.Zero) == Eintr)
+            {
+            }
+        }
+
+        private static bool SleepWindows(long nanoseconds)
+        {
+            if (_windowsTimer == IntPtr.Zero)
+            {
+                _windowsTimer = CreateWaitableTimerExW(IntPtr.Zero, null, CreateWaitableTimerHighResolution, TimerAllAccess);
+                if (_windowsTimer == IntPtr.Zero)
+                {
+                    return false; // Before Windows 10 1803
+                }
+            }
+            long dueTime = -(nanoseconds / 100); // Negative means relative, in 100ns
+            return SetWaitableTimer(_windowsTimer, ref dueTime, 0, IntPtr.Zero, IntPtr.Zero, false)
+                   && WaitForSingleObject(_windowsTimer, Infinite) == 0;
+        }
+
+        private const int ClockMonotonic = 1;
+        private const int TimerAbsoluteTime = 1;
+        private const int Eintr = 4;
+
+        [StructLayout(LayoutKind.Sequential)]
+        private struct Timespec
+        {
+            public long Seconds;
+            public long Nanoseconds;
+        }
+
+        [DllImport("libc", SetLastError = false)]
+        private static extern int clock_gettime(int clockId, out Timespec time);
+
+        [DllImport("libc", SetLastError = false)]
+        private static extern int clock_nanosleep(int clockId, int flags, ref Timespec request, IntPtr remain);
+
+        private const uint CreateWaitableTimerHighResolution = 0x00000002;
+        private const uint TimerAllAccess = 0x1F0003;
+        private const uint Infinite = 0xFFFFFFFF;
+
+        [DllImport("kernel32", SetLastError = true, CharSet = CharSet.Unicode)]
+        private static extern IntPtr CreateWaitableTimerExW(IntPtr attributes, string name, uint flags, uint access);
+
+        [DllImport("kernel32", SetLastError = true)]
+        private static extern bool SetWaitableTimer(IntPtr timer, ref long dueTime, int period,
+            IntPtr completionRoutine, IntPtr argument, bool resume);
+
+        [DllImport("kernel32", SetLastError = true)]
+        private static extern uint WaitForSingleObject(IntPtr handle, uint milliseconds);
+    }
+}
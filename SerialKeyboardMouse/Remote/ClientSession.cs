@@ -0,0 +1,274 @@
+﻿using System;
+using System.Buffers;
+using System.IO;
+using System.IO.Pipelines;
+using System.Net.Sockets;
+using System.Threading;
+using System.Threading.Channels;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse.Remote
+{
+    /// <summary>
+    /// One client connection of <see cref="KeyboardMouseServer"/>. Read loop submits requests in arrival
+    /// order, write loop awaits their replies in the same order and flushes only before it would wait,
+    /// so replies completing together leave in one write.
+    /// </summary>
+    internal sealed class ClientSession : IDisposable
+    {
+        /// <summary>
+        /// Polls of an empty ring before sleeping until doorbell
+        /// </summary>
+        private const int RingSpinCount = 200;
+
+        private readonly KeyboardMouseServer _server;
+        private readonly Socket _socket;
+        private readonly NetworkStream _stream;
+        private readonly PipeReader _reader;
+        private readonly PipeWriter _writer;
+        private readonly Channel<PendingResponse> _responses;
+        private readonly SemaphoreSlim _doorbell;
+        private CommandRing _ring;
+        private Task _ringLoop;
+
+        /// <summary>
+        /// Set once read loop ended, so ring loop stops too
+        /// </summary>
+        private volatile bool _closing;
+
+        private volatile bool _disposedValue;
+
+        private readonly struct PendingResponse
+        {
+            public readonly uint Id;
+
+            /// <summary>
+            /// Device reply, or faulted if request was rejected before reaching device
+            /// </summary>
+            public readonly Task<byte[]> Reply;
+
+            public PendingResponse(uint id, Task<byte[]> reply)
+            {
+                Id = id;
+                Reply = reply;
+            }
+        }
+
+        public ClientSession(KeyboardMouseServer server, Socket socket)
+        {
+            _server = server;
+            _socket = socket;
+            _stream = new NetworkStream(socket, true);
+            _reader = PipeReader.Create(_stream);
+            _writer = PipeWriter.Create(_stream);
+            _responses = Channel.CreateUnbounded<PendingResponse>(new UnboundedChannelOptions
+            {
+                SingleReader = true,
+                SingleWriter = false
+            });
+            _doorbell = new SemaphoreSlim(0);
+        }
+
+        /// <summary>
+        /// Serve client until it disconnects. Returns only after ring loop, if any, is done with the ring.
+        /// </summary>
+        /// <exception cref="InvalidOperationException">If client sent a corrupted stream.</exception>
+        public async Task RunAsync(CancellationToken token)
+        {
+            Task writeLoop = WriteLoopAsync();
+            try
+            {
+                await ReadLoopAsync(token).ConfigureAwait(false);
+            }
+            finally
+            {
+                _responses.Writer.TryComplete();
+                // Wakes ring loop, which then sees closing, cancellation or disconnect
+                _closing = true;
+                _doorbell.Release();
+                if (_ringLoop != null)
+                {
+                    await _ringLoop.ConfigureAwait(false);
+                }
+            }
+            await writeLoop.ConfigureAwait(false);
+        }
+
+        private async Task ReadLoopAsync(CancellationToken token)
+        {
+            while (true)
+            {
+                ReadResult result = await _reader.ReadAsync(token).ConfigureAwait(false);
+                ReadOnlySequence<byte> buffer = result.Buffer;
+                while (RemoteProtocol.TryReadMessage(ref buffer, out RemoteProtocol.ClientMessage message))
+                {
+                    switch (message.Kind)
+                    {
+                        case RemoteProtocol.MessageRequest:
+                            await Submit(message.Id, message.Device, message.Frame, token).ConfigureAwait(false);
+                            break;
+                        case RemoteProtocol.MessageAttachRing:
+                            AttachRing(message.Id, message.Path, token);
+                            break;
+                        case RemoteProtocol.MessageDoorbell:
+                            _doorbell.Release();
+                            break;
+                    }
+                }
+                _reader.AdvanceTo(buffer.Start, buffer.End);
+                if (result.IsCompleted)
+                {
+                    return;
+                }
+            }
+        }
+
+        private async Task Submit(uint id, byte device, ReadOnlyMemory<byte> frame, CancellationToken token)
+        {
+            Task<byte[]> reply;
+            try
+            {
+                reply = await _server.Submit(device, frame, token).ConfigureAwait(false);
+            }
+            catch (ArgumentException e)
+            {
+                reply = Task.FromException<byte[]>(e);
+            }
+            _responses.Writer.TryWrite(new PendingResponse(id, reply));
+        }
+
+        private void AttachRing(uint id, string path, CancellationToken token)
+        {
+            try
+            {
+                if (_ring != null)
+                {
+                    throw new ArgumentException("Client already attached a ring!");
+                }
+                if (_socket.AddressFamily != AddressFamily.Unix)
+                {
+                    // Path names a file on server, only local clients may choose it
+                    throw new ArgumentException("Shared rings are only available on the Unix socket!");
+                }
+                _ring = CommandRing.Open(path);
+            }
+            catch (Exception e) when (e is ArgumentException || e is IOException || e is InvalidDataException ||
+                                       e is UnauthorizedAccessException)
+            {
+                _responses.Writer.TryWrite(new PendingResponse(id,
+                    Task.FromException<byte[]>(new ArgumentException($"Cannot attach ring: {e.Message}"))));
+                return;
+            }
+            _responses.Writer.TryWrite(new PendingResponse(id, Task.FromResult<byte[]>(null)));
+            _ringLoop = RingLoopAsync(token);
+        }
+
+        /// <summary>
+        /// Consume ring until session closes. Ends quietly on cancellation. Any other failure ends the connection,
+        /// so a client waiting for free slots sees it lost instead of waiting forever, and is rethrown.
+        /// </summary>
+        private async Task RingLoopAsync(CancellationToken token)
+        {
+            byte[] frame = new byte[SerialSymbols.MaxFrameLength];
+            try
+            {
+                await ConsumeRingAsync(frame, token).ConfigureAwait(false);
+            }
+            catch (OperationCanceledException) when (token.IsCancellationRequested)
+            {
+            }
+            catch (Exception)
+            {
+                Dispose();
+                throw;
+            }
+            finally
+            {
+                // Only this loop touches the mapping, so it is unmapped here rather than in Dispose
+                _ring.Dispose();
+            }
+        }
+
+        private async Task ConsumeRingAsync(byte[] frame, CancellationToken token)
+        {
+            int idle = 0;
+            while (!token.IsCancellationRequested && !_closing && !_disposedValue)
+            {
+                if (_ring.TryRead(out uint id, out byte device, frame, out int length))
+                {
+                    idle = 0;
+                    // Frame is parsed before Submit first yields, so buffer can be reused
+                    await Submit(id, device, frame.AsMemory(0, length), token).ConfigureAwait(false);
+                    continue;
+                }
+                if (++idle < RingSpinCount)
+                {
+                    Thread.SpinWait(20);
+                    continue;
+                }
+                // Producer checks the flag after publishing, so either it rings or we see its request
+                _ring.ConsumerWaiting = true;
+                if (_ring.IsEmpty)
+                {
+                    await _doorbell.WaitAsync(token).ConfigureAwait(false);
+                }
+                _ring.ConsumerWaiting = false;
+                idle = 0;
+            }
+        }
+
+        private async Task WriteLoopAsync()
+        {
+            bool unflushed = false;
+            ChannelReader<PendingResponse> responses = _responses.Reader;
+            while (true)
+            {
+                if (!responses.TryRead(out PendingResponse pending))
+                {
+                    if (unflushed)
+                    {
+                        await _writer.FlushAsync().ConfigureAwait(false);
+                        unflushed = false;
+                    }
+                    if (!await responses.WaitToReadAsync().ConfigureAwait(false))
+                    {
+                        return;
+                    }
+                    continue;
+                }
+                if (!pending.Reply.IsCompleted && unflushed)
+                {
+                    await _writer.FlushAsync().ConfigureAwait(false);
+                    unflushed = false;
+                }
+                try
+                {
+                    byte[] reply = await pending.Reply.ConfigureAwait(false);
+                    RemoteProtocol.WriteResponse(_writer, pending.Id, RemoteProtocol.Status.Ok, reply);
+                }
+                catch (ArgumentException e)
+                {
+                    RemoteProtocol.WriteResponse(_writer, pending.Id, RemoteProtocol.Status.BadRequest, e.Message);
+                }
+                catch (Exception e)
+                {
+                    RemoteProtocol.WriteResponse(_writer, pending.Id, RemoteProtocol.Status.DeviceFailed, e.Message);
+                }
+                unflushed = true;
+            }
+        }
+
+        public void Dispose()
+        {
+            if (_disposedValue)
+            {
+                return;
+            }
+            _disposedValue = true;
+            _socket.Dispose();
+            _stream.Dispose();
+            _doorbell.Release();
+        }
+    }
+}
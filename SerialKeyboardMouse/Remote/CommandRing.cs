@@ -0,0 +1,228 @@
+﻿using System;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Threading;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse.Remote
+{
+    /// <summary>
+    /// Single-producer single-consumer ring of requests in a memory-mapped file, for clients on the
+    /// same machine as <see cref="KeyboardMouseServer"/>. Producer publishes a slot with one store and
+    /// no system call. Consumer spins briefly, then sets <see cref="ConsumerWaiting"/> and sleeps until
+    /// producer rings the doorbell on the socket, so only the first request after a quiet period pays
+    /// for a socket write. File-backed, since named shared memory is Windows-only in .NET.
+    /// </summary>
+    internal sealed unsafe class CommandRing : IDisposable
+    {
+        private const uint Magic = 0x524D4B53; // "SKMR"
+
+        /// <summary>
+        /// &lt;4-byte id&gt; &lt;Device index&gt; &lt;Frame length&gt; &lt;Device frame&gt;
+        /// </summary>
+        public const int SlotLength = 16;
+
+        // Head, tail and waiting flag live on separate cache lines, written by different processes
+        private const int MagicOffset = 0;
+        private const int CapacityOffset = 4;
+        private const int HeadOffset = 64;
+        private const int TailOffset = 128;
+        private const int WaitingOffset = 192;
+        private const int HeaderLength = 256;
+
+        private readonly MemoryMappedFile _file;
+        private readonly MemoryMappedViewAccessor _view;
+        private readonly byte* _base;
+        private readonly int _capacity;
+        private bool _disposedValue;
+
+        private CommandRing(MemoryMappedFile file, int capacity)
+        {
+            _file = file;
+            _view = file.CreateViewAccessor(0, HeaderLength + (long)capacity * SlotLength);
+            byte* pointer = null;
+            _view.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+            _base = pointer + _view.PointerOffset;
+            _capacity = capacity;
+        }
+
+        /// <summary>
+        /// Create ring file as producer. Existing file is overwritten.
+        /// </summary>
+        /// <param name="path">File path, should be on a memory-backed file system, e.g. /dev/shm</param>
+        /// <param name="capacity">Number of slots, power of two</param>
+        public static CommandRing Create(string path, int capacity)
+        {
+            if (capacity <= 0 || (capacity & (capacity - 1)) != 0)
+            {
+                throw new ArgumentException("Ring capacity must be a power of two!");
+            }
+            long length = HeaderLength + (long)capacity * SlotLength;
+            FileStream stream = new FileStream(path, FileMode.Create, FileAccess.ReadWrite, FileShare.ReadWrite);
+            MemoryMappedFile file = Map(stream, length);
+            CommandRing ring;
+            try
+            {
+                ring = new CommandRing(file, capacity);
+            }
+            catch
+            {
+                file.Dispose();
+                throw;
+            }
+            *(uint*)(ring._base + CapacityOffset) = (uint)capacity;
+            Volatile.Write(ref *(uint*)(ring._base + MagicOffset), Magic);
+            return ring;
+        }
+
+        /// <summary>
+        /// Open ring file created by producer, as consumer.
+        /// </summary>
+        /// <exception cref="InvalidDataException">If file is not a ring.</exception>
+        public static CommandRing Open(string path)
+        {
+            // Shared with producer, which keeps its own handle open
+            FileStream stream = new FileStream(path, FileMode.Open, FileAccess.ReadWrite, FileShare.ReadWrite);
+            MemoryMappedFile file = Map(stream, 0);
+            try
+            {
+                if (stream.Length < HeaderLength)
+                {
+                    throw new InvalidDataException("Not a command ring file!");
+                }
+                int capacity;
+                using (MemoryMappedViewAccessor header = file.CreateViewAccessor(0, HeaderLength))
+                {
+                    if (header.ReadUInt32(MagicOffset) != Magic)
+                    {
+                        throw new InvalidDataException("Not a command ring file!");
+                    }
+                    capacity = (int)header.ReadUInt32(CapacityOffset);
+                }
+                if (capacity <= 0 || (capacity & (capacity - 1)) != 0)
+                {
+                    throw new InvalidDataException($"Invalid ring capacity {capacity}!");
+                }
+                if (stream.Length < HeaderLength + (long)capacity * SlotLength)
+                {
+                    throw new InvalidDataException($"Ring file is shorter than capacity {capacity}!");
+                }
+                return new CommandRing(file, capacity);
+            }
+            catch
+            {
+                file.Dispose();
+                throw;
+            }
+        }
+
+        private static MemoryMappedFile Map(FileStream stream, long length)
+        {
+            try
+            {
+                // Mapping owns stream once created
+                return MemoryMappedFile.CreateFromFile(stream, null, length,
+                    MemoryMappedFileAccess.ReadWrite, HandleInheritability.None, false);
+            }
+            catch
+            {
+                stream.Dispose();
+                throw;
+            }
+        }
+
+        private ref long Head => ref *(long*)(_base + HeadOffset);
+
+        private ref long Tail => ref *(long*)(_base + TailOffset);
+
+        private ref int Waiting => ref *(int*)(_base + WaitingOffset);
+
+        /// <summary>
+        /// True while consumer sleeps until doorbell. Read by producer after publishing.
+        /// </summary>
+        public bool ConsumerWaiting
+        {
+            get
+            {
+                Interlocked.MemoryBarrier();
+                return Volatile.Read(ref Waiting) != 0;
+            }
+            set
+            {
+                Volatile.Write(ref Waiting, value ? 1 : 0);
+                Interlocked.MemoryBarrier();
+            }
+        }
+
+        public bool IsEmpty => Volatile.Read(ref Head) == Volatile.Read(ref Tail);
+
+        /// <summary>
+        /// Producer only. Publish a request.
+        /// </summary>
+        /// <returns>False if ring is full.</returns>
+        public bool TryWrite(uint id, byte device, ReadOnlySpan<byte> frame)
+        {
+            if (frame.Length > SlotLength - 6)
+            {
+                throw new ArgumentException("Frame too long for ring slot!");
+            }
+            long head = Head;
+            if (head - Volatile.Read(ref Tail) >= _capacity)
+            {
+                return false;
+            }
+            byte* slot = _base + HeaderLength + (head & (_capacity - 1)) * SlotLength;
+            *(uint*)slot = id;
+            slot[4] = device;
+            slot[5] = (byte)frame.Length;
+            frame.CopyTo(new Span<byte>(slot + 6, frame.Length));
+            Volatile.Write(ref Head, head + 1);
+            return true;
+        }
+
+        /// <summary>
+        /// Consumer only. Take the oldest request.
+        /// </summary>
+        /// <param name="frame">Receives frame, at least <see cref="SerialSymbols.MaxFrameLength"/> long</param>
+        /// <returns>False if ring is empty.</returns>
+        public bool TryRead(out uint id, out byte device, Span<byte> frame, out int length)
+        {
+            id = 0;
+            device = 0;
+            length = 0;
+            long tail = Tail;
+            if (Volatile.Read(ref Head) == tail)
+            {
+                return false;
+            }
+            byte* slot = _base + HeaderLength + (tail & (_capacity - 1)) * SlotLength;
+            id = *(uint*)slot;
+            device = slot[4];
+            // Length comes from another process, never trust it
+            length = Math.Min((int)slot[5], Math.Min(SlotLength - 6, frame.Length));
+            new ReadOnlySpan<byte>(slot + 6, length).CopyTo(frame);
+            Volatile.Write(ref Tail, tail + 1);
+            return true;
+        }
+
+        private void Dispose(bool disposing)
+        {
+            if (!_disposedValue)
+            {
+                if (disposing)
+                {
+                    _view.SafeMemoryMappedViewHandle.ReleasePointer();
+                    _view.Dispose();
+                    _file.Dispose();
+                }
+                _disposedValue = true;
+            }
+        }
+
+        public void Dispose()
+        {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
@@ -0,0 +1,205 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.IO;
+using System.Net;
+using System.Net.Sockets;
+using System.Threading;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse.Remote
+{
+    /// <summary>
+    /// Owns devices and serves many clients, see <see cref="RemoteKeyboardMouse"/>. Only one process can open
+    /// a serial port, so test processes sharing a controller connect here instead of locking around
+    /// <see cref="KeyboardMouse"/>.
+    /// <para>
+    /// Requests of a client are queued to the device in the order they were sent, without waiting for
+    /// earlier ones to be acknowledged, so device link stays busy. Responses are written in the same
+    /// order and batched into one socket write when several are ready. Clients may also submit through a
+    /// shared-memory <see cref="CommandRing"/>.
+    /// </para>
+    /// </summary>
+    public class KeyboardMouseServer : IDisposable
+    {
+        /// <summary>
+        /// Frames queued per device at most, across all clients. Sender rejects more than 50.
+        /// </summary>
+        private const int MaxFramesInFlight = 32;
+
+        private readonly IReadOnlyList<KeyboardMouse> _devices;
+        private readonly SemaphoreSlim[] _deviceSlots;
+        private readonly List<Socket> _listeners;
+        private readonly ConcurrentDictionary<ClientSession, byte> _sessions;
+        private readonly CancellationTokenSource _cancellation;
+        private bool _disposedValue;
+
+        /// <summary>
+        /// Number of connected clients
+        /// </summary>
+        public int ClientCount => _sessions.Count;
+
+        /// <summary>
+        /// Raised when a client connection fails, e.g. it sent a corrupted stream. Must not block.
+        /// </summary>
+        public event Action<Exception> ClientFailed;
+
+        /// <param name="devices">Devices served, addressed by index. Owned by caller.</param>
+        public KeyboardMouseServer(IReadOnlyList<KeyboardMouse> devices)
+        {
+            if (devices == null || devices.Count == 0 || devices.Count > byte.MaxValue + 1)
+            {
+                throw new ArgumentException("Server needs 1 to 256 devices!");
+            }
+            _devices = devices;
+            _deviceSlots = new SemaphoreSlim[devices.Count];
+            for (int i = 0; i < _deviceSlots.Length; ++i)
+            {
+                _deviceSlots[i] = new SemaphoreSlim(MaxFramesInFlight, MaxFramesInFlight);
+            }
+            _listeners = new List<Socket>();
+            _sessions = new ConcurrentDictionary<ClientSession, byte>();
+            _cancellation = new CancellationTokenSource();
+        }
+
+        /// <summary>
+        /// Accept clients on a Unix domain socket. Stale socket file of a previous run is removed.
+        /// </summary>
+        public void ListenUnix(string path)
+        {
+            if (File.Exists(path))
+            {
+                File.Delete(path);
+            }
+            Socket socket = new Socket(AddressFamily.Unix, SocketType.Stream, ProtocolType.Unspecified);
+            socket.Bind(new UnixDomainSocketEndPoint(path));
+            Listen(socket, false);
+        }
+
+        /// <summary>
+        /// Accept clients over TCP, with Nagle's algorithm disabled on every connection.
+        /// </summary>
+        public void ListenTcp(IPEndPoint endPoint)
+        {
+            Socket socket = new Socket(endPoint.AddressFamily, SocketType.Stream, ProtocolType.Tcp);
+            socket.Bind(endPoint);
+            Listen(socket, true);
+        }
+
+        private void Listen(Socket socket, bool tcp)
+        {
+            socket.Listen(16);
+            lock (_listeners)
+            {
+                _listeners.Add(socket);
+            }
+            _ = AcceptLoopAsync(socket, tcp);
+        }
+
+        private async Task AcceptLoopAsync(Socket listener, bool tcp)
+        {
+            while (!_cancellation.IsCancellationRequested)
+            {
+                Socket client;
+                try
+                {
+                    client = await listener.AcceptAsync().ConfigureAwait(false);
+                }
+                catch (Exception e) when (e is ObjectDisposedException || e is SocketException)
+                {
+                    return; // Listener closed
+                }
+                if (tcp)
+                {
+                    client.NoDelay = true;
+                }
+                ClientSession session = new ClientSession(this, client);
+                _sessions.TryAdd(session, 0);
+                _ = RunSessionAsync(session);
+            }
+        }
+
+        private async Task RunSessionAsync(ClientSession session)
+        {
+            try
+            {
+                await session.RunAsync(_cancellation.Token).ConfigureAwait(false);
+            }
+            catch (OperationCanceledException)
+            {
+            }
+            catch (Exception e)
+            {
+                ClientFailed?.Invoke(e);
+            }
+            finally
+            {
+                _sessions.TryRemove(session, out _);
+                session.Dispose();
+            }
+        }
+
+        /// <summary>
+        /// Queue a client's frame to device. Waits while device has <see cref="MaxFramesInFlight"/> frames
+        /// queued, which stops reading from that client. Callers submit one at a time to keep their order.
+        /// </summary>
+        /// <returns>Task of device reply, see <see cref="KeyboardMouse.SendEncoded"/>.</returns>
+        /// <exception cref="ArgumentException">If device index or frame is invalid.</exception>
+        internal async ValueTask<Task<byte[]>> Submit(byte device, ReadOnlyMemory<byte> frameBytes,
+            CancellationToken token)
+        {
+            if (device >= _devices.Count)
+            {
+                throw new ArgumentException($"Unknown device {device}, server has {_devices.Count}!");
+            }
+            SerialCommandFrame frame = SerialCommandFrame.Parse(frameBytes.Span);
+            SemaphoreSlim slots = _deviceSlots[device];
+            await slots.WaitAsync(token).ConfigureAwait(false);
+            Task<byte[]> reply;
+            try
+            {
+                reply = _devices[device].SendEncoded(frame);
+            }
+            catch
+            {
+                slots.Release();
+                throw;
+            }
+            _ = reply.ContinueWith((_, state) => ((SemaphoreSlim)state).Release(), slots,
+                CancellationToken.None, TaskContinuationOptions.ExecuteSynchronously, TaskScheduler.Default);
+            return reply;
+        }
+
+        protected virtual void Dispose(bool disposing)
+        {
+            if (!_disposedValue)
+            {
+                if (disposing)
+                {
+                    _cancellation.Cancel();
+                    lock (_listeners)
+                    {
+                        foreach (Socket listener in _listeners)
+                        {
+                            listener.Dispose();
+                        }
+                        _listeners.Clear();
+                    }
+                    foreach (ClientSession session in _sessions.Keys)
+                    {
+                        session.Dispose();
+                    }
+                    _cancellation.Dispose();
+                }
+                _disposedValue = true;
+            }
+        }
+
+        public void Dispose()
+        {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
@@ -0,0 +1,394 @@
+﻿using System;
+using System.Buffers;
+using System.Collections.Concurrent;
+using System.IO.Pipelines;
+using System.Net.Sockets;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse.Remote
+{
+    /// <summary>
+    /// Client of a device owned by <see cref="KeyboardMouseServer"/>, with the same commands as
+    /// <see cref="KeyboardMouse"/>. Safe to share between threads. Commands are delivered in call order,
+    /// and commands issued while a socket write is in progress are sent together in the next write.
+    /// </summary>
+    public class RemoteKeyboardMouse : IDisposable
+    {
+        private readonly Socket _socket;
+        private readonly NetworkStream _stream;
+        private readonly byte _device;
+        private readonly ConcurrentDictionary<uint, TaskCompletionSource<byte[]>> _pending;
+        private readonly object _writeLock = new object();
+        private readonly object _sendLock = new object();
+        private readonly Task _readLoop;
+        private ArrayBufferWriter<byte> _writeBuffer = new ArrayBufferWriter<byte>();
+        private ArrayBufferWriter<byte> _sendBuffer = new ArrayBufferWriter<byte>();
+        private bool _flushScheduled;
+        private uint _nextId;
+        private CommandRing _ring;
+        private bool _disposedValue;
+
+        /// <summary>
+        /// Set once connection is lost or being disposed, read without _writeLock by a sender waiting on the ring
+        /// </summary>
+        private volatile bool _connectionClosed;
+
+        public int MouseResolutionWidth { get; private set; }
+
+        public int MouseResolutionHeight { get; private set; }
+
+        private RemoteKeyboardMouse(Socket socket, int device)
+        {
+            if (device < 0 || device > byte.MaxValue)
+            {
+                throw new ArgumentOutOfRangeException(nameof(device));
+            }
+            _socket = socket;
+            _stream = new NetworkStream(socket, true);
+            _device = (byte)device;
+            _pending = new ConcurrentDictionary<uint, TaskCompletionSource<byte[]>>();
+            _readLoop = ReadLoopAsync();
+        }
+
+        /// <summary>
+        /// Connect to a server on the same machine.
+        /// </summary>
+        /// <param name="path">Unix domain socket of server</param>
+        /// <param name="device">Index of device on server</param>
+        public static RemoteKeyboardMouse ConnectUnix(string path, int device = 0)
+        {
+            Socket socket = new Socket(AddressFamily.Unix, SocketType.Stream, ProtocolType.Unspecified);
+            socket.Connect(new UnixDomainSocketEndPoint(path));
+            return new RemoteKeyboardMouse(socket, device);
+        }
+
+        /// <summary>
+        /// Connect to a server over TCP, with Nagle's algorithm disabled.
+        /// </summary>
+        /// <param name="device">Index of device on server</param>
+        public static RemoteKeyboardMouse ConnectTcp(string host, int port, int device = 0)
+        {
+            Socket socket = new Socket(SocketType.Stream, ProtocolType.Tcp) { NoDelay = true };
+            socket.Connect(host, port);
+            return new RemoteKeyboardMouse(socket, device);
+        }
+
+        /// <summary>
+        /// Submit later commands through a shared-memory ring instead of the socket, which saves a system
+        /// call per command while server is busy. Only for connections made with <see cref="ConnectUnix"/>.
+        /// Replies still arrive on the socket. Call before issuing commands, since commands still in flight
+        /// on the socket are not ordered with those in the ring.
+        /// </summary>
+        /// <param name="path">Ring file to create, readable by server. Prefer a memory-backed file system, e.g. /dev/shm</param>
+        /// <param name="capacity">Number of slots, power of two</param>
+        /// <exception cref="ArgumentException">If server cannot open the ring.</exception>
+        public async Task AttachSharedRing(string path, int capacity = 256)
+        {
+            if (_ring != null)
+            {
+                throw new InvalidOperationException("Ring already attached!");
+            }
+            CommandRing ring = CommandRing.Create(path, capacity);
+            Task<byte[]> attached;
+            lock (_writeLock)
+            {
+                uint id = unchecked(++_nextId);
+                attached = Register(id);
+                RemoteProtocol.WriteAttachRing(_writeBuffer, id, path);
+                ScheduleFlush();
+            }
+            try
+            {
+                await attached.ConfigureAwait(false);
+            }
+            catch
+            {
+                ring.Dispose();
+                throw;
+            }
+            lock (_writeLock)
+            {
+                _ring = ring;
+            }
+        }
+
+        /// <summary>
+        /// Set the absolute mouse's resolution on device.
+        /// </summary>
+        /// <exception cref="ArgumentException">If supplied with non-positive values</exception>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task SetMouseResolution(int width, int height)
+        {
+            if (width <= 0 || height <= 0)
+            {
+                throw new ArgumentException("Resolution values cannot be negative!");
+            }
+            MouseResolutionWidth = width;
+            MouseResolutionHeight = height;
+            return Send(SerialCommandFrame.OfCoordinateType(SerialSymbols.FrameType.MouseResolution,
+                new Tuple<ushort, ushort>((ushort)width, (ushort)height)));
+        }
+
+        /// <summary>
+        /// Move the absolute mouse. Every call is delivered reliably, nothing is coalesced.
+        /// </summary>
+        /// <exception cref="ArgumentException">If supplied with non-positive values or out of resolution range.</exception>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task MoveMouseToCoordinate(int x, int y)
+        {
+            if (x <= 0 || y <= 0 || x > MouseResolutionWidth || y > MouseResolutionHeight)
+            {
+                throw new ArgumentOutOfRangeException($"Mouse Coordinate {x},{y} is out of range {MouseResolutionWidth},{MouseResolutionHeight}!\n");
+            }
+            return Send(SerialCommandFrame.OfCoordinateType(SerialSymbols.FrameType.MouseMove,
+                new Tuple<ushort, ushort>((ushort)x, (ushort)y)));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task MouseScroll(sbyte value)
+        {
+            return Send(SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseScroll, (byte)value));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task MousePressButton(SerialSymbols.MouseButton button)
+        {
+            return Send(SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MousePress, (byte)button));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task MouseReleaseButton(SerialSymbols.MouseButton button)
+        {
+            return Send(SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseRelease, (byte)button));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task MouseReleaseAllButtons()
+        {
+            return Send(SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.MouseRelease, SerialSymbols.ReleaseAllKeys));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task KeyboardPress(byte key)
+        {
+            return Send(SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardPress, key));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task KeyboardRelease(byte key)
+        {
+            return Send(SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardRelease, key));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task KeyboardReleaseAll()
+        {
+            return Send(SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.KeyboardRelease, SerialSymbols.ReleaseAllKeys));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task KeyboardMousePress(byte key, SerialSymbols.MouseButton buttons)
+        {
+            return Send(SerialCommandFrame.OfKeyMouseType(SerialSymbols.FrameType.KeyMousePress, key, (byte)buttons));
+        }
+
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public Task KeyboardMouseRelease(byte key, SerialSymbols.MouseButton buttons)
+        {
+            return Send(SerialCommandFrame.OfKeyMouseType(SerialSymbols.FrameType.KeyMouseRelease, key, (byte)buttons));
+        }
+
+        /// <summary>
+        /// Read link counters kept by the device, see <see cref="KeyboardMouse.QueryDeviceStatistics"/>.
+        /// </summary>
+        /// <exception cref="SerialDeviceException">If command failed.</exception>
+        public async Task<DeviceStatistics> QueryDeviceStatistics()
+        {
+            byte[] reply = await Send(SerialCommandFrame.OfKeyType(SerialSymbols.FrameType.QueryStats, 0))
+                .ConfigureAwait(false);
+            return new DeviceStatistics(reply);
+        }
+
+        private Task<byte[]> Send(SerialCommandFrame frame)
+        {
+            ReadOnlySpan<byte> bytes = frame.Bytes.Span;
+            lock (_writeLock)
+            {
+                if (_disposedValue)
+                {
+                    throw new ObjectDisposedException(nameof(RemoteKeyboardMouse));
+                }
+                uint id = unchecked(++_nextId);
+                Task<byte[]> reply = Register(id);
+                if (_ring != null)
+                {
+                    SpinWait spin = new SpinWait();
+                    while (!_ring.TryWrite(id, _device, bytes))
+                    {
+                        if (_connectionClosed)
+                        {
+                            // Nobody drains the ring any more
+                            _pending.TryRemove(id, out _);
+                            throw new SerialDeviceException("Connection to server lost.");
+                        }
+                        spin.SpinOnce(); // Server is behind, wait for a free slot to keep order
+                    }
+                    if (_ring.ConsumerWaiting)
+                    {
+                        RemoteProtocol.WriteDoorbell(_writeBuffer);
+                        ScheduleFlush();
+                    }
+                }
+                else
+                {
+                    RemoteProtocol.WriteRequest(_writeBuffer, id, _device, bytes);
+                    ScheduleFlush();
+                }
+                return reply;
+            }
+        }
+
+        private Task<byte[]> Register(uint id)
+        {
+            TaskCompletionSource<byte[]> source
+                = new TaskCompletionSource<byte[]>(TaskCreationOptions.RunContinuationsAsynchronously);
+            _pending[id] = source;
+            return source.Task;
+        }
+
+        /// <summary>
+        /// Must hold _writeLock. Write buffered messages soon, together with any added meanwhile.
+        /// </summary>
+        private void ScheduleFlush()
+        {
+            if (_flushScheduled)
+            {
+                return;
+            }
+            _flushScheduled = true;
+            ThreadPool.UnsafeQueueUserWorkItem(_ => Flush(), null);
+        }
+
+        private void Flush()
+        {
+            // Swapping under _sendLock keeps writes in buffer order
+            lock (_sendLock)
+            {
+                lock (_writeLock)
+                {
+                    (_writeBuffer, _sendBuffer) = (_sendBuffer, _writeBuffer);
+                    _flushScheduled = false;
+                }
+                try
+                {
+                    _socket.Send(_sendBuffer.WrittenSpan);
+                }
+                catch (Exception e) when (e is SocketException || e is ObjectDisposedException)
+                {
+                    _connectionClosed = true;
+                    FailPending(new SerialDeviceException("Connection to server lost.", e));
+                }
+                _sendBuffer.Clear();
+            }
+        }
+
+        private async Task ReadLoopAsync()
+        {
+            PipeReader reader = PipeReader.Create(_stream);
+            try
+            {
+                while (true)
+                {
+                    ReadResult result = await reader.ReadAsync().ConfigureAwait(false);
+                    ReadOnlySequence<byte> buffer = result.Buffer;
+                    while (RemoteProtocol.TryReadResponse(ref buffer, out uint id, out RemoteProtocol.Status status,
+                        out byte[] body))
+                    {
+                        if (_pending.TryRemove(id, out TaskCompletionSource<byte[]> source))
+                        {
+                            Complete(source, status, body);
+                        }
+                    }
+                    reader.AdvanceTo(buffer.Start, buffer.End);
+                    if (result.IsCompleted)
+                    {
+                        break;
+                    }
+                }
+                _connectionClosed = true;
+                FailPending(new SerialDeviceException("Server closed connection."));
+            }
+            catch (Exception e)
+            {
+                _connectionClosed = true;
+                FailPending(new SerialDeviceException("Connection to server lost.", e));
+            }
+        }
+
+        private static void Complete(TaskCompletionSource<byte[]> source, RemoteProtocol.Status status, byte[] body)
+        {
+            switch (status)
+            {
+                case RemoteProtocol.Status.Ok:
+                    source.TrySetResult(body);
+                    break;
+                case RemoteProtocol.Status.BadRequest:
+                    source.TrySetException(new ArgumentException(Encoding.UTF8.GetString(body)));
+                    break;
+                default:
+                    source.TrySetException(new SerialDeviceException(Encoding.UTF8.GetString(body)));
+                    break;
+            }
+        }
+
+        private void FailPending(Exception exception)
+        {
+            foreach (uint id in _pending.Keys)
+            {
+                if (_pending.TryRemove(id, out TaskCompletionSource<byte[]> source))
+                {
+                    source.TrySetException(exception);
+                }
+            }
+        }
+
+        protected virtual void Dispose(bool disposing)
+        {
+            if (!_disposedValue)
+            {
+                if (disposing)
+                {
+                    // Releases a sender spinning on a full ring, which holds _writeLock
+                    _connectionClosed = true;
+                    lock (_writeLock)
+                    {
+                        _disposedValue = true;
+                    }
+                    lock (_sendLock)
+                    {
+                        _socket.Dispose();
+                        _stream.Dispose();
+                    }
+                    try
+                    {
+                        _readLoop.Wait();
+                    }
+                    catch (AggregateException)
+                    {
+                    }
+                    _ring?.Dispose();
+                }
+                _disposedValue = true;
+            }
+        }
+
+        public void Dispose()
+        {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
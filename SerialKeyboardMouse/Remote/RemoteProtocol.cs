@@ -0,0 +1,214 @@
+﻿using System;
+using System.Buffers;
+using System.Buffers.Binary;
+using System.Text;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse.Remote
+{
+    /// <summary>
+    /// Messages between <see cref="KeyboardMouseServer"/> and <see cref="RemoteKeyboardMouse"/>.
+    /// Requests carry device frames already encoded, so daemon only validates and forwards them.
+    /// Integers are little-endian, like device frames.
+    /// </summary>
+    internal static class RemoteProtocol
+    {
+        /// <summary>
+        /// &lt;Kind&gt; &lt;4-byte id&gt; &lt;Device index&gt; &lt;Device frame&gt;
+        /// </summary>
+        public const byte MessageRequest = 0x01;
+
+        /// <summary>
+        /// &lt;Kind&gt; &lt;4-byte id&gt; &lt;2-byte path length&gt; &lt;UTF-8 path of <see cref="CommandRing"/>&gt;
+        /// </summary>
+        public const byte MessageAttachRing = 0x02;
+
+        /// <summary>
+        /// &lt;Kind&gt;, wakes daemon sleeping on an empty <see cref="CommandRing"/>
+        /// </summary>
+        public const byte MessageDoorbell = 0x03;
+
+        /// <summary>
+        /// Largest path accepted in <see cref="MessageAttachRing"/>
+        /// </summary>
+        public const int MaxPathLength = 1024;
+
+        /// <summary>
+        /// Response is &lt;4-byte id&gt; &lt;Status&gt; &lt;Body length&gt; &lt;Body&gt;
+        /// </summary>
+        public const int ResponseHeaderLength = 6;
+
+        public enum Status : byte
+        {
+            /// <summary>
+            /// Frame acknowledged. Body is the reply frame of query types, empty otherwise.
+            /// </summary>
+            Ok = 0x00,
+
+            /// <summary>
+            /// Device failed, body is UTF-8 message
+            /// </summary>
+            DeviceFailed = 0x01,
+
+            /// <summary>
+            /// Request malformed or device index unknown, body is UTF-8 message
+            /// </summary>
+            BadRequest = 0x02
+        }
+
+        public static void WriteRequest(IBufferWriter<byte> writer, uint id, byte device, ReadOnlySpan<byte> frame)
+        {
+            Span<byte> span = writer.GetSpan(6 + frame.Length);
+            span[0] = MessageRequest;
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(1), id);
+            span[5] = device;
+            frame.CopyTo(span.Slice(6));
+            writer.Advance(6 + frame.Length);
+        }
+
+        public static void WriteAttachRing(IBufferWriter<byte> writer, uint id, string path)
+        {
+            byte[] encoded = Encoding.UTF8.GetBytes(path);
+            if (encoded.Length > MaxPathLength)
+            {
+                throw new ArgumentException($"Ring path longer than {MaxPathLength} bytes!");
+            }
+            Span<byte> span = writer.GetSpan(7 + encoded.Length);
+            span[0] = MessageAttachRing;
+            BinaryPrimitives.WriteUInt32LittleEndian(span.Slice(1), id);
+            BinaryPrimitives.WriteUInt16LittleEndian(span.Slice(5), (ushort)encoded.Length);
+            encoded.CopyTo(span.Slice(7));
+            writer.Advance(7 + encoded.Length);
+        }
+
+        public static void WriteDoorbell(IBufferWriter<byte> writer)
+        {
+            writer.GetSpan(1)[0] = MessageDoorbell;
+            writer.Advance(1);
+        }
+
+        public static void WriteResponse(IBufferWriter<byte> writer, uint id, Status status, ReadOnlySpan<byte> body)
+        {
+            if (body.Length > byte.MaxValue)
+            {
+                body = body.Slice(0, byte.MaxValue);
+            }
+            Span<byte> span = writer.GetSpan(ResponseHeaderLength + body.Length);
+            BinaryPrimitives.WriteUInt32LittleEndian(span, id);
+            span[4] = (byte)status;
+            span[5] = (byte)body.Length;
+            body.CopyTo(span.Slice(ResponseHeaderLength));
+            writer.Advance(ResponseHeaderLength + body.Length);
+        }
+
+        public static void WriteResponse(IBufferWriter<byte> writer, uint id, Status status, string message)
+        {
+            WriteResponse(writer, id, status, Encoding.UTF8.GetBytes(message));
+        }
+
+        /// <summary>
+        /// Parse one client message from the front of buffer.
+        /// </summary>
+        /// <returns>False if buffer does not hold a complete message yet.</returns>
+        /// <exception cref="InvalidOperationException">If stream is corrupted and connection must be dropped.</exception>
+        public static bool TryReadMessage(ref ReadOnlySequence<byte> buffer, out ClientMessage message)
+        {
+            message = default;
+            SequenceReader<byte> reader = new SequenceReader<byte>(buffer);
+            if (!reader.TryRead(out byte kind))
+            {
+                return false;
+            }
+            switch (kind)
+            {
+                case MessageDoorbell:
+                    message.Kind = kind;
+                    break;
+                case MessageRequest:
+                {
+                    Span<byte> frame = stackalloc byte[SerialSymbols.MaxFrameLength];
+                    if (!reader.TryReadLittleEndian(out int id) || !reader.TryRead(out byte device)
+                        || !reader.TryCopyTo(frame.Slice(0, 2)))
+                    {
+                        return false;
+                    }
+                    int frameLength = frame[1] + 2;
+                    if (frameLength < SerialSymbols.MinFrameLength || frameLength > SerialSymbols.MaxFrameLength)
+                    {
+                        throw new InvalidOperationException($"Request frame length {frameLength} out of range!");
+                    }
+                    if (!reader.TryCopyTo(frame.Slice(0, frameLength)))
+                    {
+                        return false;
+                    }
+                    reader.Advance(frameLength);
+                    message.Kind = kind;
+                    message.Id = (uint)id;
+                    message.Device = device;
+                    message.Frame = frame.Slice(0, frameLength).ToArray();
+                    break;
+                }
+                case MessageAttachRing:
+                {
+                    if (!reader.TryReadLittleEndian(out int id) || !reader.TryReadLittleEndian(out short length))
+                    {
+                        return false;
+                    }
+                    if ((ushort)length > MaxPathLength)
+                    {
+                        throw new InvalidOperationException($"Ring path length {(ushort)length} out of range!");
+                    }
+                    if (reader.Remaining < (ushort)length)
+                    {
+                        return false;
+                    }
+                    message.Kind = kind;
+                    message.Id = (uint)id;
+                    message.Path = Encoding.UTF8.GetString(reader.UnreadSequence.Slice(0, (ushort)length).ToArray());
+                    reader.Advance((ushort)length);
+                    break;
+                }
+                default:
+                    throw new InvalidOperationException($"Unknown message kind 0x{kind:X2}!");
+            }
+            buffer = buffer.Slice(reader.Position);
+            return true;
+        }
+
+        /// <summary>
+        /// Parse one response from the front of buffer.
+        /// </summary>
+        /// <returns>False if buffer does not hold a complete response yet.</returns>
+        public static bool TryReadResponse(ref ReadOnlySequence<byte> buffer, out uint id, out Status status,
+            out byte[] body)
+        {
+            id = 0;
+            status = Status.Ok;
+            body = null;
+            SequenceReader<byte> reader = new SequenceReader<byte>(buffer);
+            if (!reader.TryReadLittleEndian(out int rawId) || !reader.TryRead(out byte rawStatus)
+                || !reader.TryRead(out byte length) || reader.Remaining < length)
+            {
+                return false;
+            }
+            id = (uint)rawId;
+            status = (Status)rawStatus;
+            body = reader.UnreadSequence.Slice(0, length).ToArray();
+            reader.Advance(length);
+            buffer = buffer.Slice(reader.Position);
+            return true;
+        }
+
+        /// <summary>
+        /// Client message, fields not used by its kind are default
+        /// </summary>
+        public struct ClientMessage
+        {
+            public byte Kind;
+            public uint Id;
+            public byte Device;
+            public byte[] Frame;
+            public string Path;
+        }
+    }
+}
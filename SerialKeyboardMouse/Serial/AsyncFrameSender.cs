@@ -0,0 +1,412 @@
+﻿using System;
+using System.Diagnostics;
+using System.Threading;
+using System.Threading.Channels;
+using System.Threading.Tasks;
+using System.Threading.Tasks.Sources;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// Same delivery as <see cref="ReliableFrameSender"/>, but built on <see cref="ISerialAdaptor.AsyncWrite"/>
+    /// and <see cref="ISerialAdaptor.AsyncRead"/>. No thread is parked per device: the send loop is an async
+    /// method waiting on a channel, and loop-back timeouts are a reused timer completing a reused
+    /// <see cref="IValueTaskSource{TResult}"/>, and tagged frames are encoded into a reused buffer. Each frame
+    /// still allocates its <see cref="SenderTask"/> and the <see cref="TaskCompletionSource"/> behind the
+    /// caller's task, as <see cref="IFrameSender"/> returns a <see cref="Task"/>. Suited to serve many devices
+    /// from a few thread-pool threads.
+    /// </summary>
+    internal class AsyncFrameSender : IFrameSender
+    {
+        private readonly ISerialAdaptor _serial;
+        private readonly WireCapture _capture;
+        private readonly FrameReceiver _receiver;
+        private readonly Channel<SenderTask> _channel;
+        private readonly CancellationTokenSource _cancellation;
+        private readonly ResponseSource _response;
+        private readonly Random _random;
+        private readonly Task _sendLoop;
+
+        /// <summary>
+        /// Tag of next tagged frame, only touched by send loop
+        /// </summary>
+        private byte _nextTag;
+
+        /// <summary>
+        /// Tagged bytes of in-flight frame, reused for every tagged frame, only touched by send loop
+        /// </summary>
+        private readonly byte[] _taggedBuffer = new byte[SerialSymbols.MaxFrameLength + 2];
+
+        /// <summary>
+        /// Task waiting for loop back, null if none
+        /// </summary>
+        private volatile SenderTask _inFlight;
+
+        /// <summary>
+        /// Set when in-flight task is answered, even after its timeout fired
+        /// </summary>
+        private volatile bool _responded;
+
+        /// <summary>
+        /// Non-zero if in-flight task was answered by NACK instead of loop back
+        /// </summary>
+        private volatile int _rejectReason;
+
+        private readonly UsbReadiness _readiness;
+
+        private int _queueDepth;
+        private bool _disposedValue;
+
+        public LinkMetrics Metrics { get; }
+
+        public PrecisionPacer Pacer { get; }
+
+        public FrameReceiver Receiver => _receiver;
+
+        public UsbReadiness Readiness => _readiness;
+
+        public int QueueDepth => Volatile.Read(ref _queueDepth);
+
+        public bool IsAsynchronous => true;
+
+        public Action<SerialCommandFrame> FrameAcknowledged { get; set; }
+
+        public bool EnableKeyRetryDelay { get; set; } = true;
+
+        public bool EnableMouseMoveRetryDelay { get; set; } = false;
+
+        public bool EnableFrameTags { get; set; }
+
+        public AsyncFrameSender(ISerialAdaptor serial, WireCapture capture = null)
+        {
+            _serial = serial ?? throw new ArgumentNullException(nameof(serial));
+            _capture = capture;
+            _random = new Random();
+            _nextTag = (byte)_random.Next(256);
+            Metrics = new LinkMetrics();
+            Pacer = new PrecisionPacer(Metrics.Pacing);
+            _cancellation = new CancellationTokenSource();
+            _response = new ResponseSource();
+            _channel = Channel.CreateUnbounded<SenderTask>(new UnboundedChannelOptions
+            {
+                SingleReader = true,
+                AllowSynchronousContinuations = true
+            });
+            _readiness = new UsbReadiness();
+            _receiver = new FrameReceiver(serial, Metrics, capture, dedicatedThread: false);
+            foreach (SerialSymbols.FrameType type in SerialSymbols.ValidFrameTypes)
+            {
+                if (!SerialSymbols.UnacknowledgedFrameTypes.Contains(type))
+                {
+                    _receiver.Register(type, OnResponse);
+                }
+            }
+            _receiver.Register(SerialSymbols.FrameType.Nack, OnNack);
+            _receiver.Register(SerialSymbols.FrameType.EventUsbStatus, _readiness.OnStatusEvent);
+            _receiver.Start();
+            _sendLoop = SendLoopAsync();
+        }
+
+        public Task SendFrame(SerialCommandFrame frame, CancellationToken token = default, DateTime? deadline = null)
+        {
+            SenderTask task = new SenderTask(frame);
+            task.Watch(token, ToStopwatchDeadline(deadline), Metrics);
+            Enqueue(task);
+            return task.AwaitSource.Task;
+        }
+
+        public async Task<byte[]> SendQuery(SerialCommandFrame frame)
+        {
+            SenderTask task = SenderTask.OfQuery(frame);
+            Enqueue(task);
+            await task.AwaitSource.Task.ConfigureAwait(false);
+            return task.Reply;
+        }
+
+        private static long ToStopwatchDeadline(DateTime? deadline)
+        {
+            if (!deadline.HasValue)
+            {
+                return long.MaxValue;
+            }
+            long now = Stopwatch.GetTimestamp();
+            double ticks = (deadline.Value.ToUniversalTime() - DateTime.UtcNow).TotalSeconds * Stopwatch.Frequency;
+            return ticks >= long.MaxValue - now ? long.MaxValue : now + (long)ticks;
+        }
+
+        private void Enqueue(SenderTask task)
+        {
+            if (Volatile.Read(ref _queueDepth) > ReliableFrameSender.MaxNumQueuedTask)
+            {
+                throw new SerialDeviceException($"Too many frames ({_queueDepth}) queued!");
+            }
+
+            if (!SerialSymbols.ValidFrameBytes(task.BytesToSend))
+            {
+                throw new ArgumentException("Invalid frame bytes!");
+            }
+
+            Interlocked.Increment(ref _queueDepth);
+            if (!_channel.Writer.TryWrite(task))
+            {
+                Interlocked.Decrement(ref _queueDepth);
+                throw new ObjectDisposedException(nameof(AsyncFrameSender));
+            }
+        }
+
+        private async Task SendLoopAsync()
+        {
+            ChannelReader<SenderTask> reader = _channel.Reader;
+            while (await reader.WaitToReadAsync().ConfigureAwait(false))
+            {
+                while (reader.TryRead(out SenderTask toSend))
+                {
+                    Interlocked.Decrement(ref _queueDepth);
+                    if (_cancellation.IsCancellationRequested)
+                    {
+                        toSend.AwaitSource.TrySetCanceled();
+                        continue;
+                    }
+                    // Caller gave up while it was queued
+                    if (!toSend.TryStart(Stopwatch.GetTimestamp(), Metrics))
+                    {
+                        continue;
+                    }
+                    try
+                    {
+                        await SendAsync(toSend).ConfigureAwait(false);
+                    }
+                    catch (Exception e)
+                    {
+                        _inFlight = null;
+                        toSend.AwaitSource.TrySetException(e);
+                    }
+                }
+            }
+        }
+
+        private async ValueTask SendAsync(SenderTask toSend)
+        {
+            CancellationToken token = _cancellation.Token;
+
+            // Unacknowledged frames are written once, never waited or retried
+            if (toSend.IsUnacknowledged)
+            {
+                await _serial.AsyncWrite(toSend.BytesToSend, token).ConfigureAwait(false);
+                toSend.CompleteUnacknowledged(_capture, Metrics);
+                return;
+            }
+
+            toSend.Prepare(EnableFrameTags, ref _nextTag, _taggedBuffer);
+
+            _responded = false;
+            _rejectReason = 0;
+            _inFlight = toSend;
+            long notReadyDeadline = long.MaxValue;
+            bool notReady = false;
+            for (int i = 0; i < toSend.MaxRetries; ++i)
+            {
+                // Arm before writing, so a fast loop back cannot be missed
+                _response.Arm(toSend.TimeoutMilliseconds);
+                await _serial.AsyncWrite(toSend.BytesToSend, token).ConfigureAwait(false);
+                toSend.OnWritten(i, _capture, Metrics);
+                long start = Stopwatch.GetTimestamp();
+
+                bool responded = await _response.WaitAsync().ConfigureAwait(false);
+                if (!responded)
+                {
+                    // Retry delay if needed
+                    TimeSpan delay = toSend.RetryDelay(this, _random);
+                    if (delay > TimeSpan.Zero)
+                    {
+                        await Pacer.DelayAsync(delay, token).ConfigureAwait(false);
+                    }
+                    // Late loop back arrived during delay, no need to send again
+                    responded = _responded;
+                }
+                if (!responded)
+                {
+                    continue;
+                }
+                if (_rejectReason == 0)
+                {
+                    toSend.Acknowledge((Stopwatch.GetTimestamp() - start) * 1000000.0 / Stopwatch.Frequency, Metrics,
+                        FrameAcknowledged);
+                    return;
+                }
+
+                // Target not ready. Hold this and all later frames until device reports ready,
+                // then send again without counting a retry.
+                Metrics.OnNotReadyRejection();
+                if (notReadyDeadline == long.MaxValue)
+                {
+                    notReadyDeadline = toSend.HoldDeadline(Stopwatch.GetTimestamp(), Stopwatch.Frequency);
+                }
+                _responded = false;
+                _rejectReason = 0;
+                _inFlight = toSend;
+                TimeSpan remaining = TimeSpan.FromSeconds(
+                    (notReadyDeadline - Stopwatch.GetTimestamp()) / (double)Stopwatch.Frequency);
+                if (remaining <= TimeSpan.Zero
+                    || !await _readiness.WaitReadyAsync(remaining, token).ConfigureAwait(false))
+                {
+                    notReady = true;
+                    break;
+                }
+                --i;
+            }
+            _inFlight = null;
+            toSend.Fail(notReady, Stopwatch.GetTimestamp(), _capture, Metrics);
+        }
+
+        /// <summary>
+        /// Called by receiver for every valid inbound frame of a sent type.
+        /// </summary>
+        private void OnResponse(ReadOnlySpan<byte> frame)
+        {
+            SenderTask task = _inFlight;
+            if (task == null || !task.AcceptResponse(frame))
+            {
+                // Late loop back of a task already given up, unless it is an event handled elsewhere
+                if (!SerialSymbols.EventFrameTypes.Contains((SerialSymbols.FrameType)frame[2]))
+                {
+                    Metrics.OnInboundUnrouted();
+                }
+                return;
+            }
+            _inFlight = null;
+            _responded = true;
+            _response.TryComplete(true);
+        }
+
+        /// <summary>
+        /// Called by receiver for every NACK. Completes in-flight task as rejected, if NACK is about it.
+        /// </summary>
+        private void OnNack(ReadOnlySpan<byte> frame)
+        {
+            SenderTask task = _inFlight;
+            if (frame.Length < 6 || task == null || frame[3] != (byte)task.Original.Type)
+            {
+                Metrics.OnInboundUnrouted();
+                return;
+            }
+            _readiness.OnNotReady();
+            _inFlight = null;
+            _rejectReason = frame[4];
+            _responded = true;
+            _response.TryComplete(true);
+        }
+
+        /// <summary>
+        /// Reusable awaitable of one loop back, completed by receiver with true or by its timer with false.
+        /// Only one wait is outstanding at a time, as the send loop is sequential.
+        /// </summary>
+        private sealed class ResponseSource : IValueTaskSource<bool>, IDisposable
+        {
+            private const int Idle = 0;
+            private const int Waiting = 1;
+
+            private ManualResetValueTaskSourceCore<bool> _core;
+            private readonly Timer _timer;
+            private int _state;
+            private long _deadline;
+
+            public ResponseSource()
+            {
+                // Receiver completes this from its frame handler, which must not run the send loop
+                _core.RunContinuationsAsynchronously = true;
+                _timer = new Timer(s => ((ResponseSource)s).OnTimer(), this, Timeout.Infinite, Timeout.Infinite);
+            }
+
+            public void Arm(int timeoutMs)
+            {
+                _core.Reset();
+                Volatile.Write(ref _deadline, Stopwatch.GetTimestamp() + timeoutMs * Stopwatch.Frequency / 1000);
+                Volatile.Write(ref _state, Waiting);
+                _timer.Change(timeoutMs, Timeout.Infinite);
+            }
+
+            /// <summary>
+            /// A callback of previous wait may fire after re-arm, or timer may fire a bit early.
+            /// Either way, wait out the remaining time of current deadline.
+            /// </summary>
+            private void OnTimer()
+            {
+                long remaining = Volatile.Read(ref _deadline) - Stopwatch.GetTimestamp();
+                if (remaining > 0)
+                {
+                    _timer.Change(remaining * 1000 / Stopwatch.Frequency + 1, Timeout.Infinite);
+                    return;
+                }
+                TryComplete(false);
+            }
+
+            public ValueTask<bool> WaitAsync()
+            {
+                return new ValueTask<bool>(this, _core.Version);
+            }
+
+            public void TryComplete(bool acknowledged)
+            {
+                if (Interlocked.CompareExchange(ref _state, Idle, Waiting) != Waiting)
+                {
+                    return;
+                }
+                if (acknowledged)
+                {
+                    _timer.Change(Timeout.Infinite, Timeout.Infinite);
+                }
+                _core.SetResult(acknowledged);
+            }
+
+            public bool GetResult(short token) => _core.GetResult(token);
+
+            public ValueTaskSourceStatus GetStatus(short token) => _core.GetStatus(token);
+
+            public void OnCompleted(Action<object> continuation, object state, short token,
+                ValueTaskSourceOnCompletedFlags flags)
+            {
+                _core.OnCompleted(continuation, state, token, flags);
+            }
+
+            public void Dispose()
+            {
+                TryComplete(false);
+                _timer.Dispose();
+            }
+        }
+
+        protected virtual void Dispose(bool disposing)
+        {
+            if (!_disposedValue)
+            {
+                if (disposing)
+                {
+                    _channel.Writer.TryComplete();
+                    _cancellation.Cancel();
+                    _response.TryComplete(false);
+                    try
+                    {
+                        _sendLoop.Wait(1000);
+                    }
+                    catch (AggregateException)
+                    {
+                        // Cancelled while writing
+                    }
+                    _receiver.Dispose();
+                    _serial.Dispose();
+                    _response.Dispose();
+                    _cancellation.Dispose();
+                    _readiness.Dispose();
+                }
+                _disposedValue = true;
+            }
+        }
+
+        public void Dispose()
+        {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
@@ -1,96 +1,104 @@
-﻿using System;
-using System.IO.Ports;
-using System.Threading;
-using System.Threading.Tasks;
-
-namespace SerialKeyboardMouse.Serial
-{
-    public class DotNetSerialAdaptor : ISerialAdaptor
-    {
-        private const int ReadTimeout = 10;
-        private const int WriteTimeout = 10000;
-        private readonly SerialPort _serialPort;
-
-        public DotNetSerialAdaptor(string portName)
-        {
-            _serialPort = new SerialPort(portName, SerialSymbols.BaudRate, Parity.None);
-            _serialPort.Open();
-            _serialPort.BaseStream.ReadTimeout = ReadTimeout;
-            _serialPort.ReadTimeout = ReadTimeout;
-            _serialPort.BaseStream.WriteTimeout = WriteTimeout;
-            _serialPort.WriteTimeout = WriteTimeout;
-            _serialPort.DataReceived += (o, e) => { SerialDataAvailableEvent?.Invoke(this); };
-        }
-
-        public event ISerialAdaptor.SerialDataAvailable SerialDataAvailableEvent;
-
-        public byte ReadByte(out bool timeout)
-        {
-            byte ret = 0;
-            try
-            {
-                ret = (byte)_serialPort.ReadByte();
-            }
-            catch (TimeoutException)
-            {
-                timeout = true;
-                return ret;
-            }
-            timeout = false;
-            return ret;
-        }
-
-        public void WriteByte(byte b)
-        {
-            Span<byte> toSend = stackalloc byte[1];
-            _serialPort.BaseStream.Write(toSend);
-        }
-
-        public int Read(Memory<byte> memory)
-        {
-            return _serialPort.BaseStream.Read(memory.Span);
-        }
-
-        public void Write(Memory<byte> memory)
-        {
-            _serialPort.BaseStream.Write(memory.Span);
-        }
-
-        public int AvailableBytes => (int)_serialPort.BaseStream.Length;
-
-        public ValueTask<int> AsyncRead(Memory<byte> memory, CancellationToken token = default)
-        {
-            return _serialPort.BaseStream.ReadAsync(memory, token);
-        }
-
-        public ValueTask AsyncWrite(Memory<byte> memory, CancellationToken token = default)
-        {
-            return _serialPort.BaseStream.WriteAsync(memory, token);
-        }
-
-        public async ValueTask<byte> AsyncReadByte(CancellationToken token = default)
-        {
-            byte[] arr = new byte[1];
-            await AsyncRead(arr, token).ConfigureAwait(false);
-            return arr[0];
-        }
-
-        public async ValueTask AsyncWriteByte(byte b, CancellationToken token = default)
-        {
-            byte[] arr = new byte[1];
-            arr[0] = b;
-            await AsyncWrite(arr, token).ConfigureAwait(false);
-        }
-
-        public void DiscardReadBuffer()
-        {
-            _serialPort.BaseStream.Flush();
-            _serialPort.DiscardInBuffer();
-        }
-
-        public void Dispose()
-        {
-            _serialPort?.Dispose();
-        }
-    }
+﻿using System;
+using System.IO.Ports;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse.Serial
+{
+    public class DotNetSerialAdaptor : ISerialAdaptor
+    {
+        private const int ReadTimeout = 10;
+        private const int WriteTimeout = 10000;
+        private readonly SerialPort _serialPort;
+
+        /// <summary>
+        /// Single-byte buffers of async byte operations, reused instead of allocated per call
+        /// </summary>
+        private readonly byte[] _readByteBuffer = new byte[1];
+        private readonly byte[] _writeByteBuffer = new byte[1];
+
+        public DotNetSerialAdaptor(string portName)
+        {
+            _serialPort = new SerialPort(portName, SerialSymbols.BaudRate, Parity.None);
+            _serialPort.Open();
+            _serialPort.BaseStream.ReadTimeout = ReadTimeout;
+            _serialPort.ReadTimeout = ReadTimeout;
+            _serialPort.BaseStream.WriteTimeout = WriteTimeout;
+            _serialPort.WriteTimeout = WriteTimeout;
+            _serialPort.DataReceived += (o, e) => { SerialDataAvailableEvent?.Invoke(this); };
+        }
+
+        public event ISerialAdaptor.SerialDataAvailable SerialDataAvailableEvent;
+
+        public byte ReadByte(out bool timeout)
+        {
+            byte ret = 0;
+            try
+            {
+                ret = (byte)_serialPort.ReadByte();
+            }
+            catch (TimeoutException)
+            {
+                timeout = true;
+                return ret;
+            }
+            timeout = false;
+            return ret;
+        }
+
+        public void WriteByte(byte b)
+        {
+            Span<byte> toSend = stackalloc byte[1];
+            toSend[0] = b;
+            _serialPort.BaseStream.Write(toSend);
+        }
+
+        public int Read(Memory<byte> memory)
+        {
+            return _serialPort.BaseStream.Read(memory.Span);
+        }
+
+        public void Write(Memory<byte> memory)
+        {
+            _serialPort.BaseStream.Write(memory.Span);
+        }
+
+        /// <summary>
+        /// Bytes in driver's receive buffer. Not BaseStream.Length, SerialStream does not support it.
+        /// </summary>
+        public int AvailableBytes => _serialPort.BytesToRead;
+
+        public ValueTask<int> AsyncRead(Memory<byte> memory, CancellationToken token = default)
+        {
+            return _serialPort.BaseStream.ReadAsync(memory, token);
+        }
+
+        public ValueTask AsyncWrite(Memory<byte> memory, CancellationToken token = default)
+        {
+            return _serialPort.BaseStream.WriteAsync(memory, token);
+        }
+
+        public async ValueTask<byte> AsyncReadByte(CancellationToken token = default)
+        {
+            await AsyncRead(_readByteBuffer, token).ConfigureAwait(false);
+            return _readByteBuffer[0];
+        }
+
+        public ValueTask AsyncWriteByte(byte b, CancellationToken token = default)
+        {
+            _writeByteBuffer[0] = b;
+            return AsyncWrite(_writeByteBuffer, token);
+        }
+
+        public void DiscardReadBuffer()
+        {
+            _serialPort.BaseStream.Flush();
+            _serialPort.DiscardInBuffer();
+        }
+
+        public void Dispose()
+        {
+            _serialPort?.Dispose();
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+﻿using System;
+using System.Buffers;
+using System.IO.Pipelines;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// Handler of a complete inbound frame, checksum verified.
+    /// </summary>
+    /// <param name="frame">Frame bytes from <see cref="SerialSymbols.FrameStart"/> to checksum.
+    /// Only valid during the call.</param>
+    internal delegate void FrameHandler(ReadOnlySpan<byte> frame);
+
+    /// <summary>
+    /// Continuously reads the serial port, parses every inbound frame and routes it by type.
+    /// A reader moves bytes into a <see cref="Pipe"/> backed by pooled buffers, and the parser
+    /// consumes the pipe inline and dispatches through a 256-entry table, so cost per frame is
+    /// the same whatever its kind. Reader is either a dedicated thread blocking on the port,
+    /// or an async loop on <see cref="ISerialAdaptor.AsyncRead"/> holding no thread while idle.
+    /// </summary>
+    internal class FrameReceiver : IDisposable
+    {
+        /// <summary>
+        /// Minimum buffer requested from pipe for each read
+        /// </summary>
+        private const int ReadChunkSize = 256;
+
+        private readonly ISerialAdaptor _serial;
+        private readonly WireCapture _capture;
+        private readonly LinkMetrics _metrics;
+        private readonly Pipe _pipe;
+        private readonly FrameHandler[] _handlers;
+        private readonly object _registerLock = new object();
+        private readonly Thread _readerThread;
+        private readonly CancellationTokenSource _cancellation;
+        private Task _readerTask;
+        private Task _parserTask;
+
+        private volatile bool _shouldExit;
+        private bool _disposedValue;
+
+        /// <param name="serial">Serial adaptor of device</param>
+        /// <param name="metrics">Metrics counting corrupted and unrouted frames</param>
+        /// <param name="capture">Capture recording all reads, or null</param>
+        /// <param name="dedicatedThread">Read in a dedicated thread instead of async I/O</param>
+        public FrameReceiver(ISerialAdaptor serial, LinkMetrics metrics, WireCapture capture = null,
+            bool dedicatedThread = true)
+        {
+            _serial = serial ?? throw new ArgumentNullException(nameof(serial));
+            _metrics = metrics ?? throw new ArgumentNullException(nameof(metrics));
+            _capture = capture;
+            _handlers = new FrameHandler[256];
+            // Inline schedulers: parser runs right in the reader's flush, no thread hop per chunk
+            _pipe = new Pipe(new PipeOptions(pool: MemoryPool<byte>.Shared, readerScheduler: PipeScheduler.Inline,
+                writerScheduler: PipeScheduler.Inline, useSynchronizationContext: false));
+            _cancellation = new CancellationTokenSource();
+            if (dedicatedThread)
+            {
+                _readerThread = new Thread(ReaderLoop) { IsBackground = true, Priority = ThreadPriority.Highest };
+            }
+        }
+
+        /// <summary>
+        /// Route frames of a type to handler, in addition to handlers registered before.
+        /// Handler runs on parser thread and must not block.
+        /// </summary>
+        public void Register(SerialSymbols.FrameType type, FrameHandler handler)
+        {
+            lock (_registerLock)
+            {
+                _handlers[(byte)type] += handler;
+            }
+        }
+
+        public void Unregister(SerialSymbols.FrameType type, FrameHandler handler)
+        {
+            lock (_registerLock)
+            {
+                _handlers[(byte)type] -= handler;
+            }
+        }
+
+        public void Start()
+        {
+            _parserTask = ParserLoopAsync();
+            if (_readerThread != null)
+            {
+                _readerThread.Start();
+            }
+            else
+            {
+                _readerTask = ReaderLoopAsync();
+            }
+        }
+
+        private void ReaderLoop()
+        {
+            PipeWriter writer = _pipe.Writer;
+            try
+            {
+                while (!_shouldExit)
+                {
+                    // Block on a single byte so idle port costs nothing, then take all available
+                    byte first = _serial.ReadByte(out bool timeout);
+                    if (timeout)
+                    {
+                        continue;
+                    }
+                    Memory<byte> memory = writer.GetMemory(ReadChunkSize);
+                    memory.Span[0] = first;
+                    int count = 1;
+                    int available = Math.Min(_serial.AvailableBytes, memory.Length - 1);
+                    if (available > 0)
+                    {
+                        count += _serial.Read(memory.Slice(1, available));
+                    }
+                    _capture?.RecordRead(memory.Span.Slice(0, count));
+                    writer.Advance(count);
+                    writer.FlushAsync().AsTask().Wait();
+                }
+                writer.Complete();
+            }
+            catch (Exception e)
+            {
+                // Port closed or broken, nothing more to parse
+                writer.Complete(e);
+            }
+        }
+
+        private async Task ReaderLoopAsync()
+        {
+            PipeWriter writer = _pipe.Writer;
+            try
+            {
+                while (!_shouldExit)
+                {
+                    Memory<byte> memory = writer.GetMemory(ReadChunkSize);
+                    int count;
+                    try
+                    {
+                        count = await _serial.AsyncRead(memory, _cancellation.Token).ConfigureAwait(false);
+                    }
+                    catch (TimeoutException)
+                    {
+                        continue;
+                    }
+                    if (count == 0)
+                    {
+                        continue;
+                    }
+                    _capture?.RecordRead(memory.Span.Slice(0, count));
+                    writer.Advance(count);
+                    FlushResult flush = await writer.FlushAsync().ConfigureAwait(false);
+                    if (flush.IsCompleted)
+                    {
+                        break;
+                    }
+                }
+                await writer.CompleteAsync().ConfigureAwait(false);
+            }
+            catch (Exception e)
+            {
+                // Port closed, broken or cancelled, nothing more to parse
+                await writer.CompleteAsync(e).ConfigureAwait(false);
+            }
+        }
+
+        private async Task ParserLoopAsync()
+        {
+            PipeReader reader = _pipe.Reader;
+            try
+            {
+                while (true)
+                {
+                    ReadResult result = await reader.ReadAsync().ConfigureAwait(false);
+                    ReadOnlySequence<byte> buffer = result.Buffer;
+                    while (TryParseFrame(ref buffer))
+                    {
+                    }
+                    reader.AdvanceTo(buffer.Start, buffer.End);
+                    if (result.IsCompleted)
+                    {
+                        break;
+                    }
+                }
+                await reader.CompleteAsync().ConfigureAwait(false);
+            }
+            catch (Exception e)
+            {
+                await reader.CompleteAsync(e).ConfigureAwait(false);
+            }
+        }
+
+        /// <summary>
+        /// Consume one frame or garbage byte from buffer.
+        /// </summary>
+        /// <returns>False if more bytes are needed</returns>
+        private bool TryParseFrame(ref ReadOnlySequence<byte> buffer)
+        {
+            SequencePosition? start = buffer.PositionOf(SerialSymbols.FrameStart);
+            if (start == null)
+            {
+                buffer = buffer.Slice(buffer.End);
+                return false;
+            }
+            buffer = buffer.Slice(start.Value);
+            if (buffer.Length < 2)
+            {
+                return false;
+            }
+            int length = buffer.Slice(1, 1).FirstSpan[0] + 2;
+            if (length < SerialSymbols.MinFrameLength || length > SerialSymbols.MaxFrameLength)
+            {
+                // Not a frame start, resynchronize on next one
+                _metrics.OnInboundCorrupted();
+                buffer = buffer.Slice(1);
+                return true;
+            }
+            if (buffer.Length < length)
+            {
+                return false;
+            }
+            Span<byte> frame = stackalloc byte[length];
+            buffer.Slice(0, length).CopyTo(frame);
+            if (!SerialSymbols.XorChecker(frame.Slice(2, length - 3), frame[length - 1]))
+            {
+                _metrics.OnInboundCorrupted();
+                buffer = buffer.Slice(1);
+                return true;
+            }
+            buffer = buffer.Slice(length);
+            FrameHandler handler = _handlers[frame[2]];
+            if (handler == null)
+            {
+                _metrics.OnInboundUnrouted();
+            }
+            else
+            {
+                handler(frame);
+            }
+            return true;
+        }
+
+        protected virtual void Dispose(bool disposing)
+        {
+            if (!_disposedValue)
+            {
+                if (disposing)
+                {
+                    _shouldExit = true;
+                    _cancellation.Cancel();
+                    if (_readerThread != null && _readerThread.IsAlive && !_readerThread.Join(1000))
+                    {
+                        throw new Exception("Failed to terminate serial reader thread.");
+                    }
+                    // Loops complete the pipe on any exception, so waiting never throws
+                    if (_readerTask != null && !_readerTask.Wait(1000))
+                    {
+                        throw new Exception("Failed to terminate serial reader.");
+                    }
+                    if (_parserTask != null && !_parserTask.Wait(1000))
+                    {
+                        throw new Exception("Failed to terminate serial parser.");
+                    }
+                    _cancellation.Dispose();
+                }
+                _disposedValue = true;
+            }
+        }
+
+        public void Dispose()
+        {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
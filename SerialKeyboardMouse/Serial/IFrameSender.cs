@@ -0,0 +1,85 @@
+﻿using System;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// Delivers frames to device in-order, see <see cref="ReliableFrameSender"/>
+    /// and <see cref="AsyncFrameSender"/>.
+    /// </summary>
+    internal interface IFrameSender : IDisposable
+    {
+        /// <summary>
+        /// Counters of this link
+        /// </summary>
+        public LinkMetrics Metrics { get; }
+
+        /// <summary>
+        /// Pacer recording into <see cref="LinkMetrics.Pacing"/>, shared with other paced operations of this link.
+        /// </summary>
+        public PrecisionPacer Pacer { get; }
+
+        /// <summary>
+        /// Receiver of all inbound frames, to register handlers of unsolicited device messages.
+        /// </summary>
+        public FrameReceiver Receiver { get; }
+
+        /// <summary>
+        /// Whether target can receive reports. Frames rejected as not ready are held until it is.
+        /// </summary>
+        public UsbReadiness Readiness { get; }
+
+        /// <summary>
+        /// Number of frames waiting to be sent
+        /// </summary>
+        public int QueueDepth { get; }
+
+        /// <summary>
+        /// True if this sender parks no thread of its own, so callers should not either.
+        /// </summary>
+        public bool IsAsynchronous { get; }
+
+        /// <summary>
+        /// Enable the delay between retries of all key/button operations.
+        /// </summary>
+        public bool EnableKeyRetryDelay { get; set; }
+
+        /// <summary>
+        /// Enable the delay between retries of mouse move operations.
+        /// </summary>
+        public bool EnableMouseMoveRetryDelay { get; set; }
+
+        /// <summary>
+        /// Wrap commands in <see cref="SerialSymbols.FrameType.Tagged"/>, so device re-acknowledges a retransmission
+        /// without executing it again, and retry sooner. Only set if device reports
+        /// <see cref="SerialSymbols.DeviceCapabilities.FrameTags"/>.
+        /// </summary>
+        public bool EnableFrameTags { get; set; }
+
+        /// <summary>
+        /// Invoked on sending thread when device acknowledges a frame, before its task completes.
+        /// Must not block.
+        /// </summary>
+        public Action<SerialCommandFrame> FrameAcknowledged { get; set; }
+
+        /// <summary>
+        /// Send frame to serial, and wait respond. A frame still queued when token is cancelled or deadline
+        /// passes is skipped, never sent.
+        /// </summary>
+        /// <param name="frame">Frame to send</param>
+        /// <param name="token">Cancels frame while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which frame is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException"> If timeout or exceed maximum number of retries.</exception>
+        /// <exception cref="TimeoutException"> If deadline passed before frame was delivered.</exception>
+        /// <exception cref="OperationCanceledException"> If cancelled before frame was sent.</exception>
+        public Task SendFrame(SerialCommandFrame frame, CancellationToken token = default, DateTime? deadline = null);
+
+        /// <summary>
+        /// Send a query frame, and wait for device's reply of the same type.
+        /// </summary>
+        /// <returns>Complete reply frame, checksum verified.</returns>
+        /// <exception cref="SerialDeviceException"> If timeout or exceed maximum number of retries.</exception>
+        public Task<byte[]> SendQuery(SerialCommandFrame frame);
+    }
+}
@@ -0,0 +1,62 @@
+﻿using System;
+using System.Diagnostics;
+using System.Threading;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// Time source and delay primitives of <see cref="ReliableFrameSender"/>. Default is real time.
+    /// Inject <see cref="VirtualSenderClock"/> with <see cref="SimulatedSerialAdaptor"/> to run retry and
+    /// timeout scenarios without waiting real time.
+    /// </summary>
+    public interface ISenderClock
+    {
+        /// <summary>
+        /// Ticks of <see cref="GetTimestamp"/> per second
+        /// </summary>
+        public long Frequency { get; }
+
+        public long GetTimestamp();
+
+        /// <summary>
+        /// Block sending thread for a duration.
+        /// </summary>
+        public void Delay(TimeSpan duration);
+
+        /// <summary>
+        /// Block sending thread until handle is set or timeout.
+        /// </summary>
+        /// <returns>False if timeout</returns>
+        public bool Wait(ManualResetEventSlim handle, TimeSpan timeout);
+    }
+
+    /// <summary>
+    /// Real time, with delays paced by the link's <see cref="PrecisionPacer"/> so they are recorded in metrics.
+    /// </summary>
+    internal sealed class SystemSenderClock : ISenderClock
+    {
+        private readonly PrecisionPacer _pacer;
+
+        public SystemSenderClock(PrecisionPacer pacer)
+        {
+            _pacer = pacer;
+        }
+
+        public long Frequency => Stopwatch.Frequency;
+
+        public long GetTimestamp()
+        {
+            return Stopwatch.GetTimestamp();
+        }
+
+        public void Delay(TimeSpan duration)
+        {
+            _pacer.Delay(duration);
+        }
+
+        public bool Wait(ManualResetEventSlim handle, TimeSpan timeout)
+        {
+            return handle.Wait(timeout);
+        }
+    }
+}
@@ -1,263 +1,450 @@
-﻿using System;
-using System.Collections.Concurrent;
-using System.Collections.Generic;
-using System.Diagnostics;
-using System.Linq;
-using System.Text;
-using System.Threading;
-using System.Threading.Tasks;
-
-namespace SerialKeyboardMouse.Serial
-{
-    /// <summary>
-    /// A reliable serial communication utility class to make sure all
-    /// commands are sent correctly and in-order. Otherwise, throw exception
-    /// <see cref="SerialDeviceException"/>. If a frame was received by the device,
-    /// device will loop it back.
-    /// </summary>
-    internal class ReliableFrameSender : IDisposable
-    {
-        /// <summary>
-        /// Max number of retries when timeout or unsuccessful
-        /// </summary>
-        private const int NumMaxRetries = 3;
-
-        /// <summary>
-        /// Time interval in ms between each retries
-        /// </summary>
-        private const int RetryInterval = 120;
-
-        /// <summary>
-        /// Timeout when waiting for command loop back. Unit in ms.
-        /// </summary>
-        private const int CommandTimeout = 20;
-
-        /// <summary>
-        /// Maximum number of frame pending for send.
-        /// </summary>
-        private const int MaxNumQueuedTask = 50;
-
-        private readonly ISerialAdaptor _serial;
-
-        /// <summary>
-        /// All serial I/O happens in this thread
-        /// </summary>
-        private readonly Thread _thread;
-
-        private readonly EventWaitHandle _threadTrigger;
-
-        private volatile bool _shouldExit;
-        private bool _disposedValue;
-        private readonly ConcurrentQueue<SenderTask> _senderTasks;
-
-        private readonly Random _random;
-
-        /// <summary>
-        /// Enable the delay between retries of all key/button operations. Default is true.
-        /// Set this can make sure our HID report interval is big enough.
-        /// </summary>
-        public bool EnableKeyRetryDelay { get; set; } = true;
-
-        /// <summary>
-        /// Enable the delay between retries of mouse move operations. Default is false
-        /// </summary>
-        public bool EnableMouseMoveRetryDelay { get; set; } = false;
-
-        public ReliableFrameSender(ISerialAdaptor serial)
-        {
-            _serial = serial ?? throw new ArgumentNullException(nameof(serial));
-            _shouldExit = false;
-            _threadTrigger = new EventWaitHandle(false, EventResetMode.AutoReset);
-            _senderTasks = new ConcurrentQueue<SenderTask>();
-            _random = new Random();
-            _thread = new Thread(new ThreadStart(ThreadLoop));
-            _thread.Priority = ThreadPriority.Highest;
-            _thread.Start();
-        }
-
-        /// <summary>
-        /// Send frame bytes to serial, and wait respond. 
-        /// </summary>
-        /// <param name="bytes">Bytes to sent</param>
-        /// <exception cref="SerialDeviceException"> If timeout or exceed maximum number of retries.</exception>
-        public Task SendFrame(SerialCommandFrame frame)
-        {
-            if (_senderTasks.Count > MaxNumQueuedTask)
-            {
-                throw new SerialDeviceException($"Too many frames ({_senderTasks.Count}) queued!");
-            }
-
-            SenderTask task = new SenderTask(frame);
-
-            if (!ValidFrameBytes(task.BytesToSend))
-            {
-                throw new ArgumentException("Invalid frame bytes!");
-            }
-
-            _senderTasks.Enqueue(task);
-            _threadTrigger.Set();
-
-            return task.AwaitSource.Task;
-        }
-
-        private void ThreadLoop()
-        {
-            Stopwatch stopwatch = new Stopwatch();
-            byte[] desiredLoopback = new byte[SerialSymbols.MaxFrameLength];
-
-            while (true)
-            {
-                // Get next task
-                if (!_senderTasks.TryDequeue(out SenderTask toSend))
-                {
-                    _threadTrigger.WaitOne();
-                }
-
-                if (_shouldExit)
-                {
-                    return; // Terminate thread
-                }
-
-                if (toSend == null)
-                {
-                    continue;
-                }
-
-                try
-                {
-                    // Load bytes to thread local array
-                    toSend.BytesToSend.CopyTo(new Memory<byte>(desiredLoopback));
-                    int length = toSend.BytesToSend.Length;
-
-                    // Loop for retry
-                    for (int i = 0; i < NumMaxRetries; ++i)
-                    {
-                        // Send command
-                        _serial.Write(toSend.BytesToSend);
-
-                        // Start timer
-                        stopwatch.Restart();
-
-                        // Wait loop back
-                        int index = 0;
-                        for (byte
-                            c = _serial.ReadByte(out bool _); // We don't care timeout here, and it shouldn't happen
-                            stopwatch.ElapsedMilliseconds <= CommandTimeout;
-                            c = _serial.ReadByte(out _))
-                        {
-                            if (c == desiredLoopback[index])
-                            {
-                                if (++index == length)
-                                {
-                                    goto onSuccessful;
-                                }
-                            }
-                            else
-                            {
-                                index = 0;
-                            }
-                        }
-                        // Retry delay if needed
-                        if ((toSend.Original.Type == SerialSymbols.FrameType.MouseMove && EnableMouseMoveRetryDelay)
-                            || (toSend.Original.Type != SerialSymbols.FrameType.MouseMove && EnableKeyRetryDelay))
-                        {
-                            Thread.Sleep(RetryInterval + _random.Next(-20, 20));
-                        }
-                        // Clean serial buffer
-                        _serial.DiscardReadBuffer();
-                    }
-                    toSend.AwaitSource.SetException(
-                        new SerialDeviceException($"Command failed or timeout after {NumMaxRetries} retries."));
-                    continue;
-                onSuccessful:
-                    toSend.AwaitSource.SetResult();
-                    continue;
-                }
-                catch (Exception e)
-                {
-                    toSend.AwaitSource.SetException(e);
-                }
-            }
-        }
-
-        private static bool ValidFrameBytes(Memory<byte> memory)
-        {
-            Span<byte> span = memory.Span;
-            int length = span.Length;
-            if (length > SerialSymbols.MaxFrameLength || length < SerialSymbols.MinFrameLength)
-            {
-                return false;
-            }
-
-            if (span[0] != SerialSymbols.FrameStart)
-            {
-                return false;
-            }
-
-            SerialSymbols.FrameType type = (SerialSymbols.FrameType)span[2];
-            if (!SerialSymbols.ValidFrameTypes.Contains(type))
-            {
-                return false;
-            }
-
-            byte checksum = span[length - 1];
-            if (!SerialSymbols.XorChecker(memory.Slice(2, length - 3), checksum))
-            {
-                return false;
-            }
-
-            return true;
-        }
-
-        ~ReliableFrameSender()
-        {
-            _shouldExit = true;
-            _threadTrigger.Set();
-            if (!_thread.Join(1000))
-            {
-                throw new Exception("Failed to terminate serial sender thread.");
-            }
-        }
-
-        private class SenderTask
-        {
-            public TaskCompletionSource AwaitSource { get; }
-
-            public Memory<byte> BytesToSend { get; }
-
-            public SerialCommandFrame Original { get; }
-
-            public SenderTask(SerialCommandFrame frame)
-            {
-                AwaitSource = new TaskCompletionSource();
-                Original = frame;
-                BytesToSend = frame.Bytes;
-            }
-        }
-
-        protected virtual void Dispose(bool disposing)
-        {
-            if (!_disposedValue)
-            {
-                if (disposing)
-                {
-                    _serial.Dispose();
-                    _threadTrigger.Dispose();
-                    _shouldExit = true;
-                    _threadTrigger.Set();
-                    if (!_thread.Join(1000))
-                    {
-                        throw new Exception("Failed to terminate serial sender thread.");
-                    }
-                }
-                _disposedValue = true;
-            }
-        }
-
-        public void Dispose()
-        {
-            Dispose(disposing: true);
-            GC.SuppressFinalize(this);
-        }
-    }
-}
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// A reliable serial communication utility class to make sure all
+    /// commands are sent correctly and in-order. Otherwise, throw exception
+    /// <see cref="SerialDeviceException"/>. If a frame was received by the device,
+    /// device will loop it back. Inbound bytes are parsed by <see cref="FrameReceiver"/>,
+    /// other consumers can register for frame types there.
+    /// </summary>
+    internal class ReliableFrameSender : IFrameSender
+    {
+        /// <summary>
+        /// Max number of retries when timeout or unsuccessful
+        /// </summary>
+        internal const int NumMaxRetries = 3;
+
+        /// <summary>
+        /// Time interval in ms between each retries
+        /// </summary>
+        internal const int RetryInterval = 120;
+
+        /// <summary>
+        /// Timeout when waiting for command loop back. Unit in ms.
+        /// </summary>
+        internal const int CommandTimeout = 20;
+
+        /// <summary>
+        /// Max number of retries of tagged frames. Retransmissions cannot execute twice, so they are sent sooner and more often.
+        /// </summary>
+        internal const int NumMaxTaggedRetries = 6;
+
+        /// <summary>
+        /// Timeout when waiting for loop back of a tagged frame. Unit in ms.
+        /// </summary>
+        internal const int TaggedCommandTimeout = 8;
+
+        /// <summary>
+        /// Maximum number of frame pending for send.
+        /// </summary>
+        internal const int MaxNumQueuedTask = 50;
+
+        /// <summary>
+        /// How long a frame rejected as not ready is held, waiting for target to enumerate or resume.
+        /// </summary>
+        internal static readonly TimeSpan NotReadyTimeout = TimeSpan.FromSeconds(60);
+
+        private readonly ISerialAdaptor _serial;
+
+        /// <summary>
+        /// Optional capture of all serial traffic, null if disabled
+        /// </summary>
+        private readonly WireCapture _capture;
+
+        /// <summary>
+        /// All serial I/O happens in this thread
+        /// </summary>
+        private readonly Thread _thread;
+
+        private readonly EventWaitHandle _threadTrigger;
+
+        /// <summary>
+        /// Parses everything device sends, and routes loop-backs to <see cref="OnResponse"/>
+        /// </summary>
+        private readonly FrameReceiver _receiver;
+
+        /// <summary>
+        /// Task waiting for loop back, null if none
+        /// </summary>
+        private volatile SenderTask _inFlight;
+
+        /// <summary>
+        /// Set by receiver when in-flight task is acknowledged
+        /// </summary>
+        private readonly ManualResetEventSlim _responseEvent;
+
+        /// <summary>
+        /// Non-zero if in-flight task was answered by NACK instead of loop back
+        /// </summary>
+        private volatile int _rejectReason;
+
+        private readonly UsbReadiness _readiness;
+
+        private volatile bool _shouldExit;
+        private bool _disposedValue;
+        private readonly ConcurrentQueue<SenderTask> _senderTasks;
+
+        private readonly Random _random;
+
+        /// <summary>
+        /// Tag of next tagged frame, only touched by sending thread
+        /// </summary>
+        private byte _nextTag;
+
+        /// <summary>
+        /// Tagged bytes of in-flight frame, reused for every tagged frame, only touched by sending thread
+        /// </summary>
+        private readonly byte[] _taggedBuffer = new byte[SerialSymbols.MaxFrameLength + 2];
+
+        /// <summary>
+        /// Paces retry back-off precisely instead of Thread.Sleep
+        /// </summary>
+        private readonly PrecisionPacer _pacer;
+
+        /// <summary>
+        /// Source of all time and waits of sending thread, real unless injected
+        /// </summary>
+        private readonly ISenderClock _clock;
+
+        /// <summary>
+        /// Counters of this link
+        /// </summary>
+        public LinkMetrics Metrics { get; }
+
+        /// <summary>
+        /// Pacer recording into <see cref="LinkMetrics.Pacing"/>, shared with other paced operations of this link.
+        /// </summary>
+        public PrecisionPacer Pacer => _pacer;
+
+        /// <summary>
+        /// Receiver of all inbound frames, to register handlers of unsolicited device messages.
+        /// </summary>
+        public FrameReceiver Receiver => _receiver;
+
+        public UsbReadiness Readiness => _readiness;
+
+        /// <summary>
+        /// Number of frames waiting to be sent
+        /// </summary>
+        public int QueueDepth => _senderTasks.Count;
+
+        public bool IsAsynchronous => false;
+
+        public Action<SerialCommandFrame> FrameAcknowledged { get; set; }
+
+        /// <summary>
+        /// Enable the delay between retries of all key/button operations. Default is true.
+        /// Set this can make sure our HID report interval is big enough.
+        /// </summary>
+        public bool EnableKeyRetryDelay { get; set; } = true;
+
+        /// <summary>
+        /// Enable the delay between retries of mouse move operations. Default is false
+        /// </summary>
+        public bool EnableMouseMoveRetryDelay { get; set; } = false;
+
+        public bool EnableFrameTags { get; set; }
+
+        /// <param name="serial">Serial adaptor of device</param>
+        /// <param name="capture">Capture receiving all serial traffic, or null</param>
+        /// <param name="clock">Clock of timeouts and delays, or null for real time</param>
+        public ReliableFrameSender(ISerialAdaptor serial, WireCapture capture = null, ISenderClock clock = null)
+        {
+            _serial = serial ?? throw new ArgumentNullException(nameof(serial));
+            _capture = capture;
+            _shouldExit = false;
+            _threadTrigger = new EventWaitHandle(false, EventResetMode.AutoReset);
+            _senderTasks = new ConcurrentQueue<SenderTask>();
+            // Injected clocks get a fixed jitter sequence, so simulated runs repeat exactly
+            _random = clock == null ? new Random() : new Random(0);
+            // Random start, so a new session is unlikely to repeat the frame device remembers from the last one
+            _nextTag = (byte)_random.Next(256);
+            Metrics = new LinkMetrics();
+            _pacer = new PrecisionPacer(Metrics.Pacing);
+            _clock = clock ?? new SystemSenderClock(_pacer);
+            _responseEvent = new ManualResetEventSlim(false);
+            _readiness = new UsbReadiness();
+            _receiver = new FrameReceiver(serial, Metrics, capture);
+            foreach (SerialSymbols.FrameType type in SerialSymbols.ValidFrameTypes)
+            {
+                if (!SerialSymbols.UnacknowledgedFrameTypes.Contains(type))
+                {
+                    _receiver.Register(type, OnResponse);
+                }
+            }
+            _receiver.Register(SerialSymbols.FrameType.Nack, OnNack);
+            _receiver.Register(SerialSymbols.FrameType.EventUsbStatus, _readiness.OnStatusEvent);
+            _receiver.Start();
+            _thread = new Thread(new ThreadStart(ThreadLoop));
+            _thread.Priority = ThreadPriority.Highest;
+            _thread.Start();
+        }
+
+        /// <summary>
+        /// Send frame bytes to serial, and wait respond. A frame still queued when token is cancelled or
+        /// deadline passes is skipped by the sending thread.
+        /// </summary>
+        /// <param name="frame">Frame to send</param>
+        /// <param name="token">Cancels frame while it is queued</param>
+        /// <param name="deadline">Time (UTC) after which frame is no longer sent, null if none</param>
+        /// <exception cref="SerialDeviceException"> If timeout or exceed maximum number of retries.</exception>
+        /// <exception cref="TimeoutException"> If deadline passed before frame was delivered.</exception>
+        public Task SendFrame(SerialCommandFrame frame, CancellationToken token = default, DateTime? deadline = null)
+        {
+            SenderTask task = new SenderTask(frame);
+            task.Watch(token, ToClockDeadline(deadline), Metrics);
+            Enqueue(task);
+            return task.AwaitSource.Task;
+        }
+
+        /// <summary>
+        /// Convert a deadline to a timestamp of sender's clock, which may be simulated.
+        /// </summary>
+        private long ToClockDeadline(DateTime? deadline)
+        {
+            if (!deadline.HasValue)
+            {
+                return long.MaxValue;
+            }
+            long now = _clock.GetTimestamp();
+            double ticks = (deadline.Value.ToUniversalTime() - DateTime.UtcNow).TotalSeconds * _clock.Frequency;
+            return ticks >= long.MaxValue - now ? long.MaxValue : now + (long)ticks;
+        }
+
+        /// <summary>
+        /// Send a query frame, and wait for device's reply of the same type.
+        /// </summary>
+        /// <param name="frame">Frame of a type in <see cref="SerialSymbols.ReplyLengthLookup"/></param>
+        /// <returns>Complete reply frame, checksum verified.</returns>
+        /// <exception cref="SerialDeviceException"> If timeout or exceed maximum number of retries.</exception>
+        public async Task<byte[]> SendQuery(SerialCommandFrame frame)
+        {
+            SenderTask task = SenderTask.OfQuery(frame);
+            Enqueue(task);
+            await task.AwaitSource.Task.ConfigureAwait(false);
+            return task.Reply;
+        }
+
+        private void Enqueue(SenderTask task)
+        {
+            if (_senderTasks.Count > MaxNumQueuedTask)
+            {
+                throw new SerialDeviceException($"Too many frames ({_senderTasks.Count}) queued!");
+            }
+
+            if (!SerialSymbols.ValidFrameBytes(task.BytesToSend))
+            {
+                throw new ArgumentException("Invalid frame bytes!");
+            }
+
+            _senderTasks.Enqueue(task);
+            _threadTrigger.Set();
+        }
+
+        private void ThreadLoop()
+        {
+            while (true)
+            {
+                // Get next task
+                if (!_senderTasks.TryDequeue(out SenderTask toSend))
+                {
+                    _threadTrigger.WaitOne();
+                }
+
+                if (_shouldExit)
+                {
+                    return; // Terminate thread
+                }
+
+                if (toSend == null)
+                {
+                    continue;
+                }
+
+                // Caller gave up while it was queued
+                if (!toSend.TryStart(_clock.GetTimestamp(), Metrics))
+                {
+                    continue;
+                }
+
+                try
+                {
+                    // Unacknowledged frames are written once, never waited or retried
+                    if (toSend.IsUnacknowledged)
+                    {
+                        _serial.Write(toSend.BytesToSend);
+                        toSend.CompleteUnacknowledged(_capture, Metrics);
+                        continue;
+                    }
+
+                    toSend.Prepare(EnableFrameTags, ref _nextTag, _taggedBuffer);
+                    TimeSpan timeout = TimeSpan.FromMilliseconds(toSend.TimeoutMilliseconds);
+
+                    // Receiver completes in-flight task through OnResponse or OnNack
+                    _responseEvent.Reset();
+                    _rejectReason = 0;
+                    _inFlight = toSend;
+                    long notReadyDeadline = long.MaxValue;
+                    long start = 0;
+                    bool notReady = false;
+
+                    bool acknowledged = false;
+
+                    // Loop for retry
+                    for (int i = 0; i < toSend.MaxRetries; ++i)
+                    {
+                        // Send command
+                        _serial.Write(toSend.BytesToSend);
+                        toSend.OnWritten(i, _capture, Metrics);
+
+                        // Start timer and wait loop back
+                        start = _clock.GetTimestamp();
+                        bool responded = _clock.Wait(_responseEvent, timeout);
+                        if (!responded)
+                        {
+                            // Retry delay if needed
+                            TimeSpan delay = toSend.RetryDelay(this, _random);
+                            if (delay > TimeSpan.Zero)
+                            {
+                                _clock.Delay(delay);
+                            }
+                            // Late loop back arrived during delay, no need to send again
+                            responded = _responseEvent.IsSet;
+                        }
+                        if (!responded)
+                        {
+                            continue;
+                        }
+                        if (_rejectReason == 0)
+                        {
+                            acknowledged = true;
+                            break;
+                        }
+
+                        // Target not ready. Hold this and all later frames until device reports ready,
+                        // then send again without counting a retry.
+                        Metrics.OnNotReadyRejection();
+                        if (notReadyDeadline == long.MaxValue)
+                        {
+                            notReadyDeadline = toSend.HoldDeadline(_clock.GetTimestamp(), _clock.Frequency);
+                        }
+                        _responseEvent.Reset();
+                        _rejectReason = 0;
+                        _inFlight = toSend;
+                        TimeSpan remaining = TimeSpan.FromSeconds(
+                            (notReadyDeadline - _clock.GetTimestamp()) / (double)_clock.Frequency);
+                        if (remaining <= TimeSpan.Zero || !_readiness.WaitReady(_clock, remaining))
+                        {
+                            notReady = true;
+                            break;
+                        }
+                        if (_shouldExit)
+                        {
+                            // Woken by dispose, not by target
+                            throw new ObjectDisposedException(nameof(ReliableFrameSender));
+                        }
+                        --i;
+                    }
+                    if (acknowledged)
+                    {
+                        toSend.Acknowledge((_clock.GetTimestamp() - start) * 1000000.0 / _clock.Frequency, Metrics,
+                            FrameAcknowledged);
+                        continue;
+                    }
+                    _inFlight = null;
+                    toSend.Fail(notReady, _clock.GetTimestamp(), _capture, Metrics);
+                }
+                catch (Exception e)
+                {
+                    _inFlight = null;
+                    toSend.AwaitSource.SetException(e);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Called by receiver for every valid inbound frame of a sent type.
+        /// Completes in-flight task on its exact loop-back, or for queries, on a reply of same type.
+        /// </summary>
+        private void OnResponse(ReadOnlySpan<byte> frame)
+        {
+            SenderTask task = _inFlight;
+            if (task == null || !task.AcceptResponse(frame))
+            {
+                // Late loop back of a task already given up, unless it is an event handled elsewhere
+                if (!SerialSymbols.EventFrameTypes.Contains((SerialSymbols.FrameType)frame[2]))
+                {
+                    Metrics.OnInboundUnrouted();
+                }
+                return;
+            }
+            _inFlight = null;
+            _responseEvent.Set();
+        }
+
+        /// <summary>
+        /// Called by receiver for every NACK. Completes in-flight task as rejected, if NACK is about it.
+        /// </summary>
+        private void OnNack(ReadOnlySpan<byte> frame)
+        {
+            SenderTask task = _inFlight;
+            if (frame.Length < 6 || task == null || frame[3] != (byte)task.Original.Type)
+            {
+                Metrics.OnInboundUnrouted();
+                return;
+            }
+            _readiness.OnNotReady();
+            _inFlight = null;
+            _rejectReason = frame[4];
+            _responseEvent.Set();
+        }
+
+        ~ReliableFrameSender()
+        {
+            // Never throw here, it would end the process
+            _shouldExit = true;
+            _threadTrigger.Set();
+            _readiness.Release();
+            _thread.Join(1000);
+        }
+
+        protected virtual void Dispose(bool disposing)
+        {
+            if (!_disposedValue)
+            {
+                if (disposing)
+                {
+                    _shouldExit = true;
+                    _threadTrigger.Set();
+                    // Thread may be holding a frame for target to boot
+                    _readiness.Release();
+                    if (!_thread.Join(1000))
+                    {
+                        throw new Exception("Failed to terminate serial sender thread.");
+                    }
+                    _receiver.Dispose();
+                    _serial.Dispose();
+                    _threadTrigger.Dispose();
+                    _responseEvent.Dispose();
+                    _readiness.Dispose();
+                }
+                _disposedValue = true;
+            }
+        }
+
+        public void Dispose()
+        {
+            Dispose(disposing: true);
+            GC.SuppressFinalize(this);
+        }
+    }
+}
@@ -0,0 +1,283 @@
+﻿using System;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// A frame queued in a sender, with the source completing its caller's task. Decisions both
+    /// <see cref="ReliableFrameSender"/> and <see cref="AsyncFrameSender"/> make about a frame, tagging, timeouts,
+    /// retry back-off, holding while target is not ready, and how it completes, live here so the two
+    /// engines only differ in how they write and wait.
+    /// </summary>
+    internal class SenderTask
+    {
+        public TaskCompletionSource AwaitSource { get; }
+
+        public Memory<byte> BytesToSend { get; private set; }
+
+        /// <summary>
+        /// True if sent wrapped in <see cref="SerialSymbols.FrameType.Tagged"/>
+        /// </summary>
+        public bool IsTagged { get; private set; }
+
+        public SerialCommandFrame Original { get; }
+
+        /// <summary>
+        /// Buffer of reply for query frames, null if frame is looped back
+        /// </summary>
+        public byte[] Reply { get; }
+
+        /// <summary>
+        /// Timestamp of sender's clock after which frame is no longer sent, <see cref="long.MaxValue"/> if none
+        /// </summary>
+        public long Deadline { get; private set; } = long.MaxValue;
+
+        /// <summary>
+        /// Loop-back timeout in ms, set by <see cref="Prepare"/>
+        /// </summary>
+        public int TimeoutMilliseconds { get; private set; }
+
+        /// <summary>
+        /// Transmissions before giving up, set by <see cref="Prepare"/>
+        /// </summary>
+        public int MaxRetries { get; private set; }
+
+        /// <summary>
+        /// True if frame is written once, never waited for nor retried
+        /// </summary>
+        public bool IsUnacknowledged => SerialSymbols.UnacknowledgedFrameTypes.Contains(Original.Type);
+
+        /// <summary>
+        /// <see cref="Queued"/> until sender takes it, then <see cref="Started"/>, or <see cref="Skipped"/> if
+        /// caller gave up first. Only a queued task may be skipped, a frame written cannot be called back.
+        /// </summary>
+        private int _state;
+
+        private const int Queued = 0;
+        private const int Started = 1;
+        private const int Skipped = 2;
+
+        private CancellationTokenRegistration _registration;
+
+        public SenderTask(SerialCommandFrame frame, byte[] reply = null)
+        {
+            // Completed from receiver's frame handler or sender's loop, neither may run callers' continuations
+            AwaitSource = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+            Original = frame;
+            BytesToSend = frame.Bytes;
+            Reply = reply;
+        }
+
+        /// <summary>
+        /// Create a task for a query frame, with reply buffer sized for its type.
+        /// </summary>
+        /// <exception cref="ArgumentException">If frame type has no reply.</exception>
+        public static SenderTask OfQuery(SerialCommandFrame frame)
+        {
+            if (!SerialSymbols.ReplyLengthLookup.TryGetValue(frame.Type, out int replyLength))
+            {
+                throw new ArgumentException($"Frame type {frame.Type} has no reply!");
+            }
+            return new SenderTask(frame, new byte[replyLength]);
+        }
+
+        /// <summary>
+        /// Skip this task if caller gives up before it is sent: cancellation completes it at once,
+        /// and sender skips it when dequeued. Call before enqueueing.
+        /// </summary>
+        /// <param name="token">Caller's token</param>
+        /// <param name="deadline">Timestamp of sender's clock, <see cref="long.MaxValue"/> if none</param>
+        /// <param name="metrics">Metrics counting skipped tasks</param>
+        public void Watch(CancellationToken token, long deadline, LinkMetrics metrics)
+        {
+            Deadline = deadline;
+            if (token.CanBeCanceled)
+            {
+                _registration = token.Register(() =>
+                {
+                    if (Interlocked.CompareExchange(ref _state, Skipped, Queued) == Queued)
+                    {
+                        metrics.OnFrameCancelled();
+                        AwaitSource.TrySetCanceled(token);
+                    }
+                });
+            }
+        }
+
+        /// <summary>
+        /// Called by sender on dequeue. Skips this task if cancelled, or expires it if deadline passed.
+        /// Never blocks, so skipped tasks cost the queue nothing.
+        /// </summary>
+        /// <param name="now">Timestamp of sender's clock</param>
+        /// <param name="metrics">Metrics counting expired tasks</param>
+        /// <returns>True if frame should be sent</returns>
+        public bool TryStart(long now, LinkMetrics metrics)
+        {
+            if (Interlocked.CompareExchange(ref _state, Started, Queued) != Queued)
+            {
+                return false;
+            }
+            _registration.Dispose();
+            if (now < Deadline)
+            {
+                return true;
+            }
+            Expire(metrics);
+            return false;
+        }
+
+        /// <summary>
+        /// Fail this task because its deadline passed before device accepted it.
+        /// </summary>
+        public void Expire(LinkMetrics metrics)
+        {
+            metrics.OnFrameExpired();
+            AwaitSource.TrySetException(new TimeoutException(
+                $"Deadline passed before {Original.Type} frame could be delivered."));
+        }
+
+        /// <summary>
+        /// Decide how an acknowledged frame is sent, before its first transmission: tag it if enabled and its type
+        /// allows, then pick timeout and retries to match.
+        /// </summary>
+        /// <param name="enableTags">Sender's <see cref="IFrameSender.EnableFrameTags"/></param>
+        /// <param name="nextTag">Sender's next tag, advanced if used</param>
+        /// <param name="taggedBuffer">Sender's buffer for tagged frames, see <see cref="Tag"/></param>
+        public void Prepare(bool enableTags, ref byte nextTag, byte[] taggedBuffer)
+        {
+            if (enableTags && Reply == null && SerialSymbols.TaggableFrameTypes.Contains(Original.Type))
+            {
+                Tag(nextTag++, taggedBuffer);
+            }
+            TimeoutMilliseconds = IsTagged
+                ? ReliableFrameSender.TaggedCommandTimeout
+                : ReliableFrameSender.CommandTimeout;
+            MaxRetries = IsTagged ? ReliableFrameSender.NumMaxTaggedRetries : ReliableFrameSender.NumMaxRetries;
+        }
+
+        /// <summary>
+        /// Send this task's frame wrapped in <see cref="SerialSymbols.FrameType.Tagged"/>. Call before first send,
+        /// retransmissions then carry the same tag. Tagged bytes are encoded into the sender's buffer, which the
+        /// next tagged frame overwrites, so they are only valid while this task is in flight.
+        /// </summary>
+        /// <param name="tag">Tag, different from the one of previous tagged frame</param>
+        /// <param name="buffer">Buffer of <see cref="SerialSymbols.MaxFrameLength"/> + 2 bytes, owned by sender</param>
+        public void Tag(byte tag, byte[] buffer)
+        {
+            BytesToSend = new Memory<byte>(buffer, 0, Original.EncodeTagged(tag, buffer));
+            IsTagged = true;
+        }
+
+        /// <summary>
+        /// Check if an inbound frame acknowledges this task: its exact loop-back,
+        /// or for queries, a reply of the same type, which is copied to <see cref="Reply"/>.
+        /// </summary>
+        public bool AcceptResponse(ReadOnlySpan<byte> frame)
+        {
+            if (Reply == null)
+            {
+                return frame.SequenceEqual(BytesToSend.Span);
+            }
+            if (frame.Length != Reply.Length || frame[2] != (byte)Original.Type)
+            {
+                return false;
+            }
+            frame.CopyTo(Reply);
+            return true;
+        }
+
+        /// <summary>
+        /// Back-off before retransmitting after a timeout, <see cref="TimeSpan.Zero"/> if none.
+        /// </summary>
+        public TimeSpan RetryDelay(IFrameSender sender, Random random)
+        {
+            return ShouldDelayRetry(sender)
+                ? TimeSpan.FromMilliseconds(ReliableFrameSender.RetryInterval + random.Next(-20, 20))
+                : TimeSpan.Zero;
+        }
+
+        /// <summary>
+        /// Timestamp until which a frame rejected as not ready is held: <see cref="ReliableFrameSender.NotReadyTimeout"/>
+        /// after its first rejection, or the caller's deadline if sooner.
+        /// </summary>
+        /// <param name="now">Timestamp of sender's clock at first rejection</param>
+        /// <param name="frequency">Ticks per second of sender's clock</param>
+        public long HoldDeadline(long now, long frequency)
+        {
+            return Math.Min(now + (long)(ReliableFrameSender.NotReadyTimeout.TotalSeconds * frequency), Deadline);
+        }
+
+        /// <summary>
+        /// Record a transmission of this frame.
+        /// </summary>
+        /// <param name="attempt">0 for the first transmission, retries after</param>
+        public void OnWritten(int attempt, WireCapture capture, LinkMetrics metrics)
+        {
+            capture?.RecordWrite(BytesToSend.Span);
+            if (attempt > 0)
+            {
+                metrics.OnRetry();
+            }
+        }
+
+        /// <summary>
+        /// Complete an unacknowledged frame once written.
+        /// </summary>
+        public void CompleteUnacknowledged(WireCapture capture, LinkMetrics metrics)
+        {
+            capture?.RecordWrite(BytesToSend.Span);
+            metrics.OnUnacknowledgedSent();
+            AwaitSource.SetResult();
+        }
+
+        /// <summary>
+        /// Complete as acknowledged by device.
+        /// </summary>
+        /// <param name="ackMicroseconds">Time from last transmission to its loop back</param>
+        /// <param name="metrics">Metrics of sender</param>
+        /// <param name="acknowledged">Sender's <see cref="IFrameSender.FrameAcknowledged"/></param>
+        public void Acknowledge(double ackMicroseconds, LinkMetrics metrics, Action<SerialCommandFrame> acknowledged)
+        {
+            metrics.OnAck(ackMicroseconds);
+            metrics.OnFrameSent();
+            acknowledged?.Invoke(Original);
+            AwaitSource.SetResult();
+        }
+
+        /// <summary>
+        /// Complete as failed after all retries, or after being held while target was not ready. A frame held
+        /// until the caller's deadline was only ever rejected, never executed, so it expires instead.
+        /// </summary>
+        /// <param name="notReady">True if hold ended, false if retries ran out</param>
+        /// <param name="now">Timestamp of sender's clock</param>
+        public void Fail(bool notReady, long now, WireCapture capture, LinkMetrics metrics)
+        {
+            if (notReady && now >= Deadline)
+            {
+                Expire(metrics);
+                return;
+            }
+            capture?.RecordMarker(WireCaptureMarker.Failure, (byte)Original.Type);
+            metrics.OnFrameFailed();
+            AwaitSource.SetException(new SerialDeviceException(notReady
+                ? $"Target USB not ready within {ReliableFrameSender.NotReadyTimeout.TotalSeconds} seconds."
+                : $"Command failed or timeout after {MaxRetries} retries."));
+        }
+
+        /// <summary>
+        /// True if retries of this frame should be delayed, as configured in sender.
+        /// </summary>
+        private bool ShouldDelayRetry(IFrameSender sender)
+        {
+            // Device never executes a tagged frame twice, so there is no report interval to protect
+            if (IsTagged)
+            {
+                return false;
+            }
+            return Original.Type == SerialSymbols.FrameType.MouseMove
+                ? sender.EnableMouseMoveRetryDelay
+                : sender.EnableKeyRetryDelay;
+        }
+    }
+}
@@ -1,125 +1,298 @@
-﻿using System;
-using System.Buffers;
-using System.Numerics;
-
-namespace SerialKeyboardMouse.Serial
-{
-    internal class SerialCommandFrame
-    {
-        private static readonly ArrayPool<byte> FrameArrayPool
-            = ArrayPool<byte>.Create(SerialSymbols.MaxFrameLength, 1000);
-
-        /// <summary>
-        /// Length of raw frame in bytes
-        /// </summary>
-        public int Length { get; private set; }
-
-        private SerialSymbols.FrameType _type;
-        /// <summary>
-        /// Type of this serial frame
-        /// </summary>
-        public SerialSymbols.FrameType Type
-        {
-            get => _type;
-            private set
-            {
-                if (!SerialSymbols.FrameLengthLookup.TryGetValue(value, out int length))
-                {
-                    throw new ArgumentException("Invalid type of serial frame!");
-                }
-                _type = value;
-                Length = length;
-            }
-        }
-
-        /// <summary>
-        /// Key or value of press/release or scroll type, null otherwise
-        /// </summary>
-        public byte? Key { get; }
-
-        /// <summary>
-        /// Coordinate of move or resolution type, null otherwise
-        /// </summary>
-        public Tuple<ushort, ushort> Coordinate { get; }
-
-        private readonly byte[] _bytes;
-
-        /// <summary>
-        /// Bytes that are ready to send
-        /// </summary>
-        public Memory<byte> Bytes
-        {
-            get
-            {
-                _bytes[0] = SerialSymbols.FrameStart;
-                _bytes[1] = (byte)(Length - 2);
-                _bytes[2] = (byte)Type;
-                if (_isKeyType)
-                {
-                    _bytes[3] = Key.Value;
-                    _bytes[4] = SerialSymbols.XorChecksum(new Memory<byte>(_bytes, 2, 2));
-                }
-                else
-                {
-                    ushort x = Coordinate.Item1;
-                    ushort y = Coordinate.Item2;
-                    if (!BitConverter.TryWriteBytes(new Span<byte>(_bytes, 3, 2), x)
-                        || !BitConverter.TryWriteBytes(new Span<byte>(_bytes, 5, 2), y))
-                    {
-                        throw new Exception("BitConverter failed.");
-                    }
-                    _bytes[7] = SerialSymbols.XorChecksum(new Memory<byte>(_bytes, 2, 5));
-                }
-                return new Memory<byte>(_bytes, 0, Length);
-            }
-        }
-
-        private readonly bool _isKeyType;
-
-        private SerialCommandFrame(SerialSymbols.FrameType type, byte? key, Tuple<ushort, ushort> cord, bool keyType)
-        {
-            Type = type;
-            Key = key;
-            Coordinate = cord;
-            _bytes = FrameArrayPool.Rent(SerialSymbols.MaxFrameLength);
-            _isKeyType = keyType;
-        }
-
-        ~SerialCommandFrame()
-        {
-            FrameArrayPool.Return(_bytes, true);
-        }
-
-        /// <summary>
-        /// Construct a Key type of serial frame. (Scroll or key press/release)
-        /// </summary>
-        /// <param name="type">Type of serial command</param>
-        /// <param name="key">Key or value of this command</param>
-        /// <returns>Constructed frame</returns>
-        /// <exception cref="ArgumentException"> If type is not key/value </exception>
-        public static SerialCommandFrame OfKeyType(SerialSymbols.FrameType type, byte key)
-        {
-            if (!SerialSymbols.KeyFrameTypes.Contains(type))
-            {
-                throw new ArgumentException("Type is not Key type!");
-            }
-            return new SerialCommandFrame(type, key, null, true);
-        }
-
-        /// <summary>
-        /// Construct a coordinate type of serial frame. (Mouse move or change of resolution)
-        /// </summary>
-        /// <param name="type">Type of serial command</param>
-        /// <param name="cord">Coordinate of this command. First is X, second is Y.</param>
-        /// <returns>Constructed frame</returns>
-        /// <exception cref="ArgumentException"> If type is not coordinate type.</exception>
-        public static SerialCommandFrame OfCoordinateType(SerialSymbols.FrameType type, Tuple<ushort, ushort> cord)
-        {
-            if (!SerialSymbols.CoordinateFrameTypes.Contains(type))
-            {
-                throw new ArgumentException("Type is not Coordinate type!");
-            }
-            return new SerialCommandFrame(type, null, cord, false);
-        }
-    }
-}
+﻿using System;
+using System.Buffers;
+using System.Numerics;
+
+namespace SerialKeyboardMouse.Serial
+{
+    internal class SerialCommandFrame
+    {
+        private static readonly ArrayPool<byte> FrameArrayPool
+            = ArrayPool<byte>.Create(SerialSymbols.MaxFrameLength, 1000);
+
+        /// <summary>
+        /// Length of raw frame in bytes
+        /// </summary>
+        public int Length { get; private set; }
+
+        /// <summary>
+        /// Length of this frame wrapped in <see cref="SerialSymbols.FrameType.Tagged"/>
+        /// </summary>
+        public int TaggedLength => Length + 2;
+
+        private SerialSymbols.FrameType _type;
+        /// <summary>
+        /// Type of this serial frame
+        /// </summary>
+        public SerialSymbols.FrameType Type
+        {
+            get => _type;
+            private set
+            {
+                if (!SerialSymbols.FrameLengthLookup.TryGetValue(value, out int length))
+                {
+                    throw new ArgumentException("Invalid type of serial frame!");
+                }
+                _type = value;
+                Length = length;
+            }
+        }
+
+        /// <summary>
+        /// Key or value of press/release or scroll type, null otherwise
+        /// </summary>
+        public byte? Key { get; }
+
+        /// <summary>
+        /// Mouse buttons of key and mouse type, null otherwise
+        /// </summary>
+        public byte? Buttons { get; }
+
+        /// <summary>
+        /// Coordinate of move or resolution type, null otherwise
+        /// </summary>
+        public Tuple<ushort, ushort> Coordinate { get; }
+
+        /// <summary>
+        /// Sequence number of unreliable move type, null otherwise
+        /// </summary>
+        public byte? Sequence { get; }
+
+        /// <summary>
+        /// Keys of type keys type, null otherwise
+        /// </summary>
+        public byte[] Keys { get; }
+
+        private readonly byte[] _bytes;
+
+        /// <summary>
+        /// Bytes that are ready to send. Encoded once on construction, so sending
+        /// the same frame again costs nothing.
+        /// </summary>
+        public Memory<byte> Bytes => new Memory<byte>(_bytes, 0, Length);
+
+        private readonly bool _isKeyType;
+
+        private SerialCommandFrame(SerialSymbols.FrameType type, byte? key, Tuple<ushort, ushort> cord, bool keyType,
+            byte? sequence = null, byte? buttons = null, byte[] keys = null)
+        {
+            Type = type;
+            Key = key;
+            Buttons = buttons;
+            Coordinate = cord;
+            Sequence = sequence;
+            Keys = keys;
+            _bytes = FrameArrayPool.Rent(SerialSymbols.MaxFrameLength);
+            _isKeyType = keyType;
+            Encode();
+        }
+
+        private void Encode()
+        {
+            _bytes[0] = SerialSymbols.FrameStart;
+            _bytes[1] = (byte)(Length - 2);
+            _bytes[2] = (byte)Type;
+            if (Keys != null)
+            {
+                Keys.CopyTo(_bytes, 3);
+            }
+            else if (_isKeyType)
+            {
+                _bytes[3] = Key.Value;
+                if (Buttons.HasValue)
+                {
+                    _bytes[4] = Buttons.Value;
+                }
+            }
+            else
+            {
+                ushort x = Coordinate.Item1;
+                ushort y = Coordinate.Item2;
+                if (!BitConverter.TryWriteBytes(new Span<byte>(_bytes, 3, 2), x)
+                    || !BitConverter.TryWriteBytes(new Span<byte>(_bytes, 5, 2), y))
+                {
+                    throw new Exception("BitConverter failed.");
+                }
+                if (Sequence.HasValue)
+                {
+                    _bytes[7] = Sequence.Value;
+                }
+            }
+            _bytes[Length - 1] = SerialSymbols.XorChecksum(new Memory<byte>(_bytes, 2, Length - 3));
+        }
+
+        /// <summary>
+        /// Encode this frame wrapped in <see cref="SerialSymbols.FrameType.Tagged"/>.
+        /// </summary>
+        /// <param name="tag">Tag, different from the one of previous tagged frame</param>
+        /// <returns>Bytes that are ready to send</returns>
+        /// <exception cref="InvalidOperationException"> If type cannot be tagged.</exception>
+        public byte[] EncodeTagged(byte tag)
+        {
+            byte[] bytes = new byte[TaggedLength];
+            EncodeTagged(tag, bytes);
+            return bytes;
+        }
+
+        /// <summary>
+        /// Encode this frame wrapped in <see cref="SerialSymbols.FrameType.Tagged"/> into a buffer of caller,
+        /// so senders can reuse one buffer for every tagged frame.
+        /// </summary>
+        /// <param name="tag">Tag, different from the one of previous tagged frame</param>
+        /// <param name="destination">Buffer of at least <see cref="TaggedLength"/> bytes</param>
+        /// <returns>Number of bytes written</returns>
+        /// <exception cref="InvalidOperationException"> If type cannot be tagged.</exception>
+        /// <exception cref="ArgumentException"> If destination is too short.</exception>
+        public int EncodeTagged(byte tag, Span<byte> destination)
+        {
+            if (!SerialSymbols.TaggableFrameTypes.Contains(Type))
+            {
+                throw new InvalidOperationException($"Frame type {Type} cannot be tagged!");
+            }
+            int length = TaggedLength;
+            if (destination.Length < length)
+            {
+                throw new ArgumentException($"Buffer of {destination.Length} bytes cannot hold tagged frame of {length}!");
+            }
+            destination[0] = SerialSymbols.FrameStart;
+            destination[1] = (byte)(length - 2);
+            destination[2] = (byte)SerialSymbols.FrameType.Tagged;
+            destination[3] = tag;
+            new ReadOnlySpan<byte>(_bytes, 2, Length - 3).CopyTo(destination.Slice(4, Length - 3));
+            destination[length - 1] = SerialSymbols.XorChecksum(destination.Slice(2, length - 3));
+            return length;
+        }
+
+        ~SerialCommandFrame()
+        {
+            FrameArrayPool.Return(_bytes, true);
+        }
+
+        /// <summary>
+        /// Construct a Key type of serial frame. (Scroll or key press/release)
+        /// </summary>
+        /// <param name="type">Type of serial command</param>
+        /// <param name="key">Key or value of this command</param>
+        /// <returns>Constructed frame</returns>
+        /// <exception cref="ArgumentException"> If type is not key/value </exception>
+        public static SerialCommandFrame OfKeyType(SerialSymbols.FrameType type, byte key)
+        {
+            if (!SerialSymbols.KeyFrameTypes.Contains(type))
+            {
+                throw new ArgumentException("Type is not Key type!");
+            }
+            return new SerialCommandFrame(type, key, null, true);
+        }
+
+        /// <summary>
+        /// Construct a key and mouse type of serial frame, applied by device as one change.
+        /// </summary>
+        /// <param name="type">Type of serial command</param>
+        /// <param name="key">Key, 0 for none</param>
+        /// <param name="buttons">Mouse buttons, 0 for none</param>
+        /// <returns>Constructed frame</returns>
+        /// <exception cref="ArgumentException"> If type is not key and mouse type.</exception>
+        public static SerialCommandFrame OfKeyMouseType(SerialSymbols.FrameType type, byte key, byte buttons)
+        {
+            if (!SerialSymbols.KeyMouseFrameTypes.Contains(type))
+            {
+                throw new ArgumentException("Type is not key and mouse type!");
+            }
+            return new SerialCommandFrame(type, key, null, true, null, buttons);
+        }
+
+        /// <summary>
+        /// Construct a type keys frame, queued and typed by device.
+        /// </summary>
+        /// <param name="keys">Up to <see cref="SerialSymbols.TypeKeysPerFrame"/> usages,
+        /// with <see cref="SerialSymbols.TypeKeyShift"/> if typed with Shift</param>
+        /// <returns>Constructed frame</returns>
+        /// <exception cref="ArgumentException"> If there are too many keys, or one is 0.</exception>
+        public static SerialCommandFrame OfTypeKeys(ReadOnlySpan<byte> keys)
+        {
+            if (keys.Length > SerialSymbols.TypeKeysPerFrame || keys.IndexOf((byte)0) >= 0)
+            {
+                throw new ArgumentException("Invalid keys to type!");
+            }
+            byte[] padded = new byte[SerialSymbols.TypeKeysPerFrame];
+            keys.CopyTo(padded);
+            return new SerialCommandFrame(SerialSymbols.FrameType.TypeKeys, null, null, false, null, null, padded);
+        }
+
+        /// <summary>
+        /// Construct a coordinate type of serial frame. (Mouse move or change of resolution)
+        /// </summary>
+        /// <param name="type">Type of serial command</param>
+        /// <param name="cord">Coordinate of this command. First is X, second is Y.</param>
+        /// <returns>Constructed frame</returns>
+        /// <exception cref="ArgumentException"> If type is not coordinate type.</exception>
+        public static SerialCommandFrame OfCoordinateType(SerialSymbols.FrameType type, Tuple<ushort, ushort> cord)
+        {
+            if (!SerialSymbols.CoordinateFrameTypes.Contains(type))
+            {
+                throw new ArgumentException("Type is not Coordinate type!");
+            }
+            return new SerialCommandFrame(type, null, cord, false);
+        }
+
+        /// <summary>
+        /// Construct an unreliable mouse move, which device never loops back.
+        /// </summary>
+        /// <param name="cord">Coordinate. First is X, second is Y.</param>
+        /// <param name="sequence">Rolling sequence number, so device can count lost moves.</param>
+        /// <returns>Constructed frame</returns>
+        public static SerialCommandFrame OfUnreliableMove(Tuple<ushort, ushort> cord, byte sequence)
+        {
+            return new SerialCommandFrame(SerialSymbols.FrameType.MouseMoveUnreliable, null, cord, false, sequence);
+        }
+
+        /// <summary>
+        /// Reconstruct a frame from its encoded bytes, e.g. a frame stored in a compiled macro.
+        /// </summary>
+        /// <param name="bytes">Complete frame, starting with <see cref="SerialSymbols.FrameStart"/>.</param>
+        /// <returns>Constructed frame</returns>
+        /// <exception cref="ArgumentException"> If bytes are not a valid frame.</exception>
+        public static SerialCommandFrame Parse(ReadOnlySpan<byte> bytes)
+        {
+            if (bytes.Length < SerialSymbols.MinFrameLength || bytes.Length > SerialSymbols.MaxFrameLength
+                || bytes[0] != SerialSymbols.FrameStart || bytes[1] != bytes.Length - 2)
+            {
+                throw new ArgumentException("Malformed frame!");
+            }
+            SerialSymbols.FrameType type = (SerialSymbols.FrameType)bytes[2];
+            if (!SerialSymbols.FrameLengthLookup.TryGetValue(type, out int length) || length != bytes.Length)
+            {
+                throw new ArgumentException($"Invalid frame type 0x{bytes[2]:X2} or length!");
+            }
+            byte checksum = bytes[2];
+            for (int i = 3; i < bytes.Length - 1; ++i)
+            {
+                checksum ^= bytes[i];
+            }
+            if (checksum != bytes[^1])
+            {
+                throw new ArgumentException("Frame checksum mismatch!");
+            }
+            if (SerialSymbols.KeyFrameTypes.Contains(type))
+            {
+                return OfKeyType(type, bytes[3]);
+            }
+            if (SerialSymbols.KeyMouseFrameTypes.Contains(type))
+            {
+                return OfKeyMouseType(type, bytes[3], bytes[4]);
+            }
+            if (type == SerialSymbols.FrameType.TypeKeys)
+            {
+                ReadOnlySpan<byte> keys = bytes.Slice(3, SerialSymbols.TypeKeysPerFrame);
+                int used = keys.IndexOf((byte)0);
+                return OfTypeKeys(used < 0 ? keys : keys.Slice(0, used));
+            }
+            Tuple<ushort, ushort> cord = new Tuple<ushort, ushort>(
+                BitConverter.ToUInt16(bytes.Slice(3, 2)), BitConverter.ToUInt16(bytes.Slice(5, 2)));
+            if (type == SerialSymbols.FrameType.MouseMoveUnreliable)
+            {
+                return OfUnreliableMove(cord, bytes[7]);
+            }
+            return OfCoordinateType(type, cord);
+        }
+    }
+}
@@ -1,109 +1,319 @@
-﻿using System;
-using System.Collections.Generic;
-using System.Linq;
-using System.Text;
-using System.Threading.Tasks;
-
-namespace SerialKeyboardMouse.Serial
-{
-    public static class SerialSymbols
-    {
-        public const int BaudRate = 500000;
-
-        public const byte FrameStart = 0xAB;
-
-        public const int MinFrameLength = 5; // 0xAB <Length> <Type> <Value> <Checksum>
-
-        public const int MaxDataLength = 6; // Coordinate type, 4-byte coordinates + <Type> + <Checksum>
-
-        public const int MaxFrameLength = MaxDataLength + 2;
-
-        public enum FrameType
-        {
-            MouseMove = 0xAA,
-            MouseScroll = 0xAB,
-            MousePress = 0xAC,
-            MouseRelease = 0xAD,
-            MouseResolution = 0xAE,
-
-            KeyboardPress = 0xBB,
-            KeyboardRelease = 0xBC,
-
-            Unknown = 0xFF
-        }
-
-        public const int ReleaseAllKeys = 0x00;
-
-        [Flags]
-        public enum MouseButton
-        {
-            Left = 0x01,
-            Right = 0x02,
-            Middle = 0x04
-        }
-
-        /// <summary>
-        /// Set of all key/value frame type. (E.g. Scroll or key press)
-        /// </summary>
-        public static HashSet<FrameType> KeyFrameTypes = new HashSet<FrameType>
-        {
-            FrameType.MouseScroll,
-            FrameType.MousePress,
-            FrameType.MouseRelease,
-            FrameType.KeyboardPress,
-            FrameType.KeyboardRelease,
-        };
-
-        /// <summary>
-        /// Set of all coordinate frame type (E.g. Mouse move or change resolution).
-        /// </summary>
-        public static HashSet<FrameType> CoordinateFrameTypes = new HashSet<FrameType>
-        {
-            FrameType.MouseMove,
-            FrameType.MouseResolution,
-        };
-
-        /// <summary>
-        /// Dictionary mapped frame type to frame length
-        /// </summary>
-        public static Dictionary<FrameType, int> FrameLengthLookup =
-            new Dictionary<FrameType, int>
-            {
-                {FrameType.MouseMove, 8}, // 0xAB 0x06 0xAA <4-byte coordinate> <Checksum>
-                {FrameType.MouseScroll, 5}, // 0xAB 0x03 0xAB <Value> <Checksum>
-                {FrameType.MousePress, 5}, // 0xAB 0x03 0xAC <Key> <Checksum>
-                {FrameType.MouseRelease, 5}, // 0xAB 0x03 0xAD <Key> <Checksum>
-                {FrameType.MouseResolution, 8}, // 0xAB 0x06 0xAA <4-byte resolution> <Checksum>
-
-                {FrameType.KeyboardPress, 5}, // 0xAB 0x03 0xBB <Key> <Checksum>
-                {FrameType.KeyboardRelease, 5} // 0xAB 0x03 0xBC <Key> <Checksum>
-            };
-
-        /// <summary>
-        /// All valid frame types
-        /// </summary>
-        public static HashSet<FrameType> ValidFrameTypes
-            = new HashSet<FrameType>(FrameLengthLookup.Keys);
-
-        public static byte XorChecksum(Memory<byte> memory)
-        {
-            if (memory.Length == 0)
-            {
-                return 0;
-            }
-            Span<byte> arr = memory.Span;
-            byte ret = arr[0];
-            for (int i = 1; i < arr.Length; ++i)
-            {
-                ret ^= arr[i];
-            }
-            return ret;
-        }
-
-        public static bool XorChecker(Memory<byte> memory, byte desired)
-        {
-            return XorChecksum(memory) == desired;
-        }
-    }
-
-}
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse.Serial
+{
+    public static class SerialSymbols
+    {
+        public const int BaudRate = 500000;
+
+        public const byte FrameStart = 0xAB;
+
+        public const int MinFrameLength = 5; // 0xAB <Length> <Type> <Value> <Checksum>
+
+        public const int MaxDataLength = 8; // Statistics reply, <Type> + 6-byte statistics + <Checksum>
+
+        public const int MaxFrameLength = MaxDataLength + 2;
+
+        public enum FrameType
+        {
+            MouseMove = 0xAA,
+            MouseScroll = 0xAB,
+            MousePress = 0xAC,
+            MouseRelease = 0xAD,
+            MouseResolution = 0xAE,
+            MouseMoveUnreliable = 0xAF,
+
+            KeyboardPress = 0xBB,
+            KeyboardRelease = 0xBC,
+            KeyMousePress = 0xBD,
+            KeyMouseRelease = 0xBE,
+            TypeKeys = 0xBF,
+
+            QueryStats = 0xC0,
+            Nack = 0xC1,
+            QueryIdleStats = 0xC2,
+            Identify = 0xC3,
+            Tagged = 0xC4,
+
+            EventKeyboardLeds = 0xD0,
+            EventUsbStatus = 0xD1,
+
+            Unknown = 0xFF
+        }
+
+        public const int ReleaseAllKeys = 0x00;
+
+        /// <summary>
+        /// Keys carried by <see cref="FrameType.TypeKeys"/>, unused ones 0
+        /// </summary>
+        public const int TypeKeysPerFrame = 4;
+
+        /// <summary>
+        /// Bit of a key in <see cref="FrameType.TypeKeys"/> typing it with Shift
+        /// </summary>
+        public const byte TypeKeyShift = 0x80;
+
+        [Flags]
+        public enum MouseButton
+        {
+            Left = 0x01,
+            Right = 0x02,
+            Middle = 0x04
+        }
+
+        /// <summary>
+        /// Reason in <see cref="FrameType.Nack"/>
+        /// </summary>
+        public enum NackReason
+        {
+            NotConfigured = 0x01,
+            Suspended = 0x02
+        }
+
+        /// <summary>
+        /// Bits of <see cref="FrameType.EventUsbStatus"/>
+        /// </summary>
+        [Flags]
+        public enum UsbStatus
+        {
+            None = 0x00,
+            Configured = 0x01,
+            Suspended = 0x02
+        }
+
+        /// <summary>
+        /// Protocol version this library speaks, compared with <see cref="DeviceIdentity.ProtocolVersion"/>
+        /// </summary>
+        public const byte ProtocolVersion = 0x01;
+
+        /// <summary>
+        /// Capability bits of <see cref="FrameType.Identify"/>
+        /// </summary>
+        [Flags]
+        public enum DeviceCapabilities
+        {
+            None = 0x00,
+            UnreliableMove = 0x01,
+            KeyboardLeds = 0x02,
+            UsbStatus = 0x04,
+            IdleSleep = 0x08,
+            KeyMouseFrames = 0x10,
+            CompositeReport = 0x20,
+            FrameTags = 0x40,
+            Typing = 0x80
+        }
+
+        /// <summary>
+        /// LED bits of keyboard output report, set by target
+        /// </summary>
+        [Flags]
+        public enum KeyboardLeds
+        {
+            None = 0x00,
+            NumLock = 0x01,
+            CapsLock = 0x02,
+            ScrollLock = 0x04,
+            Compose = 0x08,
+            Kana = 0x10
+        }
+
+        /// <summary>
+        /// Set of all key/value frame type. (E.g. Scroll or key press)
+        /// </summary>
+        public static HashSet<FrameType> KeyFrameTypes = new HashSet<FrameType>
+        {
+            FrameType.MouseScroll,
+            FrameType.MousePress,
+            FrameType.MouseRelease,
+            FrameType.KeyboardPress,
+            FrameType.KeyboardRelease,
+            FrameType.QueryStats,
+            FrameType.QueryIdleStats,
+            FrameType.Identify,
+            FrameType.EventKeyboardLeds,
+            FrameType.EventUsbStatus,
+        };
+
+        /// <summary>
+        /// Set of frame types carrying a key and mouse buttons together. (E.g. Ctrl+Click)
+        /// </summary>
+        public static HashSet<FrameType> KeyMouseFrameTypes = new HashSet<FrameType>
+        {
+            FrameType.KeyMousePress,
+            FrameType.KeyMouseRelease,
+        };
+
+        /// <summary>
+        /// Set of all coordinate frame type (E.g. Mouse move or change resolution).
+        /// </summary>
+        public static HashSet<FrameType> CoordinateFrameTypes = new HashSet<FrameType>
+        {
+            FrameType.MouseMove,
+            FrameType.MouseResolution,
+        };
+
+        /// <summary>
+        /// Dictionary mapped frame type to frame length
+        /// </summary>
+        public static Dictionary<FrameType, int> FrameLengthLookup =
+            new Dictionary<FrameType, int>
+            {
+                {FrameType.MouseMove, 8}, // 0xAB 0x06 0xAA <4-byte coordinate> <Checksum>
+                {FrameType.MouseScroll, 5}, // 0xAB 0x03 0xAB <Value> <Checksum>
+                {FrameType.MousePress, 5}, // 0xAB 0x03 0xAC <Key> <Checksum>
+                {FrameType.MouseRelease, 5}, // 0xAB 0x03 0xAD <Key> <Checksum>
+                {FrameType.MouseResolution, 8}, // 0xAB 0x06 0xAA <4-byte resolution> <Checksum>
+
+                {FrameType.MouseMoveUnreliable, 9}, // 0xAB 0x07 0xAF <4-byte coordinate> <Sequence> <Checksum>
+
+                {FrameType.KeyboardPress, 5}, // 0xAB 0x03 0xBB <Key> <Checksum>
+                {FrameType.KeyboardRelease, 5}, // 0xAB 0x03 0xBC <Key> <Checksum>
+                {FrameType.KeyMousePress, 6}, // 0xAB 0x04 0xBD <Key> <Mouse buttons> <Checksum>
+                {FrameType.KeyMouseRelease, 6}, // 0xAB 0x04 0xBE <Key> <Mouse buttons> <Checksum>
+                {FrameType.TypeKeys, 8}, // 0xAB 0x06 0xBF <4 keys> <Checksum>
+
+                {FrameType.QueryStats, 5}, // 0xAB 0x03 0xC0 0x00 <Checksum>
+                {FrameType.QueryIdleStats, 5}, // 0xAB 0x03 0xC2 0x00 <Checksum>
+                {FrameType.Identify, 5}, // 0xAB 0x03 0xC3 0x00 <Checksum>
+
+                {FrameType.EventKeyboardLeds, 5}, // 0xAB 0x03 0xD0 0x00 <Checksum>, query of current LEDs
+                {FrameType.EventUsbStatus, 5} // 0xAB 0x03 0xD1 0x00 <Checksum>, query of current USB status
+            };
+
+        /// <summary>
+        /// Frame types that can be wrapped in <see cref="FrameType.Tagged"/>: commands looped back by device.
+        /// </summary>
+        public static HashSet<FrameType> TaggableFrameTypes = new HashSet<FrameType>
+        {
+            FrameType.MouseMove,
+            FrameType.MouseScroll,
+            FrameType.MousePress,
+            FrameType.MouseRelease,
+            FrameType.MouseResolution,
+            FrameType.KeyboardPress,
+            FrameType.KeyboardRelease,
+            FrameType.KeyMousePress,
+            FrameType.KeyMouseRelease,
+            FrameType.TypeKeys,
+        };
+
+        /// <summary>
+        /// Frame types never looped back by device. Sent once without retry.
+        /// </summary>
+        public static HashSet<FrameType> UnacknowledgedFrameTypes = new HashSet<FrameType>
+        {
+            FrameType.MouseMoveUnreliable,
+        };
+
+        /// <summary>
+        /// Frame types answered by a reply of the same type instead of loop-back, mapped to reply frame length.
+        /// </summary>
+        public static Dictionary<FrameType, int> ReplyLengthLookup =
+            new Dictionary<FrameType, int>
+            {
+                {FrameType.QueryStats, 10}, // 0xAB 0x08 0xC0 <2-byte received> <2-byte dropped> <2-byte corrupted> <Checksum>
+                {FrameType.QueryIdleStats, 10}, // 0xAB 0x08 0xC2 <2-byte wakes> <2-byte last latency> <2-byte max latency> <Checksum>
+                {FrameType.Identify, 10}, // 0xAB 0x08 0xC3 <4-byte device id> <Protocol version> <Capabilities> <Checksum>
+                {FrameType.EventKeyboardLeds, 5}, // 0xAB 0x03 0xD0 <LEDs> <Checksum>
+                {FrameType.EventUsbStatus, 9}, // 0xAB 0x07 0xD1 <Status> <2-byte ms to configured> <2-byte ms to first report> <Checksum>
+            };
+
+        /// <summary>
+        /// Frame types device sends unsolicited. These may also answer a query of the same type.
+        /// </summary>
+        public static HashSet<FrameType> EventFrameTypes = new HashSet<FrameType>
+        {
+            FrameType.EventKeyboardLeds,
+            FrameType.EventUsbStatus,
+        };
+
+        /// <summary>
+        /// All valid frame types. <see cref="FrameType.Tagged"/> has no fixed length, it is the wrapped frame's plus 2:
+        /// 0xAB &lt;Length&gt; 0xC4 &lt;Tag&gt; &lt;Wrapped type&gt; &lt;Wrapped data&gt; &lt;Checksum&gt;
+        /// </summary>
+        public static HashSet<FrameType> ValidFrameTypes
+            = new HashSet<FrameType>(FrameLengthLookup.Keys) { FrameType.Tagged };
+
+        /// <summary>
+        /// Type of command a frame carries, looking through <see cref="FrameType.Tagged"/>.
+        /// </summary>
+        public static FrameType CommandTypeOf(ReadOnlySpan<byte> frame)
+        {
+            if (frame.Length < 3)
+            {
+                return FrameType.Unknown;
+            }
+            if ((FrameType)frame[2] == FrameType.Tagged)
+            {
+                return frame.Length > 4 ? (FrameType)frame[4] : FrameType.Unknown;
+            }
+            return (FrameType)frame[2];
+        }
+
+        /// <summary>
+        /// Check bytes form a complete frame of a known type, with correct checksum.
+        /// </summary>
+        internal static bool ValidFrameBytes(Memory<byte> memory)
+        {
+            Span<byte> span = memory.Span;
+            int length = span.Length;
+            if (length > MaxFrameLength || length < MinFrameLength)
+            {
+                return false;
+            }
+
+            if (span[0] != FrameStart)
+            {
+                return false;
+            }
+
+            FrameType type = (FrameType)span[2];
+            if (!ValidFrameTypes.Contains(type))
+            {
+                return false;
+            }
+
+            byte checksum = span[length - 1];
+            if (!XorChecker(memory.Slice(2, length - 3), checksum))
+            {
+                return false;
+            }
+
+            return true;
+        }
+
+        public static byte XorChecksum(Memory<byte> memory)
+        {
+            return XorChecksum(memory.Span);
+        }
+
+        public static byte XorChecksum(ReadOnlySpan<byte> arr)
+        {
+            if (arr.Length == 0)
+            {
+                return 0;
+            }
+            byte ret = arr[0];
+            for (int i = 1; i < arr.Length; ++i)
+            {
+                ret ^= arr[i];
+            }
+            return ret;
+        }
+
+        public static bool XorChecker(Memory<byte> memory, byte desired)
+        {
+            return XorChecksum(memory) == desired;
+        }
+
+        public static bool XorChecker(ReadOnlySpan<byte> span, byte desired)
+        {
+            return XorChecksum(span) == desired;
+        }
+    }
+
+}
@@ -0,0 +1,240 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// Device and wire simulated on a <see cref="VirtualSenderClock"/>, for deterministic retry and timeout
+    /// scenarios with <see cref="ReliableFrameSender"/>. Every frame written is lost, executed without loop-back,
+    /// or executed and looped back (possibly corrupted) after a latency, as drawn from a seeded random source.
+    /// Only the dedicated-thread engine is supported, async members throw.
+    /// </summary>
+    public class SimulatedSerialAdaptor : ISerialAdaptor
+    {
+        /// <summary>
+        /// Real time a read blocks before reporting timeout, so receiver notices disposal quickly
+        /// </summary>
+        private const int ReadTimeout = 1;
+
+        private readonly VirtualSenderClock _clock;
+        private readonly Random _random;
+        private readonly object _lock = new object();
+        private readonly Queue<byte> _inbound = new Queue<byte>();
+
+        /// <summary>
+        /// True while receiver is blocked on an empty port, i.e. everything delivered has been handled
+        /// </summary>
+        private bool _readerIdle;
+
+        private int _framesReceived;
+        private int _framesExecuted;
+
+        /// <summary>
+        /// Last tagged frame executed, as device remembers it
+        /// </summary>
+        private byte[] _lastTagged;
+        private bool _disposedValue;
+
+        /// <summary>
+        /// Probability a frame from host is lost on the wire
+        /// </summary>
+        public double LossProbability { get; set; }
+
+        /// <summary>
+        /// Probability a frame is executed, but its loop-back is lost
+        /// </summary>
+        public double EchoLossProbability { get; set; }
+
+        /// <summary>
+        /// Probability a loop-back arrives with a flipped bit
+        /// </summary>
+        public double CorruptionProbability { get; set; }
+
+        /// <summary>
+        /// Time from frame written to loop-back received
+        /// </summary>
+        public TimeSpan Latency { get; set; } = TimeSpan.FromMilliseconds(1);
+
+        /// <summary>
+        /// Uniform extra latency, from zero to this
+        /// </summary>
+        public TimeSpan LatencyJitter { get; set; }
+
+        /// <summary>
+        /// Frames that reached device intact
+        /// </summary>
+        public int FramesReceived => Volatile.Read(ref _framesReceived);
+
+        /// <summary>
+        /// Frames executed by device, counting every retransmission executed again.
+        /// Retransmitted tagged frames are only looped back, as by firmware.
+        /// </summary>
+        public int FramesExecuted => Volatile.Read(ref _framesExecuted);
+
+        public event ISerialAdaptor.SerialDataAvailable SerialDataAvailableEvent;
+
+        public SimulatedSerialAdaptor(VirtualSenderClock clock, int seed)
+        {
+            _clock = clock ?? throw new ArgumentNullException(nameof(clock));
+            _random = new Random(seed);
+            _clock.AddQuiescenceCheck(IsDrained);
+        }
+
+        private bool IsDrained()
+        {
+            lock (_lock)
+            {
+                return _disposedValue || (_readerIdle && _inbound.Count == 0);
+            }
+        }
+
+        /// <summary>
+        /// Device side of a write. Called on sender thread, so random draws happen in a fixed order.
+        /// </summary>
+        public void Write(Memory<byte> memory)
+        {
+            byte[] frame = memory.ToArray();
+            if (_random.NextDouble() < LossProbability || !SerialSymbols.ValidFrameBytes(frame))
+            {
+                return;
+            }
+            Interlocked.Increment(ref _framesReceived);
+            SerialSymbols.FrameType type = (SerialSymbols.FrameType)frame[2];
+            if (type != SerialSymbols.FrameType.Tagged || _lastTagged == null || !frame.AsSpan().SequenceEqual(_lastTagged))
+            {
+                Interlocked.Increment(ref _framesExecuted);
+            }
+            if (type == SerialSymbols.FrameType.Tagged)
+            {
+                // Copy, loop-back below may be corrupted in place
+                _lastTagged = (byte[])frame.Clone();
+            }
+            if (SerialSymbols.UnacknowledgedFrameTypes.Contains(type) || _random.NextDouble() < EchoLossProbability)
+            {
+                return;
+            }
+            byte[] reply = frame;
+            if (SerialSymbols.ReplyLengthLookup.TryGetValue(type, out int replyLength))
+            {
+                // Queries are answered by a reply of the same type, all counters zero and target ready
+                reply = new byte[replyLength];
+                reply[0] = SerialSymbols.FrameStart;
+                reply[1] = (byte)(replyLength - 2);
+                reply[2] = (byte)type;
+                if (type == SerialSymbols.FrameType.EventUsbStatus)
+                {
+                    reply[3] = (byte)SerialSymbols.UsbStatus.Configured;
+                }
+                reply[^1] = SerialSymbols.XorChecksum(new ReadOnlySpan<byte>(reply, 2, replyLength - 3));
+            }
+            if (_random.NextDouble() < CorruptionProbability)
+            {
+                reply[2 + _random.Next(reply.Length - 2)] ^= (byte)(1 << _random.Next(8));
+            }
+            TimeSpan latency = Latency + TimeSpan.FromTicks((long)(_random.NextDouble() * LatencyJitter.Ticks));
+            _clock.Schedule(latency, () => Deliver(reply));
+        }
+
+        private void Deliver(byte[] bytes)
+        {
+            lock (_lock)
+            {
+                foreach (byte b in bytes)
+                {
+                    _inbound.Enqueue(b);
+                }
+                Monitor.PulseAll(_lock);
+            }
+            SerialDataAvailableEvent?.Invoke(this);
+        }
+
+        public void WriteByte(byte b)
+        {
+            Write(new[] {b});
+        }
+
+        public byte ReadByte(out bool timeout)
+        {
+            lock (_lock)
+            {
+                if (_inbound.Count == 0)
+                {
+                    _readerIdle = true;
+                    Monitor.Wait(_lock, ReadTimeout);
+                    if (_inbound.Count == 0)
+                    {
+                        timeout = true;
+                        return 0;
+                    }
+                }
+                _readerIdle = false;
+                timeout = false;
+                return _inbound.Dequeue();
+            }
+        }
+
+        public int Read(Memory<byte> memory)
+        {
+            lock (_lock)
+            {
+                int count = Math.Min(memory.Length, _inbound.Count);
+                Span<byte> span = memory.Span;
+                for (int i = 0; i < count; ++i)
+                {
+                    span[i] = _inbound.Dequeue();
+                }
+                return count;
+            }
+        }
+
+        public int AvailableBytes
+        {
+            get
+            {
+                lock (_lock)
+                {
+                    return _inbound.Count;
+                }
+            }
+        }
+
+        public void DiscardReadBuffer()
+        {
+            lock (_lock)
+            {
+                _inbound.Clear();
+            }
+        }
+
+        public ValueTask<int> AsyncRead(Memory<byte> memory, CancellationToken token = default)
+        {
+            throw new NotSupportedException("Simulation only drives the dedicated-thread engine.");
+        }
+
+        public ValueTask AsyncWrite(Memory<byte> memory, CancellationToken token = default)
+        {
+            throw new NotSupportedException("Simulation only drives the dedicated-thread engine.");
+        }
+
+        public ValueTask<byte> AsyncReadByte(CancellationToken token = default)
+        {
+            throw new NotSupportedException("Simulation only drives the dedicated-thread engine.");
+        }
+
+        public ValueTask AsyncWriteByte(byte b, CancellationToken token = default)
+        {
+            throw new NotSupportedException("Simulation only drives the dedicated-thread engine.");
+        }
+
+        public void Dispose()
+        {
+            lock (_lock)
+            {
+                _disposedValue = true;
+                Monitor.PulseAll(_lock);
+            }
+        }
+    }
+}
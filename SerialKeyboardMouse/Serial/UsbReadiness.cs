@@ -0,0 +1,115 @@
+﻿using System;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// Tracks whether target can receive reports, from device's USB status events and NACKs,
+    /// so senders can hold frames while target boots or sleeps instead of losing them.
+    /// Assumed ready until device says otherwise, so firmware without this support works as before.
+    /// </summary>
+    internal class UsbReadiness : IDisposable
+    {
+        private readonly ManualResetEventSlim _ready = new ManualResetEventSlim(true);
+        private readonly object _lock = new object();
+        private TaskCompletionSource _readySource;
+        private volatile TargetUsbStatus _status;
+        private bool _released;
+
+        /// <summary>
+        /// Last status reported by device, null if none yet
+        /// </summary>
+        public TargetUsbStatus Status => _status;
+
+        /// <summary>
+        /// Raised on receiving thread for every status reported by device
+        /// </summary>
+        public event Action<TargetUsbStatus> StatusChanged;
+
+        public UsbReadiness()
+        {
+            _readySource = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+            _readySource.SetResult();
+        }
+
+        /// <summary>
+        /// Handler of <see cref="SerialSymbols.FrameType.EventUsbStatus"/>
+        /// </summary>
+        public void OnStatusEvent(ReadOnlySpan<byte> frame)
+        {
+            TargetUsbStatus status = new TargetUsbStatus(frame);
+            _status = status;
+            SetReady(status.IsReady);
+            StatusChanged?.Invoke(status);
+        }
+
+        /// <summary>
+        /// Called when device rejected a frame as not ready. Device always reports
+        /// readiness after such rejection, so it is safe to wait for it.
+        /// </summary>
+        public void OnNotReady()
+        {
+            SetReady(false);
+        }
+
+        private void SetReady(bool ready)
+        {
+            lock (_lock)
+            {
+                if (ready)
+                {
+                    _ready.Set();
+                    _readySource.TrySetResult();
+                }
+                else if (_ready.IsSet && !_released)
+                {
+                    _ready.Reset();
+                    _readySource = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Wake every wait for readiness for good, as sender shuts down. Waits then return as if target was
+        /// ready, so waiter must check why it woke.
+        /// </summary>
+        public void Release()
+        {
+            lock (_lock)
+            {
+                _released = true;
+                _ready.Set();
+                _readySource.TrySetResult();
+            }
+        }
+
+        /// <param name="clock">Clock of the waiting sender</param>
+        /// <param name="timeout">Timeout in clock's time</param>
+        /// <returns>False if timeout</returns>
+        public bool WaitReady(ISenderClock clock, TimeSpan timeout)
+        {
+            return clock.Wait(_ready, timeout);
+        }
+
+        /// <returns>False if timeout</returns>
+        public async Task<bool> WaitReadyAsync(TimeSpan timeout, CancellationToken token)
+        {
+            Task ready;
+            lock (_lock)
+            {
+                ready = _readySource.Task;
+            }
+            if (ready.IsCompleted)
+            {
+                return true;
+            }
+            return await Task.WhenAny(ready, Task.Delay(timeout, token)).ConfigureAwait(false) == ready;
+        }
+
+        public void Dispose()
+        {
+            _ready.Dispose();
+        }
+    }
+}
@@ -0,0 +1,154 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Threading;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// Simulated time for <see cref="ReliableFrameSender"/>. Time only moves inside the sender's
+    /// <see cref="Wait"/> and <see cref="Delay"/>, and only once every simulated device reports everything it
+    /// delivered has been handled. It then jumps straight to the next scheduled event or deadline, so a 120 ms
+    /// retry back-off costs microseconds, and the outcome of a run depends only on the devices' seeds.
+    /// Only one thread, the sender's, may wait on a clock.
+    /// </summary>
+    public class VirtualSenderClock : ISenderClock
+    {
+        private readonly object _lock = new object();
+        private readonly List<ScheduledEvent> _events = new List<ScheduledEvent>();
+        private readonly List<Func<bool>> _quiescenceChecks = new List<Func<bool>>();
+        private long _now;
+        private long _sequence;
+
+        private readonly struct ScheduledEvent
+        {
+            public readonly long Due;
+
+            /// <summary>
+            /// Orders events due at the same time by scheduling order
+            /// </summary>
+            public readonly long Sequence;
+
+            public readonly Action Action;
+
+            public ScheduledEvent(long due, long sequence, Action action)
+            {
+                Due = due;
+                Sequence = sequence;
+                Action = action;
+            }
+        }
+
+        /// <summary>
+        /// Ticks are <see cref="TimeSpan"/> ticks
+        /// </summary>
+        public long Frequency => TimeSpan.TicksPerSecond;
+
+        public long GetTimestamp()
+        {
+            return Interlocked.Read(ref _now);
+        }
+
+        /// <summary>
+        /// Simulated time since clock was created
+        /// </summary>
+        public TimeSpan Elapsed => TimeSpan.FromTicks(GetTimestamp());
+
+        /// <summary>
+        /// Run action on waiting thread once simulated time reaches now + delay.
+        /// </summary>
+        public void Schedule(TimeSpan delay, Action action)
+        {
+            lock (_lock)
+            {
+                _events.Add(new ScheduledEvent(_now + Math.Max(0, delay.Ticks), _sequence++, action));
+            }
+        }
+
+        /// <summary>
+        /// Time is held while any check returns false, e.g. while delivered bytes are still being parsed.
+        /// </summary>
+        public void AddQuiescenceCheck(Func<bool> isQuiescent)
+        {
+            lock (_lock)
+            {
+                _quiescenceChecks.Add(isQuiescent);
+            }
+        }
+
+        public void Delay(TimeSpan duration)
+        {
+            Advance(null, duration);
+        }
+
+        public bool Wait(ManualResetEventSlim handle, TimeSpan timeout)
+        {
+            return Advance(handle, timeout);
+        }
+
+        private bool Advance(ManualResetEventSlim handle, TimeSpan timeout)
+        {
+            long deadline = GetTimestamp() + Math.Max(0, timeout.Ticks);
+            SpinWait spinner = new SpinWait();
+            while (true)
+            {
+                if (!IsQuiescent())
+                {
+                    // Receiver still handling what was delivered, which may set handle
+                    spinner.SpinOnce(-1);
+                    continue;
+                }
+                if (handle != null && handle.IsSet)
+                {
+                    return true;
+                }
+                Action due = null;
+                lock (_lock)
+                {
+                    int next = -1;
+                    for (int i = 0; i < _events.Count; ++i)
+                    {
+                        if (next < 0 || _events[i].Due < _events[next].Due
+                                     || (_events[i].Due == _events[next].Due && _events[i].Sequence < _events[next].Sequence))
+                        {
+                            next = i;
+                        }
+                    }
+                    if (next >= 0 && _events[next].Due <= deadline)
+                    {
+                        Interlocked.Exchange(ref _now, Math.Max(_now, _events[next].Due));
+                        due = _events[next].Action;
+                        _events.RemoveAt(next);
+                    }
+                    else
+                    {
+                        Interlocked.Exchange(ref _now, Math.Max(_now, deadline));
+                    }
+                }
+                if (due == null)
+                {
+                    return false;
+                }
+                due();
+                spinner = new SpinWait();
+            }
+        }
+
+        private bool IsQuiescent()
+        {
+            Func<bool>[] checks;
+            lock (_lock)
+            {
+                // Checks take devices' locks, never call them under ours
+                checks = _quiescenceChecks.ToArray();
+            }
+            foreach (Func<bool> check in checks)
+            {
+                if (!check())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+}
@@ -0,0 +1,298 @@
+﻿using System;
+using System.Diagnostics;
+using System.IO;
+using System.Text;
+using System.Threading;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// Kind of a record in wire capture
+    /// </summary>
+    public enum WireCaptureRecordKind
+    {
+        Write = 0,
+        Read = 1,
+        Marker = 2
+    }
+
+    /// <summary>
+    /// Out-of-band events recorded in wire capture
+    /// </summary>
+    public enum WireCaptureMarker
+    {
+        /// <summary>
+        /// Sender discarded serial receiving buffer
+        /// </summary>
+        Discard = 1,
+
+        /// <summary>
+        /// Sender gave up a frame after all retries
+        /// </summary>
+        Failure = 2,
+
+        /// <summary>
+        /// Records were dropped because capture ring was full. Argument is the number of lost records, saturated to 255.
+        /// </summary>
+        Lost = 3
+    }
+
+    /// <summary>
+    /// Cheap, always-on capture of every byte written to and read from serial, with high-resolution timestamps.
+    /// Writes and markers are appended by the sender, reads by the receiver's reader, into an in-memory ring
+    /// without allocation. Appends take a short lock, held only to copy the record, since the two producers
+    /// share the ring and the timestamp delta chain. A background thread flushes the ring into a capture file. When the file exceeds its
+    /// size limit, it is rotated to "&lt;path&gt;.1", so disk usage is bounded by twice the limit.
+    /// If writing the file fails, capturing stops and the cause is kept in <see cref="Error"/>; the link keeps running.
+    /// </summary>
+    /// <remarks>
+    /// File format: header "SKMC" &lt;u16 version&gt; &lt;i64 UTC start time ticks&gt; &lt;i64 base timestamp ticks&gt;,
+    /// followed by records. Each record is &lt;header&gt; &lt;varint timestamp delta&gt; &lt;payload&gt;.
+    /// Header bits 7..6 are <see cref="WireCaptureRecordKind"/>, bits 5..0 are payload length - 1.
+    /// Timestamps are in 100ns ticks since capture started; delta is relative to previous record,
+    /// the first record of a file is relative to base timestamp in header.
+    /// </remarks>
+    public sealed class WireCapture : IDisposable
+    {
+        internal static readonly byte[] Magic = Encoding.ASCII.GetBytes("SKMC");
+        internal const ushort FormatVersion = 1;
+        internal const int HeaderLength = 4 + 2 + 8 + 8;
+        internal const int MaxPayloadLength = 64;
+        private const int MaxRecordLength = 1 + 10 + MaxPayloadLength;
+        private const int FlushInterval = 100;
+
+        private readonly byte[] _ring;
+        private readonly int _ringMask;
+        private readonly long _maxFileBytes;
+        private readonly string _path;
+        private readonly long _startTimestamp;
+        private readonly DateTime _startTime;
+        private readonly Thread _flusher;
+        private readonly AutoResetEvent _flushTrigger;
+
+        // Producer state, guarded by _appendLock
+        private readonly object _appendLock = new object();
+        private long _head;
+        private long _lastTicks;
+        private int _lost;
+
+        // Consumer state, only touched by flusher thread
+        private long _tail;
+        private FileStream _file;
+        private long _fileLastTicks;
+
+        private volatile bool _shouldExit;
+        private volatile Exception _error;
+        private bool _disposedValue;
+
+        /// <summary>
+        /// Number of records dropped because ring was full.
+        /// </summary>
+        public long LostRecords => Interlocked.Read(ref _totalLost);
+        private long _totalLost;
+
+        /// <summary>
+        /// Exception that stopped capturing, e.g. a full disk, or null while capturing.
+        /// </summary>
+        public Exception Error => _error;
+
+        /// <summary>
+        /// Path of capture file
+        /// </summary>
+        public string Path => _path;
+
+        /// <summary>
+        /// Create a capture file.
+        /// </summary>
+        /// <param name="path">Path of capture file. Overwritten if exists.</param>
+        /// <param name="ringBytes">Size of in-memory ring, rounded up to power of 2.</param>
+        /// <param name="maxFileBytes">File size triggering rotation.</param>
+        public WireCapture(string path, int ringBytes = 1 << 20, long maxFileBytes = 64L << 20)
+        {
+            if (ringBytes < 4 * MaxRecordLength)
+            {
+                throw new ArgumentOutOfRangeException(nameof(ringBytes));
+            }
+            _path = path ?? throw new ArgumentNullException(nameof(path));
+            int size = 1;
+            while (size < ringBytes)
+            {
+                size <<= 1;
+            }
+            _ring = new byte[size];
+            _ringMask = size - 1;
+            _maxFileBytes = maxFileBytes;
+            _startTimestamp = Stopwatch.GetTimestamp();
+            _startTime = DateTime.UtcNow;
+            _file = CreateFile(_path, 0);
+            _flushTrigger = new AutoResetEvent(false);
+            _flusher = new Thread(FlushLoop) { IsBackground = true, Name = "WireCapture flusher" };
+            _flusher.Start();
+        }
+
+        internal void RecordWrite(ReadOnlySpan<byte> bytes)
+        {
+            while (bytes.Length > MaxPayloadLength)
+            {
+                Append(WireCaptureRecordKind.Write, bytes.Slice(0, MaxPayloadLength));
+                bytes = bytes.Slice(MaxPayloadLength);
+            }
+            Append(WireCaptureRecordKind.Write, bytes);
+        }
+
+        internal void RecordRead(ReadOnlySpan<byte> bytes)
+        {
+            while (bytes.Length > MaxPayloadLength)
+            {
+                Append(WireCaptureRecordKind.Read, bytes.Slice(0, MaxPayloadLength));
+                bytes = bytes.Slice(MaxPayloadLength);
+            }
+            Append(WireCaptureRecordKind.Read, bytes);
+        }
+
+        internal void RecordMarker(WireCaptureMarker marker, byte argument = 0)
+        {
+            Append(WireCaptureRecordKind.Marker, stackalloc byte[] { (byte)marker, argument });
+        }
+
+        private void Append(WireCaptureRecordKind kind, ReadOnlySpan<byte> payload)
+        {
+            if (payload.Length == 0 || _error != null)
+            {
+                return;
+            }
+            lock (_appendLock)
+            {
+                // Timestamp under the lock, so records are in time order and deltas never go negative
+                long ticks = (long)((Stopwatch.GetTimestamp() - _startTimestamp) * (TimeSpan.TicksPerSecond / (double)Stopwatch.Frequency));
+                long head = _head;
+                long tail = Volatile.Read(ref _tail);
+                if (_ring.Length - (head - tail) < 2 * MaxRecordLength)
+                {
+                    ++_lost;
+                    Interlocked.Increment(ref _totalLost);
+                    return;
+                }
+                if (_lost > 0)
+                {
+                    int lost = Math.Min(_lost, byte.MaxValue);
+                    _lost = 0;
+                    Span<byte> marker = stackalloc byte[] { (byte)WireCaptureMarker.Lost, (byte)lost };
+                    head = Put(head, WireCaptureRecordKind.Marker, marker, ticks);
+                }
+                head = Put(head, kind, payload, ticks);
+                // Publish only after record is complete
+                Volatile.Write(ref _head, head);
+            }
+        }
+
+        private long Put(long head, WireCaptureRecordKind kind, ReadOnlySpan<byte> payload, long ticks)
+        {
+            _ring[head++ & _ringMask] = (byte)(((int)kind << 6) | (payload.Length - 1));
+            ulong delta = (ulong)Math.Max(0, ticks - _lastTicks);
+            _lastTicks = ticks;
+            while (delta >= 0x80)
+            {
+                _ring[head++ & _ringMask] = (byte)(delta | 0x80);
+                delta >>= 7;
+            }
+            _ring[head++ & _ringMask] = (byte)delta;
+            foreach (byte b in payload)
+            {
+                _ring[head++ & _ringMask] = b;
+            }
+            return head;
+        }
+
+        private void FlushLoop()
+        {
+            while (true)
+            {
+                _flushTrigger.WaitOne(FlushInterval);
+                bool exit = _shouldExit;
+                try
+                {
+                    Flush();
+                }
+                catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+                {
+                    // Nothing on this thread may take the process down, so give up capturing instead
+                    _error = e;
+                    _file?.Dispose();
+                    _file = null;
+                    return;
+                }
+                if (exit)
+                {
+                    return;
+                }
+            }
+        }
+
+        private void Flush()
+        {
+            long head = Volatile.Read(ref _head);
+            long tail = _tail;
+            if (head == tail)
+            {
+                return;
+            }
+            // Track absolute time of last record, so a rotated file can start from it
+            for (long i = tail; i < head;)
+            {
+                int length = (_ring[i++ & _ringMask] & 0x3F) + 1;
+                ulong delta = 0;
+                int shift = 0;
+                byte b;
+                do
+                {
+                    b = _ring[i++ & _ringMask];
+                    delta |= (ulong)(b & 0x7F) << shift;
+                    shift += 7;
+                } while ((b & 0x80) != 0);
+                _fileLastTicks += (long)delta;
+                i += length;
+            }
+            int start = (int)(tail & _ringMask);
+            int count = (int)(head - tail);
+            int first = Math.Min(count, _ring.Length - start);
+            _file.Write(_ring, start, first);
+            _file.Write(_ring, 0, count - first);
+            Volatile.Write(ref _tail, head);
+            _file.Flush();
+            if (_file.Length >= _maxFileBytes)
+            {
+                _file.Dispose();
+                _file = null;
+                File.Move(_path, _path + ".1", true);
+                _file = CreateFile(_path, _fileLastTicks);
+            }
+        }
+
+        private FileStream CreateFile(string path, long baseTicks)
+        {
+            FileStream file = new FileStream(path, FileMode.Create, FileAccess.Write, FileShare.Read);
+            using (BinaryWriter writer = new BinaryWriter(file, Encoding.ASCII, true))
+            {
+                writer.Write(Magic);
+                writer.Write(FormatVersion);
+                writer.Write(_startTime.Ticks);
+                writer.Write(baseTicks);
+            }
+            return file;
+        }
+
+        public void Dispose()
+        {
+            if (!_disposedValue)
+            {
+                _shouldExit = true;
+                _flushTrigger.Set();
+                _flusher.Join();
+                _flushTrigger.Dispose();
+                _file?.Dispose();
+                _disposedValue = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Text;
+
+namespace SerialKeyboardMouse.Serial
+{
+    /// <summary>
+    /// One decoded record of a wire capture
+    /// </summary>
+    public readonly struct WireCaptureRecord
+    {
+        /// <summary>
+        /// Time since capture started, in 100ns ticks
+        /// </summary>
+        public long Ticks { get; }
+
+        public WireCaptureRecordKind Kind { get; }
+
+        /// <summary>
+        /// Bytes written or read. For markers, first byte is <see cref="WireCaptureMarker"/>, second is argument.
+        /// </summary>
+        public byte[] Payload { get; }
+
+        public TimeSpan Time => TimeSpan.FromTicks(Ticks);
+
+        public WireCaptureRecord(long ticks, WireCaptureRecordKind kind, byte[] payload)
+        {
+            Ticks = ticks;
+            Kind = kind;
+            Payload = payload;
+        }
+    }
+
+    /// <summary>
+    /// Reads files written by <see cref="WireCapture"/>.
+    /// </summary>
+    public static class WireCaptureReader
+    {
+        /// <summary>
+        /// Decode all records of a capture file. A truncated last record is ignored.
+        /// </summary>
+        /// <param name="stream">Capture file</param>
+        /// <param name="startTime">UTC time when capture started</param>
+        /// <exception cref="InvalidDataException">If stream is not a capture file.</exception>
+        public static IEnumerable<WireCaptureRecord> ReadRecords(Stream stream, out DateTime startTime)
+        {
+            BinaryReader reader = new BinaryReader(stream, Encoding.ASCII, true);
+            byte[] magic = reader.ReadBytes(WireCapture.Magic.Length);
+            if (!magic.AsSpan().SequenceEqual(WireCapture.Magic))
+            {
+                throw new InvalidDataException("Not a wire capture file.");
+            }
+            ushort version = reader.ReadUInt16();
+            if (version != WireCapture.FormatVersion)
+            {
+                throw new InvalidDataException($"Unsupported wire capture version {version}.");
+            }
+            startTime = new DateTime(reader.ReadInt64(), DateTimeKind.Utc);
+            long baseTicks = reader.ReadInt64();
+            return Decode(reader, baseTicks);
+        }
+
+        private static IEnumerable<WireCaptureRecord> Decode(BinaryReader reader, long ticks)
+        {
+            using (reader)
+            {
+                while (true)
+                {
+                    int header = reader.BaseStream.ReadByte();
+                    if (header < 0)
+                    {
+                        yield break;
+                    }
+                    ulong delta = 0;
+                    int shift = 0;
+                    int b;
+                    do
+                    {
+                        b = reader.BaseStream.ReadByte();
+                        if (b < 0 || shift > 63)
+                        {
+                            yield break;
+                        }
+                        delta |= (ulong)(b & 0x7F) << shift;
+                        shift += 7;
+                    } while ((b & 0x80) != 0);
+                    int length = (header & 0x3F) + 1;
+                    byte[] payload = reader.ReadBytes(length);
+                    if (payload.Length != length)
+                    {
+                        yield break;
+                    }
+                    ticks += (long)delta;
+                    yield return new WireCaptureRecord(ticks, (WireCaptureRecordKind)(header >> 6), payload);
+                }
+            }
+        }
+    }
+}
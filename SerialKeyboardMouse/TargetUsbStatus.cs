@@ -0,0 +1,90 @@
+﻿using System;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// USB state of device as seen from target, reported by device on every change.
+    /// </summary>
+    public class TargetUsbStatus
+    {
+        private const ushort ElapsedUnknown = 0xFFFF;
+
+        /// <summary>
+        /// Device counts elapsed time up to this many ms, and stops there
+        /// </summary>
+        private const ushort ElapsedSaturated = ElapsedUnknown - 1;
+
+        /// <summary>
+        /// Target enumerated the device
+        /// </summary>
+        public bool Configured { get; }
+
+        /// <summary>
+        /// Target is asleep
+        /// </summary>
+        public bool Suspended { get; }
+
+        /// <summary>
+        /// Reports sent now reach the target
+        /// </summary>
+        public bool IsReady => Configured && !Suspended;
+
+        /// <summary>
+        /// Time from device power-on, or from last loss of configuration (target reboot), to configured.
+        /// Null if not configured yet.
+        /// </summary>
+        public TimeSpan? TimeToConfigured { get; }
+
+        /// <summary>
+        /// Time from same origin as <see cref="TimeToConfigured"/> to first report accepted by device.
+        /// Null if no report was accepted yet.
+        /// </summary>
+        public TimeSpan? TimeToFirstReport { get; }
+
+        /// <summary>
+        /// True if <see cref="TimeToConfigured"/> reached the most device counts, about 65.5 s, and is only a lower
+        /// bound. A PC reboot often takes longer.
+        /// </summary>
+        public bool TimeToConfiguredSaturated { get; }
+
+        /// <summary>
+        /// True if <see cref="TimeToFirstReport"/> is only a lower bound, see <see cref="TimeToConfiguredSaturated"/>
+        /// </summary>
+        public bool TimeToFirstReportSaturated { get; }
+
+        internal TargetUsbStatus(ReadOnlySpan<byte> frame)
+        {
+            SerialSymbols.UsbStatus status = (SerialSymbols.UsbStatus)frame[3];
+            Configured = status.HasFlag(SerialSymbols.UsbStatus.Configured);
+            Suspended = status.HasFlag(SerialSymbols.UsbStatus.Suspended);
+            ushort toConfigured = BitConverter.ToUInt16(frame.Slice(4, 2));
+            ushort toFirstReport = BitConverter.ToUInt16(frame.Slice(6, 2));
+            TimeToConfigured = ToTimeSpan(toConfigured);
+            TimeToFirstReport = ToTimeSpan(toFirstReport);
+            TimeToConfiguredSaturated = toConfigured == ElapsedSaturated;
+            TimeToFirstReportSaturated = toFirstReport == ElapsedSaturated;
+        }
+
+        private static TimeSpan? ToTimeSpan(ushort milliseconds)
+        {
+            return milliseconds == ElapsedUnknown ? null : TimeSpan.FromMilliseconds(milliseconds);
+        }
+
+        public override string ToString()
+        {
+            string state = IsReady ? "ready" : Configured ? "suspended" : "not configured";
+            return $"Target USB {state}, configured after {Format(TimeToConfigured, TimeToConfiguredSaturated)} ms, " +
+                   $"first report after {Format(TimeToFirstReport, TimeToFirstReportSaturated)} ms";
+        }
+
+        private static string Format(TimeSpan? elapsed, bool saturated)
+        {
+            if (!elapsed.HasValue)
+            {
+                return "-";
+            }
+            return (saturated ? ">=" : "") + elapsed.Value.TotalMilliseconds;
+        }
+    }
+}
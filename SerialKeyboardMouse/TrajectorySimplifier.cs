@@ -0,0 +1,183 @@
+﻿using System;
+using System.Collections.Generic;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// One sample of a mouse trajectory, in pixels of the mouse resolution, at a time since the path started.
+    /// </summary>
+    public readonly struct TrajectoryPoint
+    {
+        public double X { get; }
+
+        public double Y { get; }
+
+        public TimeSpan Time { get; }
+
+        public TrajectoryPoint(double x, double y, TimeSpan time)
+        {
+            X = x;
+            Y = y;
+            Time = time;
+        }
+
+        public override string ToString()
+        {
+            return $"({X},{Y})@{Time.TotalMilliseconds:F1}ms";
+        }
+    }
+
+    /// <summary>
+    /// Reduces recorded or generated trajectories to the points worth a move frame. Points are quantized to
+    /// the coordinates a frame carries, points the device maps to the same logical position as the one before
+    /// are dropped, and Ramer–Douglas–Peucker decimation removes points within a tolerance of the segment
+    /// between their neighbours kept. Kept points keep their own time, nothing is interpolated.
+    /// </summary>
+    public static class TrajectorySimplifier
+    {
+        /// <summary>
+        /// Deviation allowed by default, half a pixel: below what quantization already loses.
+        /// </summary>
+        public const double DefaultTolerance = 0.5;
+
+        /// <summary>
+        /// Logical maximum of the device's absolute X and Y, as in the HID descriptor
+        /// </summary>
+        private const long MaxLogicalCoordinate = 32767;
+
+        /// <summary>
+        /// Quantize and decimate a trajectory.
+        /// </summary>
+        /// <param name="points">Samples in time order</param>
+        /// <param name="width">Mouse resolution width</param>
+        /// <param name="height">Mouse resolution height</param>
+        /// <param name="tolerance">Largest distance in pixels a dropped point may have from the path kept</param>
+        /// <returns>Points kept, with integral coordinates in 1..width and 1..height</returns>
+        /// <exception cref="ArgumentException">If resolution or tolerance is invalid, or points are out of time order.</exception>
+        public static IReadOnlyList<TrajectoryPoint> Simplify(IReadOnlyList<TrajectoryPoint> points, int width,
+            int height, double tolerance = DefaultTolerance)
+        {
+            return Decimate(Quantize(points, width, height), tolerance);
+        }
+
+        /// <summary>
+        /// Round to the pixel a move frame carries, clamped to the resolution, and drop each point the device maps
+        /// to the same logical position as the one before. Of a run of such points the first is kept,
+        /// which is when the pointer got there.
+        /// </summary>
+        /// <exception cref="ArgumentException">If resolution is invalid, or points are out of time order.</exception>
+        public static IReadOnlyList<TrajectoryPoint> Quantize(IReadOnlyList<TrajectoryPoint> points, int width,
+            int height)
+        {
+            if (points == null)
+            {
+                throw new ArgumentNullException(nameof(points));
+            }
+            if (width <= 0 || height <= 0)
+            {
+                throw new ArgumentException($"Invalid resolution {width}x{height}!");
+            }
+            List<TrajectoryPoint> quantized = new List<TrajectoryPoint>(points.Count);
+            long lastLogicalX = -1;
+            long lastLogicalY = -1;
+            TimeSpan lastTime = TimeSpan.MinValue;
+            foreach (TrajectoryPoint point in points)
+            {
+                if (point.Time < lastTime)
+                {
+                    throw new ArgumentException($"Point {point} is earlier than the one before!");
+                }
+                lastTime = point.Time;
+                int x = Math.Clamp((int)Math.Round(point.X), 1, width);
+                int y = Math.Clamp((int)Math.Round(point.Y), 1, height);
+                // Same mapping as firmware's AbsMouse_::move
+                long logicalX = MaxLogicalCoordinate * x / width;
+                long logicalY = MaxLogicalCoordinate * y / height;
+                if (logicalX == lastLogicalX && logicalY == lastLogicalY)
+                {
+                    continue;
+                }
+                lastLogicalX = logicalX;
+                lastLogicalY = logicalY;
+                quantized.Add(new TrajectoryPoint(x, y, point.Time));
+            }
+            return quantized;
+        }
+
+        /// <summary>
+        /// Ramer–Douglas–Peucker decimation. First and last points are always kept. Distance is to the
+        /// segment between kept points, not the line through them, so a path doubling back is kept.
+        /// </summary>
+        /// <param name="points">Samples in time order</param>
+        /// <param name="tolerance">Largest distance in pixels a dropped point may have from the path kept</param>
+        /// <exception cref="ArgumentException">If tolerance is negative.</exception>
+        public static IReadOnlyList<TrajectoryPoint> Decimate(IReadOnlyList<TrajectoryPoint> points,
+            double tolerance = DefaultTolerance)
+        {
+            if (points == null)
+            {
+                throw new ArgumentNullException(nameof(points));
+            }
+            if (!(tolerance >= 0))
+            {
+                throw new ArgumentException($"Invalid tolerance {tolerance}!");
+            }
+            if (points.Count <= 2)
+            {
+                return points;
+            }
+
+            bool[] keep = new bool[points.Count];
+            keep[0] = true;
+            keep[^1] = true;
+            // Explicit stack, recorded sessions are long enough to overflow recursion
+            Stack<(int First, int Last)> ranges = new Stack<(int, int)>();
+            ranges.Push((0, points.Count - 1));
+            while (ranges.Count > 0)
+            {
+                (int first, int last) = ranges.Pop();
+                double farthest = tolerance;
+                int index = -1;
+                for (int i = first + 1; i < last; ++i)
+                {
+                    double distance = DistanceToSegment(points[i], points[first], points[last]);
+                    if (distance > farthest)
+                    {
+                        farthest = distance;
+                        index = i;
+                    }
+                }
+                if (index < 0)
+                {
+                    continue;
+                }
+                keep[index] = true;
+                ranges.Push((first, index));
+                ranges.Push((index, last));
+            }
+
+            List<TrajectoryPoint> kept = new List<TrajectoryPoint>();
+            for (int i = 0; i < points.Count; ++i)
+            {
+                if (keep[i])
+                {
+                    kept.Add(points[i]);
+                }
+            }
+            return kept;
+        }
+
+        private static double DistanceToSegment(TrajectoryPoint p, TrajectoryPoint a, TrajectoryPoint b)
+        {
+            double dx = b.X - a.X;
+            double dy = b.Y - a.Y;
+            double lengthSquared = dx * dx + dy * dy;
+            double t = lengthSquared == 0
+                ? 0
+                : Math.Clamp(((p.X - a.X) * dx + (p.Y - a.Y) * dy) / lengthSquared, 0, 1);
+            double ex = p.X - (a.X + t * dx);
+            double ey = p.Y - (a.Y + t * dy);
+            return Math.Sqrt(ex * ex + ey * ey);
+        }
+    }
+}
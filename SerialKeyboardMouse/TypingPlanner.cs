@@ -0,0 +1,203 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using SerialKeyboardMouse.Macro;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouse
+{
+    /// <summary>
+    /// Key transitions typing a text, each one frame and one HID report.
+    /// </summary>
+    public class TypingPlan
+    {
+        /// <summary>
+        /// Number of characters typed
+        /// </summary>
+        public int Characters { get; }
+
+        /// <summary>
+        /// Press or release frames in order, with key or <see cref="SerialSymbols.ReleaseAllKeys"/>
+        /// </summary>
+        public IReadOnlyList<(SerialSymbols.FrameType Type, byte Key)> Steps { get; }
+
+        /// <summary>
+        /// Number of HID reports target receives
+        /// </summary>
+        public int Reports => Steps.Count;
+
+        public double ReportsPerCharacter => Characters == 0 ? 0 : (double)Reports / Characters;
+
+        internal TypingPlan(int characters, IReadOnlyList<(SerialSymbols.FrameType, byte)> steps)
+        {
+            Characters = characters;
+            Steps = steps;
+        }
+
+        /// <summary>
+        /// Encode as a macro, so it is streamed like any other.
+        /// </summary>
+        internal CompiledMacro ToMacro((int, int) resolution)
+        {
+            MacroStep[] steps = Steps
+                .Select(s => new MacroStep(SerialCommandFrame.OfKeyType(s.Type, s.Key), 0, 0))
+                .ToArray();
+            return new CompiledMacro(steps, 0, resolution);
+        }
+    }
+
+    /// <summary>
+    /// Plans the shortest report sequence typing a text. Shift is pressed once for a run of shifted characters
+    /// instead of around each one, and when allowed, the last key of a run and Shift are released by one
+    /// release-all. A character repeated is still released in between, or target would see one key held.
+    /// </summary>
+    public static class TypingPlanner
+    {
+        /// <summary>
+        /// Plan typing of a text.
+        /// </summary>
+        /// <param name="text">Text to type</param>
+        /// <param name="layout">Layout mapping characters to keys, default US</param>
+        /// <param name="mayReleaseAll">True if no other key is held, so release-all may end a shifted run</param>
+        /// <exception cref="ArgumentException">If a character cannot be typed with layout.</exception>
+        public static TypingPlan Plan(string text, KeyboardLayout layout = null, bool mayReleaseAll = false)
+        {
+            (byte Usage, bool Shift)[] keys = Map(text, layout);
+            List<(SerialSymbols.FrameType, byte)> steps = new List<(SerialSymbols.FrameType, byte)>(keys.Length * 2 + 2);
+            bool shiftHeld = false;
+            for (int i = 0; i < keys.Length; ++i)
+            {
+                (byte usage, bool shift) = keys[i];
+                if (shift != shiftHeld)
+                {
+                    steps.Add((shift ? SerialSymbols.FrameType.KeyboardPress : SerialSymbols.FrameType.KeyboardRelease,
+                        KeyboardLayout.LeftShiftUsage));
+                    shiftHeld = shift;
+                }
+                steps.Add((SerialSymbols.FrameType.KeyboardPress, usage));
+                bool runEnds = shiftHeld && (i + 1 == keys.Length || !keys[i + 1].Shift);
+                if (runEnds && mayReleaseAll)
+                {
+                    steps.Add((SerialSymbols.FrameType.KeyboardRelease, SerialSymbols.ReleaseAllKeys));
+                    shiftHeld = false;
+                }
+                else
+                {
+                    steps.Add((SerialSymbols.FrameType.KeyboardRelease, usage));
+                }
+            }
+            if (shiftHeld)
+            {
+                steps.Add((SerialSymbols.FrameType.KeyboardRelease, KeyboardLayout.LeftShiftUsage));
+            }
+            return new TypingPlan(keys.Length, steps);
+        }
+
+        /// <summary>
+        /// Plan typing one character at a time, Shift pressed and released around each. Reference for <see cref="Plan"/>.
+        /// </summary>
+        /// <exception cref="ArgumentException">If a character cannot be typed with layout.</exception>
+        public static TypingPlan PlanPerCharacter(string text, KeyboardLayout layout = null)
+        {
+            (byte Usage, bool Shift)[] keys = Map(text, layout);
+            List<(SerialSymbols.FrameType, byte)> steps = new List<(SerialSymbols.FrameType, byte)>(keys.Length * 4);
+            foreach ((byte usage, bool shift) in keys)
+            {
+                if (shift)
+                {
+                    steps.Add((SerialSymbols.FrameType.KeyboardPress, KeyboardLayout.LeftShiftUsage));
+                }
+                steps.Add((SerialSymbols.FrameType.KeyboardPress, usage));
+                steps.Add((SerialSymbols.FrameType.KeyboardRelease, usage));
+                if (shift)
+                {
+                    steps.Add((SerialSymbols.FrameType.KeyboardRelease, KeyboardLayout.LeftShiftUsage));
+                }
+            }
+            return new TypingPlan(keys.Length, steps);
+        }
+
+        /// <summary>
+        /// Encode a text as <see cref="SerialSymbols.FrameType.TypeKeys"/> frames, typed by the device itself.
+        /// </summary>
+        /// <exception cref="ArgumentException">If a character cannot be typed with layout, or its usage
+        /// collides with <see cref="SerialSymbols.TypeKeyShift"/>.</exception>
+        internal static CompiledMacro PlanOnDevice(string text, KeyboardLayout layout, (int, int) resolution)
+        {
+            (byte Usage, bool Shift)[] keys = Map(text, layout);
+            byte[] encoded = new byte[keys.Length];
+            for (int i = 0; i < keys.Length; ++i)
+            {
+                if ((keys[i].Usage & SerialSymbols.TypeKeyShift) != 0)
+                {
+                    throw new ArgumentException(
+                        $"Character '{text[i]}' has usage 0x{keys[i].Usage:X2}, which device typing cannot carry.");
+                }
+                encoded[i] = (byte)(keys[i].Usage | (keys[i].Shift ? SerialSymbols.TypeKeyShift : 0));
+            }
+            List<MacroStep> steps = new List<MacroStep>();
+            for (int i = 0; i < encoded.Length; i += SerialSymbols.TypeKeysPerFrame)
+            {
+                int count = Math.Min(SerialSymbols.TypeKeysPerFrame, encoded.Length - i);
+                steps.Add(new MacroStep(SerialCommandFrame.OfTypeKeys(new ReadOnlySpan<byte>(encoded, i, count)), 0, 0));
+            }
+            return new CompiledMacro(steps.ToArray(), 0, resolution);
+        }
+
+        /// <summary>
+        /// Reports the device typing engine sends for a text. Each character pressed in the report releasing the
+        /// previous one costs one report; a repeated character and each change of Shift cost one more.
+        /// </summary>
+        /// <exception cref="ArgumentException">If a character cannot be typed with layout.</exception>
+        public static int CountDeviceReports(string text, KeyboardLayout layout = null)
+        {
+            (byte Usage, bool Shift)[] keys = Map(text, layout);
+            int reports = 0;
+            byte held = 0;
+            bool shiftHeld = false;
+            for (int i = 0; i < keys.Length; ++reports)
+            {
+                (byte usage, bool shift) = keys[i];
+                if (shift != shiftHeld)
+                {
+                    // Shift down releases the held key in the same report, Shift up waits for its own
+                    if (shift || held == 0)
+                    {
+                        shiftHeld = shift;
+                    }
+                    held = 0;
+                }
+                else if (usage == held)
+                {
+                    held = 0;
+                }
+                else
+                {
+                    held = usage;
+                    ++i;
+                }
+            }
+            return reports + (held != 0 ? 1 : 0) + (shiftHeld ? 1 : 0);
+        }
+
+        private static (byte, bool)[] Map(string text, KeyboardLayout layout)
+        {
+            if (text == null)
+            {
+                throw new ArgumentNullException(nameof(text));
+            }
+            layout ??= KeyboardLayout.UnitedStates;
+            (byte, bool)[] keys = new (byte, bool)[text.Length];
+            for (int i = 0; i < text.Length; ++i)
+            {
+                if (!layout.TryMap(text[i], out byte usage, out bool shift))
+                {
+                    throw new ArgumentException(
+                        $"Character '{text[i]}' (U+{(int)text[i]:X4}) cannot be typed with layout {layout.Name}.");
+                }
+                keys[i] = (usage, shift);
+            }
+            return keys;
+        }
+    }
+}
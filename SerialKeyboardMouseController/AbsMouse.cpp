@@ -20,55 +20,76 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 */
 
+#include <stddef.h>
 #include "AbsMouse.h"
+#include "Composite.h"
+#include "hid_descriptor.h"
 #include "debug_print.h"
 
 #if defined(_USING_HID)
 
-static const uint8_t HID_REPORT_DESCRIPTOR[] PROGMEM = {
-    0x05, 0x01,        // Usage Page (Generic Desktop Ctrls)
-    0x09, 0x02,        // Usage (Mouse)
-    0xA1, 0x01,        // Collection (Application)
-    0x09, 0x01,        //   Usage (Pointer)
-    0xA1, 0x00,        //   Collection (Physical)
-    0x85, 0x01,        //     Report ID (1)
-    0x05, 0x09,        //     Usage Page (Button)
-    0x19, 0x01,        //     Usage Minimum (0x01)
-    0x29, 0x03,        //     Usage Maximum (0x03)
-    0x15, 0x00,        //     Logical Minimum (0)
-    0x25, 0x01,        //     Logical Maximum (1)
-    0x95, 0x03,        //     Report Count (3)
-    0x75, 0x01,        //     Report Size (1)
-    0x81, 0x02,        //     Input (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
-    0x95, 0x01,        //     Report Count (1)
-    0x75, 0x05,        //     Report Size (5)
-    0x81, 0x03,        //     Input (Const,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
-    0x05, 0x01,        //     Usage Page (Generic Desktop Ctrls)
-    0x09, 0x30,        //     Usage (X)
-    0x09, 0x31,        //     Usage (Y)
-    0x16, 0x00, 0x00,  //     Logical Minimum (0)
-    0x26, 0xFF, 0x7F,  //     Logical Maximum (32767)
-    0x36, 0x00, 0x00,  //     Physical Minimum (0)
-    0x46, 0xFF, 0x7F,  //     Physical Maximum (32767)
-    0x75, 0x10,        //     Report Size (16)
-    0x95, 0x02,        //     Report Count (2)
-    0x81, 0x02,        //     Input (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
-    0x09, 0x38,        //     Usage (Wheel)
-    0x15, 0x81,        //     Logical Minimum (-127)
-    0x25, 0x7F,        //     Logical Maximum (127)
-    0x35, 0x81,        //     Physical Minimum (-127)
-    0x45, 0x7F,        //     Physical Maximum (127)
-    0x75, 0x08,        //     Report Size (8)
-    0x95, 0x01,        //     Report Count (1)
-    0x81, 0x06,        //     Input (Data,Var,Rel)
-    0xC0,              //   End Collection
-    0xC0               // End Collection
+static constexpr uint8_t REPORT_ID = 1;
+static constexpr int32_t MAX_COORDINATE = 32767;
+
+static constexpr uint8_t HID_REPORT_DESCRIPTOR[] PROGMEM = {
+    HID_USAGE_PAGE(0x01),                       // Generic Desktop
+    HID_USAGE(0x02),                            // Mouse
+    HID_COLLECTION(HID_APPLICATION),
+    HID_USAGE(0x01),                            //   Pointer
+    HID_COLLECTION(HID_PHYSICAL),
+    HID_REPORT_ID(REPORT_ID),
+    HID_USAGE_PAGE(0x09),                       //     Button
+    HID_USAGE_MINIMUM(0x01),
+    HID_USAGE_MAXIMUM(0x03),
+    HID_LOGICAL_MINIMUM(0),
+    HID_LOGICAL_MAXIMUM(1),
+    HID_REPORT_COUNT(3),
+    HID_REPORT_SIZE(1),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), // buttons
+    HID_REPORT_COUNT(1),
+    HID_REPORT_SIZE(5),
+    HID_INPUT(HID_CONSTANT | HID_VARIABLE | HID_ABSOLUTE), // padding
+    HID_USAGE_PAGE(0x01),                       //     Generic Desktop
+    HID_USAGE(0x30),                            //     X
+    HID_USAGE(0x31),                            //     Y
+    HID_LOGICAL_MINIMUM_16(0),
+    HID_LOGICAL_MAXIMUM_16(MAX_COORDINATE),
+    HID_PHYSICAL_MINIMUM_16(0),
+    HID_PHYSICAL_MAXIMUM_16(MAX_COORDINATE),
+    HID_REPORT_SIZE(16),
+    HID_REPORT_COUNT(2),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), // x, y
+#if ABS_MOUSE_WHEEL
+    HID_USAGE(0x38),                            //     Wheel
+    HID_LOGICAL_MINIMUM(-127),
+    HID_LOGICAL_MAXIMUM(127),
+    HID_PHYSICAL_MINIMUM(-127),
+    HID_PHYSICAL_MAXIMUM(127),
+    HID_REPORT_SIZE(8),
+    HID_REPORT_COUNT(1),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_RELATIVE), // wheel
+#endif
+    HID_END_COLLECTION,
+    HID_END_COLLECTION
 };
 
+static_assert(hid::input_report_size(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), REPORT_ID)
+              == sizeof(AbsMouseReport), "Mouse report struct does not match descriptor!");
+static_assert(hid::input_offset_bits(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), REPORT_ID, 0)
+              == offsetof(AbsMouseReport, buttons) * 8, "Mouse buttons offset does not match descriptor!");
+static_assert(hid::input_offset_bits(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), REPORT_ID, 2)
+              == offsetof(AbsMouseReport, x) * 8, "Mouse coordinate offset does not match descriptor!");
+#if ABS_MOUSE_WHEEL
+static_assert(hid::input_offset_bits(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), REPORT_ID, 3)
+              == offsetof(AbsMouseReport, wheel) * 8, "Mouse wheel offset does not match descriptor!");
+#endif
+
 AbsMouse_::AbsMouse_(void) : _buttons(0), _scroll(0), _x(0), _y(0), _width(1920), _height(1080), _autoReport(false)
 {
+#if !COMPOSITE_REPORT
     static HIDSubDescriptor descriptorNode(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR));
     HID().AppendDescriptor(&descriptorNode);
+#endif
 }
 
 void AbsMouse_::init(uint16_t width, uint16_t height, bool autoReport)
@@ -80,21 +101,26 @@ void AbsMouse_::init(uint16_t width, uint16_t height, bool autoReport)
 
 void AbsMouse_::report(void)
 {
-    uint8_t buffer[6];
-    buffer[0] = _buttons;
-    buffer[1] = _x & 0xFF;
-    buffer[2] = (_x >> 8) & 0xFF;
-    buffer[3] = _y & 0xFF;
-    buffer[4] = (_y >> 8) & 0xFF;
-    buffer[5] = _scroll;
-    HID().SendReport(1, buffer, 6);
+    // Both supported cores are little-endian, as HID is
+    AbsMouseReport report;
+    report.buttons = _buttons;
+    report.x = _x;
+    report.y = _y;
+#if ABS_MOUSE_WHEEL
+    report.wheel = _scroll;
+#endif
+#if COMPOSITE_REPORT
+    Composite.mouse_changed(report);
+#else
+    HID().SendReport(REPORT_ID, &report, sizeof(report));
+#endif
     _scroll = 0;
 }
 
 void AbsMouse_::move(uint16_t x, uint16_t y)
 {
-    _x = (uint16_t)((32767l * ((uint32_t)x)) / _width);
-    _y = (uint16_t)((32767l * ((uint32_t)y)) / _height);
+    _x = (uint16_t)((MAX_COORDINATE * ((uint32_t)x)) / _width);
+    _y = (uint16_t)((MAX_COORDINATE * ((uint32_t)y)) / _height);
 
     if (_autoReport)
     {
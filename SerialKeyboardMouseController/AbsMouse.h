@@ -36,6 +36,22 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #define MOUSE_RIGHT 0x02
 #define MOUSE_MIDDLE 0x04
 
+// Set to 0 to build without the wheel. Descriptor and report layout follow.
+#ifndef ABS_MOUSE_WHEEL
+#define ABS_MOUSE_WHEEL 1
+#endif
+
+// Input report, layout checked against the descriptor at compile time
+struct __attribute__((packed)) AbsMouseReport
+{
+    uint8_t buttons;
+    uint16_t x;
+    uint16_t y;
+#if ABS_MOUSE_WHEEL
+    int8_t wheel;
+#endif
+};
+
 class AbsMouse_
 {
 private:
@@ -0,0 +1,163 @@
+#include <stddef.h>
+#include <string.h>
+#include "Composite.h"
+#include "hid_descriptor.h"
+
+#if defined(_USING_HID)
+
+#if COMPOSITE_REPORT
+
+static constexpr int32_t MAX_COORDINATE = 32767;
+
+static constexpr uint8_t HID_REPORT_DESCRIPTOR[] PROGMEM = {
+    HID_USAGE_PAGE(0x01),                       // Generic Desktop
+    HID_USAGE(0x06),                            // Keyboard
+    HID_COLLECTION(HID_APPLICATION),
+    HID_REPORT_ID(COMPOSITE_REPORT_ID),
+    HID_USAGE_PAGE(0x07),                       //   Keyboard
+    HID_USAGE_MINIMUM(0xE0),                    //   Left Control
+    HID_USAGE_MAXIMUM(0xE7),                    //   Right GUI
+    HID_LOGICAL_MINIMUM(0),
+    HID_LOGICAL_MAXIMUM(1),
+    HID_REPORT_SIZE(1),
+    HID_REPORT_COUNT(8),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), // modifiers
+    HID_REPORT_COUNT(1),
+    HID_REPORT_SIZE(8),
+    HID_INPUT(HID_CONSTANT | HID_VARIABLE | HID_ABSOLUTE), // reserved
+#if KEYBOARD_LED_REPORT
+    HID_REPORT_COUNT(5),
+    HID_REPORT_SIZE(1),
+    HID_USAGE_PAGE(0x08),                       //   LEDs
+    HID_USAGE_MINIMUM(0x01),                    //   Num Lock
+    HID_USAGE_MAXIMUM(0x05),                    //   Kana
+    HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+    HID_REPORT_COUNT(1),
+    HID_REPORT_SIZE(3),
+    HID_OUTPUT(HID_CONSTANT | HID_VARIABLE | HID_ABSOLUTE),
+#endif
+    HID_REPORT_COUNT(6),
+    HID_REPORT_SIZE(8),
+    HID_LOGICAL_MINIMUM(0),
+    HID_LOGICAL_MAXIMUM(0x73),
+    HID_USAGE_PAGE(0x07),                       //   Keyboard
+    HID_USAGE_MINIMUM(0x00),                    //   Reserved (no event indicated)
+    HID_USAGE_MAXIMUM(0x73),                    //   Keyboard Application
+    HID_INPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE), // keys
+    HID_USAGE_PAGE(0x01),                       //   Generic Desktop
+    HID_USAGE(0x01),                            //   Pointer
+    HID_COLLECTION(HID_PHYSICAL),
+    HID_USAGE_PAGE(0x09),                       //     Button
+    HID_USAGE_MINIMUM(0x01),
+    HID_USAGE_MAXIMUM(0x03),
+    HID_LOGICAL_MINIMUM(0),
+    HID_LOGICAL_MAXIMUM(1),
+    HID_REPORT_COUNT(3),
+    HID_REPORT_SIZE(1),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), // buttons
+    HID_REPORT_COUNT(1),
+    HID_REPORT_SIZE(5),
+    HID_INPUT(HID_CONSTANT | HID_VARIABLE | HID_ABSOLUTE), // padding
+    HID_USAGE_PAGE(0x01),                       //     Generic Desktop
+    HID_USAGE(0x30),                            //     X
+    HID_USAGE(0x31),                            //     Y
+    HID_LOGICAL_MINIMUM_16(0),
+    HID_LOGICAL_MAXIMUM_16(MAX_COORDINATE),
+    HID_PHYSICAL_MINIMUM_16(0),
+    HID_PHYSICAL_MAXIMUM_16(MAX_COORDINATE),
+    HID_REPORT_SIZE(16),
+    HID_REPORT_COUNT(2),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), // x, y
+#if ABS_MOUSE_WHEEL
+    HID_USAGE(0x38),                            //     Wheel
+    HID_LOGICAL_MINIMUM(-127),
+    HID_LOGICAL_MAXIMUM(127),
+    HID_PHYSICAL_MINIMUM(-127),
+    HID_PHYSICAL_MAXIMUM(127),
+    HID_REPORT_SIZE(8),
+    HID_REPORT_COUNT(1),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_RELATIVE), // wheel
+#endif
+    HID_END_COLLECTION,
+    HID_END_COLLECTION
+};
+
+static_assert(hid::input_report_size(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), COMPOSITE_REPORT_ID)
+              == sizeof(CompositeReport), "Composite report struct does not match descriptor!");
+static_assert(hid::input_offset_bits(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), COMPOSITE_REPORT_ID, 2)
+              == (offsetof(CompositeReport, keyboard) + offsetof(KeyReport, keys)) * 8,
+              "Composite keys offset does not match descriptor!");
+static_assert(hid::input_offset_bits(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), COMPOSITE_REPORT_ID, 3)
+              == (offsetof(CompositeReport, mouse) + offsetof(AbsMouseReport, buttons)) * 8,
+              "Composite buttons offset does not match descriptor!");
+static_assert(hid::input_offset_bits(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), COMPOSITE_REPORT_ID, 5)
+              == (offsetof(CompositeReport, mouse) + offsetof(AbsMouseReport, x)) * 8,
+              "Composite coordinate offset does not match descriptor!");
+#if ABS_MOUSE_WHEEL
+static_assert(hid::input_offset_bits(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), COMPOSITE_REPORT_ID, 6)
+              == (offsetof(CompositeReport, mouse) + offsetof(AbsMouseReport, wheel)) * 8,
+              "Composite wheel offset does not match descriptor!");
+#endif
+// hid_set_report_received reads one byte of LED bits
+static_assert(hid::output_report_size(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR), COMPOSITE_REPORT_ID)
+              == (KEYBOARD_LED_REPORT ? 1u : 0u), "LED report does not match descriptor!");
+
+Composite_::Composite_(void) : _batch_depth(0), _pending(false)
+{
+    memset(&_report, 0, sizeof(_report));
+    static HIDSubDescriptor node(HID_REPORT_DESCRIPTOR, sizeof(HID_REPORT_DESCRIPTOR));
+    HID().AppendDescriptor(&node);
+}
+
+#else
+
+Composite_::Composite_(void) : _batch_depth(0), _pending(false)
+{
+    memset(&_report, 0, sizeof(_report));
+}
+
+#endif
+
+void Composite_::send(void)
+{
+    if (_batch_depth != 0)
+    {
+        _pending = true;
+        return;
+    }
+    _pending = false;
+    HID().SendReport(COMPOSITE_REPORT_ID, &_report, sizeof(_report));
+#if ABS_MOUSE_WHEEL
+    // Wheel is relative, a later keyboard change must not scroll again
+    _report.mouse.wheel = 0;
+#endif
+}
+
+void Composite_::keyboard_changed(const KeyReport& keys)
+{
+    _report.keyboard = keys;
+    send();
+}
+
+void Composite_::mouse_changed(const AbsMouseReport& mouse)
+{
+    _report.mouse = mouse;
+    send();
+}
+
+void Composite_::begin_batch(void)
+{
+    ++_batch_depth;
+}
+
+void Composite_::end_batch(void)
+{
+    if (_batch_depth != 0 && --_batch_depth == 0 && _pending)
+    {
+        send();
+    }
+}
+
+Composite_ Composite;
+
+#endif
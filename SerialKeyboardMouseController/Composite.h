@@ -0,0 +1,51 @@
+#ifndef COMPOSITE_h
+#define COMPOSITE_h
+
+#include "HID.h"
+#include "AbsMouse.h"
+#include "Keyboard.h"
+
+/*
+ * Optional single report carrying keyboard and mouse state together.
+ *
+ * With COMPOSITE_REPORT set, Keyboard and AbsMouse stop sending their own reports (ID 2 and 1) and hand their
+ * state here instead, which goes out as one report. A modifier-click then changes modifiers and buttons in the
+ * same USB transfer, so target never sees one without the other, and mixed gestures cost half the transfers.
+ *
+ * The report lives in a Keyboard application collection with a Pointer collection inside. Hosts parsing usages
+ * generically (Linux hid-input) see both. Windows binds a top-level collection to one class driver and would
+ * only see the keyboard part, so keep it off there.
+ */
+#ifndef COMPOSITE_REPORT
+#define COMPOSITE_REPORT 0
+#endif
+
+constexpr uint8_t COMPOSITE_REPORT_ID = 3;
+
+// Input report, layout checked against the descriptor at compile time
+struct __attribute__((packed)) CompositeReport
+{
+    KeyReport keyboard;
+    AbsMouseReport mouse;
+};
+
+class Composite_
+{
+private:
+    CompositeReport _report;
+    uint8_t _batch_depth;
+    bool _pending;
+    void send(void);
+
+public:
+    Composite_(void);
+    // Called instead of HID().SendReport() by Keyboard and AbsMouse when COMPOSITE_REPORT is set
+    void keyboard_changed(const KeyReport& keys);
+    void mouse_changed(const AbsMouseReport& mouse);
+    // Changes between begin and end go out as one report. Nests; no-op without COMPOSITE_REPORT.
+    void begin_batch(void);
+    void end_batch(void);
+};
+extern Composite_ Composite;
+
+#endif
@@ -23,7 +23,10 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include <stddef.h>
 #include "Keyboard.h"
+#include "Composite.h"
+#include "hid_descriptor.h"
 
 #if defined(_USING_HID)
 
@@ -31,43 +34,64 @@
 //================================================================================
 //	Keyboard
 
-static const uint8_t _hidReportDescriptor[] PROGMEM = {
-
-    //  Keyboard
-      0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)  // 47
-      0x09, 0x06,                    // USAGE (Keyboard)
-      0xa1, 0x01,                    // COLLECTION (Application)
-      0x85, 0x02,                    //   REPORT_ID (2)
-      0x05, 0x07,                    //   USAGE_PAGE (Keyboard)
-
-    0x19, 0xe0,                    //   USAGE_MINIMUM (Keyboard LeftControl)
-      0x29, 0xe7,                    //   USAGE_MAXIMUM (Keyboard Right GUI)
-      0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
-      0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
-      0x75, 0x01,                    //   REPORT_SIZE (1)
-
-    0x95, 0x08,                    //   REPORT_COUNT (8)
-      0x81, 0x02,                    //   INPUT (Data,Var,Abs)
-      0x95, 0x01,                    //   REPORT_COUNT (1)
-      0x75, 0x08,                    //   REPORT_SIZE (8)
-      0x81, 0x03,                    //   INPUT (Cnst,Var,Abs)
-
-    0x95, 0x06,                    //   REPORT_COUNT (6)
-      0x75, 0x08,                    //   REPORT_SIZE (8)
-      0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
-      0x25, 0x73,                    //   LOGICAL_MAXIMUM (115)
-      0x05, 0x07,                    //   USAGE_PAGE (Keyboard)
-
-    0x19, 0x00,                    //   USAGE_MINIMUM (Reserved (no event indicated))
-      0x29, 0x73,                    //   USAGE_MAXIMUM (Keyboard Application)
-      0x81, 0x00,                    //   INPUT (Data,Ary,Abs)
-      0xc0,                          // END_COLLECTION
+static constexpr uint8_t REPORT_ID = 2;
+// LED bits come with the report keys are sent in
+static constexpr uint8_t LED_REPORT_ID = COMPOSITE_REPORT ? COMPOSITE_REPORT_ID : REPORT_ID;
+
+static constexpr uint8_t _hidReportDescriptor[] PROGMEM = {
+    HID_USAGE_PAGE(0x01),                  // Generic Desktop
+    HID_USAGE(0x06),                       // Keyboard
+    HID_COLLECTION(HID_APPLICATION),
+    HID_REPORT_ID(REPORT_ID),
+    HID_USAGE_PAGE(0x07),                  //   Keyboard
+    HID_USAGE_MINIMUM(0xE0),               //   Left Control
+    HID_USAGE_MAXIMUM(0xE7),               //   Right GUI
+    HID_LOGICAL_MINIMUM(0),
+    HID_LOGICAL_MAXIMUM(1),
+    HID_REPORT_SIZE(1),
+    HID_REPORT_COUNT(8),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), // modifiers
+    HID_REPORT_COUNT(1),
+    HID_REPORT_SIZE(8),
+    HID_INPUT(HID_CONSTANT | HID_VARIABLE | HID_ABSOLUTE), // reserved
+#if KEYBOARD_LED_REPORT
+    HID_REPORT_COUNT(5),
+    HID_REPORT_SIZE(1),
+    HID_USAGE_PAGE(0x08),                  //   LEDs
+    HID_USAGE_MINIMUM(0x01),               //   Num Lock
+    HID_USAGE_MAXIMUM(0x05),               //   Kana
+    HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+    HID_REPORT_COUNT(1),
+    HID_REPORT_SIZE(3),
+    HID_OUTPUT(HID_CONSTANT | HID_VARIABLE | HID_ABSOLUTE),
+#endif
+    HID_REPORT_COUNT(6),
+    HID_REPORT_SIZE(8),
+    HID_LOGICAL_MINIMUM(0),
+    HID_LOGICAL_MAXIMUM(0x73),
+    HID_USAGE_PAGE(0x07),                  //   Keyboard
+    HID_USAGE_MINIMUM(0x00),               //   Reserved (no event indicated)
+    HID_USAGE_MAXIMUM(0x73),               //   Keyboard Application
+    HID_INPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE), // keys
+    HID_END_COLLECTION
 };
 
-Keyboard_::Keyboard_(void)
+static_assert(hid::input_report_size(_hidReportDescriptor, sizeof(_hidReportDescriptor), REPORT_ID)
+              == sizeof(KeyReport), "KeyReport does not match descriptor!");
+static_assert(hid::input_offset_bits(_hidReportDescriptor, sizeof(_hidReportDescriptor), REPORT_ID, 1)
+              == offsetof(KeyReport, reserved) * 8, "KeyReport reserved offset does not match descriptor!");
+static_assert(hid::input_offset_bits(_hidReportDescriptor, sizeof(_hidReportDescriptor), REPORT_ID, 2)
+              == offsetof(KeyReport, keys) * 8, "KeyReport keys offset does not match descriptor!");
+// hid_set_report_received reads one byte of LED bits
+static_assert(hid::output_report_size(_hidReportDescriptor, sizeof(_hidReportDescriptor), REPORT_ID)
+              == (KEYBOARD_LED_REPORT ? 1u : 0u), "LED report does not match descriptor!");
+
+Keyboard_::Keyboard_(void) : _leds(0)
 {
+#if !COMPOSITE_REPORT
     static HIDSubDescriptor node(_hidReportDescriptor, sizeof(_hidReportDescriptor));
     HID().AppendDescriptor(&node);
+#endif
 }
 
 void Keyboard_::begin(void)
@@ -80,7 +104,27 @@ void Keyboard_::end(void)
 
 void Keyboard_::sendReport(KeyReport* keys)
 {
-    HID().SendReport(2, keys, sizeof(KeyReport));
+#if COMPOSITE_REPORT
+    Composite.keyboard_changed(*keys);
+#else
+    HID().SendReport(REPORT_ID, keys, sizeof(KeyReport));
+#endif
+}
+
+uint8_t Keyboard_::leds(void) const
+{
+    return _leds;
+}
+
+// Runs in USB interrupt, only store the bits
+void hid_set_report_received(uint8_t report_id, const uint8_t* data, uint16_t length)
+{
+    if (report_id != LED_REPORT_ID || length == 0)
+    {
+        return;
+    }
+    // Report ID is prefixed to data, since there are multiple reports
+    Keyboard._leds = length >= 2 ? data[1] : data[0];
 }
 
 extern
@@ -362,6 +406,67 @@ size_t Keyboard_::release_scan_code(uint8_t k)
     return 1;
 }
 
+// True if key or modifier of given scan code is in the current report
+bool Keyboard_::is_pressed_scan_code(uint8_t k) const
+{
+    if (k >= 0xE0u && k <= 0xE7u)
+    {
+        return (_keyReport.modifiers & (1 << (k - 0xE0u))) != 0;
+    }
+    for (uint8_t i = 0; i < 6; i++) {
+        if (0 != k && _keyReport.keys[i] == k) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Releases one key and presses another in a single report, with no report in
+// between holding neither. Either may be 0 for none, or a modifier. Sends nothing and returns 0
+// if no slot is free for the pressed key.
+size_t Keyboard_::replace_scan_code(uint8_t released, uint8_t pressed)
+{
+    KeyReport report = _keyReport;
+    if (released >= 0xE0u && released <= 0xE7u)
+    {
+        report.modifiers &= ~(1 << (released - 0xE0u));
+    }
+    else if (released != 0)
+    {
+        for (uint8_t i = 0; i < 6; i++) {
+            if (report.keys[i] == released) {
+                report.keys[i] = 0x00;
+            }
+        }
+    }
+
+    if (pressed >= 0xE0u && pressed <= 0xE7u)
+    {
+        report.modifiers |= (1 << (pressed - 0xE0u));
+    }
+    else if (pressed != 0 &&
+        report.keys[0] != pressed && report.keys[1] != pressed &&
+        report.keys[2] != pressed && report.keys[3] != pressed &&
+        report.keys[4] != pressed && report.keys[5] != pressed)
+    {
+        uint8_t i;
+        for (i = 0; i < 6; i++) {
+            if (report.keys[i] == 0x00) {
+                report.keys[i] = pressed;
+                break;
+            }
+        }
+        if (i == 6) {
+            setWriteError();
+            return 0;
+        }
+    }
+
+    _keyReport = report;
+    sendReport(&_keyReport);
+    return 1;
+}
+
 void Keyboard_::releaseAll(void)
 {
     _keyReport.keys[0] = 0;
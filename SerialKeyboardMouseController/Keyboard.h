@@ -82,9 +82,21 @@
 #define KEY_F23       0xFA
 #define KEY_F24       0xFB
 
+//  LED bits of output report from target
+#define LED_NUM_LOCK    0x01
+#define LED_CAPS_LOCK   0x02
+#define LED_SCROLL_LOCK 0x04
+#define LED_COMPOSE     0x08
+#define LED_KANA        0x10
 
-//  Low level key report: up to 6 keys and shift, ctrl etc at once
-typedef struct
+//  Set to 0 to build without the LED output report. Descriptor follows.
+#ifndef KEYBOARD_LED_REPORT
+#define KEYBOARD_LED_REPORT 1
+#endif
+
+//  Low level key report: up to 6 keys and shift, ctrl etc at once.
+//  Layout checked against the descriptor at compile time.
+typedef struct __attribute__((packed))
 {
     uint8_t modifiers;
     uint8_t reserved;
@@ -95,7 +107,9 @@ class Keyboard_ : public Print
 {
 private:
     KeyReport _keyReport;
+    volatile uint8_t _leds;
     void sendReport(KeyReport* keys);
+    friend void hid_set_report_received(uint8_t report_id, const uint8_t* data, uint16_t length);
 public:
     Keyboard_(void);
     void begin(void);
@@ -106,8 +120,15 @@ public:
     size_t press_scan_code(uint8_t k);
     size_t release(uint8_t k);
     size_t release_scan_code(uint8_t k);
+    size_t replace_scan_code(uint8_t released, uint8_t pressed);
+    bool is_pressed_scan_code(uint8_t k) const;
     void releaseAll(void);
+    uint8_t leds(void) const;
 };
+
+//  Called by HID_::setup() on HID_SET_REPORT. Stock Arduino core ignores SET_REPORT,
+//  see README for the patch forwarding it here. Without it, leds() always returns 0.
+void hid_set_report_received(uint8_t report_id, const uint8_t* data, uint16_t length);
 extern Keyboard_ Keyboard;
 
 #endif
@@ -1,184 +1,814 @@
-/*
- Name:		SerialKeyboardMouseController.ino
- Created:	2020/12/28 4:23:35
- Author:	CSR
-*/
-
-#include <string.h>
-// Make sure to change SERIAL_RX_BUFFER_SIZE to 512 or higher in <HardwareSerial.h>
-#include <Arduino.h>
-#include "Keyboard.h"
-#include "AbsMouse.h"
-#include "serial_symbols.h"
-#include "debug_print.h"
-
-/****************************** Settings ******************************/
-constexpr unsigned int SERIAL_TIMEOUT = 1000 / ((BAUD_RATE / 8) / MAX_FRAME_LENGTH) + 2;
-constexpr unsigned int RECEIVE_DATA_BUFFER_SIZE = 128u;
-static_assert(RECEIVE_DATA_BUFFER_SIZE >= MAX_FRAME_LENGTH + 2, "Serial receiving buffer must larger than frame size!");
-constexpr unsigned long MAX_RESOLUTION_WIDTH = 7680u;
-constexpr unsigned long MAX_RESOLUTION_HEIGHT = 4320u;
-HardwareSerial& ControlSerial = Serial1;
-
-/****************************** Globals *******************************/
-unsigned long current_resolution_width = 1920u;
-unsigned long current_resolution_height = 1080u;
-
-/*************************** Implementation ***************************/
-inline bool xor_checksum_check(const uint8_t* data, const uint8_t length, const uint8_t value)
-{
-    if (length == 0)
-    {
-        return true;
-    }
-    const uint8_t* ptr = data;
-    uint8_t checksum = *(ptr++);
-    for (uint8_t i = 1; i < length; ++i)
-    {
-        checksum ^= *ptr;
-        ++ptr;
-    }
-    return checksum == value;
-}
-
-// the setup function runs once when you press reset or power the board
-void setup()
-{
-#ifdef _DEBUG
-    Serial.begin(115200);
-#endif
-    ControlSerial.begin(BAUD_RATE);
-    ControlSerial.setTimeout(SERIAL_TIMEOUT);
-    Keyboard.begin();
-    AbsMouse.init(current_resolution_width, current_resolution_height, true);
-    ControlSerial.println("ControlSerial Initialized!");
-}
-
-// the loop function runs over and over again until power down or reset
-void loop()
-{
-    static uint8_t data_buffer[RECEIVE_DATA_BUFFER_SIZE];
-    static uint8_t* const ptr_data = data_buffer + 2; // reserve 2 bytes for loop-back frame
-
-    if (ControlSerial.read() == FRAME_START)
-    {
-        // Read length
-        uint8_t length = 0xFFu;
-        ControlSerial.readBytes(&length, 1);
-        if (length > MAX_DATA_LENGTH || length == 0)
-        {
-            debug_println("Incorrect data length!");
-            return;
-        }
-        // Read data
-        if (ControlSerial.readBytes(ptr_data, length) != length)
-        {
-            debug_println("Reading data timeout!");
-            return;
-        }
-        // Integrity check
-        if (!xor_checksum_check(ptr_data, length - 1, ptr_data[length - 1]))
-        {
-            debug_println("Corrupted data!");
-            return;
-        }
-
-        // Construct reply of the same frame to indicate host that we've complete the frame
-        data_buffer[0] = FRAME_START;
-        data_buffer[1] = length;
-
-        // Execute the frame
-        const uint8_t type = ptr_data[0];
-        switch (type)
-        {
-        case FRAME_TYPE_MOUSE_MOVE:
-        {
-            uint16_t x = 0;
-            uint16_t y = 0;
-            memcpy(&x, ptr_data + 1, 2);
-            memcpy(&y, ptr_data + 3, 2);
-            if (x > current_resolution_width || y > current_resolution_height || x == 0 || y == 0)
-            {
-                debug_print("Coordinates out of range: ");
-                debug_print(x);
-                debug_print(", ");
-                debug_println(y);
-                return;
-            }
-            AbsMouse.move(x, y);
-            break;
-        }
-        case FRAME_TYPE_MOUSE_SCROLL:
-        {
-            const int8_t step = static_cast<int8_t>(ptr_data[1]);
-            AbsMouse.scroll(step);
-            break;
-        }
-        case FRAME_TYPE_MOUSE_PRESS:
-        {
-            const uint8_t key = ptr_data[1];
-            AbsMouse.press(key);
-            break;
-        }
-        case FRAME_TYPE_MOUSE_RELEASE:
-        {
-            const uint8_t key = ptr_data[1];
-            if (key == RELEASE_ALL_KEYS)
-            {
-                AbsMouse.release(MOUSE_LEFT | MOUSE_RIGHT | MOUSE_MIDDLE);
-            }
-            else
-            {
-                AbsMouse.release(key);
-            }
-            break;
-        }
-        case FRAME_TYPE_MOUSE_RESOLUTION:
-        {
-            uint16_t new_width = 0;
-            uint16_t new_height = 0;
-            memcpy(&new_width, ptr_data + 1, 2);
-            memcpy(&new_height, ptr_data + 3, 2);
-            if (new_width == 0 || new_height == 0 || new_width > MAX_RESOLUTION_WIDTH || new_height > MAX_RESOLUTION_HEIGHT)
-            {
-                debug_println("Corrupted/Incorrect resolution values!");
-                return;
-            }
-            current_resolution_width = new_width;
-            current_resolution_height = new_height;
-            AbsMouse.init(new_width, new_height, true);
-            debug_print("Changed resolution to: ");
-            debug_print(new_width);
-            debug_print("x");
-            debug_println(new_height);
-            break;
-        }
-        case FRAME_TYPE_KEY_PRESS:
-        {
-            const uint8_t key = ptr_data[1];
-            Keyboard.press_scan_code(key);
-            break;
-        }
-        case FRAME_TYPE_KEY_RELEASE:
-        {
-            const uint8_t key = ptr_data[1];
-            if (key == RELEASE_ALL_KEYS)
-            {
-                Keyboard.releaseAll();
-            }
-            else
-            {
-                Keyboard.release_scan_code(key);
-            }
-            break;
-        }
-        default:
-        {
-            return;
-        }
-        }
-        // Send loop-back frame
-        ControlSerial.write(data_buffer, length + 2);
-
-    }
-}
+/*
+ Name:		SerialKeyboardMouseController.ino
+ Created:	2020/12/28 4:23:35
+ Author:	CSR
+*/
+
+#include <string.h>
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#include <EEPROM.h>
+#endif
+// Make sure to change SERIAL_RX_BUFFER_SIZE to 512 or higher in <HardwareSerial.h>
+#include <Arduino.h>
+#include "Keyboard.h"
+#include "AbsMouse.h"
+#include "Composite.h"
+#include "serial_symbols.h"
+#include "debug_print.h"
+
+/****************************** Settings ******************************/
+constexpr unsigned int SERIAL_TIMEOUT = 1000 / ((BAUD_RATE / 8) / MAX_FRAME_LENGTH) + 2;
+constexpr unsigned int RECEIVE_DATA_BUFFER_SIZE = 128u;
+static_assert(RECEIVE_DATA_BUFFER_SIZE >= MAX_FRAME_LENGTH + 2, "Serial receiving buffer must larger than frame size!");
+constexpr unsigned long MAX_RESOLUTION_WIDTH = 7680u;
+constexpr unsigned long MAX_RESOLUTION_HEIGHT = 4320u;
+// Sleep between interrupts after this long without serial input. 0 disables idle sleep.
+constexpr unsigned long IDLE_SLEEP_AFTER_MS = 5000u;
+// EEPROM location of persistent device id, reported by FRAME_TYPE_IDENTIFY
+constexpr int DEVICE_ID_EEPROM_ADDRESS = 0;
+constexpr uint32_t DEVICE_ID_MAGIC = 0x494D4B53u; // "SKMI"
+
+constexpr uint8_t TYPING_QUEUE_SIZE = 16u;
+constexpr unsigned long TYPING_REPORT_INTERVAL_US = 1000u; // One report per full-speed USB frame
+constexpr uint8_t TYPING_SHIFT_USAGE = 0xE1u; // Left Shift
+constexpr uint8_t DEFERRED_QUEUE_SIZE = 16u;
+HardwareSerial& ControlSerial = Serial1;
+
+/****************************** Globals *******************************/
+unsigned long current_resolution_width = 1920u;
+unsigned long current_resolution_height = 1080u;
+
+// Link statistics, reported by FRAME_TYPE_QUERY_STATS
+struct LinkStatistics
+{
+    uint16_t unreliable_moves_received;
+    uint16_t unreliable_moves_dropped;
+    uint16_t frames_corrupted;
+};
+static_assert(1 + sizeof(LinkStatistics) + 1 <= MAX_DATA_LENGTH, "Statistics reply must fit in a frame!");
+LinkStatistics link_statistics = {};
+bool unreliable_sequence_valid = false;
+uint8_t unreliable_sequence_expected = 0;
+
+// Idle sleep statistics, reported by FRAME_TYPE_QUERY_IDLE_STATS.
+// Wakes counts sleeps ended with a byte received; timer and USB wakes are not counted.
+// First-frame time runs from finding that byte after sleep_cpu() returns to sending the frame's loop-back,
+// i.e. receiving the rest of the frame, executing it and writing the loop-back. The wake itself is not
+// included: the core's RX interrupt cannot be timestamped from here, and idle mode resumes within cycles.
+struct IdleStatistics
+{
+    uint16_t wakes;
+    uint16_t last_wake_frame_us;
+    uint16_t max_wake_frame_us;
+};
+static_assert(1 + sizeof(IdleStatistics) + 1 <= MAX_DATA_LENGTH, "Idle statistics reply must fit in a frame!");
+IdleStatistics idle_statistics = {};
+unsigned long last_serial_activity = 0;
+bool woke_on_serial = false;
+unsigned long wake_micros = 0;
+
+// Persistent id, reported by FRAME_TYPE_IDENTIFY
+uint32_t device_id = 0;
+
+// Last tagged frame executed, a repeat of it is a retransmission and only looped back
+uint8_t last_tagged_frame[MAX_DATA_LENGTH] = {};
+uint8_t last_tagged_length = 0;
+
+// Keys queued by FRAME_TYPE_TYPE_KEYS, and the engine typing them. At most one key of its own is held.
+uint8_t typing_queue[TYPING_QUEUE_SIZE];
+uint8_t typing_head = 0;
+uint8_t typing_count = 0;
+uint8_t typing_held = 0; // Usage held by engine, 0 for none
+bool typing_shift = false;
+bool typing_shift_pressed = false; // Shift was pressed by engine, not already held by host
+unsigned long typing_last_report = 0;
+
+// Frames looped back while typing, executed in order once it ends
+uint8_t deferred_frames[DEFERRED_QUEUE_SIZE][MAX_DATA_LENGTH];
+uint8_t deferred_head = 0;
+uint8_t deferred_count = 0;
+
+// Keyboard LEDs last told to host by FRAME_TYPE_EVENT_KEYBOARD_LEDS
+uint8_t reported_keyboard_leds = 0;
+
+// USB status last told to host by FRAME_TYPE_EVENT_USB_STATUS, with boot-to-ready timing
+constexpr uint16_t ELAPSED_UNKNOWN = 0xFFFFu;
+uint8_t reported_usb_status = 0;
+unsigned long usb_unconfigured_since = 0; // Power-on, or last loss of configuration
+uint16_t elapsed_to_configured = ELAPSED_UNKNOWN;
+uint16_t elapsed_to_first_report = ELAPSED_UNKNOWN;
+
+/*************************** Implementation ***************************/
+inline bool xor_checksum_check(const uint8_t* data, const uint8_t length, const uint8_t value)
+{
+    if (length == 0)
+    {
+        return true;
+    }
+    const uint8_t* ptr = data;
+    uint8_t checksum = *(ptr++);
+    for (uint8_t i = 1; i < length; ++i)
+    {
+        checksum ^= *ptr;
+        ++ptr;
+    }
+    return checksum == value;
+}
+
+inline bool move_mouse_checked(const uint8_t* data)
+{
+    uint16_t x = 0;
+    uint16_t y = 0;
+    memcpy(&x, data, 2);
+    memcpy(&y, data + 2, 2);
+    if (x > current_resolution_width || y > current_resolution_height || x == 0 || y == 0)
+    {
+        debug_print("Coordinates out of range: ");
+        debug_print(x);
+        debug_print(", ");
+        debug_println(y);
+        return false;
+    }
+    AbsMouse.move(x, y);
+    return true;
+}
+
+// Account an unreliable move's sequence number. Gaps since the last one are moves lost on the wire.
+inline void track_unreliable_sequence(const uint8_t sequence)
+{
+    if (unreliable_sequence_valid)
+    {
+        link_statistics.unreliable_moves_dropped += static_cast<uint8_t>(sequence - unreliable_sequence_expected);
+    }
+    unreliable_sequence_valid = true;
+    unreliable_sequence_expected = sequence + 1;
+}
+
+// Send a frame of given data, appending checksum
+inline void send_frame(const uint8_t* data, const uint8_t length)
+{
+    const uint8_t prefix[] = {FRAME_START, static_cast<uint8_t>(length + 1)};
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        checksum ^= data[i];
+    }
+    ControlSerial.write(prefix, sizeof(prefix));
+    ControlSerial.write(data, length);
+    ControlSerial.write(checksum);
+}
+
+inline void send_event(const uint8_t type, const uint8_t value)
+{
+    const uint8_t data[] = {type, value};
+    send_frame(data, sizeof(data));
+}
+
+// Milliseconds since a time, saturated at ELAPSED_UNKNOWN - 1, which host reports as a lower bound
+inline uint16_t elapsed_since(const unsigned long since)
+{
+    const unsigned long elapsed = millis() - since;
+    return elapsed >= ELAPSED_UNKNOWN ? ELAPSED_UNKNOWN - 1 : static_cast<uint16_t>(elapsed);
+}
+
+inline uint8_t current_usb_status()
+{
+    uint8_t status = 0;
+    if (USBDevice.configured())
+    {
+        status |= USB_STATUS_CONFIGURED;
+    }
+    if (USBDevice.isSuspended())
+    {
+        status |= USB_STATUS_SUSPENDED;
+    }
+    return status;
+}
+
+inline void send_usb_status()
+{
+    const uint8_t data[] = {
+        FRAME_TYPE_EVENT_USB_STATUS, reported_usb_status,
+        static_cast<uint8_t>(elapsed_to_configured), static_cast<uint8_t>(elapsed_to_configured >> 8),
+        static_cast<uint8_t>(elapsed_to_first_report), static_cast<uint8_t>(elapsed_to_first_report >> 8)
+    };
+    static_assert(sizeof(data) + 1 <= MAX_DATA_LENGTH, "USB status must fit in a frame!");
+    send_frame(data, sizeof(data));
+}
+
+// Track enumeration and suspend, and tell host on every change
+inline void update_usb_status()
+{
+    const uint8_t status = current_usb_status();
+    if (status == reported_usb_status)
+    {
+        return;
+    }
+    if ((status & USB_STATUS_CONFIGURED) && !(reported_usb_status & USB_STATUS_CONFIGURED))
+    {
+        elapsed_to_configured = elapsed_since(usb_unconfigured_since);
+    }
+    else if (!(status & USB_STATUS_CONFIGURED) && (reported_usb_status & USB_STATUS_CONFIGURED))
+    {
+        // Target rebooted or unplugged us, time its next boot
+        usb_unconfigured_since = millis();
+        elapsed_to_configured = ELAPSED_UNKNOWN;
+        elapsed_to_first_report = ELAPSED_UNKNOWN;
+    }
+    reported_usb_status = status;
+    send_usb_status();
+}
+
+// Sleep until next interrupt. Idle mode keeps UART running, so the waking byte is received as usual.
+// USB frame and millis() timer interrupts also wake us, which only costs one more loop pass.
+inline void idle_sleep()
+{
+#if defined(__AVR__)
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    noInterrupts();
+    if (ControlSerial.available())
+    {
+        interrupts();
+        return;
+    }
+    sleep_enable();
+    interrupts(); // Instruction after SEI always runs, so no interrupt can slip in before sleeping
+    sleep_cpu();
+    sleep_disable();
+#elif defined(ARDUINO_ARCH_SAMD)
+    __WFI();
+#endif
+    if (ControlSerial.available())
+    {
+        woke_on_serial = true;
+        wake_micros = micros();
+        ++idle_statistics.wakes;
+    }
+}
+
+inline void record_wake_frame_time()
+{
+    const unsigned long elapsed = micros() - wake_micros;
+    idle_statistics.last_wake_frame_us = elapsed > 0xFFFFu ? 0xFFFFu : static_cast<uint16_t>(elapsed);
+    if (idle_statistics.last_wake_frame_us > idle_statistics.max_wake_frame_us)
+    {
+        idle_statistics.max_wake_frame_us = idle_statistics.last_wake_frame_us;
+    }
+}
+
+// Load device id, creating one on first boot. AVR keeps a random id in EEPROM, which survives uploads.
+// SAMD has no EEPROM but a factory-programmed 128-bit serial number, folded to 32 bits.
+inline uint32_t load_device_id()
+{
+#if defined(__AVR__)
+    struct
+    {
+        uint32_t magic;
+        uint32_t id;
+    } stored;
+    EEPROM.get(DEVICE_ID_EEPROM_ADDRESS, stored);
+    if (stored.magic != DEVICE_ID_MAGIC || stored.id == 0 || stored.id == 0xFFFFFFFFu)
+    {
+        // Floating analog input and boot timing differ between boards
+        uint32_t seed = micros();
+        for (uint8_t i = 0; i < 32; ++i)
+        {
+            seed = (seed << 1 | seed >> 31) ^ static_cast<uint32_t>(analogRead(A0));
+        }
+        randomSeed(seed);
+        stored.magic = DEVICE_ID_MAGIC;
+        stored.id = (static_cast<uint32_t>(random(0x10000)) << 16 | static_cast<uint32_t>(random(0x10000))) | 1u;
+        EEPROM.put(DEVICE_ID_EEPROM_ADDRESS, stored);
+    }
+    return stored.id;
+#elif defined(ARDUINO_ARCH_SAMD)
+    const volatile uint32_t* const serial_words[] = {
+        reinterpret_cast<const volatile uint32_t*>(0x0080A00Cu), reinterpret_cast<const volatile uint32_t*>(0x0080A040u),
+        reinterpret_cast<const volatile uint32_t*>(0x0080A044u), reinterpret_cast<const volatile uint32_t*>(0x0080A048u)
+    };
+    uint32_t id = 0;
+    for (const volatile uint32_t* word : serial_words)
+    {
+        id = (id << 5 | id >> 27) ^ *word;
+    }
+    return id;
+#else
+    return 0;
+#endif
+}
+
+inline void send_identity()
+{
+    uint8_t data[1 + sizeof(device_id) + 2] = {FRAME_TYPE_IDENTIFY};
+    memcpy(data + 1, &device_id, sizeof(device_id));
+    data[1 + sizeof(device_id)] = PROTOCOL_VERSION;
+    data[2 + sizeof(device_id)] = CAPABILITY_UNRELIABLE_MOVE | CAPABILITY_KEYBOARD_LEDS | CAPABILITY_USB_STATUS
+        | (IDLE_SLEEP_AFTER_MS != 0 ? CAPABILITY_IDLE_SLEEP : 0) | CAPABILITY_KEY_MOUSE_FRAMES
+        | (COMPOSITE_REPORT ? CAPABILITY_COMPOSITE_REPORT : 0) | CAPABILITY_FRAME_TAGS
+        | CAPABILITY_TYPING;
+    static_assert(sizeof(data) + 1 <= MAX_DATA_LENGTH, "Identity must fit in a frame!");
+    send_frame(data, sizeof(data));
+}
+
+// Frames producing HID reports, which go nowhere unless target is ready
+inline bool frame_sends_report(const uint8_t type)
+{
+    switch (type)
+    {
+    case FRAME_TYPE_MOUSE_MOVE:
+    case FRAME_TYPE_MOUSE_MOVE_UNRELIABLE:
+    case FRAME_TYPE_MOUSE_SCROLL:
+    case FRAME_TYPE_MOUSE_PRESS:
+    case FRAME_TYPE_MOUSE_RELEASE:
+    case FRAME_TYPE_KEY_PRESS:
+    case FRAME_TYPE_KEY_RELEASE:
+    case FRAME_TYPE_KEY_MOUSE_PRESS:
+    case FRAME_TYPE_KEY_MOUSE_RELEASE:
+    case FRAME_TYPE_TYPE_KEYS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Commands that are looped back, so a retransmission can be told apart by FRAME_TYPE_TAGGED
+inline bool frame_taggable(const uint8_t type)
+{
+    return (frame_sends_report(type) && type != FRAME_TYPE_MOUSE_MOVE_UNRELIABLE) || type == FRAME_TYPE_MOUSE_RESOLUTION;
+}
+
+inline bool typing_active()
+{
+    return typing_count != 0 || typing_held != 0 || typing_shift;
+}
+
+// End a run of shifted keys. Shift held by host before the run stays held.
+inline void typing_release_shift()
+{
+    if (typing_shift_pressed)
+    {
+        Keyboard.release_scan_code(TYPING_SHIFT_USAGE);
+    }
+    typing_shift = false;
+    typing_shift_pressed = false;
+}
+
+// Sends the next report of queued typing, if one is due. The next key is pressed in the report
+// releasing the previous one, so a character costs one report instead of two. Target still sees
+// each key go down in order, and only one of them goes down per report. A repeated key is released
+// first, and Shift changes in a report of its own while no typed key is held.
+inline void typing_step()
+{
+    if (micros() - typing_last_report < TYPING_REPORT_INTERVAL_US)
+    {
+        return;
+    }
+    typing_last_report = micros();
+
+    if (typing_count == 0)
+    {
+        if (typing_held != 0)
+        {
+            Keyboard.release_scan_code(typing_held);
+            typing_held = 0;
+        }
+        else
+        {
+            typing_release_shift();
+        }
+        return;
+    }
+
+    const uint8_t next = typing_queue[typing_head];
+    const uint8_t usage = next & ~TYPE_KEY_SHIFT;
+    const bool shift = (next & TYPE_KEY_SHIFT) != 0;
+    if (shift != typing_shift)
+    {
+        if (shift)
+        {
+            typing_shift_pressed = !Keyboard.is_pressed_scan_code(TYPING_SHIFT_USAGE);
+            Keyboard.replace_scan_code(typing_held, TYPING_SHIFT_USAGE);
+            typing_held = 0;
+            typing_shift = true;
+        }
+        else if (typing_held != 0)
+        {
+            Keyboard.release_scan_code(typing_held);
+            typing_held = 0;
+        }
+        else
+        {
+            typing_release_shift();
+        }
+        return;
+    }
+    if (usage == typing_held)
+    {
+        Keyboard.release_scan_code(typing_held);
+        typing_held = 0;
+        return;
+    }
+    if (Keyboard.replace_scan_code(typing_held, usage))
+    {
+        typing_held = usage;
+    }
+    else if (typing_held != 0)
+    {
+        // All 6 slots taken, free ours and press alone next report
+        Keyboard.release_scan_code(typing_held);
+        typing_held = 0;
+        return;
+    }
+    else
+    {
+        debug_println("Keys held by host fill rollover, typed key dropped!");
+    }
+    typing_head = (typing_head + 1) % TYPING_QUEUE_SIZE;
+    --typing_count;
+}
+
+// Frames run in order with typing: those producing reports, and resolution, which scales later moves
+inline bool frame_ordered(const uint8_t type)
+{
+    return frame_sends_report(type) || type == FRAME_TYPE_MOUSE_RESOLUTION;
+}
+
+// Execute a frame of frame_ordered() type. Returns false if frame is invalid.
+inline bool execute_ordered(const uint8_t* command)
+{
+    switch (command[0])
+    {
+    case FRAME_TYPE_MOUSE_MOVE:
+    case FRAME_TYPE_MOUSE_MOVE_UNRELIABLE:
+    {
+        return move_mouse_checked(command + 1);
+    }
+    case FRAME_TYPE_MOUSE_SCROLL:
+    {
+        const int8_t step = static_cast<int8_t>(command[1]);
+        AbsMouse.scroll(step);
+        return true;
+    }
+    case FRAME_TYPE_MOUSE_PRESS:
+    {
+        const uint8_t key = command[1];
+        AbsMouse.press(key);
+        return true;
+    }
+    case FRAME_TYPE_MOUSE_RELEASE:
+    {
+        const uint8_t key = command[1];
+        if (key == RELEASE_ALL_KEYS)
+        {
+            AbsMouse.release(MOUSE_LEFT | MOUSE_RIGHT | MOUSE_MIDDLE);
+        }
+        else
+        {
+            AbsMouse.release(key);
+        }
+        return true;
+    }
+    case FRAME_TYPE_MOUSE_RESOLUTION:
+    {
+        uint16_t new_width = 0;
+        uint16_t new_height = 0;
+        memcpy(&new_width, command + 1, 2);
+        memcpy(&new_height, command + 3, 2);
+        if (new_width == 0 || new_height == 0 || new_width > MAX_RESOLUTION_WIDTH || new_height > MAX_RESOLUTION_HEIGHT)
+        {
+            debug_println("Corrupted/Incorrect resolution values!");
+            return false;
+        }
+        current_resolution_width = new_width;
+        current_resolution_height = new_height;
+        AbsMouse.init(new_width, new_height, true);
+        debug_print("Changed resolution to: ");
+        debug_print(new_width);
+        debug_print("x");
+        debug_println(new_height);
+        return true;
+    }
+    case FRAME_TYPE_KEY_PRESS:
+    {
+        const uint8_t key = command[1];
+        Keyboard.press_scan_code(key);
+        return true;
+    }
+    case FRAME_TYPE_KEY_RELEASE:
+    {
+        const uint8_t key = command[1];
+        if (key == RELEASE_ALL_KEYS)
+        {
+            Keyboard.releaseAll();
+        }
+        else
+        {
+            Keyboard.release_scan_code(key);
+        }
+        return true;
+    }
+    case FRAME_TYPE_TYPE_KEYS:
+    {
+        for (uint8_t i = 1; i <= TYPE_KEYS_PER_FRAME; ++i)
+        {
+            if (command[i] == 0)
+            {
+                continue;
+            }
+            while (typing_count == TYPING_QUEUE_SIZE)
+            {
+                typing_step();
+            }
+            typing_queue[(typing_head + typing_count) % TYPING_QUEUE_SIZE] = command[i];
+            ++typing_count;
+        }
+        return true;
+    }
+    case FRAME_TYPE_KEY_MOUSE_PRESS:
+    {
+        const uint8_t key = command[1];
+        const uint8_t buttons = command[2];
+        Composite.begin_batch();
+        if (key != 0)
+        {
+            Keyboard.press_scan_code(key);
+        }
+        if (buttons != 0)
+        {
+            AbsMouse.press(buttons);
+        }
+        Composite.end_batch();
+        return true;
+    }
+    case FRAME_TYPE_KEY_MOUSE_RELEASE:
+    {
+        const uint8_t key = command[1];
+        const uint8_t buttons = command[2];
+        Composite.begin_batch();
+        if (buttons != 0)
+        {
+            AbsMouse.release(buttons);
+        }
+        if (key != 0)
+        {
+            Keyboard.release_scan_code(key);
+        }
+        Composite.end_batch();
+        return true;
+    }
+    default:
+    {
+        return false;
+    }
+    }
+}
+
+// Execute the oldest deferred frame. It was looped back already, so an invalid one is only dropped.
+inline void deferred_step()
+{
+    if (!execute_ordered(deferred_frames[deferred_head]))
+    {
+        debug_println("Deferred frame invalid, dropped!");
+    }
+    deferred_head = (deferred_head + 1) % DEFERRED_QUEUE_SIZE;
+    --deferred_count;
+}
+
+// Type out everything queued and run all deferred frames
+inline void deferred_finish()
+{
+    while (typing_active() || deferred_count != 0)
+    {
+        if (typing_active())
+        {
+            typing_step();
+        }
+        else
+        {
+            deferred_step();
+        }
+    }
+}
+
+// the setup function runs once when you press reset or power the board
+void setup()
+{
+#ifdef _DEBUG
+    Serial.begin(115200);
+#endif
+    ControlSerial.begin(BAUD_RATE);
+    ControlSerial.setTimeout(SERIAL_TIMEOUT);
+    Keyboard.begin();
+    AbsMouse.init(current_resolution_width, current_resolution_height, true);
+    device_id = load_device_id();
+    ControlSerial.println("ControlSerial Initialized!");
+}
+
+// the loop function runs over and over again until power down or reset
+void loop()
+{
+    static uint8_t data_buffer[RECEIVE_DATA_BUFFER_SIZE];
+    static uint8_t* const ptr_data = data_buffer + 2; // reserve 2 bytes for loop-back frame
+
+    // Forward USB and LED changes from target, only between frames so they never interleave
+    update_usb_status();
+    const uint8_t keyboard_leds = Keyboard.leds();
+    if (keyboard_leds != reported_keyboard_leds)
+    {
+        reported_keyboard_leds = keyboard_leds;
+        send_event(FRAME_TYPE_EVENT_KEYBOARD_LEDS, keyboard_leds);
+    }
+
+    if (typing_active())
+    {
+        typing_step();
+    }
+    else if (deferred_count != 0)
+    {
+        deferred_step();
+    }
+
+    if (!ControlSerial.available())
+    {
+        if (IDLE_SLEEP_AFTER_MS != 0 && !typing_active() && deferred_count == 0 && millis() - last_serial_activity >= IDLE_SLEEP_AFTER_MS)
+        {
+            idle_sleep();
+        }
+        return;
+    }
+    last_serial_activity = millis();
+
+    if (ControlSerial.read() == FRAME_START)
+    {
+        // Only a frame completed right after waking is a sample
+        const bool first_frame_after_wake = woke_on_serial;
+        woke_on_serial = false;
+
+        // Read length
+        uint8_t length = 0xFFu;
+        ControlSerial.readBytes(&length, 1);
+        if (length > MAX_DATA_LENGTH || length == 0)
+        {
+            debug_println("Incorrect data length!");
+            return;
+        }
+        // Read data
+        if (ControlSerial.readBytes(ptr_data, length) != length)
+        {
+            debug_println("Reading data timeout!");
+            ++link_statistics.frames_corrupted;
+            return;
+        }
+        // Integrity check
+        if (!xor_checksum_check(ptr_data, length - 1, ptr_data[length - 1]))
+        {
+            debug_println("Corrupted data!");
+            ++link_statistics.frames_corrupted;
+            return;
+        }
+
+        // Construct reply of the same frame to indicate host that we've complete the frame
+        data_buffer[0] = FRAME_START;
+        data_buffer[1] = length;
+
+        // Unwrap tagged command. A repeat of the last one executed was already executed, only loop it back.
+        const bool tagged = ptr_data[0] == FRAME_TYPE_TAGGED;
+        const uint8_t* const command = tagged ? ptr_data + 2 : ptr_data;
+        if (tagged)
+        {
+            if (length < 4 || !frame_taggable(command[0]))
+            {
+                debug_println("Incorrect tagged frame!");
+                return;
+            }
+            if (length == last_tagged_length && memcmp(ptr_data, last_tagged_frame, length) == 0)
+            {
+                debug_println("Retransmission, not executed again.");
+                ControlSerial.write(data_buffer, length + 2);
+                return;
+            }
+        }
+
+        // Reports sent before enumeration or while suspended are lost, reject instead
+        const uint8_t type = command[0];
+        if (frame_sends_report(type) && reported_usb_status != USB_STATUS_CONFIGURED)
+        {
+            if (type == FRAME_TYPE_MOUSE_MOVE_UNRELIABLE)
+            {
+                // Advance sequence, so the next accepted move does not count this one again as a gap
+                track_unreliable_sequence(command[5]);
+                ++link_statistics.unreliable_moves_dropped;
+                return;
+            }
+            const uint8_t nack[] = {
+                FRAME_TYPE_NACK, type,
+                (reported_usb_status & USB_STATUS_CONFIGURED) ? NACK_REASON_SUSPENDED : NACK_REASON_NOT_CONFIGURED
+            };
+            send_frame(nack, sizeof(nack));
+            return;
+        }
+        if (frame_ordered(type))
+        {
+            if (type == FRAME_TYPE_MOUSE_MOVE_UNRELIABLE)
+            {
+                track_unreliable_sequence(command[5]);
+                ++link_statistics.unreliable_moves_received;
+            }
+            if (deferred_count == DEFERRED_QUEUE_SIZE)
+            {
+                // Host outran typing by a whole queue, catch up before taking more
+                deferred_finish();
+            }
+            if (deferred_count != 0 || (typing_active() && type != FRAME_TYPE_TYPE_KEYS))
+            {
+                // Runs after typing, but is looped back now: typing it out first could outlast host's timeout
+                memcpy(deferred_frames[(deferred_head + deferred_count) % DEFERRED_QUEUE_SIZE], command,
+                    tagged ? length - 2 : length);
+                ++deferred_count;
+            }
+            else if (!execute_ordered(command))
+            {
+                return;
+            }
+            if (type == FRAME_TYPE_MOUSE_MOVE_UNRELIABLE)
+            {
+                // Never looped back
+                return;
+            }
+        }
+        // Execute queries
+        switch (type)
+        {
+        case FRAME_TYPE_QUERY_STATS:
+        {
+            // Reply with statistics instead of loop-back
+            length = 1 + sizeof(LinkStatistics) + 1;
+            memcpy(ptr_data + 1, &link_statistics, sizeof(LinkStatistics));
+            ptr_data[length - 1] = 0;
+            for (uint8_t i = 0; i < length - 1; ++i)
+            {
+                ptr_data[length - 1] ^= ptr_data[i];
+            }
+            data_buffer[1] = length;
+            break;
+        }
+        case FRAME_TYPE_QUERY_IDLE_STATS:
+        {
+            // Reply with statistics instead of loop-back
+            length = 1 + sizeof(IdleStatistics) + 1;
+            memcpy(ptr_data + 1, &idle_statistics, sizeof(IdleStatistics));
+            ptr_data[length - 1] = 0;
+            for (uint8_t i = 0; i < length - 1; ++i)
+            {
+                ptr_data[length - 1] ^= ptr_data[i];
+            }
+            data_buffer[1] = length;
+            break;
+        }
+        case FRAME_TYPE_IDENTIFY:
+        {
+            send_identity();
+            return;
+        }
+        case FRAME_TYPE_EVENT_KEYBOARD_LEDS:
+        {
+            // Query, answered by current LED event
+            reported_keyboard_leds = Keyboard.leds();
+            send_event(FRAME_TYPE_EVENT_KEYBOARD_LEDS, reported_keyboard_leds);
+            return;
+        }
+        case FRAME_TYPE_EVENT_USB_STATUS:
+        {
+            // Query, answered by current USB status event
+            send_usb_status();
+            return;
+        }
+        default:
+        {
+            // Ordered frames were executed or deferred above
+            if (!frame_ordered(type))
+            {
+                return;
+            }
+            break;
+        }
+        }
+        if (frame_sends_report(type) && elapsed_to_first_report == ELAPSED_UNKNOWN)
+        {
+            elapsed_to_first_report = elapsed_since(usb_unconfigured_since);
+        }
+        if (tagged)
+        {
+            memcpy(last_tagged_frame, ptr_data, length);
+            last_tagged_length = length;
+        }
+        // Send loop-back frame
+        ControlSerial.write(data_buffer, length + 2);
+        if (first_frame_after_wake)
+        {
+            record_wake_frame_time();
+        }
+
+    }
+}
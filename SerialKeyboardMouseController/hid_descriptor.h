@@ -0,0 +1,163 @@
+#ifndef HID_DESCRIPTOR_H_
+#define HID_DESCRIPTOR_H_
+
+#include <stdint.h>
+
+/*
+ * HID report descriptor composition.
+ *
+ * Descriptors are assembled from the item macros below into a constexpr PROGMEM array. The constexpr
+ * functions in namespace hid walk that array at compile time, so report sizes and field offsets are derived
+ * from the descriptor itself and static_asserted against the report structs sent with HID().SendReport().
+ * Parts of a descriptor can be left out per build with #if, and a struct left out of step fails to compile.
+ *
+ * Only short items are supported. Push/Pop are not tracked.
+ */
+
+// Main items
+#define HID_INPUT(flags) 0x81u, (flags)
+#define HID_OUTPUT(flags) 0x91u, (flags)
+#define HID_COLLECTION(type) 0xA1u, (type)
+#define HID_END_COLLECTION 0xC0u
+
+// Global items
+#define HID_USAGE_PAGE(page) 0x05u, (page)
+#define HID_LOGICAL_MINIMUM(value) 0x15u, static_cast<uint8_t>(value)
+#define HID_LOGICAL_MAXIMUM(value) 0x25u, static_cast<uint8_t>(value)
+#define HID_LOGICAL_MINIMUM_16(value) 0x16u, hid::low_byte(value), hid::high_byte(value)
+#define HID_LOGICAL_MAXIMUM_16(value) 0x26u, hid::low_byte(value), hid::high_byte(value)
+#define HID_PHYSICAL_MINIMUM(value) 0x35u, static_cast<uint8_t>(value)
+#define HID_PHYSICAL_MAXIMUM(value) 0x45u, static_cast<uint8_t>(value)
+#define HID_PHYSICAL_MINIMUM_16(value) 0x36u, hid::low_byte(value), hid::high_byte(value)
+#define HID_PHYSICAL_MAXIMUM_16(value) 0x46u, hid::low_byte(value), hid::high_byte(value)
+#define HID_REPORT_SIZE(bits) 0x75u, (bits)
+#define HID_REPORT_ID(id) 0x85u, (id)
+#define HID_REPORT_COUNT(count) 0x95u, (count)
+
+// Local items
+#define HID_USAGE(usage) 0x09u, (usage)
+#define HID_USAGE_MINIMUM(usage) 0x19u, (usage)
+#define HID_USAGE_MAXIMUM(usage) 0x29u, (usage)
+
+// Main item data bits
+constexpr uint8_t HID_DATA = 0x00u;
+constexpr uint8_t HID_CONSTANT = 0x01u;
+constexpr uint8_t HID_ARRAY = 0x00u;
+constexpr uint8_t HID_VARIABLE = 0x02u;
+constexpr uint8_t HID_ABSOLUTE = 0x00u;
+constexpr uint8_t HID_RELATIVE = 0x04u;
+
+// Collection types
+constexpr uint8_t HID_PHYSICAL = 0x00u;
+constexpr uint8_t HID_APPLICATION = 0x01u;
+
+namespace hid
+{
+// Item tags, prefix without size bits
+constexpr uint8_t TAG_INPUT = 0x80u;
+constexpr uint8_t TAG_OUTPUT = 0x90u;
+constexpr uint8_t TAG_REPORT_SIZE = 0x74u;
+constexpr uint8_t TAG_REPORT_ID = 0x84u;
+constexpr uint8_t TAG_REPORT_COUNT = 0x94u;
+
+// Returned by item_offset_bits when report has no such item
+constexpr uint32_t NO_ITEM = 0xFFFFFFFFu;
+
+constexpr uint8_t low_byte(const int32_t value)
+{
+    return static_cast<uint8_t>(value & 0xFF);
+}
+
+constexpr uint8_t high_byte(const int32_t value)
+{
+    return static_cast<uint8_t>((value >> 8) & 0xFF);
+}
+
+constexpr uint8_t item_tag(const uint8_t prefix)
+{
+    return prefix & 0xFCu;
+}
+
+constexpr uint8_t item_data_length(const uint8_t prefix)
+{
+    return (prefix & 0x03u) == 0x03u ? 4u : (prefix & 0x03u);
+}
+
+// Unsigned data of item at i, little-endian
+constexpr uint32_t item_data(const uint8_t* d, const uint16_t i, const uint8_t length)
+{
+    return length == 0 ? 0u : (static_cast<uint32_t>(d[i + length]) << (8 * (length - 1))) | item_data(d, i, length - 1);
+}
+
+constexpr uint32_t item_value(const uint8_t* d, const uint16_t i)
+{
+    return item_data(d, i, item_data_length(d[i]));
+}
+
+constexpr uint16_t next_item(const uint8_t* d, const uint16_t i)
+{
+    return i + 1 + item_data_length(d[i]);
+}
+
+// Global state after item at i, for walking the descriptor
+constexpr uint32_t report_id_after(const uint8_t* d, const uint16_t i, const uint32_t id)
+{
+    return item_tag(d[i]) == TAG_REPORT_ID ? item_value(d, i) : id;
+}
+
+constexpr uint32_t report_size_after(const uint8_t* d, const uint16_t i, const uint32_t size)
+{
+    return item_tag(d[i]) == TAG_REPORT_SIZE ? item_value(d, i) : size;
+}
+
+constexpr uint32_t report_count_after(const uint8_t* d, const uint16_t i, const uint32_t count)
+{
+    return item_tag(d[i]) == TAG_REPORT_COUNT ? item_value(d, i) : count;
+}
+
+constexpr uint32_t report_bits_from(const uint8_t* d, const uint16_t n, const uint8_t tag, const uint32_t id,
+                                    const uint16_t i, const uint32_t current_id, const uint32_t size,
+                                    const uint32_t count)
+{
+    return i >= n
+               ? 0u
+               : (item_tag(d[i]) == tag && current_id == id ? size * count : 0u)
+               + report_bits_from(d, n, tag, id, next_item(d, i), report_id_after(d, i, current_id),
+                                  report_size_after(d, i, size), report_count_after(d, i, count));
+}
+
+constexpr uint32_t item_offset_from(const uint8_t* d, const uint16_t n, const uint8_t tag, const uint32_t id,
+                                    const uint8_t index, const uint16_t i, const uint32_t current_id,
+                                    const uint32_t size, const uint32_t count, const uint32_t offset)
+{
+    return i >= n
+               ? NO_ITEM
+               : item_tag(d[i]) == tag && current_id == id
+               ? (index == 0
+                      ? offset
+                      : item_offset_from(d, n, tag, id, index - 1, next_item(d, i), current_id, size, count,
+                                         offset + size * count))
+               : item_offset_from(d, n, tag, id, index, next_item(d, i), report_id_after(d, i, current_id),
+                                  report_size_after(d, i, size), report_count_after(d, i, count), offset);
+}
+
+// Bytes of input report with given id, without the id prefix
+constexpr uint32_t input_report_size(const uint8_t* d, const uint16_t n, const uint8_t id)
+{
+    return (report_bits_from(d, n, TAG_INPUT, id, 0, 0, 0, 0) + 7) / 8;
+}
+
+// Bytes of output report with given id, without the id prefix
+constexpr uint32_t output_report_size(const uint8_t* d, const uint16_t n, const uint8_t id)
+{
+    return (report_bits_from(d, n, TAG_OUTPUT, id, 0, 0, 0, 0) + 7) / 8;
+}
+
+// Bit offset in input report of the index-th Input item of that report
+constexpr uint32_t input_offset_bits(const uint8_t* d, const uint16_t n, const uint8_t id, const uint8_t index)
+{
+    return item_offset_from(d, n, TAG_INPUT, id, index, 0, 0, 0, 0, 0);
+}
+}
+
+#endif
@@ -1,50 +1,129 @@
-#ifndef SERIAL_SYMBOLS_H_
-#define SERIAL_SYMBOLS_H_
-
-#include <stdint.h>
-
-constexpr unsigned long BAUD_RATE = 500000u;
-
-/*
- * Frame format:
- * 0xAB <Length> <Data...> <Checksum>
- *
- * Length = Data + Checksum
- * Checksum is XOR checksum of all data bytes
- *
- * Data format:
- * Mouse move:
- * <Type> <2-byte x> <2-byte y>
- *
- * Mouse Scroll
- * <Type> <Steps>
- *
- * Mouse / Keyboard button:
- * <Type> <Key>
- *
- */
-
-constexpr uint8_t FRAME_START = 0xABu;
-constexpr uint8_t MAX_DATA_LENGTH = 6; // Data(max 5-byte) + Checksum(1-byte)
-constexpr uint8_t MAX_FRAME_LENGTH = MAX_DATA_LENGTH + 2; // Prefix 0xAB <Length> are 2 bytes
-
-enum FrameType
-{
-    FRAME_TYPE_MOUSE_MOVE = 0xAAu,
-    FRAME_TYPE_MOUSE_SCROLL = 0xABu,
-    FRAME_TYPE_MOUSE_PRESS = 0xACu,
-    FRAME_TYPE_MOUSE_RELEASE = 0xADu,
-    FRAME_TYPE_MOUSE_RESOLUTION = 0xAEu,
-
-    FRAME_TYPE_KEY_PRESS = 0xBBu,
-    FRAME_TYPE_KEY_RELEASE = 0xBC,
-
-    FRAME_TYPE_UNKNOWN = 0xFF
-};
-
-constexpr uint8_t RELEASE_ALL_KEYS = 0x00u;
-
-
-#endif
-
-
+#ifndef SERIAL_SYMBOLS_H_
+#define SERIAL_SYMBOLS_H_
+
+#include <stdint.h>
+
+constexpr unsigned long BAUD_RATE = 500000u;
+
+/*
+ * Frame format:
+ * 0xAB <Length> <Data...> <Checksum>
+ *
+ * Length = Data + Checksum
+ * Checksum is XOR checksum of all data bytes
+ *
+ * Data format:
+ * Mouse move:
+ * <Type> <2-byte x> <2-byte y>
+ *
+ * Unreliable mouse move (never looped back, sequence detects drops):
+ * <Type> <2-byte x> <2-byte y> <Sequence>
+ *
+ * Mouse Scroll
+ * <Type> <Steps>
+ *
+ * Mouse / Keyboard button:
+ * <Type> <Key>
+ *
+ * Type keys, queued and typed by the device with the next key pressed in the report releasing the previous one.
+ * Looped back once queued, later report frames run after typing finished. Keys are HID usages, 0x80 set if Shift is
+ * needed, 0x00 for none:
+ * <Type> <4 keys>
+ *
+ * Keyboard key and mouse buttons together, e.g. Ctrl+Click, applied in one HID report when built with a
+ * composite report, otherwise keyboard first on press and mouse first on release:
+ * <Type> <Key, 0x00 for none> <Mouse buttons, 0x00 for none>
+ *
+ * Tagged command, looped back whole. The device remembers the last tagged frame it executed, and a repeat of it
+ * (same tag and command) is looped back without executing again, so retransmitting after a lost loop-back is harmless.
+ * Host changes the tag for every new command. Only looped-back commands can be tagged, not queries or unreliable moves:
+ * <Type> <Tag> <Command type> <Command data...>
+ *
+ * Query statistics (answered by reply below instead of loop-back):
+ * <Type> <0x00>
+ * Reply: <Type> <2-byte unreliable moves received> <2-byte unreliable moves dropped> <2-byte corrupted frames>
+ *
+ * Identify (answered by reply below instead of loop-back), used to discover which port is which device:
+ * <Type> <0x00>
+ * Reply: <Type> <4-byte device id> <Protocol version> <Capability bits>
+ * Device id is persistent across power cycles and firmware uploads.
+ *
+ * Query idle statistics (answered by reply below instead of loop-back):
+ * <Type> <0x00>
+ * Reply: <Type> <2-byte wakes from idle sleep> <2-byte last first-frame latency us> <2-byte max first-frame latency us>
+ *
+ * NACK (sent instead of loop-back when a valid frame cannot be executed now):
+ * <Type> <Rejected frame type> <Reason>
+ *
+ * Events (sent by device unsolicited, never looped back):
+ * Keyboard LEDs, sent whenever target changes Num/Caps/Scroll Lock:
+ * <Type> <LED bits>
+ * USB status, sent whenever target configures, suspends or resumes the device:
+ * <Type> <Status bits> <2-byte ms to configured> <2-byte ms to first report>
+ * Times count from power-on, or from last loss of configuration, 0xFFFF if not happened yet.
+ * Sending <Type> <0x00> of an event queries current state, answered by the same event frame.
+ *
+ */
+
+constexpr uint8_t FRAME_START = 0xABu;
+constexpr uint8_t MAX_DATA_LENGTH = 8; // Data(max 7-byte, statistics reply) + Checksum(1-byte)
+constexpr uint8_t MAX_FRAME_LENGTH = MAX_DATA_LENGTH + 2; // Prefix 0xAB <Length> are 2 bytes
+
+enum FrameType
+{
+    FRAME_TYPE_MOUSE_MOVE = 0xAAu,
+    FRAME_TYPE_MOUSE_SCROLL = 0xABu,
+    FRAME_TYPE_MOUSE_PRESS = 0xACu,
+    FRAME_TYPE_MOUSE_RELEASE = 0xADu,
+    FRAME_TYPE_MOUSE_RESOLUTION = 0xAEu,
+    FRAME_TYPE_MOUSE_MOVE_UNRELIABLE = 0xAFu,
+
+    FRAME_TYPE_KEY_PRESS = 0xBBu,
+    FRAME_TYPE_KEY_RELEASE = 0xBC,
+    FRAME_TYPE_KEY_MOUSE_PRESS = 0xBDu,
+    FRAME_TYPE_KEY_MOUSE_RELEASE = 0xBEu,
+    FRAME_TYPE_TYPE_KEYS = 0xBFu,
+
+    FRAME_TYPE_QUERY_STATS = 0xC0u,
+    FRAME_TYPE_NACK = 0xC1u,
+    FRAME_TYPE_QUERY_IDLE_STATS = 0xC2u,
+    FRAME_TYPE_IDENTIFY = 0xC3u,
+    FRAME_TYPE_TAGGED = 0xC4u,
+
+    FRAME_TYPE_EVENT_KEYBOARD_LEDS = 0xD0u,
+    FRAME_TYPE_EVENT_USB_STATUS = 0xD1u,
+
+    FRAME_TYPE_UNKNOWN = 0xFF
+};
+
+constexpr uint8_t RELEASE_ALL_KEYS = 0x00u;
+
+// FRAME_TYPE_TYPE_KEYS
+constexpr uint8_t TYPE_KEYS_PER_FRAME = 4;
+constexpr uint8_t TYPE_KEY_SHIFT = 0x80u;
+
+// Reasons of FRAME_TYPE_NACK
+constexpr uint8_t NACK_REASON_NOT_CONFIGURED = 0x01u; // Target has not enumerated device yet
+constexpr uint8_t NACK_REASON_SUSPENDED = 0x02u; // Target is asleep
+
+// Bits of FRAME_TYPE_EVENT_USB_STATUS
+constexpr uint8_t USB_STATUS_CONFIGURED = 0x01u;
+constexpr uint8_t USB_STATUS_SUSPENDED = 0x02u;
+
+// Reported by FRAME_TYPE_IDENTIFY, bumped on any incompatible change of frames above
+constexpr uint8_t PROTOCOL_VERSION = 0x01u;
+
+// Capability bits of FRAME_TYPE_IDENTIFY
+constexpr uint8_t CAPABILITY_UNRELIABLE_MOVE = 0x01u;
+constexpr uint8_t CAPABILITY_KEYBOARD_LEDS = 0x02u;
+constexpr uint8_t CAPABILITY_USB_STATUS = 0x04u;
+constexpr uint8_t CAPABILITY_IDLE_SLEEP = 0x08u;
+constexpr uint8_t CAPABILITY_KEY_MOUSE_FRAMES = 0x10u;
+constexpr uint8_t CAPABILITY_COMPOSITE_REPORT = 0x20u; // Keyboard and mouse share one report
+constexpr uint8_t CAPABILITY_FRAME_TAGS = 0x40u;
+constexpr uint8_t CAPABILITY_TYPING = 0x80u;
+
+
+#endif
+
+
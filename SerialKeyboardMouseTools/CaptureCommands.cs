@@ -0,0 +1,194 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using CommandLine;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Offline analysis of files written by <see cref="WireCapture"/>.
+    /// </summary>
+    internal static class CaptureCommands
+    {
+        [Verb("analyze-capture", HelpText = "Reconstruct frames, ACKs, retries and gaps from wire capture files.")]
+        public class AnalyzeOptions
+        {
+            [Value(0, MetaName = "files", Required = true, HelpText = "Capture files in time order, e.g. capture.skmc.1 capture.skmc")]
+            public IEnumerable<string> Files { get; set; }
+
+            [Option(shortName: 't', longName: "timeline", Required = false, Default = false, HelpText = "Print one line per frame")]
+            public bool Timeline { get; set; }
+
+            [Option(longName: "outlier-us", Required = false, Default = 0, HelpText = "Only print timeline frames slower than this (us)")]
+            public int OutlierMicroseconds { get; set; }
+        }
+
+        private class PendingFrame
+        {
+            public byte[] Bytes;
+            public long FirstWriteTicks;
+            public long LastWriteTicks;
+            public int Attempts;
+            public int Matched;
+        }
+
+        private class TypeStats
+        {
+            public readonly Histogram Latency = new Histogram();
+            public readonly Histogram LastAttemptLatency = new Histogram();
+            public int Frames;
+            public int Retries;
+            public int Failures;
+        }
+
+        public static int Analyze(AnalyzeOptions options)
+        {
+            Dictionary<byte, TypeStats> stats = new Dictionary<byte, TypeStats>();
+            Histogram gaps = new Histogram();
+            PendingFrame pending = null;
+            long lastCompletionTicks = -1;
+            long lostRecords = 0;
+            int strayBytes = 0;
+
+            TypeStats StatsOf(byte[] frame)
+            {
+                byte type = frame.Length > 2 ? (byte)SerialSymbols.CommandTypeOf(frame) : (byte)0;
+                if (!stats.TryGetValue(type, out TypeStats s))
+                {
+                    stats[type] = s = new TypeStats();
+                }
+                return s;
+            }
+
+            void Complete(long ticks, bool success)
+            {
+                TypeStats s = StatsOf(pending.Bytes);
+                ++s.Frames;
+                s.Retries += pending.Attempts - 1;
+                double total = (ticks - pending.FirstWriteTicks) / 10.0;
+                if (success)
+                {
+                    s.Latency.Add(total);
+                    s.LastAttemptLatency.Add((ticks - pending.LastWriteTicks) / 10.0);
+                }
+                else
+                {
+                    ++s.Failures;
+                }
+                if (options.Timeline && total >= options.OutlierMicroseconds)
+                {
+                    Console.WriteLine($"{TimeSpan.FromTicks(pending.FirstWriteTicks):hh\\:mm\\:ss\\.ffffff} " +
+                                      $"{TypeName(pending.Bytes)} {BitConverter.ToString(pending.Bytes)} " +
+                                      $"attempts={pending.Attempts} {(success ? "ack" : "FAILED")} after {total:F0} us");
+                }
+                lastCompletionTicks = ticks;
+                pending = null;
+            }
+
+            foreach (string file in options.Files)
+            {
+                IEnumerable<WireCaptureRecord> records;
+                try
+                {
+                    records = WireCaptureReader.ReadRecords(File.OpenRead(file), out DateTime start);
+                    Console.WriteLine($"{file}: capture started at {start:O}");
+                }
+                catch (Exception e) when (e is IOException || e is InvalidDataException)
+                {
+                    Console.Error.WriteLine($"{file}: {e.Message}");
+                    return -1;
+                }
+                foreach (WireCaptureRecord record in records)
+                {
+                    switch (record.Kind)
+                    {
+                        case WireCaptureRecordKind.Write:
+                            if (pending != null && pending.Bytes.AsSpan().SequenceEqual(record.Payload))
+                            {
+                                ++pending.Attempts;
+                                pending.LastWriteTicks = record.Ticks;
+                                pending.Matched = 0;
+                                break;
+                            }
+                            if (pending != null)
+                            {
+                                // Sender moved on without a complete echo we could see
+                                Complete(record.Ticks, false);
+                            }
+                            if (lastCompletionTicks >= 0)
+                            {
+                                gaps.Add((record.Ticks - lastCompletionTicks) / 10.0);
+                            }
+                            pending = new PendingFrame
+                            {
+                                Bytes = record.Payload,
+                                FirstWriteTicks = record.Ticks,
+                                LastWriteTicks = record.Ticks,
+                                Attempts = 1
+                            };
+                            break;
+                        case WireCaptureRecordKind.Read:
+                            foreach (byte b in record.Payload)
+                            {
+                                if (pending == null)
+                                {
+                                    ++strayBytes;
+                                    continue;
+                                }
+                                pending.Matched = b == pending.Bytes[pending.Matched] ? pending.Matched + 1 : 0;
+                                if (pending.Matched == pending.Bytes.Length)
+                                {
+                                    Complete(record.Ticks, true);
+                                }
+                            }
+                            break;
+                        case WireCaptureRecordKind.Marker:
+                            switch ((WireCaptureMarker)record.Payload[0])
+                            {
+                                case WireCaptureMarker.Failure when pending != null:
+                                    Complete(record.Ticks, false);
+                                    break;
+                                case WireCaptureMarker.Discard when pending != null:
+                                    pending.Matched = 0;
+                                    break;
+                                case WireCaptureMarker.Lost:
+                                    lostRecords += record.Payload[1];
+                                    break;
+                            }
+                            break;
+                    }
+                }
+            }
+
+            Console.WriteLine();
+            foreach (var pair in stats.OrderBy(p => p.Key))
+            {
+                TypeStats s = pair.Value;
+                Console.WriteLine($"== {TypeName(pair.Key)}: {s.Frames} frames, {s.Retries} retries, {s.Failures} failures");
+                s.Latency.Print(Console.Out, "  Latency first write -> ack", "us");
+                s.LastAttemptLatency.Print(Console.Out, "  Latency last attempt -> ack", "us");
+            }
+            gaps.Print(Console.Out, "Idle gap between completion and next frame", "us");
+            Console.WriteLine($"Stray bytes read while idle: {strayBytes}");
+            if (lostRecords > 0)
+            {
+                Console.WriteLine($"WARNING: at least {lostRecords} records lost due to full capture ring.");
+            }
+            return 0;
+        }
+
+        internal static string TypeName(byte[] frame)
+        {
+            return frame.Length > 2 ? TypeName((byte)SerialSymbols.CommandTypeOf(frame)) : "Malformed";
+        }
+
+        internal static string TypeName(byte type)
+        {
+            return Enum.IsDefined(typeof(SerialSymbols.FrameType), (int)type)
+                ? Enum.GetName(typeof(SerialSymbols.FrameType), (int)type)
+                : $"0x{type:X2}";
+        }
+    }
+}
@@ -0,0 +1,45 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using CommandLine;
+using SerialKeyboardMouse;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Verb listing which serial port belongs to which device.
+    /// </summary>
+    internal static class DiscoverCommands
+    {
+        [Verb("discover", HelpText = "Probe serial ports in parallel and print id, protocol and capabilities of each device.")]
+        public class DiscoverOptions
+        {
+            [Value(0, MetaName = "ports", Required = false, HelpText = "Candidate ports. Default is all serial ports")]
+            public IEnumerable<string> Ports { get; set; }
+
+            [Option(longName: "cache", Required = false, HelpText = "File keeping port-to-id mapping between runs")]
+            public string Cache { get; set; }
+
+            [Option(shortName: 't', longName: "timeout-ms", Required = false, Default = 250, HelpText = "How long each port may take to answer")]
+            public int TimeoutMilliseconds { get; set; }
+        }
+
+        public static int Discover(DiscoverOptions options)
+        {
+            DeviceDiscovery discovery = new DeviceDiscovery(options.Cache)
+            {
+                ProbeTimeout = TimeSpan.FromMilliseconds(options.TimeoutMilliseconds)
+            };
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            IReadOnlyList<DiscoveredDevice> found = discovery
+                .DiscoverAsync(options.Ports.Any() ? options.Ports : null).GetAwaiter().GetResult();
+            foreach (DiscoveredDevice device in found)
+            {
+                Console.WriteLine(device.Identity.IsCompatible ? device.ToString() : $"{device} (incompatible protocol)");
+            }
+            Console.WriteLine($"Found {found.Count} device(s) in {stopwatch.ElapsedMilliseconds} ms.");
+            return found.Count > 0 ? 0 : -1;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Collects samples and prints percentiles with a log2-bucketed text histogram.
+    /// </summary>
+    internal class Histogram
+    {
+        private const int BarWidth = 40;
+
+        private readonly List<double> _samples = new List<double>();
+        private bool _sorted = true;
+
+        public int Count => _samples.Count;
+
+        public void Add(double value)
+        {
+            _samples.Add(value);
+            _sorted = false;
+        }
+
+        /// <summary>
+        /// Value at percentile p in [0, 100], NaN if empty.
+        /// </summary>
+        public double Percentile(double p)
+        {
+            if (_samples.Count == 0)
+            {
+                return double.NaN;
+            }
+            if (!_sorted)
+            {
+                _samples.Sort();
+                _sorted = true;
+            }
+            int index = (int)Math.Ceiling(p / 100.0 * _samples.Count) - 1;
+            return _samples[Math.Clamp(index, 0, _samples.Count - 1)];
+        }
+
+        public double Mean()
+        {
+            double sum = 0;
+            foreach (double sample in _samples)
+            {
+                sum += sample;
+            }
+            return _samples.Count == 0 ? double.NaN : sum / _samples.Count;
+        }
+
+        public void Print(TextWriter writer, string title, string unit)
+        {
+            writer.WriteLine($"{title}: n={Count}");
+            if (Count == 0)
+            {
+                return;
+            }
+            writer.WriteLine($"  min={Percentile(0):F1} p50={Percentile(50):F1} p90={Percentile(90):F1} " +
+                             $"p99={Percentile(99):F1} p99.9={Percentile(99.9):F1} max={Percentile(100):F1} " +
+                             $"mean={Mean():F1} ({unit})");
+            SortedDictionary<int, int> buckets = new SortedDictionary<int, int>();
+            foreach (double sample in _samples)
+            {
+                int bucket = sample < 1 ? 0 : (int)Math.Floor(Math.Log2(sample)) + 1;
+                buckets.TryGetValue(bucket, out int n);
+                buckets[bucket] = n + 1;
+            }
+            int max = 0;
+            foreach (int n in buckets.Values)
+            {
+                max = Math.Max(max, n);
+            }
+            foreach (var pair in buckets)
+            {
+                double low = pair.Key == 0 ? 0 : Math.Pow(2, pair.Key - 1);
+                double high = Math.Pow(2, pair.Key);
+                int width = Math.Max(1, pair.Value * BarWidth / max);
+                writer.WriteLine($"  [{low,8:F0}, {high,8:F0}) {pair.Value,8} {new string('#', width)}");
+            }
+        }
+    }
+}
@@ -0,0 +1,462 @@
+﻿using System;
+using System.Collections.Generic;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// One point of the design space simulated by <see cref="LinkSimulator"/>. Times are in seconds.
+    /// </summary>
+    internal class LinkConfig
+    {
+        public int Baud = SerialSymbols.BaudRate;
+
+        /// <summary>
+        /// SERIAL_RX_BUFFER_SIZE of the Arduino core, bytes queued by UART interrupt
+        /// </summary>
+        public int SerialRxBuffer = 64;
+
+        /// <summary>
+        /// Reliable frames in flight. The shipped sender waits for each loop-back, i.e. 1.
+        /// </summary>
+        public int Window = 1;
+
+        public double CommandTimeout = ReliableFrameSender.CommandTimeout / 1000.0;
+        public double RetryInterval = ReliableFrameSender.RetryInterval / 1000.0;
+        public int MaxAttempts = ReliableFrameSender.NumMaxRetries;
+        public int QueueLimit = ReliableFrameSender.MaxNumQueuedTask;
+
+        /// <summary>
+        /// Mean rate of frames submitted by application, Poisson arrivals
+        /// </summary>
+        public double OfferedRate = 500;
+
+        /// <summary>
+        /// Share of frames that are absolute moves, rest are key frames
+        /// </summary>
+        public double MoveFraction = 0.5;
+
+        /// <summary>
+        /// Send moves unacknowledged, see MouseMoveDelivery.Unreliable
+        /// </summary>
+        public bool UnreliableMoves;
+
+        /// <summary>
+        /// Device time from complete frame to executing it
+        /// </summary>
+        public double ParseTime = 30e-6;
+
+        /// <summary>
+        /// HID endpoint polling interval (bInterval). A report waits until the previous one was collected.
+        /// </summary>
+        public double PollInterval = 1e-3;
+
+        /// <summary>
+        /// USB-serial adapter latency, each direction
+        /// </summary>
+        public double UsbLatency = 1e-3;
+
+        public double ByteErrorRate;
+        public double Duration = 10;
+        public int Seed = 1;
+
+        /// <summary>
+        /// Firmware gives up reading a frame after this, SERIAL_TIMEOUT in firmware
+        /// </summary>
+        public double SerialTimeout => (1000 / (Baud / 8 / SerialSymbols.MaxFrameLength) + 2) / 1000.0;
+    }
+
+    internal class LinkResult
+    {
+        public long Offered;
+        public long Delivered;
+        public long Failed;
+        public long Rejected;
+        public long Retries;
+        public long Executions;
+        public long CorruptedFrames;
+        public long BytesSent;
+        public long OverflowBytes;
+        public double Makespan;
+        public double DeviceBusy;
+        public readonly Histogram Latency = new Histogram();
+
+        public double Throughput => Makespan > 0 ? Delivered / Makespan : 0;
+
+        /// <summary>
+        /// Bytes lost to full device RX buffer, per byte sent
+        /// </summary>
+        public double OverflowRate => BytesSent > 0 ? (double)OverflowBytes / BytesSent : 0;
+    }
+
+    /// <summary>
+    /// Discrete-event model of host sender, UART wire, device RX buffer, firmware parse and HID report pacing.
+    /// Sender follows <see cref="ReliableFrameSender"/>: write, wait loop-back up to command timeout, wait retry
+    /// interval, give up after the last attempt. Device follows the firmware loop: read a frame, execute it
+    /// (a report waits for the endpoint to be collected), loop it back; bytes arriving meanwhile queue in the RX
+    /// buffer and are dropped when it is full. Firmware's own receive buffer holds the one frame being handled,
+    /// so its size has no effect and is not modeled. A frame missing a byte is counted as corrupted after the firmware's
+    /// read timeout; the firmware's resynchronization on the following bytes is not modeled.
+    /// </summary>
+    internal class LinkSimulator
+    {
+        private const int KeyFrameLength = 5;
+        private const int MoveFrameLength = 8;
+        private const int UnreliableMoveFrameLength = 9;
+
+        private class Frame
+        {
+            public int Length;
+            public bool Reliable;
+            public double Arrival;
+            public int Attempts;
+            public bool Done;
+        }
+
+        private class Attempt
+        {
+            public Frame Frame;
+            public int BytesArrived;
+            public bool Damaged;
+
+            /// <summary>
+            /// A byte was dropped by full RX buffer, firmware waits for it until read timeout
+            /// </summary>
+            public bool Dropped;
+        }
+
+        private readonly struct WireByte
+        {
+            public readonly Attempt Attempt;
+            public readonly int Index;
+
+            public WireByte(Attempt attempt, int index)
+            {
+                Attempt = attempt;
+                Index = index;
+            }
+        }
+
+        private readonly LinkConfig _config;
+        private readonly Random _random;
+        private readonly LinkResult _result = new LinkResult();
+        private readonly double _byteTime;
+        private readonly List<(double Time, long Sequence, Action Action)> _events = new List<(double, long, Action)>();
+        private long _sequence;
+        private double _now;
+        private double _lastCompletion;
+
+        private readonly Queue<Frame> _hostQueue = new Queue<Frame>();
+        private int _inFlight;
+        private double _txFree;
+        private double _rxFree;
+
+        private readonly Queue<WireByte> _rxBuffer = new Queue<WireByte>();
+        private Attempt _reading;
+        private bool _deviceBusy;
+        private double _endpointFree;
+
+        private LinkSimulator(LinkConfig config)
+        {
+            _config = config;
+            _random = new Random(config.Seed);
+            _byteTime = 10.0 / config.Baud; // 8N1
+        }
+
+        public static LinkResult Run(LinkConfig config)
+        {
+            LinkSimulator simulator = new LinkSimulator(config);
+            simulator.Schedule(simulator.NextArrivalDelay(), simulator.OnArrival);
+            simulator.RunEvents();
+            return simulator._result;
+        }
+
+        private void RunEvents()
+        {
+            while (_events.Count > 0)
+            {
+                (double time, _, Action action) = Pop();
+                _now = time;
+                action();
+            }
+            _result.Makespan = Math.Max(_config.Duration, _lastCompletion);
+        }
+
+        private double NextArrivalDelay()
+        {
+            return -Math.Log(1 - _random.NextDouble()) / _config.OfferedRate;
+        }
+
+        private void OnArrival()
+        {
+            if (_now > _config.Duration)
+            {
+                return;
+            }
+            Schedule(NextArrivalDelay(), OnArrival);
+            ++_result.Offered;
+            bool move = _random.NextDouble() < _config.MoveFraction;
+            Frame frame = new Frame
+            {
+                Length = !move ? KeyFrameLength : _config.UnreliableMoves ? UnreliableMoveFrameLength : MoveFrameLength,
+                Reliable = !move || !_config.UnreliableMoves,
+                Arrival = _now
+            };
+            if (_hostQueue.Count > _config.QueueLimit)
+            {
+                ++_result.Rejected;
+                return;
+            }
+            _hostQueue.Enqueue(frame);
+            TrySend();
+        }
+
+        private void TrySend()
+        {
+            while (_hostQueue.Count > 0 && _inFlight < _config.Window)
+            {
+                Frame frame = _hostQueue.Dequeue();
+                if (frame.Reliable)
+                {
+                    ++_inFlight;
+                }
+                Transmit(frame);
+                if (!frame.Reliable)
+                {
+                    // Written once, complete as soon as written
+                    frame.Done = true;
+                    ++_result.Delivered;
+                    _result.Latency.Add((_now - frame.Arrival) * 1e6);
+                    _lastCompletion = _now;
+                }
+            }
+        }
+
+        private void Transmit(Frame frame)
+        {
+            Attempt attempt = new Attempt { Frame = frame };
+            int number = ++frame.Attempts;
+            double start = Math.Max(_now + _config.UsbLatency, _txFree);
+            for (int i = 0; i < frame.Length; ++i)
+            {
+                WireByte b = new WireByte(attempt, i);
+                At(start + (i + 1) * _byteTime, () => OnByteAtDevice(b));
+            }
+            _txFree = start + frame.Length * _byteTime;
+            _result.BytesSent += frame.Length;
+            if (frame.Reliable)
+            {
+                Schedule(_config.CommandTimeout, () => OnCommandTimeout(frame, number));
+            }
+        }
+
+        private void OnCommandTimeout(Frame frame, int attempt)
+        {
+            if (frame.Done || frame.Attempts != attempt)
+            {
+                return;
+            }
+            // Late loop-back during retry interval still counts
+            Schedule(_config.RetryInterval, () =>
+            {
+                if (frame.Done)
+                {
+                    return;
+                }
+                if (frame.Attempts >= _config.MaxAttempts)
+                {
+                    frame.Done = true;
+                    ++_result.Failed;
+                    _lastCompletion = _now;
+                    --_inFlight;
+                    TrySend();
+                    return;
+                }
+                ++_result.Retries;
+                Transmit(frame);
+            });
+        }
+
+        private void OnByteAtDevice(WireByte b)
+        {
+            Attempt attempt = b.Attempt;
+            ++attempt.BytesArrived;
+            if (_random.NextDouble() < _config.ByteErrorRate)
+            {
+                attempt.Damaged = true;
+            }
+            if (_reading == attempt)
+            {
+                // Firmware is blocked in readBytes on this frame
+                if (attempt.BytesArrived == attempt.Frame.Length)
+                {
+                    FinishRead(attempt);
+                }
+                return;
+            }
+            if (_rxBuffer.Count >= _config.SerialRxBuffer)
+            {
+                ++_result.OverflowBytes;
+                attempt.Dropped = true;
+                return;
+            }
+            _rxBuffer.Enqueue(b);
+            TryStartRead();
+        }
+
+        private void TryStartRead()
+        {
+            while (!_deviceBusy && _reading == null && _rxBuffer.Count > 0)
+            {
+                WireByte first = _rxBuffer.Dequeue();
+                if (first.Index != 0)
+                {
+                    continue; // Not a frame start, skipped while scanning
+                }
+                Attempt attempt = first.Attempt;
+                while (_rxBuffer.Count > 0 && _rxBuffer.Peek().Attempt == attempt)
+                {
+                    _rxBuffer.Dequeue();
+                }
+                _reading = attempt;
+                _deviceBusy = true;
+                if (attempt.BytesArrived < attempt.Frame.Length)
+                {
+                    return; // Rest is still on the wire
+                }
+                FinishRead(attempt);
+            }
+        }
+
+        private void FinishRead(Attempt attempt)
+        {
+            if (attempt.Dropped)
+            {
+                // Waits in readBytes for bytes that never come
+                Busy(_config.SerialTimeout, () => Corrupted());
+                return;
+            }
+            if (attempt.Damaged)
+            {
+                Busy(_config.ParseTime, () => Corrupted());
+                return;
+            }
+            ++_result.Executions;
+            double start = Math.Max(_now + _config.ParseTime, _endpointFree);
+            _endpointFree = (Math.Floor(start / _config.PollInterval) + 1) * _config.PollInterval;
+            Busy(start - _now, () =>
+            {
+                if (attempt.Frame.Reliable)
+                {
+                    LoopBack(attempt.Frame);
+                }
+            });
+        }
+
+        private void Corrupted()
+        {
+            ++_result.CorruptedFrames;
+        }
+
+        /// <summary>
+        /// Keep device busy for a duration, then run completion and take next frame
+        /// </summary>
+        private void Busy(double duration, Action completion)
+        {
+            _result.DeviceBusy += duration;
+            Schedule(duration, () =>
+            {
+                completion();
+                _reading = null;
+                _deviceBusy = false;
+                TryStartRead();
+            });
+        }
+
+        private void LoopBack(Frame frame)
+        {
+            double start = Math.Max(_now, _rxFree);
+            _rxFree = start + frame.Length * _byteTime;
+            bool corrupted = false;
+            for (int i = 0; i < frame.Length; ++i)
+            {
+                corrupted |= _random.NextDouble() < _config.ByteErrorRate;
+            }
+            if (corrupted)
+            {
+                return; // Host drops it for checksum
+            }
+            At(_rxFree + _config.UsbLatency, () =>
+            {
+                if (frame.Done)
+                {
+                    return; // Loop-back of an earlier attempt already matched
+                }
+                frame.Done = true;
+                ++_result.Delivered;
+                _result.Latency.Add((_now - frame.Arrival) * 1e6);
+                _lastCompletion = _now;
+                --_inFlight;
+                TrySend();
+            });
+        }
+
+        private void Schedule(double delay, Action action)
+        {
+            At(_now + delay, action);
+        }
+
+        /// <summary>
+        /// Binary min-heap by time, then scheduling order
+        /// </summary>
+        private void At(double time, Action action)
+        {
+            _events.Add((time, _sequence++, action));
+            int i = _events.Count - 1;
+            while (i > 0)
+            {
+                int parent = (i - 1) / 2;
+                if (!Before(_events[i], _events[parent]))
+                {
+                    break;
+                }
+                (_events[i], _events[parent]) = (_events[parent], _events[i]);
+                i = parent;
+            }
+        }
+
+        private (double Time, long Sequence, Action Action) Pop()
+        {
+            var top = _events[0];
+            int last = _events.Count - 1;
+            _events[0] = _events[last];
+            _events.RemoveAt(last);
+            int i = 0;
+            while (true)
+            {
+                int smallest = i;
+                int left = 2 * i + 1;
+                int right = left + 1;
+                if (left < _events.Count && Before(_events[left], _events[smallest]))
+                {
+                    smallest = left;
+                }
+                if (right < _events.Count && Before(_events[right], _events[smallest]))
+                {
+                    smallest = right;
+                }
+                if (smallest == i)
+                {
+                    return top;
+                }
+                (_events[i], _events[smallest]) = (_events[smallest], _events[i]);
+                i = smallest;
+            }
+        }
+
+        private static bool Before((double Time, long Sequence, Action) a, (double Time, long Sequence, Action) b)
+        {
+            return a.Time < b.Time || (a.Time == b.Time && a.Sequence < b.Sequence);
+        }
+    }
+}
@@ -0,0 +1,111 @@
+﻿using System;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using CommandLine;
+using SerialKeyboardMouse;
+using SerialKeyboardMouse.Macro;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Verbs for compiling and running input scripts.
+    /// </summary>
+    internal static class MacroCommands
+    {
+        [Verb("compile", HelpText = "Compile an input script into a binary frame stream.")]
+        public class CompileOptions
+        {
+            [Option(shortName: 'i', longName: "input", Required = true, HelpText = "Script to compile")]
+            public string Input { get; set; }
+
+            [Option(shortName: 'o', longName: "output", Required = false, HelpText = "Output file. Default is input with .skmm extension")]
+            public string Output { get; set; }
+
+            [Option(shortName: 'w', longName: "width", Required = false, Default = 1920, HelpText = "Assumed width of absolute mouse")]
+            public int Width { get; set; }
+
+            [Option(shortName: 'h', longName: "height", Required = false, Default = 1080, HelpText = "Assumed height of absolute mouse")]
+            public int Height { get; set; }
+        }
+
+        [Verb("run", HelpText = "Execute a script or compiled macro on a device.")]
+        public class RunOptions
+        {
+            [Option(shortName: 'c', longName: "com", Required = true, HelpText = "Serial port of device. E.g. COM1 or /dev/ttyUSB0")]
+            public string ComPort { get; set; }
+
+            [Option(shortName: 'i', longName: "input", Required = true, HelpText = "Script or compiled .skmm file")]
+            public string Input { get; set; }
+
+            [Option(shortName: 'w', longName: "width", Required = false, Default = 1920, HelpText = "Width of absolute mouse")]
+            public int Width { get; set; }
+
+            [Option(shortName: 'h', longName: "height", Required = false, Default = 1080, HelpText = "Height of absolute mouse")]
+            public int Height { get; set; }
+        }
+
+        public static int Compile(CompileOptions options)
+        {
+            CompiledMacro macro;
+            try
+            {
+                macro = MacroCompiler.CompileFile(options.Input, options.Width, options.Height);
+            }
+            catch (MacroCompileException e)
+            {
+                Console.Error.WriteLine($"{options.Input}: {e.Message}");
+                return -1;
+            }
+            string output = options.Output ?? Path.ChangeExtension(options.Input, ".skmm");
+            using (FileStream stream = File.Create(output))
+            {
+                macro.Save(stream);
+            }
+            Console.WriteLine($"Compiled {macro.Steps.Count} frames " +
+                              $"({macro.Steps.Sum(s => s.FrameBytes.Length)} bytes on wire, " +
+                              $"{macro.TotalDelay.TotalMilliseconds} ms of waits) to {output}.");
+            return 0;
+        }
+
+        public static int Run(RunOptions options)
+        {
+            CompiledMacro macro;
+            try
+            {
+                if (Path.GetExtension(options.Input).Equals(".skmm", StringComparison.OrdinalIgnoreCase))
+                {
+                    using FileStream stream = File.OpenRead(options.Input);
+                    macro = CompiledMacro.Load(stream);
+                }
+                else
+                {
+                    macro = MacroCompiler.CompileFile(options.Input, options.Width, options.Height);
+                }
+            }
+            catch (Exception e) when (e is MacroCompileException || e is InvalidDataException)
+            {
+                Console.Error.WriteLine($"{options.Input}: {e.Message}");
+                return -1;
+            }
+
+            using KeyboardMouse keyboardMouse = new KeyboardMouse(new DotNetSerialAdaptor(options.ComPort));
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            try
+            {
+                keyboardMouse.SetMouseResolution(macro.AssumedResolution.Width, macro.AssumedResolution.Height)
+                    .GetAwaiter().GetResult();
+                keyboardMouse.ExecuteMacro(macro).GetAwaiter().GetResult();
+            }
+            catch (SerialDeviceException e)
+            {
+                Console.Error.WriteLine($"Device failed: {e.Message}");
+                return -1;
+            }
+            Console.WriteLine($"Executed {macro.Steps.Count} frames in {stopwatch.ElapsedMilliseconds} ms.");
+            Console.WriteLine(keyboardMouse.Metrics);
+            return 0;
+        }
+    }
+}
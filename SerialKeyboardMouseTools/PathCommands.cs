@@ -0,0 +1,177 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using CommandLine;
+using SerialKeyboardMouse;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Verbs measuring trajectory simplification.
+    /// </summary>
+    internal static class PathCommands
+    {
+        [Verb("path-bench", HelpText = "Show how many mouse move frames trajectory simplification saves.")]
+        public class PathBenchOptions
+        {
+            [Option(shortName: 'i', longName: "input", Required = false, Separator = ',', HelpText = "CSV files of <time ms>,<x>,<y> per line. Default is built-in generated paths")]
+            public IEnumerable<string> Inputs { get; set; }
+
+            [Option(longName: "width", Required = false, Default = 1920, HelpText = "Mouse resolution width")]
+            public int Width { get; set; }
+
+            [Option(longName: "height", Required = false, Default = 1080, HelpText = "Mouse resolution height")]
+            public int Height { get; set; }
+
+            [Option(shortName: 't', longName: "tolerance", Required = false, Default = TrajectorySimplifier.DefaultTolerance, HelpText = "Largest deviation of a dropped point (pixels)")]
+            public double Tolerance { get; set; }
+
+            [Option(longName: "baud", Required = false, Default = 115200, HelpText = "UART baud rate, for link time of the moves")]
+            public int BaudRate { get; set; }
+        }
+
+        /// <summary>
+        /// Bytes on the wire per reliable move: frame and its loop-back
+        /// </summary>
+        private const int MoveWireBytes = 2 * 8;
+
+        public static int PathBench(PathBenchOptions options)
+        {
+            List<(string Name, IReadOnlyList<TrajectoryPoint> Points)> paths
+                = new List<(string, IReadOnlyList<TrajectoryPoint>)>();
+            try
+            {
+                if (options.Inputs.Any())
+                {
+                    foreach (string path in options.Inputs)
+                    {
+                        paths.Add((Path.GetFileName(path), ReadCsv(path)));
+                    }
+                }
+                else
+                {
+                    paths.AddRange(Generated(options.Width, options.Height));
+                }
+            }
+            catch (Exception e) when (e is IOException || e is FormatException)
+            {
+                Console.Error.WriteLine(e.Message);
+                return -1;
+            }
+
+            Console.WriteLine($"{"Path",-16} {"Points",8} {"Quantized",10} {"Kept",7} {"Saved",7} {"Max dev px",11} {"Link ms before",15} {"after",8}");
+            foreach ((string name, IReadOnlyList<TrajectoryPoint> points) in paths)
+            {
+                IReadOnlyList<TrajectoryPoint> quantized;
+                IReadOnlyList<TrajectoryPoint> kept;
+                try
+                {
+                    quantized = TrajectorySimplifier.Quantize(points, options.Width, options.Height);
+                    kept = TrajectorySimplifier.Decimate(quantized, options.Tolerance);
+                }
+                catch (ArgumentException e)
+                {
+                    Console.Error.WriteLine($"{name}: {e.Message}");
+                    return -1;
+                }
+                double saved = points.Count == 0 ? 0 : 1 - (double)kept.Count / points.Count;
+                double msPerMove = MoveWireBytes * 10 * 1000.0 / options.BaudRate;
+                Console.WriteLine($"{name,-16} {points.Count,8} {quantized.Count,10} {kept.Count,7} {saved,7:P0} " +
+                                  $"{MaxDeviation(quantized, kept),11:F2} {points.Count * msPerMove,15:F0} {kept.Count * msPerMove,8:F0}");
+            }
+            return 0;
+        }
+
+        private static IReadOnlyList<TrajectoryPoint> ReadCsv(string path)
+        {
+            List<TrajectoryPoint> points = new List<TrajectoryPoint>();
+            foreach (string line in File.ReadLines(path))
+            {
+                string trimmed = line.Trim();
+                if (trimmed.Length == 0 || trimmed.StartsWith('#') || char.IsLetter(trimmed[0]))
+                {
+                    // Blank, comment or header
+                    continue;
+                }
+                string[] fields = trimmed.Split(',');
+                if (fields.Length < 3)
+                {
+                    throw new FormatException($"{path}: expected <time ms>,<x>,<y> but got '{line}'.");
+                }
+                points.Add(new TrajectoryPoint(
+                    double.Parse(fields[1], CultureInfo.InvariantCulture),
+                    double.Parse(fields[2], CultureInfo.InvariantCulture),
+                    TimeSpan.FromMilliseconds(double.Parse(fields[0], CultureInfo.InvariantCulture))));
+            }
+            return points;
+        }
+
+        /// <summary>
+        /// Paths sampled at 1 kHz with sub-pixel coordinates: a smooth drag, a slow straight drag with hand
+        /// jitter, and a circle.
+        /// </summary>
+        private static IEnumerable<(string, IReadOnlyList<TrajectoryPoint>)> Generated(int width, int height)
+        {
+            Random random = new Random(1);
+            TrajectoryPoint[] bezier = new TrajectoryPoint[800];
+            for (int i = 0; i < bezier.Length; ++i)
+            {
+                double t = (double)i / (bezier.Length - 1);
+                double u = 1 - t;
+                // Cubic Bezier from bottom left to top right, bulging up
+                double x = u * u * u * 0.1 + 3 * u * u * t * 0.2 + 3 * u * t * t * 0.6 + t * t * t * 0.9;
+                double y = u * u * u * 0.9 + 3 * u * u * t * 0.2 + 3 * u * t * t * 0.1 + t * t * t * 0.2;
+                bezier[i] = new TrajectoryPoint(x * width, y * height, TimeSpan.FromMilliseconds(i));
+            }
+            yield return ("bezier-drag", bezier);
+
+            TrajectoryPoint[] jitter = new TrajectoryPoint[2000];
+            for (int i = 0; i < jitter.Length; ++i)
+            {
+                double t = (double)i / (jitter.Length - 1);
+                jitter[i] = new TrajectoryPoint(width * (0.2 + 0.1 * t) + random.NextDouble() - 0.5,
+                    height * 0.5 + random.NextDouble() - 0.5, TimeSpan.FromMilliseconds(i));
+            }
+            yield return ("slow-jitter", jitter);
+
+            TrajectoryPoint[] circle = new TrajectoryPoint[1000];
+            for (int i = 0; i < circle.Length; ++i)
+            {
+                double angle = 2 * Math.PI * i / (circle.Length - 1);
+                circle[i] = new TrajectoryPoint(width * 0.5 + height * 0.3 * Math.Cos(angle),
+                    height * 0.5 + height * 0.3 * Math.Sin(angle), TimeSpan.FromMilliseconds(i));
+            }
+            yield return ("circle", circle);
+        }
+
+        /// <summary>
+        /// Largest distance of a quantized point from the segment of kept points spanning it.
+        /// </summary>
+        private static double MaxDeviation(IReadOnlyList<TrajectoryPoint> quantized,
+            IReadOnlyList<TrajectoryPoint> kept)
+        {
+            double max = 0;
+            int segment = 0;
+            for (int i = 0; i < quantized.Count && segment + 1 < kept.Count; ++i)
+            {
+                TrajectoryPoint a = kept[segment];
+                TrajectoryPoint b = kept[segment + 1];
+                TrajectoryPoint p = quantized[i];
+                double dx = b.X - a.X;
+                double dy = b.Y - a.Y;
+                double lengthSquared = dx * dx + dy * dy;
+                double t = lengthSquared == 0
+                    ? 0
+                    : Math.Clamp(((p.X - a.X) * dx + (p.Y - a.Y) * dy) / lengthSquared, 0, 1);
+                max = Math.Max(max, Math.Sqrt(Math.Pow(p.X - a.X - t * dx, 2) + Math.Pow(p.Y - a.Y - t * dy, 2)));
+                if (p.Time == b.Time && p.X == b.X && p.Y == b.Y)
+                {
+                    ++segment;
+                }
+            }
+            return max;
+        }
+    }
+}
@@ -0,0 +1,38 @@
+﻿using System;
+using System.Collections.Generic;
+using CommandLine;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Command line utilities for SerialKeyboardMouse. Each verb lives in its own class.
+    /// </summary>
+    public class Program
+    {
+        static int Main(string[] args)
+        {
+            return Parser.Default.ParseArguments<MacroCommands.CompileOptions, MacroCommands.RunOptions,
+                    CaptureCommands.AnalyzeOptions, ServeCommands.ServeOptions, DiscoverCommands.DiscoverOptions,
+                    SimulationCommands.ScenariosOptions, UartCommands.AnalyzeUartOptions,
+                    SimulationCommands.SimulateLinkOptions, TypingCommands.TypeBenchOptions,
+                    PathCommands.PathBenchOptions>(args)
+                .MapResult(
+                    (MacroCommands.CompileOptions o) => MacroCommands.Compile(o),
+                    (MacroCommands.RunOptions o) => MacroCommands.Run(o),
+                    (CaptureCommands.AnalyzeOptions o) => CaptureCommands.Analyze(o),
+                    (ServeCommands.ServeOptions o) => ServeCommands.Serve(o),
+                    (DiscoverCommands.DiscoverOptions o) => DiscoverCommands.Discover(o),
+                    (SimulationCommands.ScenariosOptions o) => SimulationCommands.Scenarios(o),
+                    (UartCommands.AnalyzeUartOptions o) => UartCommands.AnalyzeUart(o),
+                    (SimulationCommands.SimulateLinkOptions o) => SimulationCommands.SimulateLink(o),
+                    (TypingCommands.TypeBenchOptions o) => TypingCommands.TypeBench(o),
+                    (PathCommands.PathBenchOptions o) => PathCommands.PathBench(o),
+                    OnParseError);
+        }
+
+        private static int OnParseError(IEnumerable<Error> errors)
+        {
+            return -1;
+        }
+    }
+}
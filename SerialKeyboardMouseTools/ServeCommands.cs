@@ -0,0 +1,91 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Net;
+using System.Threading;
+using CommandLine;
+using SerialKeyboardMouse;
+using SerialKeyboardMouse.Remote;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Daemon owning devices, so several processes can share them through <see cref="RemoteKeyboardMouse"/>.
+    /// </summary>
+    internal static class ServeCommands
+    {
+        [Verb("serve", HelpText = "Own devices and serve clients over a Unix domain socket, and optionally TCP.")]
+        public class ServeOptions
+        {
+            [Option(shortName: 'c', longName: "com", Required = true, Separator = ',', HelpText = "Serial ports of devices, addressed by index. E.g. COM1,COM2")]
+            public IEnumerable<string> ComPorts { get; set; }
+
+            [Option(shortName: 's', longName: "socket", Required = false, HelpText = "Unix domain socket path. Default is serial-keyboard-mouse.sock in temp directory")]
+            public string Socket { get; set; }
+
+            [Option(shortName: 'p', longName: "tcp-port", Required = false, Default = 0, HelpText = "Also listen on this TCP port, 0 to disable")]
+            public int TcpPort { get; set; }
+
+            [Option(longName: "tcp-any", Required = false, Default = false, HelpText = "Accept TCP clients from other machines, not only loopback")]
+            public bool TcpAny { get; set; }
+
+            [Option(shortName: 'w', longName: "width", Required = false, Default = 1920, HelpText = "Initial width of absolute mouse")]
+            public int Width { get; set; }
+
+            [Option(shortName: 'h', longName: "height", Required = false, Default = 1080, HelpText = "Initial height of absolute mouse")]
+            public int Height { get; set; }
+        }
+
+        public static int Serve(ServeOptions options)
+        {
+            List<KeyboardMouse> devices = new List<KeyboardMouse>();
+            try
+            {
+                foreach (string port in options.ComPorts)
+                {
+                    // Async engine serves many devices without a thread each
+                    KeyboardMouse device = new KeyboardMouse(new DotNetSerialAdaptor(port), null, SenderEngine.Asynchronous);
+                    devices.Add(device);
+                    device.SetMouseResolution(options.Width, options.Height).GetAwaiter().GetResult();
+                }
+
+                using KeyboardMouseServer server = new KeyboardMouseServer(devices);
+                server.ClientFailed += e => Console.Error.WriteLine($"Client dropped: {e.Message}");
+                string socket = options.Socket ?? Path.Combine(Path.GetTempPath(), "serial-keyboard-mouse.sock");
+                server.ListenUnix(socket);
+                Console.WriteLine($"Serving {devices.Count} device(s) on {socket}.");
+                if (options.TcpPort > 0)
+                {
+                    IPAddress address = options.TcpAny ? IPAddress.Any : IPAddress.Loopback;
+                    server.ListenTcp(new IPEndPoint(address, options.TcpPort));
+                    Console.WriteLine($"Serving on TCP {address}:{options.TcpPort}.");
+                }
+
+                using ManualResetEventSlim exit = new ManualResetEventSlim();
+                Console.CancelKeyPress += (_, e) =>
+                {
+                    e.Cancel = true;
+                    exit.Set();
+                };
+                exit.Wait();
+                File.Delete(socket);
+            }
+            catch (SerialDeviceException e)
+            {
+                Console.Error.WriteLine($"Device failed: {e.Message}");
+                return -1;
+            }
+            finally
+            {
+                for (int i = 0; i < devices.Count; ++i)
+                {
+                    Console.WriteLine($"Device {i}: {devices[i].Metrics}");
+                    devices[i].Dispose();
+                }
+            }
+            return 0;
+        }
+    }
+}
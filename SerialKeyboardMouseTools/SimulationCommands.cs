@@ -0,0 +1,242 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text.RegularExpressions;
+using System.Threading.Tasks;
+using CommandLine;
+using SerialKeyboardMouse;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Verbs running the host library against simulated devices.
+    /// </summary>
+    internal static class SimulationCommands
+    {
+        [Verb("scenarios", HelpText = "Run seeded retry and timeout scenarios against a simulated device in virtual time.")]
+        public class ScenariosOptions
+        {
+            [Option(shortName: 'n', longName: "count", Required = false, Default = 1000, HelpText = "Number of scenarios")]
+            public int Count { get; set; }
+
+            [Option(shortName: 'f', longName: "frames", Required = false, Default = 20, HelpText = "Frames sent per scenario")]
+            public int Frames { get; set; }
+
+            [Option(longName: "seed", Required = false, Default = 1, HelpText = "Seed of first scenario, later ones count up")]
+            public int Seed { get; set; }
+
+            [Option(longName: "loss", Required = false, Default = 0.05, HelpText = "Probability a frame is lost on the way to device")]
+            public double Loss { get; set; }
+
+            [Option(longName: "echo-loss", Required = false, Default = 0.05, HelpText = "Probability a loop-back is lost")]
+            public double EchoLoss { get; set; }
+
+            [Option(longName: "corrupt", Required = false, Default = 0.01, HelpText = "Probability a loop-back is corrupted")]
+            public double Corrupt { get; set; }
+
+            [Option(longName: "latency-us", Required = false, Default = 400, HelpText = "Loop-back latency (us)")]
+            public int LatencyMicroseconds { get; set; }
+
+            [Option(longName: "jitter-us", Required = false, Default = 200, HelpText = "Uniform extra loop-back latency (us)")]
+            public int JitterMicroseconds { get; set; }
+
+            [Option(longName: "frame-tags", Required = false, Default = false, HelpText = "Tag frames, so device does not execute retransmissions again")]
+            public bool FrameTags { get; set; }
+        }
+
+        [Verb("simulate-link", HelpText = "Sweep baud, RX buffer, window and timeout settings through a discrete-event model of the link, and print CSV. " +
+                                       "Firmware's RECEIVE_DATA_BUFFER_SIZE holds one frame and does not affect throughput, so it is not swept.")]
+        public class SimulateLinkOptions
+        {
+            [Option(longName: "firmware", Required = false, HelpText = "Firmware directory, to take BAUD_RATE and SERIAL_RX_BUFFER_SIZE from its sources")]
+            public string FirmwareDirectory { get; set; }
+
+            [Option(longName: "baud", Required = false, Separator = ',', HelpText = "Baud rates to sweep")]
+            public IEnumerable<int> Baud { get; set; }
+
+            [Option(longName: "rx-buffer", Required = false, Separator = ',', HelpText = "SERIAL_RX_BUFFER_SIZE values to sweep. Default is AVR core's 64")]
+            public IEnumerable<int> RxBuffer { get; set; }
+
+            [Option(longName: "window", Required = false, Separator = ',', HelpText = "Reliable frames in flight to sweep. Shipped sender is 1")]
+            public IEnumerable<int> Window { get; set; }
+
+            [Option(longName: "rate", Required = false, Separator = ',', HelpText = "Offered frame rates (Hz) to sweep")]
+            public IEnumerable<double> Rate { get; set; }
+
+            [Option(longName: "timeout-ms", Required = false, Separator = ',', HelpText = "Loop-back timeouts (ms) to sweep")]
+            public IEnumerable<double> TimeoutMilliseconds { get; set; }
+
+            [Option(longName: "retry-ms", Required = false, Separator = ',', HelpText = "Retry intervals (ms) to sweep")]
+            public IEnumerable<double> RetryMilliseconds { get; set; }
+
+            [Option(longName: "queue", Required = false, Separator = ',', HelpText = "Sender queue limits to sweep")]
+            public IEnumerable<int> Queue { get; set; }
+
+            [Option(longName: "move-fraction", Required = false, Default = 0.5, HelpText = "Share of frames that are mouse moves, rest are keys")]
+            public double MoveFraction { get; set; }
+
+            [Option(longName: "unreliable-moves", Required = false, Default = false, HelpText = "Send moves without acknowledgement")]
+            public bool UnreliableMoves { get; set; }
+
+            [Option(longName: "parse-us", Required = false, Default = 30.0, HelpText = "Firmware time to parse and execute a frame (us)")]
+            public double ParseMicroseconds { get; set; }
+
+            [Option(longName: "poll-us", Required = false, Default = 1000.0, HelpText = "HID endpoint polling interval (us)")]
+            public double PollMicroseconds { get; set; }
+
+            [Option(longName: "usb-latency-us", Required = false, Default = 1000.0, HelpText = "USB-serial adapter latency, each direction (us)")]
+            public double UsbLatencyMicroseconds { get; set; }
+
+            [Option(longName: "byte-error-rate", Required = false, Default = 0.0, HelpText = "Probability a byte is corrupted on the wire")]
+            public double ByteErrorRate { get; set; }
+
+            [Option(shortName: 'd', longName: "duration", Required = false, Default = 10.0, HelpText = "Simulated seconds of offered load per configuration")]
+            public double Duration { get; set; }
+
+            [Option(longName: "seed", Required = false, Default = 1, HelpText = "Seed of arrivals and errors, same for every configuration")]
+            public int Seed { get; set; }
+
+            [Option(shortName: 'o', longName: "output", Required = false, HelpText = "CSV file, default is standard output")]
+            public string Output { get; set; }
+        }
+
+        private static readonly Regex FirmwareConstant =
+            new Regex(@"^\s*(?:constexpr\s+[\w\s]+?\s+(\w+)\s*=|#define\s+(\w+))\s*(\d+)u?\s*;?", RegexOptions.Multiline);
+
+        public static int SimulateLink(SimulateLinkOptions options)
+        {
+            LinkConfig baseline = new LinkConfig();
+            if (options.FirmwareDirectory != null)
+            {
+                try
+                {
+                    ReadFirmwareConstants(options.FirmwareDirectory, baseline);
+                }
+                catch (IOException e)
+                {
+                    Console.Error.WriteLine(e.Message);
+                    return -1;
+                }
+            }
+
+            IEnumerable<T> Sweep<T>(IEnumerable<T> values, T fallback) => values != null && values.Any() ? values : new[] {fallback};
+
+            using StreamWriter file = options.Output == null ? null : new StreamWriter(options.Output);
+            TextWriter output = (TextWriter)file ?? Console.Out;
+            output.WriteLine("baud,rx_buffer,window,timeout_ms,retry_ms,queue,offered_hz,throughput_hz," +
+                             "p50_us,p90_us,p99_us,max_us,failed,rejected,retries,corrupted,overflow_bytes,overflow_rate," +
+                             "executions,device_busy");
+            foreach (int baud in Sweep(options.Baud, baseline.Baud))
+            foreach (int rxBuffer in Sweep(options.RxBuffer, baseline.SerialRxBuffer))
+            foreach (int window in Sweep(options.Window, baseline.Window))
+            foreach (double timeout in Sweep(options.TimeoutMilliseconds, baseline.CommandTimeout * 1000))
+            foreach (double retry in Sweep(options.RetryMilliseconds, baseline.RetryInterval * 1000))
+            foreach (int queue in Sweep(options.Queue, baseline.QueueLimit))
+            foreach (double rate in Sweep(options.Rate, baseline.OfferedRate))
+            {
+                LinkConfig config = new LinkConfig
+                {
+                    Baud = baud,
+                    SerialRxBuffer = rxBuffer,
+                    Window = window,
+                    CommandTimeout = timeout / 1000,
+                    RetryInterval = retry / 1000,
+                    MaxAttempts = baseline.MaxAttempts,
+                    QueueLimit = queue,
+                    OfferedRate = rate,
+                    MoveFraction = options.MoveFraction,
+                    UnreliableMoves = options.UnreliableMoves,
+                    ParseTime = options.ParseMicroseconds / 1e6,
+                    PollInterval = options.PollMicroseconds / 1e6,
+                    UsbLatency = options.UsbLatencyMicroseconds / 1e6,
+                    ByteErrorRate = options.ByteErrorRate,
+                    Duration = options.Duration,
+                    Seed = options.Seed
+                };
+                LinkResult r = LinkSimulator.Run(config);
+                output.WriteLine(string.Join(",", new object[]
+                {
+                    baud, rxBuffer, window, timeout, retry, queue, rate, r.Throughput,
+                    r.Latency.Percentile(50), r.Latency.Percentile(90), r.Latency.Percentile(99), r.Latency.Percentile(100),
+                    r.Failed, r.Rejected, r.Retries, r.CorruptedFrames, r.OverflowBytes, r.OverflowRate,
+                    r.Executions, r.DeviceBusy / r.Makespan
+                }.Select(v => Convert.ToString(v, CultureInfo.InvariantCulture))));
+            }
+            return 0;
+        }
+
+        /// <summary>
+        /// Take link constants from firmware sources, so a sweep starts from what is flashed.
+        /// </summary>
+        private static void ReadFirmwareConstants(string directory, LinkConfig config)
+        {
+            Dictionary<string, int> constants = new Dictionary<string, int>();
+            foreach (string file in Directory.EnumerateFiles(directory, "*.h").Concat(Directory.EnumerateFiles(directory, "*.ino")))
+            {
+                foreach (Match match in FirmwareConstant.Matches(File.ReadAllText(file)))
+                {
+                    string name = match.Groups[1].Success ? match.Groups[1].Value : match.Groups[2].Value;
+                    if (int.TryParse(match.Groups[3].Value, out int value))
+                    {
+                        constants[name] = value;
+                    }
+                }
+            }
+            config.Baud = constants.GetValueOrDefault("BAUD_RATE", config.Baud);
+            config.SerialRxBuffer = constants.GetValueOrDefault("SERIAL_RX_BUFFER_SIZE", config.SerialRxBuffer);
+        }
+
+        public static int Scenarios(ScenariosOptions options)
+        {
+            Histogram virtualDuration = new Histogram();
+            long succeeded = 0;
+            long failed = 0;
+            long retries = 0;
+            long executions = 0;
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            for (int i = 0; i < options.Count; ++i)
+            {
+                VirtualSenderClock clock = new VirtualSenderClock();
+                SimulatedSerialAdaptor device = new SimulatedSerialAdaptor(clock, options.Seed + i)
+                {
+                    LossProbability = options.Loss,
+                    EchoLossProbability = options.EchoLoss,
+                    CorruptionProbability = options.Corrupt,
+                    Latency = TimeSpan.FromTicks(options.LatencyMicroseconds * 10L),
+                    LatencyJitter = TimeSpan.FromTicks(options.JitterMicroseconds * 10L)
+                };
+                using KeyboardMouse keyboardMouse = new KeyboardMouse(device, clock) { FrameTags = options.FrameTags };
+                Task[] frames = Enumerable.Range(0, options.Frames)
+                    .Select(f => f % 2 == 0 ? keyboardMouse.KeyboardPress(0x04) : keyboardMouse.KeyboardRelease(0x04))
+                    .ToArray();
+                foreach (Task frame in frames)
+                {
+                    try
+                    {
+                        frame.GetAwaiter().GetResult();
+                        ++succeeded;
+                    }
+                    catch (SerialDeviceException)
+                    {
+                        ++failed;
+                    }
+                }
+                retries += keyboardMouse.Metrics.Retries;
+                executions += device.FramesExecuted;
+                virtualDuration.Add(clock.Elapsed.Ticks / 10);
+            }
+            stopwatch.Stop();
+
+            Console.WriteLine($"{options.Count} scenarios of {options.Frames} frames in {stopwatch.ElapsedMilliseconds} ms real time.");
+            // Retransmission of a frame whose loop-back was lost executes it again
+            Console.WriteLine($"Frames succeeded {succeeded}, failed {failed}, retries {retries}, " +
+                              $"executions by device {executions}.");
+            virtualDuration.Print(Console.Out, "Simulated scenario duration", "us");
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,121 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using CommandLine;
+using SerialKeyboardMouse;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Verbs measuring text typing.
+    /// </summary>
+    internal static class TypingCommands
+    {
+        [Verb("type-bench", HelpText = "Compare HID reports per character of per-character, planned and device typing on reference texts.")]
+        public class TypeBenchOptions
+        {
+            [Option(shortName: 'i', longName: "input", Required = false, Separator = ',', HelpText = "Text files to measure. Default is built-in reference corpora")]
+            public IEnumerable<string> Inputs { get; set; }
+
+            [Option(longName: "poll-us", Required = false, Default = 1000.0, HelpText = "HID endpoint polling interval (us), one report per poll")]
+            public double PollMicroseconds { get; set; }
+
+            [Option(shortName: 'c', longName: "com", Required = false, HelpText = "Also type each text on this device and time it. Target receives the keystrokes!")]
+            public string ComPort { get; set; }
+
+            [Option(longName: "device-typing", Required = false, Default = false, HelpText = "Type on device with its typing engine instead of planned frames")]
+            public bool DeviceTyping { get; set; }
+        }
+
+        /// <summary>
+        /// Reference corpora: prose, source code, and text heavy in capitals
+        /// </summary>
+        private static readonly (string Name, string Text)[] Corpora =
+        {
+            ("prose", "The quick brown fox jumps over the lazy dog. Pack my box with five dozen liquor jugs! " +
+                      "How vexingly quick daft zebras jump; Sphinx of black quartz, judge my vow.\n"),
+            ("code", "public static int Main(string[] args)\n{\n    var options = Parser.Default.ParseArguments<Options>(args);\n" +
+                     "    return options.Value.Count > 0 ? Run(options.Value) : -1; // \"OK\"\n}\n"),
+            ("capitals", "#define MAX_FRAME_LENGTH (MAX_DATA_LENGTH + 2)\nREADME.md LICENSE NASA USB HID UART " +
+                         "SELECT ID, NAME FROM USERS WHERE STATUS = 'ACTIVE';\n"),
+        };
+
+        public static int TypeBench(TypeBenchOptions options)
+        {
+            List<(string Name, string Text)> texts = new List<(string, string)>();
+            try
+            {
+                texts.AddRange(options.Inputs.Any()
+                    ? options.Inputs.Select(path => (Path.GetFileName(path), File.ReadAllText(path).Replace("\r\n", "\n")))
+                    : Corpora);
+            }
+            catch (IOException e)
+            {
+                Console.Error.WriteLine(e.Message);
+                return -1;
+            }
+
+            using KeyboardMouse keyboardMouse = options.ComPort == null
+                ? null
+                : new KeyboardMouse(new DotNetSerialAdaptor(options.ComPort));
+            Console.WriteLine($"{"Text",-16} {"Chars",7} {"Naive r/c",10} {"Planned r/c",12} {"Saved",7} {"Device r/c",11} {"Poll-bound c/s",15}" +
+                              (keyboardMouse == null ? "" : $" {"Measured c/s",13}"));
+            foreach ((string name, string text) in texts)
+            {
+                TypingPlan naive;
+                TypingPlan planned;
+                int deviceReports;
+                try
+                {
+                    naive = TypingPlanner.PlanPerCharacter(text);
+                    planned = TypingPlanner.Plan(text, mayReleaseAll: true);
+                    deviceReports = TypingPlanner.CountDeviceReports(text);
+                }
+                catch (ArgumentException e)
+                {
+                    Console.Error.WriteLine($"{name}: {e.Message}");
+                    return -1;
+                }
+                double saved = naive.Reports == 0 ? 0 : 1 - (double)planned.Reports / naive.Reports;
+                double deviceReportsPerCharacter = planned.Characters == 0 ? 0 : (double)deviceReports / planned.Characters;
+                double reportsPerCharacter = options.DeviceTyping ? deviceReportsPerCharacter : planned.ReportsPerCharacter;
+                double pollBound = reportsPerCharacter == 0 ? 0 : 1e6 / (options.PollMicroseconds * reportsPerCharacter);
+                Console.Write($"{name,-16} {planned.Characters,7} {naive.ReportsPerCharacter,10:F2} " +
+                              $"{planned.ReportsPerCharacter,12:F2} {saved,7:P0} {deviceReportsPerCharacter,11:F2} {pollBound,15:F0}");
+                if (keyboardMouse != null)
+                {
+                    Stopwatch stopwatch = Stopwatch.StartNew();
+                    try
+                    {
+                        if (options.DeviceTyping)
+                        {
+                            // Device runs the release after typing everything queued
+                            keyboardMouse.TypeTextOnDevice(text).GetAwaiter().GetResult();
+                            keyboardMouse.KeyboardReleaseAll().GetAwaiter().GetResult();
+                        }
+                        else
+                        {
+                            keyboardMouse.TypeText(text).GetAwaiter().GetResult();
+                        }
+                    }
+                    catch (SerialDeviceException e)
+                    {
+                        Console.WriteLine();
+                        Console.Error.WriteLine($"Device failed: {e.Message}");
+                        return -1;
+                    }
+                    Console.Write($" {planned.Characters / stopwatch.Elapsed.TotalSeconds,13:F0}");
+                }
+                Console.WriteLine();
+            }
+            if (keyboardMouse != null)
+            {
+                Console.WriteLine(keyboardMouse.Metrics);
+            }
+            return 0;
+        }
+    }
+}
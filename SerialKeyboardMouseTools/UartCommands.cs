@@ -0,0 +1,583 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text.RegularExpressions;
+using CommandLine;
+using SerialKeyboardMouse.Serial;
+
+namespace SerialKeyboardMouseTools
+{
+    /// <summary>
+    /// Offline analysis of logic analyzer captures of the serial link. Unlike <see cref="CaptureCommands"/>,
+    /// timestamps are taken on the wire, so turnaround is the device's alone, without USB-serial and OS latency.
+    /// </summary>
+    internal static class UartCommands
+    {
+        [Verb("analyze-uart", HelpText = "Decode logic analyzer captures of TX and RX lines, and report device turnaround, gaps and errors.")]
+        public class AnalyzeUartOptions
+        {
+            [Value(0, MetaName = "file", Required = true, HelpText = "CSV export, e.g. from sigrok-cli -i capture.sr -O csv:time=true, or PulseView's CSV export")]
+            public string File { get; set; }
+
+            [Option(longName: "format", Required = false, Default = "logic", HelpText = "logic: a sample per line and a column per channel. bytes: time,TX|RX,hex per line, from a UART decoder")]
+            public string Format { get; set; }
+
+            [Option(longName: "tx", Required = false, Default = "D0", HelpText = "Column name or zero-based index of host-to-device line")]
+            public string TxColumn { get; set; }
+
+            [Option(longName: "rx", Required = false, Default = "D1", HelpText = "Column name or zero-based index of device-to-host line")]
+            public string RxColumn { get; set; }
+
+            [Option(longName: "samplerate", Required = false, Default = 0.0, HelpText = "Sample rate (Hz) if file has neither time column nor samplerate comment")]
+            public double SampleRate { get; set; }
+
+            [Option(longName: "baud", Required = false, Default = SerialSymbols.BaudRate, HelpText = "Baud rate of the link")]
+            public int Baud { get; set; }
+
+            [Option(longName: "reply-timeout-us", Required = false, Default = 20000, HelpText = "Frames not answered within this are counted as lost (us)")]
+            public int ReplyTimeoutMicroseconds { get; set; }
+
+            [Option(longName: "byte-gap-us", Required = false, Default = 1000, HelpText = "Longer pause inside a frame truncates it (us)")]
+            public int ByteGapMicroseconds { get; set; }
+
+            [Option(shortName: 't', longName: "timeline", Required = false, Default = false, HelpText = "Print one line per frame and error")]
+            public bool Timeline { get; set; }
+        }
+
+        private const int DataBits = 8;
+
+        private static readonly Regex SampleRateComment =
+            new Regex(@"Samplerate:\s*([\d.]+)\s*([kMG]?)Hz", RegexOptions.IgnoreCase);
+
+        private static readonly Regex TimeUnit = new Regex(@"\[(s|ms|us|ns)\]");
+
+        private readonly struct UartByte
+        {
+            public readonly double Start;
+            public readonly double End;
+            public readonly byte Value;
+
+            public UartByte(double start, double end, byte value)
+            {
+                Start = start;
+                End = end;
+                Value = value;
+            }
+        }
+
+        private class WireFrame
+        {
+            public bool FromHost;
+            public byte[] Bytes;
+            public double Start;
+            public double End;
+
+            public SerialSymbols.FrameType Type => SerialSymbols.CommandTypeOf(Bytes);
+        }
+
+        private class WireError
+        {
+            public double Time;
+            public string Kind;
+            public string Detail;
+        }
+
+        /// <summary>
+        /// 8N1 decoder of one line, fed with samples or transitions in time order.
+        /// Bits are sampled at their middle, measured from the falling edge of start bit.
+        /// </summary>
+        private class UartLineDecoder
+        {
+            private readonly string _line;
+            private readonly double _bitTime;
+            private readonly Action<UartByte> _onByte;
+            private readonly Action<WireError> _onError;
+
+            private bool _initialized;
+            private bool _level = true;
+            private bool _inByte;
+            private double _start;
+            private int _bit;
+            private int _value;
+
+            public UartLineDecoder(string line, int baud, Action<UartByte> onByte, Action<WireError> onError)
+            {
+                _line = line;
+                _bitTime = 1.0 / baud;
+                _onByte = onByte;
+                _onError = onError;
+            }
+
+            public void Feed(double time, bool level)
+            {
+                // Previous level held until this sample
+                while (_inByte)
+                {
+                    double point = _start + (_bit + 0.5) * _bitTime;
+                    if (point >= time)
+                    {
+                        break;
+                    }
+                    Sample(point, _level);
+                }
+                if (_initialized && !_inByte && _level && !level)
+                {
+                    _inByte = true;
+                    _start = time;
+                    _bit = 0;
+                    _value = 0;
+                }
+                _level = level;
+                _initialized = true;
+            }
+
+            private void Sample(double point, bool level)
+            {
+                if (_bit == 0 && level)
+                {
+                    _inByte = false;
+                    _onError(new WireError { Time = _start, Kind = $"{_line} glitch", Detail = "start bit shorter than half a bit" });
+                    return;
+                }
+                if (_bit >= 1 && _bit <= DataBits && level)
+                {
+                    _value |= 1 << (_bit - 1);
+                }
+                if (_bit == DataBits + 1)
+                {
+                    _inByte = false;
+                    if (level)
+                    {
+                        _onByte(new UartByte(_start, point + 0.5 * _bitTime, (byte)_value));
+                    }
+                    else
+                    {
+                        _onError(new WireError
+                        {
+                            Time = _start,
+                            Kind = _value == 0 ? $"{_line} break" : $"{_line} framing error",
+                            Detail = $"stop bit low after 0x{_value:X2}"
+                        });
+                    }
+                    return;
+                }
+                ++_bit;
+            }
+        }
+
+        /// <summary>
+        /// Reassembles frames of one direction from decoded bytes, by the same rules as the host's receiver.
+        /// </summary>
+        private class FrameAssembler
+        {
+            private readonly bool _fromHost;
+            private readonly string _line;
+            private readonly double _maxByteGap;
+            private readonly Action<WireFrame> _onFrame;
+            private readonly Action<WireError> _onError;
+            private readonly List<byte> _bytes = new List<byte>();
+            private double _start;
+            private double _lastEnd;
+
+            /// <summary>
+            /// Bytes outside any frame, e.g. debug prints or boot messages
+            /// </summary>
+            public int StrayBytes;
+
+            public FrameAssembler(bool fromHost, double maxByteGap, Action<WireFrame> onFrame, Action<WireError> onError)
+            {
+                _fromHost = fromHost;
+                _line = fromHost ? "TX" : "RX";
+                _maxByteGap = maxByteGap;
+                _onFrame = onFrame;
+                _onError = onError;
+            }
+
+            public void Feed(UartByte b)
+            {
+                if (_bytes.Count > 0 && b.Start - _lastEnd > _maxByteGap)
+                {
+                    Fail("truncated frame");
+                }
+                if (_bytes.Count == 0)
+                {
+                    if (b.Value != SerialSymbols.FrameStart)
+                    {
+                        ++StrayBytes;
+                        return;
+                    }
+                    _start = b.Start;
+                }
+                _bytes.Add(b.Value);
+                _lastEnd = b.End;
+                if (_bytes.Count == 2)
+                {
+                    int length = b.Value + 2;
+                    if (length < SerialSymbols.MinFrameLength || length > SerialSymbols.MaxFrameLength)
+                    {
+                        Fail("bad length");
+                        return;
+                    }
+                }
+                if (_bytes.Count < 2 || _bytes.Count < _bytes[1] + 2)
+                {
+                    return;
+                }
+                byte[] frame = _bytes.ToArray();
+                if (!SerialSymbols.XorChecker(new ReadOnlySpan<byte>(frame, 2, frame.Length - 3), frame[^1]))
+                {
+                    Fail("bad checksum");
+                    return;
+                }
+                _bytes.Clear();
+                _onFrame(new WireFrame { FromHost = _fromHost, Bytes = frame, Start = _start, End = b.End });
+            }
+
+            private void Fail(string kind)
+            {
+                _onError(new WireError { Time = _start, Kind = $"{_line} {kind}", Detail = BitConverter.ToString(_bytes.ToArray()) });
+                _bytes.Clear();
+            }
+        }
+
+        private class TypeStats
+        {
+            public readonly Histogram Turnaround = new Histogram();
+            public readonly Histogram RoundTrip = new Histogram();
+            public int Frames;
+            public int Retransmissions;
+            public int Nacks;
+            public int Lost;
+        }
+
+        private class Outstanding
+        {
+            public WireFrame First;
+            public WireFrame Last;
+        }
+
+        public static int AnalyzeUart(AnalyzeUartOptions options)
+        {
+            List<WireFrame> frames = new List<WireFrame>();
+            List<WireError> errors = new List<WireError>();
+            double maxByteGap = options.ByteGapMicroseconds / 1e6;
+            FrameAssembler tx = new FrameAssembler(true, maxByteGap, frames.Add, errors.Add);
+            FrameAssembler rx = new FrameAssembler(false, maxByteGap, frames.Add, errors.Add);
+            double captureEnd;
+            try
+            {
+                captureEnd = options.Format.ToLowerInvariant() switch
+                {
+                    "logic" => ReadLogic(options, tx, rx, errors),
+                    "bytes" => ReadBytes(options, tx, rx),
+                    _ => throw new InvalidDataException($"Unknown format {options.Format}.")
+                };
+            }
+            catch (Exception e) when (e is IOException || e is InvalidDataException || e is FormatException)
+            {
+                Console.Error.WriteLine($"{options.File}: {e.Message}");
+                return -1;
+            }
+
+            Dictionary<SerialSymbols.FrameType, TypeStats> stats = new Dictionary<SerialSymbols.FrameType, TypeStats>();
+            Dictionary<SerialSymbols.FrameType, int> deviceEvents = new Dictionary<SerialSymbols.FrameType, int>();
+            Histogram txGaps = new Histogram();
+            Histogram rxGaps = new Histogram();
+            Histogram hostTurnaround = new Histogram();
+            List<Outstanding> outstanding = new List<Outstanding>();
+            double replyTimeout = options.ReplyTimeoutMicroseconds / 1e6;
+            WireFrame lastTx = null;
+            WireFrame lastRx = null;
+            double lastReplyEnd = -1;
+
+            TypeStats StatsOf(SerialSymbols.FrameType type)
+            {
+                if (!stats.TryGetValue(type, out TypeStats s))
+                {
+                    stats[type] = s = new TypeStats();
+                }
+                return s;
+            }
+
+            void ExpireBefore(double time)
+            {
+                foreach (Outstanding o in outstanding.Where(o => o.Last.End + replyTimeout < time).ToList())
+                {
+                    ++StatsOf(o.First.Type).Lost;
+                    errors.Add(new WireError
+                    {
+                        Time = o.Last.Start, Kind = "no reply", Detail = BitConverter.ToString(o.Last.Bytes)
+                    });
+                    outstanding.Remove(o);
+                }
+            }
+
+            // Device only answers complete frames, so ordering by start keeps every reply after its frame
+            foreach (WireFrame frame in frames.OrderBy(f => f.Start))
+            {
+                ExpireBefore(frame.Start);
+                if (frame.FromHost)
+                {
+                    if (lastTx != null)
+                    {
+                        txGaps.Add((frame.Start - lastTx.End) * 1e6);
+                    }
+                    if (lastReplyEnd >= 0)
+                    {
+                        hostTurnaround.Add((frame.Start - lastReplyEnd) * 1e6);
+                        lastReplyEnd = -1;
+                    }
+                    lastTx = frame;
+                    Outstanding retry = outstanding.FirstOrDefault(o => o.Last.Bytes.AsSpan().SequenceEqual(frame.Bytes));
+                    if (retry != null)
+                    {
+                        ++StatsOf(frame.Type).Retransmissions;
+                        retry.Last = frame;
+                    }
+                    else
+                    {
+                        ++StatsOf(frame.Type).Frames;
+                        if (!SerialSymbols.UnacknowledgedFrameTypes.Contains(frame.Type))
+                        {
+                            outstanding.Add(new Outstanding { First = frame, Last = frame });
+                        }
+                    }
+                    PrintTimeline(options, frame, null);
+                    continue;
+                }
+
+                if (lastRx != null)
+                {
+                    rxGaps.Add((frame.Start - lastRx.End) * 1e6);
+                }
+                lastRx = frame;
+                Outstanding answered;
+                if (frame.Type == SerialSymbols.FrameType.Nack)
+                {
+                    answered = outstanding.FirstOrDefault(o => frame.Bytes.Length > 4 && (byte)o.First.Type == frame.Bytes[3]);
+                    if (answered != null)
+                    {
+                        // Sender holds the frame and sends it again later, as a new frame
+                        ++StatsOf(answered.First.Type).Nacks;
+                        outstanding.Remove(answered);
+                        lastReplyEnd = frame.End;
+                    }
+                }
+                else
+                {
+                    bool isReply = SerialSymbols.ReplyLengthLookup.ContainsKey(frame.Type);
+                    answered = outstanding.FirstOrDefault(o => o.First.Type == frame.Type
+                                                               && (isReply || o.Last.Bytes.AsSpan().SequenceEqual(frame.Bytes)));
+                    if (answered != null)
+                    {
+                        TypeStats s = StatsOf(frame.Type);
+                        s.Turnaround.Add((frame.Start - answered.Last.End) * 1e6);
+                        s.RoundTrip.Add((frame.End - answered.Last.Start) * 1e6);
+                        outstanding.Remove(answered);
+                        lastReplyEnd = frame.End;
+                    }
+                }
+                if (answered == null)
+                {
+                    if (SerialSymbols.EventFrameTypes.Contains(frame.Type))
+                    {
+                        deviceEvents.TryGetValue(frame.Type, out int n);
+                        deviceEvents[frame.Type] = n + 1;
+                    }
+                    else
+                    {
+                        errors.Add(new WireError
+                        {
+                            Time = frame.Start, Kind = "unexpected reply", Detail = BitConverter.ToString(frame.Bytes)
+                        });
+                    }
+                }
+                PrintTimeline(options, frame, answered);
+            }
+            ExpireBefore(captureEnd);
+
+            if (options.Timeline)
+            {
+                foreach (WireError error in errors.OrderBy(e => e.Time))
+                {
+                    Console.WriteLine($"{error.Time * 1e6,14:F1} us ERROR {error.Kind}: {error.Detail}");
+                }
+            }
+
+            Console.WriteLine();
+            foreach (var pair in stats.OrderBy(p => p.Key))
+            {
+                TypeStats s = pair.Value;
+                Console.WriteLine($"== {CaptureCommands.TypeName((byte)pair.Key)}: {s.Frames} frames, " +
+                                  $"{s.Retransmissions} retransmissions, {s.Nacks} NACKs, {s.Lost} without reply");
+                s.Turnaround.Print(Console.Out, "  Device turnaround, TX end -> RX start", "us");
+                s.RoundTrip.Print(Console.Out, "  Round trip, TX start -> RX end", "us");
+            }
+            foreach (var pair in deviceEvents.OrderBy(p => p.Key))
+            {
+                Console.WriteLine($"Device events {CaptureCommands.TypeName((byte)pair.Key)}: {pair.Value}");
+            }
+            hostTurnaround.Print(Console.Out, "Host turnaround, RX end -> next TX start", "us");
+            txGaps.Print(Console.Out, "Gap between TX frames", "us");
+            rxGaps.Print(Console.Out, "Gap between RX frames", "us");
+            Console.WriteLine($"Stray bytes outside frames: TX {tx.StrayBytes}, RX {rx.StrayBytes}");
+            PrintErrors(errors, captureEnd);
+            return 0;
+        }
+
+        private static void PrintTimeline(AnalyzeUartOptions options, WireFrame frame, Outstanding answered)
+        {
+            if (!options.Timeline)
+            {
+                return;
+            }
+            string turnaround = answered == null ? "" : $" turnaround {(frame.Start - answered.Last.End) * 1e6:F1} us";
+            Console.WriteLine($"{frame.Start * 1e6,14:F1} us {(frame.FromHost ? "TX" : "RX")} " +
+                              $"{CaptureCommands.TypeName(frame.Bytes)} {BitConverter.ToString(frame.Bytes)}{turnaround}");
+        }
+
+        /// <summary>
+        /// Error counts by kind, and how they spread over the capture in tenths.
+        /// </summary>
+        private static void PrintErrors(List<WireError> errors, double captureEnd)
+        {
+            const int Slices = 10;
+            const int BarWidth = 40;
+            Console.WriteLine($"Errors: {errors.Count}");
+            foreach (var group in errors.GroupBy(e => e.Kind).OrderByDescending(g => g.Count()))
+            {
+                Console.WriteLine($"  {group.Key,-20} {group.Count(),8}");
+            }
+            if (errors.Count == 0 || captureEnd <= 0)
+            {
+                return;
+            }
+            int[] counts = new int[Slices];
+            foreach (WireError error in errors)
+            {
+                ++counts[Math.Clamp((int)(error.Time / captureEnd * Slices), 0, Slices - 1)];
+            }
+            int max = counts.Max();
+            for (int i = 0; i < Slices; ++i)
+            {
+                int width = counts[i] == 0 ? 0 : Math.Max(1, counts[i] * BarWidth / max);
+                Console.WriteLine($"  [{captureEnd * i / Slices,9:F3} s, {captureEnd * (i + 1) / Slices,9:F3} s) " +
+                                  $"{counts[i],8} {new string('#', width)}");
+            }
+        }
+
+        /// <summary>
+        /// Decode a logic CSV. Header row names the columns; comment lines start with ';'.
+        /// Time comes from a "Time" column, or from sample index and rate.
+        /// </summary>
+        /// <returns>Time of last sample, in seconds.</returns>
+        private static double ReadLogic(AnalyzeUartOptions options, FrameAssembler tx, FrameAssembler rx,
+            List<WireError> errors)
+        {
+            UartLineDecoder txLine = new UartLineDecoder("TX", options.Baud, tx.Feed, errors.Add);
+            UartLineDecoder rxLine = new UartLineDecoder("RX", options.Baud, rx.Feed, errors.Add);
+            double sampleRate = options.SampleRate;
+            double timeScale = 1;
+            int timeColumn = -1;
+            int txColumn = -1;
+            int rxColumn = -1;
+            bool columnsKnown = false;
+            long sample = 0;
+            double time = 0;
+            foreach (string line in File.ReadLines(options.File))
+            {
+                if (line.StartsWith(";"))
+                {
+                    Match match = SampleRateComment.Match(line);
+                    if (match.Success && options.SampleRate <= 0)
+                    {
+                        sampleRate = double.Parse(match.Groups[1].Value, CultureInfo.InvariantCulture)
+                                     * match.Groups[2].Value switch { "k" or "K" => 1e3, "M" => 1e6, "G" => 1e9, _ => 1 };
+                    }
+                    continue;
+                }
+                if (string.IsNullOrWhiteSpace(line))
+                {
+                    continue;
+                }
+                string[] cells = line.Split(',');
+                if (!columnsKnown)
+                {
+                    columnsKnown = true;
+                    bool isHeader = cells.Any(c => !double.TryParse(c, NumberStyles.Float, CultureInfo.InvariantCulture, out _));
+                    string[] names = isHeader ? cells.Select(c => c.Trim().Trim('"')).ToArray() : new string[cells.Length];
+                    timeColumn = Array.FindIndex(names, n => n != null && n.StartsWith("Time", StringComparison.OrdinalIgnoreCase));
+                    if (timeColumn >= 0)
+                    {
+                        Match unit = TimeUnit.Match(names[timeColumn]);
+                        timeScale = unit.Groups[1].Value switch { "ms" => 1e-3, "us" => 1e-6, "ns" => 1e-9, _ => 1 };
+                    }
+                    txColumn = FindColumn(names, options.TxColumn);
+                    rxColumn = FindColumn(names, options.RxColumn);
+                    if (timeColumn < 0 && sampleRate <= 0)
+                    {
+                        throw new InvalidDataException("No time column nor samplerate comment, pass --samplerate.");
+                    }
+                    if (isHeader)
+                    {
+                        continue;
+                    }
+                }
+                time = timeColumn >= 0
+                    ? double.Parse(cells[timeColumn], NumberStyles.Float, CultureInfo.InvariantCulture) * timeScale
+                    : sample / sampleRate;
+                ++sample;
+                txLine.Feed(time, cells[txColumn].Trim() != "0");
+                rxLine.Feed(time, cells[rxColumn].Trim() != "0");
+            }
+            return time;
+        }
+
+        private static int FindColumn(string[] names, string column)
+        {
+            int index = Array.FindIndex(names, n => string.Equals(n, column, StringComparison.OrdinalIgnoreCase));
+            if (index < 0 && (!int.TryParse(column, out index) || index < 0 || index >= names.Length))
+            {
+                throw new InvalidDataException($"No column {column}, columns are {string.Join(",", names)}.");
+            }
+            return index;
+        }
+
+        /// <summary>
+        /// Read bytes already decoded elsewhere: time in seconds, TX or RX, and byte in hex per line.
+        /// </summary>
+        /// <returns>Time of last byte, in seconds.</returns>
+        private static double ReadBytes(AnalyzeUartOptions options, FrameAssembler tx, FrameAssembler rx)
+        {
+            double byteTime = (DataBits + 2.0) / options.Baud;
+            double time = 0;
+            foreach (string line in File.ReadLines(options.File))
+            {
+                string[] cells = line.Split(',');
+                if (line.StartsWith(";") || cells.Length < 3
+                    || !double.TryParse(cells[0], NumberStyles.Float, CultureInfo.InvariantCulture, out double start))
+                {
+                    continue; // Comment or header
+                }
+                time = start;
+                string hex = cells[2].Trim();
+                hex = hex.StartsWith("0x", StringComparison.OrdinalIgnoreCase) ? hex[2..] : hex;
+                UartByte b = new UartByte(time, time + byteTime, byte.Parse(hex, NumberStyles.HexNumber));
+                switch (cells[1].Trim().ToUpperInvariant())
+                {
+                    case "TX":
+                        tx.Feed(b);
+                        break;
+                    case "RX":
+                        rx.Feed(b);
+                        break;
+                    default:
+                        throw new InvalidDataException($"Line must be TX or RX: {line}");
+                }
+            }
+            return time;
+        }
+    }
+}